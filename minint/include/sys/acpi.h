@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <system.h>
+
+/**
+ * just enough acpi to find static tables. tables are mapped on demand
+ * through the mmio window (they usually sit in memory the direct map
+ * leaves out) and stay mapped.
+ */
+struct acpi_header
+{
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} PACKED;
+
+// generic address structure
+struct acpi_gas
+{
+    uint8_t space_id;       // 0 memory, 1 port io
+    uint8_t bit_width;
+    uint8_t bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+} PACKED;
+
+#define ACPI_GAS_MEMORY 0
+
+void acpi_init(uint64_t rsdp_phys);
+const struct acpi_header *acpi_find_table(const char *signature);
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <system.h>
+#include <ktime.h>
+#include <pmu.h>
+
+/**
+ * in-kernel benchmarks, only built with -DCONFIG_BENCH.
+ * bench_run_all() is called from kmain once everything is initialized
+ * and prints its results to the kernel console.
+ */
+
+#ifdef CONFIG_BENCH
+
+static ALWAYS_INLINE uint64_t bench_begin(void)
+{
+    return tsc_read_start();
+}
+
+static ALWAYS_INLINE uint64_t bench_end(void)
+{
+    return tsc_read_end();
+}
+
+// keep the compiler from dropping or merging the timed work
+static ALWAYS_INLINE void bench_clobber(void)
+{
+    asm volatile ("" ::: "memory");
+}
+
+void bench_print_u64(uint64_t n);
+void bench_print_fixed(uint64_t num, uint64_t den);   // num/den, 2 decimals
+void bench_print_size(uint64_t bytes);
+void bench_print_pad(const char *s, size_t width);
+
+/**
+ * timings are taken in cycles and reported in wall time, using the
+ * calibrated tsc rate: bench_print_rate() prints count per second with
+ * a k/M/G prefix ("12.34 Mpairs/s" for unit "pairs/s"),
+ * bench_print_ns() the nanoseconds per item.
+ */
+void bench_print_rate(uint64_t count, uint64_t cycles, const char *unit);
+void bench_print_ns(uint64_t cycles, uint64_t count);
+void bench_report_bw(const char *op, const char *variant, size_t size,
+                     uint64_t bytes, uint64_t cycles);
+
+/**
+ * hardware events around a timed section, if the cpu has a pmu:
+ * bench_pmu_begin() snapshots the calling thread's counts (or the whole
+ * cpu's, when the work runs in other threads pinned to it), and
+ * bench_pmu_report() prints every counted event per item since then,
+ * plus instructions per cycle. prints nothing without a pmu.
+ */
+struct bench_pmu
+{
+    struct pmu_counts start;
+    bool whole_cpu;
+};
+
+void bench_pmu_begin(struct bench_pmu *b, bool whole_cpu);
+void bench_pmu_report(const char *prefix, const struct bench_pmu *b,
+                      uint64_t items, const char *item);
+
+/**
+ * run fn(arg) on cpus 0..ncpus-1 at once, returning the wall time in
+ * cycles from a common start until the last one finishes. the aps run
+ * it with interrupts off. bench_next_cpus() walks
+ * 1, 2, 4, ... cpu_count and returns 0 past the end.
+ */
+uint64_t bench_parallel(uint32_t ncpus, void (*fn)(void *arg), void *arg);
+uint32_t bench_next_cpus(uint32_t n);
+
+void bench_mem(void);
+void bench_string(void);
+void bench_console(void);
+void bench_blit(void);
+void bench_klog(void);
+void bench_serial(void);
+void bench_pmm(void);
+void bench_slab(void);
+void bench_vmm(void);
+void bench_fb(void);
+void bench_sched(void);
+void bench_lock(void);
+void bench_rcu(void);
+void bench_object(void);
+void bench_timer(void);
+void bench_irq(void);
+void bench_syscall(void);
+
+void bench_run_all(void);
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * 2d fill/copy on 32bpp surfaces. the framebuffer is write-only memory
+ * as far as we are concerned, so every store here is non-temporal and
+ * each call ends with an sfence. stride is in pixels, not bytes.
+ */
+struct blit_surface
+{
+    uint32_t *base;
+    uint32_t width;
+    uint32_t height;
+    size_t stride;
+};
+
+void blit_fill_rect(const struct blit_surface *s, uint32_t x, uint32_t y,
+                    uint32_t w, uint32_t h, uint32_t color);
+
+// copy within one surface, any overlap between the two rects is fine
+void blit_copy_rect(const struct blit_surface *s, uint32_t dx, uint32_t dy,
+                    uint32_t sx, uint32_t sy, uint32_t w, uint32_t h);
+
+// upload w x h pixels from ordinary memory, src_stride in pixels
+void blit_put(const struct blit_surface *s, uint32_t x, uint32_t y,
+              const uint32_t *src, size_t src_stride, uint32_t w, uint32_t h);
+
+void blit_clear(const struct blit_surface *s, uint32_t color);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <limine.h>
+
+/**
+ * boot timeline
+ *
+ * kmain calls boottrace_mark() as it enters each init phase; a phase
+ * runs until the next mark. only the raw tsc is recorded, so marking
+ * works before anything else is up and the conversion waits for ktime.
+ * boottrace_report() closes the last phase, puts the firmware and loader
+ * times from limine in front and prints the lot to serial, one line per
+ * phase in microseconds since reset, so two boots can be diffed.
+ */
+#define BOOTTRACE_MAX_PHASES    48
+
+void boottrace_mark(const char *phase);
+void boottrace_report(const struct limine_bootloader_performance_response *perf);
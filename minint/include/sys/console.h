@@ -1,10 +1,37 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <limine.h>
+#include <blit.h>
+#include <pat.h>
+
+enum console_mode
+{
+    CONSOLE_SYNC,       // draw every character as it arrives
+    CONSOLE_DEFERRED,   // update the cell grid, draw on console_flush()
+};
 
 void console_init(struct limine_framebuffer *fb);
 void console_clear(void);
 void console_putc(char c);
+void console_write(const char *s, size_t len);
 void console_print(const char *s);
-void console_fill(uint32_t color);
\ No newline at end of file
+void console_fill(uint32_t color);
+void console_get_size(size_t *cols, size_t *rows);
+const struct blit_surface *console_surface(void);
+
+// memory type of the framebuffer mapping, after pat and mtrrs combine
+enum memtype console_memtype(void);
+bool console_set_memtype(enum memtype type);
+
+void console_set_mode(enum console_mode mode);
+void console_flush(void);
+void console_tick(void);    // flushes if anything is pending, klogd calls it via ksink_tick()
+
+#ifdef CONFIG_BENCH
+// draw with the old one-pixel-at-a-time path, for comparison
+void console_set_bitwise_render(bool enable);
+// scroll by copying pixels within video memory instead of re-rendering
+void console_set_readback_scroll(bool enable);
+#endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <system.h>
+
+/**
+ * cpu feature flags, filled in once by cpuid_init() on the bsp.
+ * a flag is only set if the os side is enabled as well, so e.g. avx2
+ * means "cpuid says avx2 and xcr0 has ymm state turned on".
+ */
+struct cpu_features
+{
+    bool sse3;
+    bool ssse3;
+    bool sse41;
+    bool sse42;
+    bool xsave;
+    bool avx;
+    bool avx2;
+    bool erms;      // enhanced rep movsb/stosb
+    bool fsrm;      // fast short rep movsb
+    bool nx;
+    bool pge;       // global pages
+    bool pdpe1gb;   // 1 GiB pages
+    bool pcid;
+    bool invpcid;
+    bool x2apic;
+    bool tsc_deadline;  // lapic timer can fire at an absolute tsc value
+    bool invariant_tsc; // constant rate across p-states and c-states
+    bool rdtscp;
+
+    uint32_t max_leaf;
+    uint32_t max_ext_leaf;
+    uint32_t llc_size;  // last level cache in bytes, 0 if unknown
+};
+
+extern struct cpu_features cpu_features;
+
+static ALWAYS_INLINE void cpuid(uint32_t leaf, uint32_t subleaf,
+                                uint32_t *a, uint32_t *b,
+                                uint32_t *c, uint32_t *d)
+{
+    asm volatile ("cpuid"
+                  : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                  : "a"(leaf), "c"(subleaf));
+}
+
+void cpuid_init(void);
+void cpuid_init_ap(void);    // same cr0/cr4/xcr0 setup as the bsp got
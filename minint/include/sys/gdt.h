@@ -9,4 +9,43 @@ typedef struct PACKED gdt_descriptor
     uint64_t base;
 } gdt_descriptor_t;
 
+struct gdt_entry
+{
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_mid;
+    uint8_t access;
+    uint8_t granularity;
+    uint8_t base_high;
+} PACKED;
+
+struct gdt_tss_entry
+{
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_mid;
+    uint8_t access;
+    uint8_t granularity;
+    uint8_t base_high;
+    uint32_t base_upper;
+    uint32_t reserved;
+} PACKED;
+
+/**
+ * selectors. sysret loads the user ss from STAR[63:48] + 8 and cs from
+ * + 16, so user data has to sit right below user code.
+ */
+#define GDT_KERNEL_CODE     0x08
+#define GDT_KERNEL_DATA     0x10
+#define GDT_USER_DATA       0x18
+#define GDT_USER_CODE       0x20
+#define GDT_TSS             0x28
+
+struct gdt_table
+{
+    struct gdt_entry     entries[5];
+    struct gdt_tss_entry tss;
+} PACKED;
+
+// builds and loads the calling cpu's gdt, see struct cpu
 void gdt_init(void);
\ No newline at end of file
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * hpet main counter, read-only use as a calibration reference. the
+ * comparators are left alone.
+ */
+bool hpet_init(void);           // false if acpi has no usable hpet
+uint64_t hpet_read(void);
+uint64_t hpet_period_fs(void);  // femtoseconds per tick
+uint64_t hpet_mask(void);       // counter width, for wrapping deltas
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <system.h>
 
 struct idt_entry
 {
@@ -19,5 +20,37 @@ struct idt_descriptor
     uint64_t base;
 } PACKED;
 
+/**
+ * every vector enters through its own stub in cpu.s, which saves the
+ * caller-saved registers (and rbp, for stack walks) and calls the
+ * dispatcher with this frame. the
+ * dispatcher runs the handler registered for the vector. an exception
+ * nobody handles is fatal, an irq nobody handles is dropped.
+ */
+struct isr_frame
+{
+    uint64_t rbp, rbx;
+    uint64_t r11, r10, r9, r8;
+    uint64_t rdi, rsi, rdx, rcx, rax;
+    uint64_t vector;
+    uint64_t error;         // 0 for vectors without an error code
+    uint64_t rip, cs, rflags, rsp, ss;
+};
+
+_Static_assert(sizeof(struct isr_frame) == 18 * 8, "isr_frame matches cpu.s");
+
+typedef void (*isr_handler_t)(struct isr_frame *frame);
+
+#define IDT_ENTRIES         256
+#define IDT_EXCEPTIONS      32
+
+#define VECTOR_NMI          2
+#define VECTOR_DOUBLE_FAULT 8
+#define VECTOR_MACHINE_CHECK 18
+
 void idt_init(void);
+void idt_reload(void);     // load the shared idt on an ap
 void idt_set_gate(int vec, void (*handler)(void), uint8_t ist, uint8_t flags);
+
+void isr_register(uint8_t vec, isr_handler_t handler);
+void isr_dispatch(struct isr_frame *frame);     // from the entry stubs
@@ -7,9 +7,17 @@ static inline void outb(uint16_t port, uint8_t value)
     __asm__ volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
 }
 
-static inline void inb(uint16_t port)
+static inline uint8_t inb(uint16_t port)
 {
     uint8_t ret;
 
-    __asm__ volatile ("inb %1, %0" : : "=a"(ret) : "Nd"(port));
-}
\ No newline at end of file
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+
+    return ret;
+}
+
+// a write to an unused port, roughly a microsecond for slow old chips
+static inline void io_wait(void)
+{
+    outb(0x80, 0);
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * klib dispatch
+ *
+ * memcpy/memset/memmove go through a per-routine function pointer that
+ * klib_init() points at the best variant for this cpu. before that the
+ * rep string variants are used, they are correct on every amd64 part
+ * and do not touch simd state the os may not have enabled yet.
+ *
+ * sizes at or above klib_nt_threshold take the "large" pointer, which
+ * uses non-temporal stores so a big copy doesn't evict the whole cache.
+ */
+
+#define KLIB_NT_THRESHOLD_DEFAULT (1024 * 1024)
+
+typedef void *(*memcpy_fn)(void *restrict, const void *restrict, size_t);
+typedef void *(*memset_fn)(void *, int, size_t);
+typedef void *(*memmove_fn)(void *, const void *, size_t);
+typedef int (*memcmp_fn)(const void *, const void *, size_t);
+typedef void *(*memchr_fn)(const void *, int, size_t);
+typedef size_t (*strlen_fn)(const char *);
+typedef int (*strcmp_fn)(const char *, const char *);
+
+extern size_t klib_nt_threshold;
+
+extern memcpy_fn  memcpy_impl;
+extern memcpy_fn  memcpy_large;
+extern memset_fn  memset_impl;
+extern memset_fn  memset_large;
+extern memmove_fn memmove_fwd;
+extern memmove_fn memmove_bwd;
+extern memcmp_fn  memcmp_impl;
+extern memchr_fn  memchr_impl;
+extern strlen_fn  strlen_impl;
+extern strcmp_fn  strcmp_impl;
+
+void *memcpy_rep(void *restrict dest, const void *restrict src, size_t n);
+void *memcpy_sse2(void *restrict dest, const void *restrict src, size_t n);
+void *memcpy_avx2(void *restrict dest, const void *restrict src, size_t n);
+void *memcpy_sse2_nt(void *restrict dest, const void *restrict src, size_t n);
+void *memcpy_avx2_nt(void *restrict dest, const void *restrict src, size_t n);
+
+void *memset_rep(void *s, int c, size_t n);
+void *memset_sse2(void *s, int c, size_t n);
+void *memset_avx2(void *s, int c, size_t n);
+void *memset_sse2_nt(void *s, int c, size_t n);
+void *memset_avx2_nt(void *s, int c, size_t n);
+
+/**
+ * memmove: forward (dest < src) copies low to high like memcpy but with
+ * no restrict, backward walks down from the end. each loads a block
+ * before storing over it.
+ */
+void *memmove_rep_fwd(void *dest, const void *src, size_t n);
+void *memmove_sse2_fwd(void *dest, const void *src, size_t n);
+void *memmove_avx2_fwd(void *dest, const void *src, size_t n);
+void *memmove_rep_bwd(void *dest, const void *src, size_t n);
+void *memmove_sse2_bwd(void *dest, const void *src, size_t n);
+void *memmove_avx2_bwd(void *dest, const void *src, size_t n);
+
+/**
+ * the string side: word-at-a-time scalar versions are the boot default,
+ * the simd versions never read past the end of the buffer or across a
+ * page the string does not reach into.
+ */
+int memcmp_word(const void *s1, const void *s2, size_t n);
+int memcmp_sse2(const void *s1, const void *s2, size_t n);
+int memcmp_avx2(const void *s1, const void *s2, size_t n);
+
+void *memchr_word(const void *s, int c, size_t n);
+void *memchr_sse2(const void *s, int c, size_t n);
+void *memchr_avx2(const void *s, int c, size_t n);
+
+size_t strlen_word(const char *s);
+size_t strlen_sse2(const char *s);
+size_t strlen_avx2(const char *s);
+
+int strcmp_byte(const char *s1, const char *s2);
+int strcmp_sse42(const char *s1, const char *s2);
+
+typedef uint64_t klib_u64 __attribute__((aligned(1), may_alias));
+typedef uint32_t klib_u32 __attribute__((aligned(1), may_alias));
+typedef uint16_t klib_u16 __attribute__((aligned(1), may_alias));
+
+/**
+ * 0..16 byte copy with two possibly overlapping loads per size class.
+ * both loads happen before either store, so this is overlap safe.
+ */
+static inline void klib_copy_small(void *dest, const void *src, size_t n)
+{
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (n >= 8) {
+        uint64_t a = *(const klib_u64 *)s;
+        uint64_t b = *(const klib_u64 *)(s + n - 8);
+        *(klib_u64 *)d = a;
+        *(klib_u64 *)(d + n - 8) = b;
+    } else if (n >= 4) {
+        uint32_t a = *(const klib_u32 *)s;
+        uint32_t b = *(const klib_u32 *)(s + n - 4);
+        *(klib_u32 *)d = a;
+        *(klib_u32 *)(d + n - 4) = b;
+    } else if (n >= 2) {
+        uint16_t a = *(const klib_u16 *)s;
+        uint16_t b = *(const klib_u16 *)(s + n - 2);
+        *(klib_u16 *)d = a;
+        *(klib_u16 *)(d + n - 2) = b;
+    } else if (n) {
+        *d = *s;
+    }
+}
+
+static inline void klib_set_small(void *s, uint8_t c, size_t n)
+{
+    uint8_t *p = s;
+    uint64_t v = 0x0101010101010101ull * c;
+
+    if (n >= 8) {
+        *(klib_u64 *)p = v;
+        *(klib_u64 *)(p + n - 8) = v;
+    } else if (n >= 4) {
+        *(klib_u32 *)p = (uint32_t)v;
+        *(klib_u32 *)(p + n - 4) = (uint32_t)v;
+    } else if (n >= 2) {
+        *(klib_u16 *)p = (uint16_t)v;
+        *(klib_u16 *)(p + n - 2) = (uint16_t)v;
+    } else if (n) {
+        *p = c;
+    }
+}
+
+void klib_init(void);
+const char *klib_describe(void);
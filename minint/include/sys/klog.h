@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <system.h>
+
+/**
+ * kernel log ring
+ *
+ * klog() does not format anything. it reserves a slot in the calling
+ * cpu's ring with one atomic add, captures the timestamp, level, format
+ * pointer and arguments, and publishes the record by writing its
+ * sequence number last. klog_drain() formats committed records, oldest
+ * first across all cpus, and hands them to the output sinks.
+ *
+ * a full ring overwrites its oldest records (the drainer counts them as
+ * lost), so after a panic the ring holds the most recent history.
+ */
+
+#define KLOG_MAX_CPUS   MAX_CPUS
+#define KLOG_RING_SIZE  128     // records per cpu, power of two
+#define KLOG_MAX_ARGS   6
+#define KLOG_STR_BYTES  48      // inline copies of %s arguments
+
+struct klog_record
+{
+    uint64_t seq;       // ring position + 1 once committed, 0 while written
+    uint64_t tsc;
+    const char *fmt;
+    uint8_t level;
+    uint8_t nargs;
+    uint16_t cpu;
+    uint32_t reserved;
+    uint64_t args[KLOG_MAX_ARGS];
+    char strs[KLOG_STR_BYTES];
+} ALIGNED(64);
+
+void klog_set_sync(bool sync);  // format in the caller, as before the ring
+size_t klog_drain(void);
+void klog_dump(size_t count);   // last count records, drained or not
+uint64_t klog_lost(void);
+
+// low priority thread on the bsp that drains the rings periodically
+void klog_start_thread(void);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+/**
+ * output side of the printf core. kformat appends into buf and calls
+ * flush after every newline and whenever buf is full; flush must empty
+ * the buffer (set len back to 0). with no flush, output past cap is
+ * dropped but still counted in total, which is what snprintf needs.
+ */
+struct fmt_out
+{
+    char *buf;
+    size_t cap;
+    size_t len;
+    size_t total;
+    void (*flush)(struct fmt_out *o);
+};
+
+void kformat(struct fmt_out *o, const char *fmt, va_list ap);
+
+/**
+ * deferred formatting: kformat_capture pulls the arguments a format
+ * needs out of ap into 64 bit slots and copies %s strings into strs
+ * (str_cap must be at least 1), kformat_args formats from those slots
+ * later. returns the number of slots used.
+ */
+size_t kformat_capture(const char *fmt, va_list ap, uint64_t *args,
+                       size_t max_args, char *strs, size_t str_cap);
+void kformat_args(struct fmt_out *o, const char *fmt, const uint64_t *args,
+                  size_t count, const char *strbase);
+
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list ap);
+int ksnprintf(char *buf, size_t size, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limine.h>
+
+/**
+ * kernel symbols, read from our own elf image as limine loaded it off
+ * the boot medium. only code symbols are kept, sorted by address, so a
+ * lookup is a binary search. the names point into the image, which
+ * stays mapped for good.
+ */
+bool ksym_init(const struct limine_file *kernel, uint64_t virtual_base);
+
+// name of the function containing addr and the offset into it, or NULL
+const char *ksym_lookup(uint64_t addr, uint64_t *offset);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <system.h>
+#include <cpuid.h>
+
+/**
+ * the tsc as the kernel clock
+ *
+ * ktime_init() measures the tsc against the hpet (the pit if there is
+ * none) and precomputes 32.32 fixed point factors both ways, so turning
+ * cycles into nanoseconds is one multiply and a shift. ktime_get_ns()
+ * counts from tsc reset, which the cpus share as long as the tsc is
+ * invariant; ktime_check_skew() measures how far apart they really are.
+ */
+
+#define KTIME_SHIFT 32
+
+extern uint64_t tsc_hz;
+extern uint64_t ktime_ns_mult;      // ns per cycle << KTIME_SHIFT
+extern uint64_t ktime_cyc_mult;     // cycles per ns << KTIME_SHIFT
+
+static ALWAYS_INLINE uint64_t ktime_cycles_to_ns(uint64_t cycles)
+{
+    return (uint64_t)(((unsigned __int128)cycles * ktime_ns_mult) >> KTIME_SHIFT);
+}
+
+static ALWAYS_INLINE uint64_t ktime_ns_to_cycles(uint64_t ns)
+{
+    return (uint64_t)(((unsigned __int128)ns * ktime_cyc_mult) >> KTIME_SHIFT);
+}
+
+static ALWAYS_INLINE uint64_t ktime_get_ns(void)
+{
+    return ktime_cycles_to_ns(rdtsc());
+}
+
+/**
+ * ordered reads for timing a stretch of code: nothing before the start
+ * read is still in flight when it executes, and nothing after the end
+ * read starts before it. rdtscp waits for the timed code itself.
+ */
+static ALWAYS_INLINE uint64_t tsc_read_start(void)
+{
+    asm volatile ("lfence" ::: "memory");
+    return rdtsc();
+}
+
+static ALWAYS_INLINE uint64_t tsc_read_end(void)
+{
+    uint32_t lo, hi;
+
+    if (cpu_features.rdtscp)
+        asm volatile ("rdtscp" : "=a"(lo), "=d"(hi) : : "rcx", "memory");
+    else
+        asm volatile ("lfence; rdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+
+    asm volatile ("lfence" ::: "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void ktime_init(void);          // bsp, after acpi_init()
+void ktime_check_skew(void);    // after smp_init(), prints the result
+const char *ktime_source(void); // what the tsc was calibrated against
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * local apic. x2apic mode (msr access) when the cpu has it, otherwise
+ * the xapic registers through an uncached mmio window. the pic keeps
+ * delivering legacy irqs to the bsp through lint0, which is left alone.
+ *
+ * the timer is one-shot only: tsc-deadline mode when the cpu has it,
+ * else a count at bus clock / 16 that the caller converts itself.
+ */
+#define LAPIC_VECTOR_TIMER      0xF0
+#define LAPIC_VECTOR_RESCHED    0xF1
+#define LAPIC_VECTOR_BENCH      0xF2    // self-ipi latency bench
+#define LAPIC_VECTOR_RCU        0xF3    // cpus holding up a grace period
+#define LAPIC_VECTOR_TLB        0xF4    // kernel half tlb shootdown
+#define LAPIC_VECTOR_SPURIOUS   0xFF
+
+void lapic_init(void);      // bsp: picks the mode, then as lapic_init_ap()
+void lapic_init_ap(void);   // enable the calling cpu's apic
+
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void lapic_send_nmi(uint32_t apic_id);
+
+bool lapic_deadline_mode(void);
+void lapic_timer_deadline(uint64_t tsc);    // 0 disarms
+void lapic_timer_oneshot(uint32_t ticks);   // 0 disarms
+
+// calibration: count down from the top with the interrupt masked
+void lapic_timer_free_run(void);
+uint32_t lapic_timer_stop(void);            // ticks since lapic_timer_free_run()
+
+// pmu overflow as an nmi. delivery masks it again, the handler re-arms
+void lapic_perfmon_nmi(bool enable);
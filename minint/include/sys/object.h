@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <system.h>
+#include <spinlock.h>
+#include <rcu.h>
+
+/**
+ * kernel objects
+ *
+ * everything a handle can name starts with a struct object: its type
+ * and a reference count. whoever creates an object holds the first
+ * reference; handles hold one each. when the last one goes the type's
+ * destroy runs, one grace period later, so a lockless lookup that found
+ * the object under rcu_read_lock() can still look at it and try to take
+ * a reference (object_tryref fails once the count has hit zero).
+ */
+
+struct object;
+
+struct object_type
+{
+    const char *name;
+    void (*destroy)(struct object *o);      // frees the containing object
+};
+
+struct object
+{
+    const struct object_type *type;
+    volatile uint32_t refs;
+    struct rcu_head rcu;
+};
+
+static ALWAYS_INLINE void object_init(struct object *o, const struct object_type *type)
+{
+    o->type = type;
+    o->refs = 1;
+}
+
+// the caller already holds a reference
+static ALWAYS_INLINE void object_ref(struct object *o)
+{
+    __atomic_fetch_add(&o->refs, 1, __ATOMIC_RELAXED);
+}
+
+// from a read section, for an object that may be on its way out
+static ALWAYS_INLINE bool object_tryref(struct object *o)
+{
+    uint32_t refs = __atomic_load_n(&o->refs, __ATOMIC_RELAXED);
+
+    do {
+        if (!refs)
+            return false;
+    } while (!__atomic_compare_exchange_n(&o->refs, &refs, refs + 1, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    return true;
+}
+
+void object_release(struct object *o);      // the count hit zero
+
+static ALWAYS_INLINE void object_unref(struct object *o)
+{
+    if (__atomic_sub_fetch(&o->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        object_release(o);
+}
+
+/**
+ * per-process handle tables
+ *
+ * a handle is a slot index in the low half and the slot's generation in
+ * the high half. the generation is odd while the slot is open and moves
+ * on when it is opened or closed, so a stale handle stops matching as
+ * soon as it is closed, even once the slot is reused, and of several
+ * closes of one handle exactly one wins. 0 is never a valid handle.
+ *
+ * slots live in pages of HANDLE_PER_PAGE, found through a directory
+ * page, both allocated as the table grows and only freed with it, one
+ * grace period after handle_table_destroy(). a
+ * lookup is a few loads and no lock: the generation, the object and
+ * the generation again. freed slots go to the closing cpu's free list
+ * and are handed out again from there, spilling to and refilling from
+ * a shared list under the table lock in batches.
+ */
+
+typedef uint64_t handle_t;
+
+#define HANDLE_INVALID      0
+#define HANDLE_PER_PAGE     (PAGE_SIZE / sizeof(struct handle_entry))
+#define HANDLE_DIR_SIZE     (PAGE_SIZE / sizeof(void *))
+#define HANDLE_MAX          (HANDLE_PER_PAGE * HANDLE_DIR_SIZE)
+#define HANDLE_FREE_BATCH   32      // slots moved to or from the shared list at once
+
+struct handle_entry
+{
+    struct object *volatile object;     // NULL while free
+    volatile uint32_t generation;       // odd while open
+    uint32_t next_free;                 // index, 0 ends the list
+};
+
+_Static_assert(sizeof(struct handle_entry) == 16, "handle entries pack a page");
+
+struct handle_table
+{
+    struct handle_entry *volatile *dir;
+
+    struct
+    {
+        uint32_t head;
+        uint32_t count;
+    } ALIGNED(64) free[MAX_CPUS];
+
+    spinlock_t lock ALIGNED(64);    // the shared list and growing
+    uint32_t free_head;
+    uint32_t free_count;
+    uint32_t next_index;            // first slot never handed out
+
+    struct rcu_head rcu;            // frees the pages once destroyed
+};
+
+struct handle_table *handle_table_create(void);
+void handle_table_destroy(struct handle_table *t);   // closes whatever is left open
+
+// takes a new reference to o; HANDLE_INVALID when the table is full
+handle_t handle_open(struct handle_table *t, struct object *o);
+bool handle_close(struct handle_table *t, handle_t h);
+
+// a new reference, or NULL if the handle is stale or not of the type (NULL for any)
+struct object *handle_lookup(struct handle_table *t, handle_t h,
+                             const struct object_type *type);
+
+// no reference: from a read section, and only good until it ends
+struct object *handle_lookup_rcu(struct handle_table *t, handle_t h,
+                                 const struct object_type *type);
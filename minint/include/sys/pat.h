@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * page attribute table. pat_init() loads the layout below on the calling
+ * cpu; entries 0-3 match the power-on default, so mappings made before
+ * it keep their meaning. a pte picks its entry with pat:pcd:pwt.
+ */
+enum memtype
+{
+    MEMTYPE_UC = 0,
+    MEMTYPE_WC = 1,
+    MEMTYPE_WT = 4,
+    MEMTYPE_WP = 5,
+    MEMTYPE_WB = 6,
+    MEMTYPE_UC_MINUS = 7,
+};
+
+void pat_init(void);
+
+uint64_t pat_pte_bits(enum memtype type);      // 4 KiB pte form
+enum memtype pat_memtype(uint64_t pte_flags);  // 4 KiB pte form
+enum memtype mtrr_memtype(uint64_t phys);
+enum memtype memtype_effective(enum memtype mtrr, enum memtype pat);
+const char *memtype_name(enum memtype type);
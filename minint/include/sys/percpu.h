@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limine.h>
+#include <system.h>
+#include <gdt.h>
+#include <tss.h>
+
+#define MSR_GS_BASE         0xC0000101
+#define MSR_KERNEL_GS_BASE  0xC0000102
+
+#define IST_STACK_SIZE      (16 * 1024)
+
+// read straight off gs by the syscall entry in cpu.s
+#define CPU_KERNEL_RSP_OFFSET   16
+#define CPU_USER_RSP_OFFSET     24
+
+struct thread;
+struct isr_frame;
+
+/**
+ * per-cpu data. in the kernel gs base points at the cpu's struct cpu
+ * and kernel gs base holds the user value (0), so an entry from user
+ * mode only needs a swapgs. the first four fields are read straight off
+ * gs by this_cpu(), cpu_id() and the syscall entry, keep them where they
+ * are.
+ */
+struct cpu
+{
+    struct cpu *self;
+    uint32_t id;                // dense, the bsp is 0
+    uint32_t lapic_id;
+    uint64_t kernel_rsp;        // the tss rsp0, see tss_set_rsp0()
+    uint64_t user_rsp;          // syscall entry scratch
+
+    volatile bool online;
+
+    struct thread *thread;      // running now, see sched.h
+    struct isr_frame *irq_frame;    // innermost interrupt being handled
+    volatile uint64_t rcu_seen;     // last grace period it passed a quiescent point in
+
+    // smp_call() mailbox, polled by an idle ap
+    void (*volatile call_fn)(void *arg);
+    void *call_arg;
+
+    uint64_t ist[IST_COUNT];    // stack tops for the tss
+
+    struct gdt_table gdt ALIGNED(16);
+    struct gdt_descriptor gdtr;
+    struct tss64 tss ALIGNED(16);
+} ALIGNED(64);
+
+_Static_assert(offsetof(struct cpu, self) == 0, "this_cpu() reads %gs:0");
+_Static_assert(offsetof(struct cpu, id) == CPU_ID_OFFSET, "cpu_id() reads %gs:8");
+_Static_assert(offsetof(struct cpu, kernel_rsp) == CPU_KERNEL_RSP_OFFSET, "cpu.s reads %gs:16");
+_Static_assert(offsetof(struct cpu, user_rsp) == CPU_USER_RSP_OFFSET, "cpu.s writes %gs:24");
+
+extern struct cpu cpus[MAX_CPUS];
+extern uint32_t cpu_count;
+
+static ALWAYS_INLINE struct cpu *this_cpu(void)
+{
+    struct cpu *c;
+    asm volatile ("mov %%gs:0, %0" : "=r"(c));
+    return c;
+}
+
+void percpu_init_bsp(void);
+void smp_init(struct limine_mp_response *mp);
+
+// run fn(arg) on an idle ap, one caller per target at a time.
+// smp_wait() spins until it has returned.
+bool smp_call(uint32_t cpu, void (*fn)(void *arg), void *arg);
+void smp_wait(uint32_t cpu);
+
+// panic: nmi every other cpu into a halt and wait (a while) until they are
+void smp_stop_others(void);
+bool smp_stopping(void);
+NORETURN void smp_stop_self(void);      // from the nmi handler
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * legacy 8259 pair, remapped above the exception vectors. every line
+ * starts masked, drivers unmask the ones they install a gate for.
+ */
+#define PIC_VECTOR_BASE 0x20
+
+void pic_init(void);
+void pic_unmask(uint8_t irq);
+void pic_mask(uint8_t irq);
+void pic_eoi(uint8_t irq);
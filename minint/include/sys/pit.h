@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * 8254 channel 2, gated through port 0x61 with the speaker off. only used
+ * as a known-rate reference to calibrate the other clocks against.
+ */
+#define PIT_HZ 1193182
+
+void pit_oneshot_start(uint16_t count);
+bool pit_oneshot_done(void);
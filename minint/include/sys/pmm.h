@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limine.h>
+
+/**
+ * physical page allocator
+ *
+ * a binary buddy allocator over the usable memmap entries, orders 0 to
+ * PMM_MAX_ORDER, behind one lock. single pages normally come from a
+ * per-cpu cache instead: recently freed (hot) pages sit at the front
+ * and are handed out first, batch refills from the buddy (cold) sit at
+ * the back, and trimming gives the coldest pages back. the cache only
+ * takes the buddy lock once per PMM_PCP_BATCH pages.
+ *
+ * everything deals in physical addresses; use phys_to_virt() to touch
+ * the memory through the hhdm. 0 means out of memory.
+ */
+
+#define PMM_MAX_ORDER   10      // 4 MiB blocks
+#define PMM_PCP_BATCH   32
+#define PMM_PCP_HIGH    128     // trim a cpu cache back down past this
+
+struct pmm_stats
+{
+    uint64_t total_pages;
+    uint64_t free_pages;        // in the buddy or sitting in a cpu cache
+    uint64_t cached_pages;      // of free_pages, in cpu caches
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t pcp_refills;       // buddy lock round trips from the caches
+    uint64_t pcp_trims;
+    uint64_t failed;
+};
+
+extern uint64_t hhdm_offset;
+
+static inline void *phys_to_virt(uint64_t phys)
+{
+    return (void *)(phys + hhdm_offset);
+}
+
+static inline uint64_t virt_to_phys(const void *virt)
+{
+    return (uint64_t)virt - hhdm_offset;
+}
+
+void pmm_init(struct limine_memmap_response *memmap, uint64_t hhdm);
+
+uint64_t pmm_alloc_pages(unsigned order);
+void pmm_free_pages(uint64_t phys, unsigned order);
+
+uint64_t pmm_alloc_page(void);
+void pmm_free_page(uint64_t phys);
+void pmm_free_page_cold(uint64_t phys);    // the cpu won't touch it again soon
+
+// per-page back pointer for the allocator layered on top (slab, ...)
+void pmm_set_owner(uint64_t phys, unsigned order, void *owner);
+void *pmm_owner(uint64_t phys);
+unsigned pmm_order(uint64_t phys);     // of the block starting at phys
+
+void pmm_get_stats(struct pmm_stats *out);
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <system.h>
+#include <idt.h>
+
+/**
+ * architectural performance monitoring (cpuid leaf 0xa)
+ *
+ * pmu_configure() picks the events to count and programs them on every
+ * cpu: cycles, instructions and reference cycles on the fixed counters
+ * where the cpu has them, everything else on the general purpose ones.
+ * counts are kept per cpu and per thread; the scheduler folds what the
+ * counters moved into the outgoing thread on every switch, so a thread
+ * only sees its own events.
+ *
+ * with no pmu (amd, or qemu without a vpmu) pmu_init() says so, nothing
+ * can be configured and every count reads as zero.
+ *
+ * the overflow interface samples on the last general purpose counter,
+ * which pmu_configure() then leaves alone: it fires an nmi every period
+ * events and calls the handler with the interrupted frame. an nmi the
+ * pmu did not raise is counted as spurious and otherwise ignored.
+ */
+
+enum pmu_event
+{
+    PMU_CYCLES,
+    PMU_INSTRUCTIONS,
+    PMU_REF_CYCLES,
+    PMU_LLC_REFS,
+    PMU_LLC_MISSES,
+    PMU_BRANCHES,
+    PMU_BRANCH_MISSES,
+    PMU_DTLB_WALKS,         // not architectural: skylake and later
+    PMU_EVENT_COUNT,
+};
+
+struct pmu_counts
+{
+    uint64_t count[PMU_EVENT_COUNT];
+    uint64_t generation;    // of the configuration these belong to
+};
+
+struct thread;
+
+struct pmu_info
+{
+    uint8_t version;        // 0: no usable pmu
+    uint8_t gp_counters;
+    uint8_t gp_width;
+    uint8_t fixed_counters;
+    uint8_t fixed_width;
+};
+
+typedef void (*pmu_overflow_fn)(const struct isr_frame *frame);
+
+void pmu_init(void);        // bsp, after cpuid_init()
+void pmu_init_ap(void);     // applies the current configuration
+const struct pmu_info *pmu_info(void);
+const char *pmu_event_name(enum pmu_event e);
+bool pmu_event_supported(enum pmu_event e);
+
+// from a thread, with the aps idle; returns how many events are counted
+unsigned pmu_configure(const enum pmu_event *events, unsigned n);
+bool pmu_counting(enum pmu_event e);
+
+// totals since pmu_configure(), for this cpu or for a thread. a thread
+// running elsewhere is only as current as its last switch.
+void pmu_read_cpu(struct pmu_counts *out);
+void pmu_read_thread(struct thread *t, struct pmu_counts *out);
+
+// scheduler hook, irqs off: charge the counters' progress to prev
+void pmu_switch(struct pmu_counts *prev);
+
+struct pmu_overflow_stats
+{
+    uint32_t cpus;          // sampling, 0 when stopped
+    uint64_t samples;
+    uint64_t spurious;
+};
+
+bool pmu_overflow_start(enum pmu_event e, uint64_t period, pmu_overflow_fn fn);
+void pmu_overflow_stop(void);
+void pmu_overflow_get_stats(struct pmu_overflow_stats *out);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <idt.h>
+
+/**
+ * statistical sampling profiler
+ *
+ * while running, every cpu takes a sample from its own lapic timer at
+ * the requested rate, or from a pmu overflow nmi every period cycles
+ * (profile_start_pmu, which also sees code running with irqs off): the
+ * interrupted rip plus up to PROFILE_DEPTH - 1
+ * return addresses found by following the rbp chain. the chain is only
+ * followed inside the interrupted thread's stack, and is only as good
+ * as the frame pointers the kernel was built with
+ * (-fno-omit-frame-pointer); without them most stacks are one deep.
+ *
+ * profile_sample() takes no locks and can also be called from an nmi,
+ * for a pmu overflow driven profile.
+ *
+ * profile_dump() symbolizes the samples against the kernel's own symbol
+ * table and writes them to serial as folded stacks ("a;b;c count"),
+ * between a begin and an end line, ready for flamegraph.pl.
+ */
+#define PROFILE_DEPTH       16
+#define PROFILE_SAMPLES     8192    // per cpu, later samples are dropped
+#define PROFILE_HZ          997     // prime, so it does not beat with periodic work
+
+bool profile_start(uint32_t hz);    // false if the buffers cannot be had
+bool profile_start_pmu(uint64_t cycles);    // false without a usable pmu
+void profile_stop(void);
+void profile_dump(void);
+
+void profile_sample(const struct isr_frame *frame);
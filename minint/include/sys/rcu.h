@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <system.h>
+#include <percpu.h>
+#include <sched.h>
+
+/**
+ * read-copy-update, quiescent state based
+ *
+ * readers bracket their walk with rcu_read_lock/unlock, which only bump
+ * a counter in their own thread: no atomics, no shared lines. a thread
+ * cannot be switched out inside a read section (preemption waits for
+ * the unlock, blocking panics), so a cpu that passes through the
+ * scheduler or sits idle holds no references. writers publish with
+ * rcu_assign_pointer() and, once an old version is unlinked, wait for
+ * every cpu to pass such a point before freeing it: synchronize_rcu()
+ * blocks for that, call_rcu() queues a callback for the rcu thread to
+ * run afterwards.
+ *
+ * grace periods are numbered. starting one bumps rcu_gp, and every cpu
+ * copies rcu_gp to its rcu_seen at each quiescent point, so the period
+ * is over when all online cpus have caught up. cpus that take too long
+ * (halted, or running one thread without switching) get an ipi on every
+ * look, whose handler counts unless it interrupted a read section; then
+ * the outermost rcu_read_unlock() reports instead. a cpu running with
+ * interrupts off holds the period up until it turns them back on.
+ *
+ * usable once rcu_init() has run, after sched_init().
+ */
+
+struct rcu_head
+{
+    struct rcu_head *next;
+    void (*fn)(struct rcu_head *head);
+};
+
+extern volatile uint64_t rcu_gp;
+
+// readers: loads see the pointer and then what it points to
+#define rcu_dereference(p)          __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+// writers: the object is fully built before anyone can find it
+#define rcu_assign_pointer(p, v)    __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+void rcu_read_unlock_slow(void);
+
+static ALWAYS_INLINE void rcu_read_lock(void)
+{
+    this_thread()->rcu_nesting++;
+    asm volatile ("" ::: "memory");
+}
+
+static ALWAYS_INLINE void rcu_read_unlock(void)
+{
+    struct thread *t = this_thread();
+
+    asm volatile ("" ::: "memory");
+
+    // a preemption or a grace period's ipi came in while we were reading
+    if (--t->rcu_nesting == 0 && (t->preempt_deferred || t->rcu_qs_needed))
+        rcu_read_unlock_slow();
+}
+
+// the calling cpu holds no references; irqs off or from the scheduler
+static ALWAYS_INLINE void rcu_quiescent(void)
+{
+    struct cpu *c = this_cpu();
+    uint64_t gp = __atomic_load_n(&rcu_gp, __ATOMIC_ACQUIRE);
+
+    // one store per grace period, the line stays shared otherwise
+    if (c->rcu_seen != gp)
+        __atomic_store_n(&c->rcu_seen, gp, __ATOMIC_RELEASE);
+}
+
+void rcu_init(void);
+
+// not from a read section or with interrupts off
+void synchronize_rcu(void);
+
+// head->fn(head) runs in the rcu thread after a grace period
+void call_rcu(struct rcu_head *head, void (*fn)(struct rcu_head *head));
+
+struct rcu_stats
+{
+    uint64_t grace_periods;
+    uint64_t ipis;          // sent to cpus that held one up
+    uint64_t callbacks;     // run so far
+};
+
+void rcu_get_stats(struct rcu_stats *out);
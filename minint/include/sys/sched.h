@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <system.h>
+#include <percpu.h>
+#include <pmu.h>
+
+/**
+ * kernel threads and the scheduler
+ *
+ * every cpu owns a run queue with one fifo per priority and a bitmap of
+ * the non-empty ones, so picking the next thread is a bit scan. a cpu
+ * that runs dry steals from the busiest other queue instead of going
+ * through anything global. a thread runs until it yields, blocks, exits
+ * or is preempted at the end of its slice. the slice timer is only armed
+ * while another thread of the same or a better priority is waiting, so
+ * a cpu with one thing to do takes no timer interrupts, and an idle cpu
+ * halts until an ipi or its next timer.
+ *
+ * the fpu/sse state is switched with the thread, since the klib string
+ * routines use vector registers.
+ */
+
+#define SCHED_PRIO_HIGH     0
+#define SCHED_PRIO_NORMAL   1
+#define SCHED_PRIO_LOW      2
+#define SCHED_PRIO_COUNT    3
+
+#define THREAD_STACK_ORDER  2
+#define THREAD_STACK_SIZE   (PAGE_SIZE << THREAD_STACK_ORDER)
+#define THREAD_FPU_SIZE     1024    // x87 + sse + avx xsave area, rounded up
+
+#define SCHED_SLICE_NS      (4ull * 1000 * 1000)
+
+#define THREAD_PINNED       0x01    // never stolen by another cpu
+#define THREAD_BOOT         0x02    // runs on a stack we did not allocate
+
+enum thread_state
+{
+    THREAD_RUNNABLE,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD,
+};
+
+typedef void (*thread_fn)(void *arg);
+
+struct thread
+{
+    uint64_t rsp;               // saved by switch_context, keep first
+    struct thread *next;        // run queue link
+
+    uint32_t id;
+    uint32_t cpu;
+    uint8_t prio;
+    uint8_t flags;
+    volatile uint8_t state;
+    bool wake_pending;          // woken before it got to block
+    bool preempt_deferred;      // preempted inside a read section, see rcu.h
+    bool rcu_qs_needed;         // a grace period waits for the end of the read section
+    uint32_t rcu_nesting;
+
+    thread_fn fn;
+    void *arg;
+    const char *name;
+
+    uint64_t stack;             // lowest address, 0 for boot threads
+    uint64_t rsp0;              // where entries from ring 3 start, see user_run()
+    uint64_t slice_start;       // tsc when it last got the cpu
+    struct pmu_counts pmu;      // events while it ran, see pmu.h
+
+    uint8_t fpu[THREAD_FPU_SIZE] ALIGNED(64);
+};
+
+struct sched_stats
+{
+    uint64_t switches;
+    uint64_t steals;        // threads this cpu took from another queue
+    uint64_t preemptions;
+    uint64_t ipis;
+    uint64_t created;
+    uint64_t exited;
+};
+
+static ALWAYS_INLINE struct thread *this_thread(void)
+{
+    return this_cpu()->thread;
+}
+
+void sched_init(void);      // bsp, after kmem and ktime: kmain becomes a thread
+void sched_init_ap(void);   // ap boot context becomes its idle thread
+
+struct thread *thread_create(const char *name, thread_fn fn, void *arg,
+                             unsigned prio, uint32_t flags);
+NORETURN void thread_exit(void);
+
+void sched_yield(void);
+void sched_block(void);     // may return early, callers loop on their condition
+void sched_wake(struct thread *t);
+void sched_sleep_until(uint64_t deadline);  // tsc
+
+// from an interrupt, after eoi: switch if the slice is used up or a
+// better thread is queued
+void sched_preempt(void);
+
+// idle loop hook: run whatever is queued or can be stolen, else halt
+// until the next interrupt
+void sched_idle(void);
+
+void sched_get_stats(uint32_t cpu, struct sched_stats *out);
+
+#ifdef CONFIG_BENCH
+// only cpus below n steal or get stolen from
+void sched_set_steal_cpus(uint32_t n);
+#endif
@@ -2,8 +2,31 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * com1 at 115200 8n1 with the 16 byte fifo on. writers copy into a tx
+ * ring and return; the thr-empty interrupt refills the fifo from it. a
+ * writer that finds the ring full feeds the fifo itself by polling the
+ * lsr, and counts that as a stall. safe to call from any cpu.
+ */
+struct serial_stats
+{
+    uint64_t tx_bytes;      // bytes handed to the uart
+    uint64_t stalls;        // writes that found the ring full
+    uint64_t irqs;
+};
 
 void serial_init(void);
 void serial_putc(char c);
 void serial_write(const char *s);
-void serial_write_len(const char *s, size_t len);
\ No newline at end of file
+void serial_write_len(const char *s, size_t len);
+
+void serial_flush(void);    // drain the ring by polling, then wait for the fifo
+void serial_panic(void);    // drain by polling, and poll from then on
+void serial_get_stats(struct serial_stats *out);
+
+#ifdef CONFIG_BENCH
+// bypass the ring and spin on lsr for every fifo load, for comparison
+void serial_set_polled(bool enable);
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * slab allocator with per-cpu magazines
+ *
+ * each cache hands out fixed size objects carved from slabs of one or
+ * more pages. in front of the slab layer every cpu holds two magazines
+ * (small stacks of free objects); alloc and free only touch the cpu's
+ * own magazines with interrupts off, and trade whole magazines with the
+ * cache's depot under the cache lock when both run dry or full.
+ *
+ * a constructor runs once per object when its slab is created. objects
+ * must be freed back in their constructed state; the allocator never
+ * writes into a constructed object.
+ */
+
+#define KMEM_NO_MAGAZINE 0x01   // every alloc/free goes to the slab layer
+
+typedef void (*kmem_ctor_fn)(void *obj);
+
+struct kmem_cache;
+
+struct kmem_cache_stats
+{
+    uint64_t active;        // objects held by callers
+    uint64_t slabs;
+    uint64_t mag_hits;      // allocs and frees served by a magazine
+    uint64_t mag_misses;    // ... that had to go to the slab layer
+};
+
+void kmem_init(void);
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+                                     size_t align, kmem_ctor_fn ctor,
+                                     uint32_t flags);
+void *kmem_cache_alloc(struct kmem_cache *c);
+void kmem_cache_free(struct kmem_cache *c, void *obj);
+void kmem_cache_stats(struct kmem_cache *c, struct kmem_cache_stats *out);
+
+// power of two size classes up to KMALLOC_MAX, whole pages above that
+#define KMALLOC_MAX 4096
+
+void *kmalloc(size_t size);
+void kfree(void *ptr);
+
+void kmem_dump_stats(void);     // one line per cache, to the serial port
@@ -0,0 +1,520 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <system.h>
+
+/**
+ * spinning locks, for code that cannot sleep
+ *
+ * spinlock_t      test-and-test-and-set. the cheapest to take uncontended,
+ *                 but every release sends all waiters at the line at once
+ *                 and nothing is fair, so it falls over past a few cpus.
+ * ticket_lock_t   fifo. waiters take a ticket and watch the owner field,
+ *                 backing off in proportion to their place in line. still
+ *                 one line that every waiter reads.
+ * mcs_lock_t      queued. each waiter spins on its own node, which the
+ *                 caller provides (usually on its stack) and passes to
+ *                 both lock and unlock, so a release only touches the
+ *                 next waiter's line.
+ * rwlock_t        any number of readers or one writer. a waiting writer
+ *                 holds off new readers, so writers are not starved.
+ *
+ * each has _irqsave variants that disable interrupts first and hand back
+ * the flags for the matching _irqrestore.
+ *
+ * built with -DCONFIG_LOCKSTAT, every lock also counts its acquisitions,
+ * how many of them had to wait and for how long, and how long it was
+ * held, see lockstat_dump(). a lock shows up there once it is first
+ * taken, named after the code that took it. one that lives in memory
+ * which gets freed must be passed to lock_destroy() first.
+ */
+
+#define LOCKSTAT_BUCKETS    16  // held < 64 << n cycles, the last one open ended
+
+struct lockstat
+{
+    struct lockstat *next;      // every lock taken so far
+    uint64_t site;              // where it was first taken
+    uint32_t registered;
+
+    // exclusive holders, updated with the lock held
+    uint64_t acquisitions;
+    uint64_t contentions;       // acquisitions that had to wait
+    uint64_t wait_cycles;       // summed over the contended ones
+    uint64_t acquired_at;
+    uint64_t held[LOCKSTAT_BUCKETS];
+
+    // rwlock readers, updated atomically
+    uint64_t read_acquisitions;
+    uint64_t read_contentions;
+    uint64_t read_wait_cycles;
+};
+
+#ifdef CONFIG_LOCKSTAT
+
+void lockstat_register(struct lockstat *s, uint64_t site);
+void lockstat_unregister(struct lockstat *s);
+void lockstat_dump(void);
+
+#define lock_stat(l)    (&(l)->stat)
+#define lock_destroy(l) lockstat_unregister(lock_stat(l))
+
+static ALWAYS_INLINE uint64_t lockstat_now(void)
+{
+    return rdtsc();
+}
+
+static ALWAYS_INLINE void lockstat_seen(struct lockstat *s)
+{
+    if (!__atomic_load_n(&s->registered, __ATOMIC_RELAXED)) {
+        uint64_t site;
+
+        // inlined, so this lands in the function taking the lock
+        asm volatile ("lea 0(%%rip), %0" : "=r"(site));
+        lockstat_register(s, site);
+    }
+}
+
+static ALWAYS_INLINE void lockstat_acquired(struct lockstat *s, bool contended,
+                                            uint64_t wait_start)
+{
+    uint64_t now = rdtsc();
+
+    lockstat_seen(s);
+
+    s->acquisitions++;
+    if (contended) {
+        s->contentions++;
+        s->wait_cycles += now - wait_start;
+    }
+    s->acquired_at = now;
+}
+
+static ALWAYS_INLINE void lockstat_released(struct lockstat *s)
+{
+    uint64_t held = rdtsc() - s->acquired_at;
+    unsigned b = held < 64 ? 0 : 58 - __builtin_clzll(held);
+
+    s->held[b < LOCKSTAT_BUCKETS ? b : LOCKSTAT_BUCKETS - 1]++;
+}
+
+static ALWAYS_INLINE void lockstat_read_acquired(struct lockstat *s, bool contended,
+                                                 uint64_t wait_start)
+{
+    lockstat_seen(s);
+
+    __atomic_fetch_add(&s->read_acquisitions, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        __atomic_fetch_add(&s->read_contentions, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&s->read_wait_cycles, rdtsc() - wait_start, __ATOMIC_RELAXED);
+    }
+}
+
+#else
+
+#define lock_stat(l)    ((struct lockstat *)NULL)
+#define lock_destroy(l) ((void)(l))
+
+static ALWAYS_INLINE uint64_t lockstat_now(void)
+{
+    return 0;
+}
+
+static ALWAYS_INLINE void lockstat_acquired(struct lockstat *s, bool contended,
+                                            uint64_t wait_start)
+{
+    (void)s;
+    (void)contended;
+    (void)wait_start;
+}
+
+static ALWAYS_INLINE void lockstat_released(struct lockstat *s)
+{
+    (void)s;
+}
+
+static ALWAYS_INLINE void lockstat_read_acquired(struct lockstat *s, bool contended,
+                                                 uint64_t wait_start)
+{
+    (void)s;
+    (void)contended;
+    (void)wait_start;
+}
+
+#endif
+
+/**
+ * test-and-test-and-set lock. waiters spin on a plain load so the line
+ * stays shared until the holder lets go.
+ */
+typedef struct
+{
+    volatile uint32_t locked;
+#ifdef CONFIG_LOCKSTAT
+    struct lockstat stat;
+#endif
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static ALWAYS_INLINE void spin_lock(spinlock_t *l)
+{
+    bool contended = false;
+    uint64_t start = 0;
+
+    while (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE)) {
+        if (!contended) {
+            contended = true;
+            start = lockstat_now();
+        }
+
+        while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED))
+            cpu_pause();
+    }
+
+    lockstat_acquired(lock_stat(l), contended, start);
+}
+
+static ALWAYS_INLINE bool spin_trylock(spinlock_t *l)
+{
+    if (__atomic_load_n(&l->locked, __ATOMIC_RELAXED)
+     || __atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE))
+        return false;
+
+    lockstat_acquired(lock_stat(l), false, 0);
+    return true;
+}
+
+static ALWAYS_INLINE void spin_unlock(spinlock_t *l)
+{
+    lockstat_released(lock_stat(l));
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+static ALWAYS_INLINE uint64_t spin_lock_irqsave(spinlock_t *l)
+{
+    uint64_t flags = irq_save();
+    spin_lock(l);
+    return flags;
+}
+
+static ALWAYS_INLINE void spin_unlock_irqrestore(spinlock_t *l, uint64_t flags)
+{
+    spin_unlock(l);
+    irq_restore(flags);
+}
+
+/**
+ * ticket lock. the next ticket and the one being served share a word, so
+ * a trylock can check and take in one compare-and-swap. 16 bits of
+ * ticket are plenty for MAX_CPUS waiters.
+ */
+typedef struct
+{
+    union
+    {
+        volatile uint32_t word;
+        struct
+        {
+            volatile uint16_t owner;
+            volatile uint16_t next;
+        };
+    };
+#ifdef CONFIG_LOCKSTAT
+    struct lockstat stat;
+#endif
+} ticket_lock_t;
+
+#define TICKET_LOCK_INIT { 0 }
+
+#define TICKET_BACKOFF  16      // pauses per waiter ahead of us
+
+static ALWAYS_INLINE void ticket_lock(ticket_lock_t *l)
+{
+    uint16_t me = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+    uint16_t owner = __atomic_load_n(&l->owner, __ATOMIC_ACQUIRE);
+    uint64_t start = 0;
+    bool contended = owner != me;
+
+    if (contended) {
+        start = lockstat_now();
+
+        do {
+            // reading the line while the holder writes it slows it down
+            for (uint32_t n = (uint16_t)(me - owner) * TICKET_BACKOFF; n; n--)
+                cpu_pause();
+
+            owner = __atomic_load_n(&l->owner, __ATOMIC_ACQUIRE);
+        } while (owner != me);
+    }
+
+    lockstat_acquired(lock_stat(l), contended, start);
+}
+
+static ALWAYS_INLINE bool ticket_trylock(ticket_lock_t *l)
+{
+    uint32_t v = __atomic_load_n(&l->word, __ATOMIC_RELAXED);
+
+    // free when the next ticket is the one being served
+    if ((v >> 16) != (v & 0xFFFF)
+     || !__atomic_compare_exchange_n(&l->word, &v, v + (1u << 16), false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+
+    lockstat_acquired(lock_stat(l), false, 0);
+    return true;
+}
+
+static ALWAYS_INLINE void ticket_unlock(ticket_lock_t *l)
+{
+    lockstat_released(lock_stat(l));
+
+    // only the holder writes owner, and the half-word store cannot carry into next
+    __atomic_store_n(&l->owner, (uint16_t)(l->owner + 1), __ATOMIC_RELEASE);
+}
+
+static ALWAYS_INLINE uint64_t ticket_lock_irqsave(ticket_lock_t *l)
+{
+    uint64_t flags = irq_save();
+    ticket_lock(l);
+    return flags;
+}
+
+static ALWAYS_INLINE void ticket_unlock_irqrestore(ticket_lock_t *l, uint64_t flags)
+{
+    ticket_unlock(l);
+    irq_restore(flags);
+}
+
+/**
+ * mcs lock. the lock is the tail of a queue of waiters; each one links
+ * itself behind the previous tail and spins on its own node until its
+ * predecessor hands over. the node must stay put until the unlock.
+ */
+struct mcs_node
+{
+    struct mcs_node *volatile next;
+    volatile uint32_t waiting;
+};
+
+typedef struct
+{
+    struct mcs_node *volatile tail;
+#ifdef CONFIG_LOCKSTAT
+    struct lockstat stat;
+#endif
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT { 0 }
+
+static ALWAYS_INLINE void mcs_lock(mcs_lock_t *l, struct mcs_node *n)
+{
+    uint64_t start = 0;
+
+    n->next = NULL;
+    n->waiting = 1;
+
+    struct mcs_node *prev = __atomic_exchange_n(&l->tail, n, __ATOMIC_ACQ_REL);
+
+    if (prev) {
+        start = lockstat_now();
+        __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+
+        while (__atomic_load_n(&n->waiting, __ATOMIC_ACQUIRE))
+            cpu_pause();
+    }
+
+    lockstat_acquired(lock_stat(l), prev != NULL, start);
+}
+
+static ALWAYS_INLINE bool mcs_trylock(mcs_lock_t *l, struct mcs_node *n)
+{
+    struct mcs_node *expected = NULL;
+
+    n->next = NULL;
+    n->waiting = 0;
+
+    if (!__atomic_compare_exchange_n(&l->tail, &expected, n, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+
+    lockstat_acquired(lock_stat(l), false, 0);
+    return true;
+}
+
+static ALWAYS_INLINE void mcs_unlock(mcs_lock_t *l, struct mcs_node *n)
+{
+    struct mcs_node *next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE);
+
+    lockstat_released(lock_stat(l));
+
+    if (!next) {
+        struct mcs_node *expected = n;
+
+        // nobody behind us
+        if (__atomic_compare_exchange_n(&l->tail, &expected, NULL, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+
+        // someone swapped the tail but has not linked in yet
+        while (!(next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)))
+            cpu_pause();
+    }
+
+    __atomic_store_n(&next->waiting, 0, __ATOMIC_RELEASE);
+}
+
+static ALWAYS_INLINE uint64_t mcs_lock_irqsave(mcs_lock_t *l, struct mcs_node *n)
+{
+    uint64_t flags = irq_save();
+    mcs_lock(l, n);
+    return flags;
+}
+
+static ALWAYS_INLINE void mcs_unlock_irqrestore(mcs_lock_t *l, struct mcs_node *n,
+                                                uint64_t flags)
+{
+    mcs_unlock(l, n);
+    irq_restore(flags);
+}
+
+/**
+ * reader-writer lock in one word: the reader count in the low bits, a
+ * bit for the writer holding it and one for a writer waiting. readers
+ * only get in while neither is set; a writer waits for the count to
+ * drain, and sets the waiting bit again if another writer beat it to
+ * the lock and cleared it.
+ */
+#define RWLOCK_WRITER   (1u << 31)
+#define RWLOCK_WAITING  (1u << 30)
+
+typedef struct
+{
+    volatile uint32_t word;
+#ifdef CONFIG_LOCKSTAT
+    struct lockstat stat;
+#endif
+} rwlock_t;
+
+#define RWLOCK_INIT { 0 }
+
+static ALWAYS_INLINE bool read_trylock(rwlock_t *l)
+{
+    uint32_t v = __atomic_load_n(&l->word, __ATOMIC_RELAXED);
+
+    if ((v & (RWLOCK_WRITER | RWLOCK_WAITING))
+     || !__atomic_compare_exchange_n(&l->word, &v, v + 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+
+    lockstat_read_acquired(lock_stat(l), false, 0);
+    return true;
+}
+
+static ALWAYS_INLINE void read_lock(rwlock_t *l)
+{
+    uint32_t v = __atomic_load_n(&l->word, __ATOMIC_RELAXED);
+    bool contended = false;
+    uint64_t start = 0;
+
+    for (;;) {
+        if (!(v & (RWLOCK_WRITER | RWLOCK_WAITING))) {
+            // other readers coming and going fail this too, just retry
+            if (__atomic_compare_exchange_n(&l->word, &v, v + 1, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                break;
+            continue;
+        }
+
+        if (!contended) {
+            contended = true;
+            start = lockstat_now();
+        }
+
+        cpu_pause();
+        v = __atomic_load_n(&l->word, __ATOMIC_RELAXED);
+    }
+
+    lockstat_read_acquired(lock_stat(l), contended, start);
+}
+
+static ALWAYS_INLINE void read_unlock(rwlock_t *l)
+{
+    __atomic_fetch_sub(&l->word, 1, __ATOMIC_RELEASE);
+}
+
+static ALWAYS_INLINE bool write_trylock(rwlock_t *l)
+{
+    uint32_t v = __atomic_load_n(&l->word, __ATOMIC_RELAXED);
+
+    // a waiting writer may be overtaken, it is still waiting for the same thing
+    if ((v & ~RWLOCK_WAITING)
+     || !__atomic_compare_exchange_n(&l->word, &v, RWLOCK_WRITER, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+
+    lockstat_acquired(lock_stat(l), false, 0);
+    return true;
+}
+
+static ALWAYS_INLINE void write_lock(rwlock_t *l)
+{
+    bool contended = false;
+    uint64_t start = 0;
+
+    for (;;) {
+        uint32_t v = __atomic_load_n(&l->word, __ATOMIC_RELAXED);
+
+        if (!(v & ~RWLOCK_WAITING)) {
+            if (__atomic_compare_exchange_n(&l->word, &v, RWLOCK_WRITER, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                break;
+        } else if (!(v & RWLOCK_WAITING)) {
+            __atomic_fetch_or(&l->word, RWLOCK_WAITING, __ATOMIC_RELAXED);
+        }
+
+        if (!contended) {
+            contended = true;
+            start = lockstat_now();
+        }
+
+        cpu_pause();
+    }
+
+    lockstat_acquired(lock_stat(l), contended, start);
+}
+
+static ALWAYS_INLINE void write_unlock(rwlock_t *l)
+{
+    lockstat_released(lock_stat(l));
+
+    // keeps a waiting bit another writer set meanwhile
+    __atomic_fetch_and(&l->word, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+}
+
+static ALWAYS_INLINE uint64_t read_lock_irqsave(rwlock_t *l)
+{
+    uint64_t flags = irq_save();
+    read_lock(l);
+    return flags;
+}
+
+static ALWAYS_INLINE void read_unlock_irqrestore(rwlock_t *l, uint64_t flags)
+{
+    read_unlock(l);
+    irq_restore(flags);
+}
+
+static ALWAYS_INLINE uint64_t write_lock_irqsave(rwlock_t *l)
+{
+    uint64_t flags = irq_save();
+    write_lock(l);
+    return flags;
+}
+
+static ALWAYS_INLINE void write_unlock_irqrestore(rwlock_t *l, uint64_t flags)
+{
+    write_unlock(l);
+    irq_restore(flags);
+}
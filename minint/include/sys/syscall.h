@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <system.h>
+
+/**
+ * system calls
+ *
+ * ring 3 enters with syscall: the number in rax, up to six arguments in
+ * rdi, rsi, rdx, r10, r8 and r9, the result comes back in rax. rcx and
+ * r11 are lost (the cpu parks the return rip and rflags there), all
+ * other registers are preserved. the entry swaps to the kernel gs,
+ * moves onto the thread's kernel stack (tss rsp0, see tss_set_rsp0())
+ * and calls the handler from the table with interrupts on, so handlers
+ * may block like any thread.
+ */
+#define SYSCALL_MAX     64
+#define SYSCALL_ENOSYS  ((uint64_t)-1)
+
+#define SYS_NULL        0       // does nothing, for measuring the round trip
+#define SYS_EXIT        1       // back out of user_run(), returning the argument
+
+typedef uint64_t (*syscall_fn)(uint64_t a0, uint64_t a1, uint64_t a2,
+                               uint64_t a3, uint64_t a4, uint64_t a5);
+
+// what syscall_entry in cpu.s saves, lowest address first
+struct syscall_frame
+{
+    uint64_t r9, r8, r10, rdx, rsi, rdi;
+    uint64_t nr;
+    uint64_t rip, rflags, rsp;
+};
+
+_Static_assert(sizeof(struct syscall_frame) == 10 * 8, "cpu.s pushes 10 words");
+
+void syscall_init(void);        // bsp: the built-in calls, then as syscall_init_ap()
+void syscall_init_ap(void);     // efer.sce, STAR, LSTAR and FMASK
+
+bool syscall_register(uint32_t nr, syscall_fn fn);
+
+/**
+ * run rip in ring 3 on the stack rsp, with arg in rdi, in whatever
+ * address space is loaded, until it calls SYS_EXIT; returns what it
+ * passed. only for threads with a stack of their own. user mappings
+ * must stay clear of the last page below the canonical hole, where
+ * sysret would fault in ring 0.
+ */
+uint64_t user_run(uint64_t rip, uint64_t rsp, uint64_t arg);
@@ -4,9 +4,11 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdarg.h>
 #include <stdnoreturn.h>
 #include <console.h>
 #include <memstring.h>
+#include <kprintf.h>
 
 #define KERNEL_NAME     "LAIN"
 #define KERNEL_VER      "0.13.37"
@@ -16,6 +18,16 @@
 
 #define UNUSED(X) (void)(x)
 
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+#define PAGE_SIZE   4096ul
+#define PAGE_SHIFT  12
+
+#define ALIGN_UP(x, a)   (((x) + ((a) - 1)) & ~((uint64_t)(a) - 1))
+#define ALIGN_DOWN(x, a) ((x) & ~((uint64_t)(a) - 1))
+
+#define MAX_CPUS 64
+
 /**
  * gnu defs
  */
@@ -24,6 +36,7 @@
 #define NORETURN _Noreturn
 #define ALWAYS_INLINE inline __attribute__((always_inline))
 #define NOINLINE __attribute__((noinline))
+#define PRINTF_LIKE(f, a) __attribute__((format(printf, f, a)))
 
 typedef enum {
     LOG_DEBUG,
@@ -33,10 +46,23 @@ typedef enum {
     LOG_FATAL
 } log_level_t;
 
+/**
+ * kernel output goes to every registered sink, a completed line (or a
+ * full buffer) at a time. the console is registered from the start.
+ */
+typedef void (*ksink_fn)(const char *s, size_t len);
+
+#define KSINK_MAX 4
+
+void ksink_register(ksink_fn sink);
+void ksink_write(const char *s, size_t len);
+void ksink_tick(void);      // periodic: lets a deferred console catch up
+
 void kputc(char c);
 void kprint(const char *s);
-void kprintf(const char *fmt, ...);
-void klog(log_level_t level, const char *fmt, ...);
+void kprintf(const char *fmt, ...) PRINTF_LIKE(1, 2);
+void kvprintf(const char *fmt, va_list ap);
+void klog(log_level_t level, const char *fmt, ...) PRINTF_LIKE(2, 3);
 
 NORETURN void panic(const char *msg);
 NORETURN void halt(void);
@@ -48,6 +74,19 @@ static ALWAYS_INLINE uint64_t rdtsc(void)
     return ((uint64_t)hi << 32) | lo;
 }
 
+static ALWAYS_INLINE uint64_t rdmsr(uint32_t msr)
+{
+    uint32_t lo, hi;
+    asm volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static ALWAYS_INLINE void wrmsr(uint32_t msr, uint64_t value)
+{
+    asm volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                  "d"((uint32_t)(value >> 32)));
+}
+
 static ALWAYS_INLINE void breakpoint(void) 
 {
     asm volatile ("int3");
@@ -58,4 +97,40 @@ static ALWAYS_INLINE void cpu_pause(void)
     asm volatile ("pause");
 }
 
+// struct cpu (percpu.h) keeps its dense id here, gs based
+#define CPU_ID_OFFSET 8
+
+static ALWAYS_INLINE uint32_t cpu_id(void)
+{
+    uint32_t id;
+    asm volatile ("movl %%gs:" TOSTRING(CPU_ID_OFFSET) ", %0" : "=r"(id));
+    return id;
+}
+
+#define RFLAGS_IF (1ull << 9)
+
+static ALWAYS_INLINE void irq_enable(void)
+{
+    asm volatile ("sti" ::: "memory");
+}
+
+static ALWAYS_INLINE void irq_disable(void)
+{
+    asm volatile ("cli" ::: "memory");
+}
+
+// disable interrupts, returning rflags so irq_restore can put them back
+static ALWAYS_INLINE uint64_t irq_save(void)
+{
+    uint64_t flags;
+    asm volatile ("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static ALWAYS_INLINE void irq_restore(uint64_t flags)
+{
+    if (flags & RFLAGS_IF)
+        irq_enable();
+}
+
 #endif
\ No newline at end of file
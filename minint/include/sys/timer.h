@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <system.h>
+#include <ktime.h>
+
+/**
+ * one-shot timers, tickless
+ *
+ * every cpu keeps its pending timers sorted by deadline and programs its
+ * lapic for the earliest one only; with nothing pending the timer is off
+ * and an idle cpu takes no interrupts at all. deadlines are absolute tsc
+ * values.
+ *
+ * a timer fires on the cpu that added it, from the interrupt, with
+ * interrupts off. the callback gets only its argument: once the timer
+ * is seen as not pending its memory may already be gone.
+ */
+struct timer
+{
+    uint64_t deadline;
+    void (*fn)(void *arg);
+    void *arg;
+    struct timer *next;
+    uint32_t cpu;
+    volatile bool pending;
+};
+
+struct timer_stats
+{
+    uint64_t irqs;
+    uint64_t expired;       // callbacks run
+    uint64_t programmed;    // lapic writes
+};
+
+// durations in tsc cycles, for building deadlines
+static ALWAYS_INLINE uint64_t timer_us(uint64_t us)
+{
+    return ktime_ns_to_cycles(us * 1000);
+}
+
+static ALWAYS_INLINE uint64_t timer_ms(uint64_t ms)
+{
+    return ktime_ns_to_cycles(ms * 1000000);
+}
+
+void timer_init(void);      // bsp, after ktime_init()
+void timer_init_ap(void);
+
+// t must not be pending; it fires on the calling cpu
+void timer_add(struct timer *t, uint64_t deadline, void (*fn)(void *arg), void *arg);
+bool timer_cancel(struct timer *t);     // from any cpu, false if not pending
+
+void timer_get_stats(uint32_t cpu, struct timer_stats *out);
+const char *timer_mode(void);
@@ -21,7 +21,11 @@ typedef struct PACKED tss64
     uint16_t   iomap_base;
 } tss64_t;
 
-extern struct tss64 g_tss;
+// ist slots used by the idt; the stacks are set up per cpu in smp.c
+#define IST_DOUBLE_FAULT    1
+#define IST_NMI             2
+#define IST_MACHINE_CHECK   3
+#define IST_COUNT           3
 
-void tss_init(void);
-void tss_set_rsp0(uint64_t rsp);
\ No newline at end of file
+void tss_init(void);    // the calling cpu's tss, see struct cpu
+void tss_set_rsp0(uint64_t rsp);    // kernel stack for entries from ring 3
\ No newline at end of file
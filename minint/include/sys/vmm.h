@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limine.h>
+#include <pat.h>
+
+/**
+ * page table bits. flags passed to and returned from the vmm are in the
+ * 4 KiB pte layout, where bit 7 is the pat bit; the vmm sets the page
+ * size bit and moves pat itself for big pages, and strips VMM_SMALL.
+ */
+#define PTE_PRESENT     (1ull << 0)
+#define PTE_WRITE       (1ull << 1)
+#define PTE_USER        (1ull << 2)
+#define PTE_PWT         (1ull << 3)
+#define PTE_PCD         (1ull << 4)
+#define PTE_ACCESSED    (1ull << 5)
+#define PTE_DIRTY       (1ull << 6)
+#define PTE_HUGE        (1ull << 7)     // pd/pdpt entries: 2 MiB / 1 GiB page
+#define PTE_PAT         (1ull << 7)     // pt entries
+#define PTE_GLOBAL      (1ull << 8)
+#define PTE_NX          (1ull << 63)
+
+#define VMM_SMALL       (1ull << 9)     // software: only use 4 KiB pages
+
+#define VMM_KERNEL_RO   (PTE_PRESENT | PTE_GLOBAL | PTE_NX)
+#define VMM_KERNEL_RW   (PTE_PRESENT | PTE_WRITE | PTE_GLOBAL | PTE_NX)
+#define VMM_KERNEL_RX   (PTE_PRESENT | PTE_GLOBAL)
+
+// start of the kernel half not used by the direct map, for dynamic mappings
+#define VMM_KVA_BASE    0xffffc00000000000ull
+#define VMM_MMIO_BASE   0xffffd00000000000ull   // device windows, never unmapped
+
+/**
+ * an address space is a pml4 plus the pcid its tlb entries are tagged
+ * with. the kernel half (pml4 slots 256-511) is shared by all of them.
+ */
+struct vmm_space
+{
+    uint64_t pml4;      // physical
+    uint16_t pcid;
+    bool stale;         // changed while not loaded, next switch must flush
+};
+
+extern struct vmm_space kernel_space;
+
+void vmm_init(struct limine_memmap_response *memmap,
+              struct limine_executable_address_response *exe);
+void vmm_init_ap(void);     // load kernel_space on an ap
+
+// a kernel half change has reached every cpu's tlb by the time these
+// return; make one with no spinlock held, the wait is for all of them
+bool vmm_map(struct vmm_space *s, uint64_t virt, uint64_t phys, size_t size,
+             uint64_t flags);
+void vmm_unmap(struct vmm_space *s, uint64_t virt, size_t size);
+bool vmm_protect(struct vmm_space *s, uint64_t virt, size_t size,
+                 uint64_t flags);
+bool vmm_translate(struct vmm_space *s, uint64_t virt, uint64_t *phys);
+uint64_t vmm_flags(struct vmm_space *s, uint64_t virt);    // 0 if unmapped
+
+// map device registers that are not in the direct map
+void *vmm_map_mmio(uint64_t phys, size_t size, enum memtype type);
+
+struct vmm_space *vmm_create_space(void);
+void vmm_switch(struct vmm_space *s);
@@ -32,10 +32,310 @@ idt_load:
     lidt [rdi]
     ret
 
-global isr_default_stub
-isr_default_stub:
+; one entry stub per vector. each pushes a zero where the cpu did not
+; push an error code, then the vector, so every frame has the same
+; layout (struct isr_frame) by the time isr_common sees it. nmi, #df
+; and #mc can land anywhere, see isr_paranoid.
+%assign i 0
+%rep 256
+isr_stub_%[i]:
+%if !(i == 8 || (i >= 10 && i <= 14) || i == 17 || i == 21 || i == 29 || i == 30)
+    push 0
+%endif
+    push i
+%if i == 2 || i == 8 || i == 18
+    jmp isr_paranoid
+%else
+    jmp isr_common
+%endif
+%assign i i+1
+%endrep
+
+MSR_GS_BASE     equ 0xC0000101
+XSAVE_MASK      equ 7           ; x87, sse, avx: what xcr0 can hold, see cpuid.c
+FPU_AREA        equ 832         ; their standard xsave layout, 512 for fxsave
+FPU_HEADER      equ 512
+CPU_KERNEL_RSP  equ 16          ; percpu.h
+CPU_USER_RSP    equ 24
+USER_RFLAGS     equ 0x202       ; if, and the always-one bit
+
+; C code a handler runs may use the vector registers: klib picks avx2
+; memcpy and memset at boot, and the compiler may copy structs through
+; xmm. the interrupted thread's are only saved if the handler switches
+; threads, and by then they are gone, so keep them on the stack across
+; the dispatch, below the frame and 64 byte aligned. the frame pointer
+; sits just above the area. xrstor wants the header past xstate_bv
+; zeroed, and xsave leaves it alone.
+extern isr_xsave
+
+%macro FPU_SAVE 0
+    mov rax, rsp
+    sub rsp, FPU_AREA + 16
+    and rsp, -64
+    mov [rsp + FPU_AREA], rax
+    test byte [rel isr_xsave], 1
+    jz %%fxsave
+    xor eax, eax
+%assign o 0
+%rep 8
+    mov [rsp + FPU_HEADER + o], rax
+%assign o o+8
+%endrep
+    mov eax, XSAVE_MASK
+    xor edx, edx
+    xsave64 [rsp]
+    jmp %%saved
+%%fxsave:
+    fxsave64 [rsp]
+%%saved:
+%endmacro
+
+%macro FPU_RESTORE 0
+    test byte [rel isr_xsave], 1
+    jz %%fxrstor
+    mov eax, XSAVE_MASK
+    xor edx, edx
+    xrstor64 [rsp]
+    jmp %%restored
+%%fxrstor:
+    fxrstor64 [rsp]
+%%restored:
+    mov rsp, [rsp + FPU_AREA]
+%endmacro
+
+; save what the sysv abi lets C clobber, plus rbp for stack walks and
+; rbx to keep the count even, and hand the frame to the dispatcher. a
+; handler may switch threads, this stack is the thread's. the cpu left
+; rsp 16 byte aligned before its 6 words with the error code; vector
+; plus 11 registers keep it aligned for the call. coming from ring 3
+; (the rpl of the saved cs, at +24 past vector and error) gs holds the
+; user base and needs swapping both ways.
+extern isr_dispatch
+
+isr_common:
+    test byte [rsp + 24], 3
+    jz .from_kernel
+    swapgs
+.from_kernel:
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    push rbx
+    push rbp
+    cld
+    FPU_SAVE
+    mov rdi, [rsp + FPU_AREA]
+    call isr_dispatch
+    FPU_RESTORE
+    pop rbp
+    pop rbx
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+    test byte [rsp + 24], 3
+    jz .to_kernel
+    swapgs
+.to_kernel:
+    add rsp, 16
+    iretq
+
+; the same for the vectors that can interrupt the few instructions
+; around a swapgs, where cs says kernel but gs is still the user's. the
+; gs base itself tells: the kernel's is a higher half address. rbx
+; remembers whether we swapped, C code leaves it alone.
+isr_paranoid:
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    push rbx
+    push rbp
+    cld
+    mov ecx, MSR_GS_BASE
+    rdmsr
+    xor ebx, ebx
+    test edx, edx
+    js .kernel_gs
+    swapgs
+    mov ebx, 1
+.kernel_gs:
+    FPU_SAVE
+    mov rdi, [rsp + FPU_AREA]
+    call isr_dispatch
+    FPU_RESTORE
+    test ebx, ebx
+    jz .no_swap
+    swapgs
+.no_swap:
+    pop rbp
+    pop rbx
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+    add rsp, 16
+    iretq
+
+; syscall from ring 3: rip in rcx, rflags in r11, interrupts already
+; masked by FMASK. swap to the kernel gs, move onto the thread's kernel
+; stack and build a struct syscall_frame there (10 words, which keeps
+; the aligned rsp0 aligned for the call). the caller's argument
+; registers go back as they were, so only rax, rcx and r11 change.
+extern syscall_dispatch
+
+global syscall_entry
+syscall_entry:
+    swapgs
+    mov [gs:CPU_USER_RSP], rsp
+    mov rsp, [gs:CPU_KERNEL_RSP]
+    push qword [gs:CPU_USER_RSP]
+    push r11
+    push rcx
+    push rax
+    push rdi
+    push rsi
+    push rdx
+    push r10
+    push r8
+    push r9
+    sti
+    mov rdi, rsp
+    call syscall_dispatch
     cli
+    pop r9
+    pop r8
+    pop r10
+    pop rdx
+    pop rsi
+    pop rdi
+    add rsp, 8
+    pop rcx
+    pop r11
+    pop rsp
+    swapgs
+    o64 sysret
+
+; uint64_t user_enter(uint64_t rip, uint64_t rsp, uint64_t *rsp0, uint64_t arg)
+; saves the callee saved registers and makes the stack below them the
+; thread's rsp0, then drops to ring 3 at rip with arg in rdi and nothing
+; of ours in the other registers. user_leave comes back out of it.
+extern tss_set_rsp0
+
+global user_enter
+user_enter:
+    push rbx
+    push rbp
+    push r12
+    push r13
+    push r14
+    push r15
+    sub rsp, 8
+    mov r12, rdi
+    mov r13, rsi
+    mov r14, rcx
+    cli
+    mov [rdx], rsp
+    mov rdi, rsp
+    call tss_set_rsp0
+    mov rcx, r12
+    mov r11, USER_RFLAGS
+    mov rdi, r14
+    mov rsp, r13
+    xor eax, eax
+    xor ebx, ebx
+    xor edx, edx
+    xor esi, esi
+    xor ebp, ebp
+    xor r8d, r8d
+    xor r9d, r9d
+    xor r10d, r10d
+    xor r12d, r12d
+    xor r13d, r13d
+    xor r14d, r14d
+    xor r15d, r15d
+    swapgs
+    o64 sysret
+
+; NORETURN void user_leave(uint64_t rsp0, uint64_t value)
+; unwinds to the user_enter frame at rsp0 and returns value from it
+global user_leave
+user_leave:
+    mov rsp, rdi
+    mov rax, rsi
+    add rsp, 8
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+section .rodata
+
+global isr_stub_table
+isr_stub_table:
+%assign i 0
+%rep 256
+    dq isr_stub_%[i]
+%assign i i+1
+%endrep
+
+section .text
+
+; struct thread *switch_context(struct thread *prev, struct thread *next)
+; saves the callee saved registers on prev's stack and its rsp in
+; prev->rsp (offset 0), then resumes next. returns prev to whoever
+; comes out on the other side.
+global switch_context
+switch_context:
+    push rbx
+    push rbp
+    push r12
+    push r13
+    push r14
+    push r15
+
+    mov [rdi], rsp
+    mov rsp, [rsi]
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+
+    mov rax, rdi
+    ret
+
+; a new thread's first return from switch_context lands here
+extern thread_entry
 
-.hang:
-    hlt
-    jmp .hang
\ No newline at end of file
+global thread_start
+thread_start:
+    mov rdi, rax
+    call thread_entry
+    ud2
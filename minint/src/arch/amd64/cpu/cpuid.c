@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <cpuid.h>
+
+struct cpu_features cpu_features;
+
+#define CR0_MP          (1ull << 1)
+#define CR0_EM          (1ull << 2)
+#define CR4_OSFXSR      (1ull << 9)
+#define CR4_OSXMMEXCPT  (1ull << 10)
+#define CR4_OSXSAVE     (1ull << 18)
+
+#define XCR0_X87        (1ull << 0)
+#define XCR0_SSE        (1ull << 1)
+#define XCR0_AVX        (1ull << 2)
+
+static inline uint64_t xgetbv(uint32_t idx)
+{
+    uint32_t lo, hi;
+    asm volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(idx));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void xsetbv(uint32_t idx, uint64_t val)
+{
+    asm volatile ("xsetbv" : : "c"(idx), "a"((uint32_t)val),
+                  "d"((uint32_t)(val >> 32)));
+}
+
+/**
+ * walk the deterministic cache parameter leaf and keep the largest
+ * unified/data cache, that is what non-temporal thresholds key off.
+ */
+static uint32_t detect_llc_size(void)
+{
+    uint32_t a, b, c, d;
+    uint32_t best = 0;
+
+    if (cpu_features.max_leaf < 4)
+        return 0;
+
+    for (uint32_t i = 0; i < 16; i++) {
+        cpuid(4, i, &a, &b, &c, &d);
+
+        uint32_t type = a & 0x1F;
+        if (type == 0)
+            break;
+        if (type == 2)  // instruction cache
+            continue;
+
+        uint32_t ways       = ((b >> 22) & 0x3FF) + 1;
+        uint32_t partitions = ((b >> 12) & 0x3FF) + 1;
+        uint32_t line       = (b & 0xFFF) + 1;
+        uint32_t sets       = c + 1;
+        uint32_t size       = ways * partitions * line * sets;
+
+        if (size > best)
+            best = size;
+    }
+
+    return best;
+}
+
+// control register opt-ins, done on every cpu
+static void enable_features(void)
+{
+    uint64_t cr0, cr4;
+
+    // sse is architectural on amd64, but the os still has to opt in
+    asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP;
+    asm volatile ("mov %0, %%cr0" : : "r"(cr0));
+
+    asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (cpu_features.xsave)
+        cr4 |= CR4_OSXSAVE;
+    asm volatile ("mov %0, %%cr4" : : "r"(cr4));
+
+    if (cpu_features.xsave) {
+        uint64_t xcr0 = XCR0_X87 | XCR0_SSE;
+        if (cpu_features.avx)
+            xcr0 |= XCR0_AVX;
+        xsetbv(0, xcr0);
+
+        cpu_features.avx = cpu_features.avx && (xgetbv(0) & (XCR0_SSE | XCR0_AVX))
+                                  == (XCR0_SSE | XCR0_AVX);
+    }
+}
+
+void cpuid_init(void)
+{
+    uint32_t a, b, c, d;
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    cpu_features.max_leaf = a;
+
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    cpu_features.max_ext_leaf = a;
+
+    cpuid(1, 0, &a, &b, &c, &d);
+    cpu_features.sse3  = c & (1u << 0);
+    cpu_features.ssse3 = c & (1u << 9);
+    cpu_features.sse41 = c & (1u << 19);
+    cpu_features.sse42 = c & (1u << 20);
+    cpu_features.xsave = c & (1u << 26);
+    cpu_features.pcid  = c & (1u << 17);
+    cpu_features.pge   = d & (1u << 13);
+    cpu_features.x2apic = c & (1u << 21);
+    cpu_features.tsc_deadline = c & (1u << 24);
+
+    cpu_features.avx = c & (1u << 28);   // until xcr0 says otherwise
+    enable_features();
+
+    if (cpu_features.max_leaf >= 7) {
+        cpuid(7, 0, &a, &b, &c, &d);
+        cpu_features.avx2 = cpu_features.avx && (b & (1u << 5));
+        cpu_features.erms = b & (1u << 9);
+        cpu_features.fsrm = d & (1u << 4);
+        cpu_features.invpcid = b & (1u << 10);
+    }
+
+    if (cpu_features.max_ext_leaf >= 0x80000001) {
+        cpuid(0x80000001, 0, &a, &b, &c, &d);
+        cpu_features.nx = d & (1u << 20);
+        cpu_features.pdpe1gb = d & (1u << 26);
+        cpu_features.rdtscp = d & (1u << 27);
+    }
+
+    if (cpu_features.max_ext_leaf >= 0x80000007) {
+        cpuid(0x80000007, 0, &a, &b, &c, &d);
+        cpu_features.invariant_tsc = d & (1u << 8);
+    }
+
+    cpu_features.llc_size = detect_llc_size();
+}
+
+void cpuid_init_ap(void)
+{
+    enable_features();
+}
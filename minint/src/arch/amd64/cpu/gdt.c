@@ -3,54 +3,29 @@
 #include <system.h>
 #include <gdt.h>
 #include <tss.h>
-
-struct gdt_entry
-{
-    uint16_t limit_low;
-    uint16_t base_low;
-    uint8_t base_mid;
-    uint8_t access;
-    uint8_t granularity;
-    uint8_t base_high;
-} PACKED;
-
-struct gdt_tss_entry
-{
-    uint16_t limit_low;
-    uint16_t base_low;
-    uint8_t base_mid;
-    uint8_t access;
-    uint8_t granularity;
-    uint8_t base_high;
-    uint32_t base_upper;
-    uint32_t reserved;
-} PACKED;
-
-struct gdt_table
-{
-    struct gdt_entry     entries[5];
-    struct gdt_tss_entry tss;
-} PACKED;
+#include <percpu.h>
 
 /**
  * gdt layout
  * 0000 null descriptor segment
  * 0008 kernel code segment
  * 0010 kernel data segment
- * 0018 user mode code segment
- * 0020 user mode data segment
+ * 0018 user mode data segment
+ * 0020 user mode code segment
  * 0028 tss segment
+ *
+ * user data before user code is the order sysret wants, see gdt.h
  */
 
-static struct gdt_table gdt_table;
-static struct gdt_descriptor gdtr;
+_Static_assert(GDT_USER_CODE == GDT_USER_DATA + 8, "sysret: user cs = ss + 8");
+_Static_assert(GDT_TSS == 5 * sizeof(struct gdt_entry), "tss follows the five segments");
 
 extern void gdt_load(struct gdt_descriptor *gdtr);
 extern void tss_load(uint16_t selector);
 
-static void gdt_set_entry(int idx, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags)
+static void gdt_set_entry(struct gdt_table *gdt_table, int idx, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags)
 {
-    struct gdt_entry *e = &gdt_table.entries[idx];
+    struct gdt_entry *e = &gdt_table->entries[idx];
 
     e->limit_low = (uint16_t)(limit & 0xFFFF);
     e->base_low = (uint16_t)(base & 0xFFFF);
@@ -62,39 +37,44 @@ static void gdt_set_entry(int idx, uint32_t base, uint32_t limit, uint8_t access
 
 void gdt_init(void)
 {
+    struct cpu *cpu = this_cpu();
+    struct gdt_table *gdt_table = &cpu->gdt;
+
     // NULL DESCRIPTOR
-    gdt_set_entry(0, 0, 0, 0, 0);
+    gdt_set_entry(gdt_table, 0, 0, 0, 0, 0);
 
     // kernel code segment
-    gdt_set_entry(1, 0, 0, 0x9A, 0x20);
+    gdt_set_entry(gdt_table, 1, 0, 0, 0x9A, 0x20);
 
     // kernel data segment
-    gdt_set_entry(2, 0, 0, 0x92, 0x00);
-
-    // user mode code segment
-    gdt_set_entry(3, 0, 0, 0xF2, 0x00);
+    gdt_set_entry(gdt_table, 2, 0, 0, 0x92, 0x00);
 
     // user mode data segment
-    gdt_set_entry(4, 0, 0, 0xFA, 0x20);
+    gdt_set_entry(gdt_table, GDT_USER_DATA / 8, 0, 0, 0xF2, 0x00);
+
+    // user mode code segment, long mode
+    gdt_set_entry(gdt_table, GDT_USER_CODE / 8, 0, 0, 0xFA, 0x20);
 
     // tss descriptor (last in mem order)
 
-    uint64_t base = (uint64_t)&g_tss;
+    uint64_t base = (uint64_t)&cpu->tss;
     uint32_t limit = sizeof(struct tss64) - 1;
 
-    gdt_table.tss.limit_low = (uint16_t)(limit & 0xFFFF);
-    gdt_table.tss.base_low = (uint16_t)(base & 0xFFFF);
-    gdt_table.tss.base_mid = (uint8_t)((base >> 16) & 0xFF);
-    gdt_table.tss.access = 0x89;
-    gdt_table.tss.granularity = (uint8_t)(((limit >> 16) & 0x0F));
-    gdt_table.tss.base_high = (uint8_t)((base >> 24) & 0xFF);
-    gdt_table.tss.base_upper = (uint32_t)(base >> 32);
-    gdt_table.tss.reserved = 0;
+    gdt_table->tss.limit_low = (uint16_t)(limit & 0xFFFF);
+    gdt_table->tss.base_low = (uint16_t)(base & 0xFFFF);
+    gdt_table->tss.base_mid = (uint8_t)((base >> 16) & 0xFF);
+    gdt_table->tss.access = 0x89;
+    gdt_table->tss.granularity = (uint8_t)(((limit >> 16) & 0x0F));
+    gdt_table->tss.base_high = (uint8_t)((base >> 24) & 0xFF);
+    gdt_table->tss.base_upper = (uint32_t)(base >> 32);
+    gdt_table->tss.reserved = 0;
 
-    gdtr.base = (uint64_t)&gdt_table;
-    gdtr.limit = sizeof(gdt_table) - 1;
+    cpu->gdtr.base = (uint64_t)gdt_table;
+    cpu->gdtr.limit = sizeof(*gdt_table) - 1;
 
-    gdt_load(&gdtr);
+    // reloading gs zeroes its base, which is where this cpu's data lives
+    gdt_load(&cpu->gdtr);
+    wrmsr(MSR_GS_BASE, (uint64_t)cpu);
 
-    tss_load(0x28);
+    tss_load(GDT_TSS);
 }
\ No newline at end of file
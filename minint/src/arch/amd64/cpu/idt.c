@@ -1,22 +1,55 @@
 #include <stdint.h>
 #include <system.h>
+#include <kprintf.h>
 #include <idt.h>
+#include <tss.h>
+#include <percpu.h>
+#include <cpuid.h>
+#include <ksym.h>
 
 extern void idt_load(struct idt_descriptor *idtr);
 
-extern void isr_default_stub(void);
-
-#define IDT_ENTRIES 256
+extern void (*const isr_stub_table[IDT_ENTRIES])(void);
 
 static struct idt_entry idt[IDT_ENTRIES];
 static struct idt_descriptor idtr;
 
+static isr_handler_t handlers[IDT_ENTRIES];
+
+uint8_t isr_xsave;      // the entry stubs save vector state with xsave, not fxsave
+
+static const char *const exception_names[IDT_EXCEPTIONS] = {
+    [0]  = "divide error",
+    [1]  = "debug",
+    [2]  = "nmi",
+    [3]  = "breakpoint",
+    [4]  = "overflow",
+    [5]  = "bound range exceeded",
+    [6]  = "invalid opcode",
+    [7]  = "device not available",
+    [8]  = "double fault",
+    [10] = "invalid tss",
+    [11] = "segment not present",
+    [12] = "stack fault",
+    [13] = "general protection",
+    [14] = "page fault",
+    [16] = "x87 fpu error",
+    [17] = "alignment check",
+    [18] = "machine check",
+    [19] = "simd fpu error",
+    [20] = "virtualization",
+    [21] = "control protection",
+    [28] = "hypervisor injection",
+    [29] = "vmm communication",
+    [30] = "security",
+};
+
 void idt_set_gate(int vec, void (*handler)(void), uint8_t ist, uint8_t flags)
 {
     uint64_t addr = (uint64_t)handler;
 
     idt[vec].offset_low  = (uint16_t)(addr & 0xFFFF);
-    idt[vec].selector    = 0x08;       // kernel code segment
+    idt[vec].selector    = GDT_KERNEL_CODE;
     idt[vec].ist         = ist & 0x7;  // lower 3 bits 
     idt[vec].type_attr   = flags; 
     idt[vec].offset_mid  = (uint16_t)((addr >> 16) & 0xFFFF);
@@ -24,26 +57,82 @@ void idt_set_gate(int vec, void (*handler)(void), uint8_t ist, uint8_t flags)
     idt[vec].zero        = 0;
 }
 
+void isr_register(uint8_t vec, isr_handler_t handler)
+{
+    __atomic_store_n(&handlers[vec], handler, __ATOMIC_RELEASE);
+}
+
+static NORETURN void fatal_exception(struct isr_frame *f)
+{
+    char msg[256];
+    const char *name = exception_names[f->vector];
+    uint64_t cr2 = 0;
+
+    if (f->vector == 14)
+        asm volatile ("mov %%cr2, %0" : "=r"(cr2));
+
+    uint64_t off = 0;
+    const char *sym = ksym_lookup(f->rip, &off);
+
+    ksnprintf(msg, sizeof(msg),
+              "%s (vector %lu) on cpu%u, error %#lx\n"
+              "rip %016lx <%s+%#lx>\n"
+              "rsp %016lx  rbp %016lx  rflags %08lx  cr2 %016lx",
+              name ? name : "reserved exception", f->vector, cpu_id(), f->error,
+              f->rip, sym ? sym : "?", off, f->rsp, f->rbp, f->rflags, cr2);
+
+    panic(msg);
+}
+
+void isr_dispatch(struct isr_frame *frame)
+{
+    isr_handler_t handler = handlers[frame->vector];
+    struct isr_frame *outer = this_cpu()->irq_frame;
+
+    // another cpu panicked and wants this one quiet
+    if (frame->vector == VECTOR_NMI && smp_stopping())
+        smp_stop_self();
+
+    // for handlers that look at what they interrupted, e.g. the profiler
+    this_cpu()->irq_frame = frame;
+
+    if (handler)
+        handler(frame);
+    else if (frame->vector < IDT_EXCEPTIONS)
+        fatal_exception(frame);
+
+    // the handler may have switched threads and come back on another
+    // cpu; nobody reads irq_frame outside a dispatch, so that is fine
+    this_cpu()->irq_frame = outer;
+
+    // an unclaimed irq has no one to eoi it; a lapic one then blocks
+    // its priority class, which is a bug in whoever enabled it
+}
+
 void idt_init(void)
 {
     for (int i = 0; i < IDT_ENTRIES; i++)
     {
-        idt[i].offset_low  = 0;
-        idt[i].selector    = 0;
-        idt[i].ist         = 0;
-        idt[i].type_attr   = 0;
-        idt[i].offset_mid  = 0;
-        idt[i].offset_high = 0;
-        idt[i].zero        = 0;
+        idt_set_gate(i, isr_stub_table[i], 0, 0x8E);
     }
 
-    for (int i = 0; i < 32; i++)
-    {
-        idt_set_gate(i, isr_default_stub, 0, 0x8E);
-    }
+    // these can arrive on a bad stack, give them known good ones
+    idt_set_gate(VECTOR_NMI, isr_stub_table[VECTOR_NMI], IST_NMI, 0x8E);
+    idt_set_gate(VECTOR_DOUBLE_FAULT, isr_stub_table[VECTOR_DOUBLE_FAULT],
+                 IST_DOUBLE_FAULT, 0x8E);
+    idt_set_gate(VECTOR_MACHINE_CHECK, isr_stub_table[VECTOR_MACHINE_CHECK],
+                 IST_MACHINE_CHECK, 0x8E);
 
     idtr.base = (uint64_t)&idt[0];
     idtr.limit = (uint16_t)(sizeof(idt) - 1);
 
+    // after cpuid_init(), which turned xsave on
+    isr_xsave = cpu_features.xsave;
+
     idt_load(&idtr);
-}
\ No newline at end of file
+}
+
+void idt_reload(void)
+{
+    idt_load(&idtr);
+}
@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <cpuid.h>
+#include <percpu.h>
+#include <vmm.h>
+#include <idt.h>
+#include <lapic.h>
+
+#define MSR_APIC_BASE       0x1B
+#define MSR_TSC_DEADLINE    0x6E0
+#define MSR_X2APIC          0x800   // + register offset / 16
+
+#define APIC_BASE_EXTD      (1ull << 10)
+#define APIC_BASE_EN        (1ull << 11)
+#define APIC_BASE_ADDR      0x000FFFFFFFFFF000ull
+
+#define LAPIC_ID            0x020
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_ICR_LOW       0x300
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_PERF      0x340
+#define LAPIC_TIMER_INIT    0x380
+#define LAPIC_TIMER_CUR     0x390
+#define LAPIC_TIMER_DIV     0x3E0
+
+#define SVR_ENABLE          0x100
+#define LVT_MASKED          (1u << 16)
+#define LVT_TSC_DEADLINE    (2u << 17)
+#define LVT_NMI             (4u << 8)
+#define ICR_NMI             (4u << 8)       // delivery mode
+#define ICR_PENDING         (1u << 12)
+#define ICR_ASSERT          (1u << 14)
+#define TIMER_DIV_16        0x3
+
+static volatile uint32_t *mmio;
+static bool x2apic;
+static bool deadline;
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    if (x2apic)
+        return (uint32_t)rdmsr(MSR_X2APIC + (reg >> 4));
+
+    return mmio[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+    if (x2apic)
+        wrmsr(MSR_X2APIC + (reg >> 4), value);
+    else
+        mmio[reg / 4] = value;
+}
+
+// the apic's own spurious vector, never in service so never eoi'd
+static void lapic_spurious(struct isr_frame *frame)
+{
+}
+
+void lapic_init(void)
+{
+    x2apic = cpu_features.x2apic;
+    deadline = cpu_features.tsc_deadline;
+
+    if (!x2apic) {
+        mmio = vmm_map_mmio(rdmsr(MSR_APIC_BASE) & APIC_BASE_ADDR, PAGE_SIZE, MEMTYPE_UC);
+        if (!mmio)
+            panic("lapic: cannot map the registers");
+    }
+
+    isr_register(LAPIC_VECTOR_SPURIOUS, lapic_spurious);
+    lapic_init_ap();
+}
+
+void lapic_init_ap(void)
+{
+    uint64_t base = rdmsr(MSR_APIC_BASE) | APIC_BASE_EN;
+
+    if (x2apic)
+        base |= APIC_BASE_EXTD;
+    wrmsr(MSR_APIC_BASE, base);
+
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, SVR_ENABLE | LAPIC_VECTOR_SPURIOUS);
+
+    if (deadline) {
+        lapic_write(LAPIC_LVT_TIMER, LVT_TSC_DEADLINE | LAPIC_VECTOR_TIMER);
+        // the lvt write has to land before the first deadline msr write
+        asm volatile ("mfence" ::: "memory");
+    } else {
+        lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_VECTOR_TIMER);
+    }
+
+    this_cpu()->lapic_id = lapic_id();
+}
+
+uint32_t lapic_id(void)
+{
+    uint32_t id = lapic_read(LAPIC_ID);
+
+    return x2apic ? id : id >> 24;
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void send_icr(uint32_t apic_id, uint32_t low)
+{
+    if (x2apic) {
+        wrmsr(MSR_X2APIC + (LAPIC_ICR_LOW >> 4), ((uint64_t)apic_id << 32) | low);
+        return;
+    }
+
+    if (!mmio)
+        return;
+
+    // the two halves must not be split by another ipi from an interrupt
+    uint64_t flags = irq_save();
+
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, low);
+
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING)
+        cpu_pause();
+
+    irq_restore(flags);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+    send_icr(apic_id, ICR_ASSERT | vector);
+}
+
+// the vector field is ignored, the nmi goes through idt entry 2
+void lapic_send_nmi(uint32_t apic_id)
+{
+    send_icr(apic_id, ICR_ASSERT | ICR_NMI);
+}
+
+bool lapic_deadline_mode(void)
+{
+    return deadline;
+}
+
+void lapic_timer_deadline(uint64_t tsc)
+{
+    wrmsr(MSR_TSC_DEADLINE, tsc);
+}
+
+void lapic_timer_oneshot(uint32_t ticks)
+{
+    lapic_write(LAPIC_TIMER_INIT, ticks);
+}
+
+void lapic_timer_free_run(void)
+{
+    lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_VECTOR_TIMER);
+    lapic_write(LAPIC_TIMER_INIT, UINT32_MAX);
+}
+
+void lapic_perfmon_nmi(bool enable)
+{
+    lapic_write(LAPIC_LVT_PERF, LVT_NMI | (enable ? 0 : LVT_MASKED));
+}
+
+uint32_t lapic_timer_stop(void)
+{
+    uint32_t ticks = UINT32_MAX - lapic_read(LAPIC_TIMER_CUR);
+
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    lapic_write(LAPIC_LVT_TIMER, deadline ? LVT_TSC_DEADLINE | LAPIC_VECTOR_TIMER
+                                          : LAPIC_VECTOR_TIMER);
+
+    return ticks;
+}
@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <vmm.h>
+#include <pat.h>
+
+#define MSR_MTRRCAP         0xFE
+#define MSR_MTRR_PHYSBASE0  0x200
+#define MSR_MTRR_PHYSMASK0  0x201
+#define MSR_PAT             0x277
+#define MSR_MTRR_DEF_TYPE   0x2FF
+
+#define MTRR_DEF_ENABLE     (1ull << 11)
+#define MTRR_MASK_VALID     (1ull << 11)
+#define MTRR_ADDR_MASK      0x000FFFFFFFFFF000ull
+
+
+/**
+ * index = pat:pcd:pwt. 0-3 are the reset values (wb, wt, uc-, uc) except
+ * that entry 1 becomes wc, so a plain pwt mapping is write-combining.
+ * 4-7 repeat wb and add the two types nothing else reaches.
+ */
+static const enum memtype pat_layout[8] =
+{
+    MEMTYPE_WB, MEMTYPE_WC, MEMTYPE_UC_MINUS, MEMTYPE_UC,
+    MEMTYPE_WB, MEMTYPE_WT, MEMTYPE_WP, MEMTYPE_UC,
+};
+
+static inline uint64_t index_bits(unsigned idx)
+{
+    return ((idx & 1) ? PTE_PWT : 0)
+         | ((idx & 2) ? PTE_PCD : 0)
+         | ((idx & 4) ? PTE_PAT : 0);
+}
+
+void pat_init(void)
+{
+    uint64_t pat = 0;
+
+    for (unsigned i = 0; i < 8; i++)
+        pat |= (uint64_t)pat_layout[i] << (i * 8);
+
+    // the sdm sequence, minus the cr0.cd dance: nothing uses wc yet
+    uint64_t flags = irq_save();
+    asm volatile ("wbinvd" ::: "memory");
+    wrmsr(MSR_PAT, pat);
+    asm volatile ("wbinvd" ::: "memory");
+    asm volatile ("mov %%cr3, %%rax; mov %%rax, %%cr3" ::: "rax", "memory");
+    irq_restore(flags);
+}
+
+uint64_t pat_pte_bits(enum memtype type)
+{
+    for (unsigned i = 0; i < 8; i++) {
+        if (pat_layout[i] == type)
+            return index_bits(i);
+    }
+
+    return index_bits(3);   // uc, the safe answer
+}
+
+enum memtype pat_memtype(uint64_t pte_flags)
+{
+    unsigned idx = ((pte_flags & PTE_PWT) ? 1 : 0)
+                 | ((pte_flags & PTE_PCD) ? 2 : 0)
+                 | ((pte_flags & PTE_PAT) ? 4 : 0);
+
+    return (enum memtype)((rdmsr(MSR_PAT) >> (idx * 8)) & 7);
+}
+
+/**
+ * variable range mtrrs only; the fixed ranges cover the first megabyte,
+ * nothing we care about here lives there.
+ */
+enum memtype mtrr_memtype(uint64_t phys)
+{
+    uint64_t def = rdmsr(MSR_MTRR_DEF_TYPE);
+
+    if (!(def & MTRR_DEF_ENABLE))
+        return MEMTYPE_UC;
+
+    unsigned count = rdmsr(MSR_MTRRCAP) & 0xFF;
+    int found = -1;
+
+    for (unsigned i = 0; i < count; i++) {
+        uint64_t mask = rdmsr(MSR_MTRR_PHYSMASK0 + 2 * i);
+        uint64_t base = rdmsr(MSR_MTRR_PHYSBASE0 + 2 * i);
+
+        if (!(mask & MTRR_MASK_VALID))
+            continue;
+        if ((phys & mask & MTRR_ADDR_MASK) != (base & mask & MTRR_ADDR_MASK))
+            continue;
+
+        int type = (int)(base & 0xFF);
+
+        // overlaps: uc wins, then wt over wb, anything else is undefined
+        if (found < 0 || type == MEMTYPE_UC
+         || (type == MEMTYPE_WT && found == MEMTYPE_WB))
+            found = type;
+    }
+
+    return found < 0 ? (enum memtype)(def & 0xFF) : (enum memtype)found;
+}
+
+enum memtype memtype_effective(enum memtype mtrr, enum memtype pat)
+{
+    switch (pat) {
+    case MEMTYPE_UC:
+    case MEMTYPE_WC:
+        return pat;
+    case MEMTYPE_UC_MINUS:
+        return mtrr == MEMTYPE_WC ? MEMTYPE_WC : MEMTYPE_UC;
+    case MEMTYPE_WT:
+    case MEMTYPE_WP:
+        if (mtrr == MEMTYPE_UC || mtrr == MEMTYPE_WC)
+            return MEMTYPE_UC;
+        return mtrr == MEMTYPE_WP ? MEMTYPE_WP : pat;
+    case MEMTYPE_WB:
+    default:
+        return mtrr;
+    }
+}
+
+const char *memtype_name(enum memtype type)
+{
+    switch (type) {
+    case MEMTYPE_UC:       return "UC";
+    case MEMTYPE_WC:       return "WC";
+    case MEMTYPE_WT:       return "WT";
+    case MEMTYPE_WP:       return "WP";
+    case MEMTYPE_WB:       return "WB";
+    case MEMTYPE_UC_MINUS: return "UC-";
+    }
+
+    return "??";
+}
@@ -0,0 +1,75 @@
+#include <stdint.h>
+#include <system.h>
+#include <io.h>
+#include <idt.h>
+#include <pic.h>
+
+#define PIC1_CMD    0x20
+#define PIC1_DATA   0x21
+#define PIC2_CMD    0xA0
+#define PIC2_DATA   0xA1
+
+#define PIC_EOI     0x20
+
+// irq 7 fires spuriously even while masked and wants no eoi
+static void pic_spurious(struct isr_frame *frame)
+{
+}
+
+void pic_init(void)
+{
+    // icw1: edge triggered, cascade, icw4 follows
+    outb(PIC1_CMD, 0x11);
+    io_wait();
+    outb(PIC2_CMD, 0x11);
+    io_wait();
+
+    // icw2: vector offsets
+    outb(PIC1_DATA, PIC_VECTOR_BASE);
+    io_wait();
+    outb(PIC2_DATA, PIC_VECTOR_BASE + 8);
+    io_wait();
+
+    // icw3: slave on irq 2
+    outb(PIC1_DATA, 0x04);
+    io_wait();
+    outb(PIC2_DATA, 0x02);
+    io_wait();
+
+    // icw4: 8086 mode
+    outb(PIC1_DATA, 0x01);
+    io_wait();
+    outb(PIC2_DATA, 0x01);
+    io_wait();
+
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+
+    isr_register(PIC_VECTOR_BASE + 7, pic_spurious);
+}
+
+void pic_unmask(uint8_t irq)
+{
+    if (irq >= 8) {
+        outb(PIC2_DATA, inb(PIC2_DATA) & ~(1 << (irq - 8)));
+        irq = 2;
+    }
+
+    outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << irq));
+}
+
+void pic_mask(uint8_t irq)
+{
+    if (irq >= 8)
+        outb(PIC2_DATA, inb(PIC2_DATA) | (1 << (irq - 8)));
+    else
+        outb(PIC1_DATA, inb(PIC1_DATA) | (1 << irq));
+}
+
+void pic_eoi(uint8_t irq)
+{
+    if (irq >= 8)
+        outb(PIC2_CMD, PIC_EOI);
+
+    outb(PIC1_CMD, PIC_EOI);
+}
@@ -0,0 +1,34 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <io.h>
+#include <pit.h>
+
+#define PIT_CH2     0x42
+#define PIT_CMD     0x43
+#define PIT_GATE    0x61
+
+#define GATE_CH2    0x01
+#define GATE_SPKR   0x02
+#define GATE_OUT2   0x20
+
+#define CMD_CH2_MODE0   0xB0    // channel 2, lobyte/hibyte, interrupt on terminal count
+
+void pit_oneshot_start(uint16_t count)
+{
+    uint8_t gate = inb(PIT_GATE) & ~(GATE_CH2 | GATE_SPKR);
+
+    outb(PIT_GATE, gate);
+    outb(PIT_CMD, CMD_CH2_MODE0);
+    outb(PIT_CH2, count & 0xFF);
+    outb(PIT_CH2, count >> 8);
+
+    // mode 0 counts while the gate is high and raises out2 at zero
+    outb(PIT_GATE, gate | GATE_CH2);
+}
+
+bool pit_oneshot_done(void)
+{
+    return inb(PIT_GATE) & GATE_OUT2;
+}
@@ -0,0 +1,451 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <cpuid.h>
+#include <percpu.h>
+#include <idt.h>
+#include <lapic.h>
+#include <sched.h>
+#include <klog.h>
+#include <pmu.h>
+
+#define MSR_PMC0            0x0C1
+#define MSR_PERFEVTSEL0     0x186
+#define MSR_FIXED_CTR0      0x309
+#define MSR_FIXED_CTR_CTRL  0x38D
+#define MSR_GLOBAL_STATUS   0x38E
+#define MSR_GLOBAL_CTRL     0x38F
+#define MSR_GLOBAL_OVF_CTRL 0x390
+
+#define EVTSEL_USR          (1ull << 16)
+#define EVTSEL_OS           (1ull << 17)
+#define EVTSEL_INT          (1ull << 20)
+#define EVTSEL_EN           (1ull << 22)
+
+#define FIXED_OS            0x1
+#define FIXED_USR           0x2
+
+#define MAX_GP              8
+#define MAX_FIXED           4
+#define FIXED_SLOT          32      // slot values from here on are fixed counters
+#define NO_SLOT             -1
+
+#define RDPMC_FIXED         (1u << 30)
+
+struct event_desc
+{
+    const char *name;
+    uint8_t event;
+    uint8_t umask;
+    int8_t fixed;       // fixed counter that counts it, or -1
+    int8_t arch_bit;    // cpuid 0xa ebx bit saying it is missing, or -1
+};
+
+static const struct event_desc events[PMU_EVENT_COUNT] = {
+    [PMU_CYCLES]        = { "cycles",        0x3C, 0x00,  1,  0 },
+    [PMU_INSTRUCTIONS]  = { "instructions",  0xC0, 0x00,  0,  1 },
+    [PMU_REF_CYCLES]    = { "ref-cycles",    0x3C, 0x01,  2,  2 },
+    [PMU_LLC_REFS]      = { "llc-refs",      0x2E, 0x4F, -1,  3 },
+    [PMU_LLC_MISSES]    = { "llc-misses",    0x2E, 0x41, -1,  4 },
+    [PMU_BRANCHES]      = { "branches",      0xC4, 0x00, -1,  5 },
+    [PMU_BRANCH_MISSES] = { "branch-misses", 0xC5, 0x00, -1,  6 },
+    [PMU_DTLB_WALKS]    = { "dtlb-walks",    0x08, 0x0E, -1, -1 },
+};
+
+struct pmu_cpu
+{
+    uint64_t last[PMU_EVENT_COUNT];     // raw counter at the last flush
+    struct pmu_counts total;
+    uint64_t samples;                   // overflow nmis taken
+    uint64_t spurious;                  // nmis the pmu did not raise
+} ALIGNED(64);
+
+static struct pmu_info info;
+static uint32_t missing;            // cpuid 0xa ebx
+static uint64_t gp_mask, fixed_mask;
+static uint32_t usable_gp;          // the last one is kept for overflow sampling
+
+// the configuration, the same on every cpu
+static int8_t slot[PMU_EVENT_COUNT];
+static uint64_t evtsel[MAX_GP];
+static uint64_t fixed_ctrl;
+static uint64_t global_ctrl;
+static uint64_t generation;
+static bool active;
+
+static pmu_overflow_fn overflow_fn;
+static uint32_t overflow_cpus;
+static uint64_t overflow_period;
+static uint64_t overflow_evtsel;
+
+static struct pmu_cpu pcpu[MAX_CPUS];
+
+static ALWAYS_INLINE uint64_t rdpmc(uint32_t idx)
+{
+    uint32_t lo, hi;
+    asm volatile ("rdpmc" : "=a"(lo), "=d"(hi) : "c"(idx));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t read_slot(int8_t s)
+{
+    return s >= FIXED_SLOT ? rdpmc(RDPMC_FIXED | (uint32_t)(s - FIXED_SLOT))
+                           : rdpmc((uint32_t)s);
+}
+
+static uint64_t slot_mask(int8_t s)
+{
+    return s >= FIXED_SLOT ? fixed_mask : gp_mask;
+}
+
+// fn(arg) here and on every ap, waiting out calls already pending there;
+// returns how many cpus ran it
+static uint32_t call_all(void (*fn)(void *arg), void *arg)
+{
+    uint32_t done = 1;
+
+    fn(arg);
+
+    for (uint32_t cpu = 1; cpu < cpu_count; cpu++) {
+        bool called;
+
+        while (!(called = smp_call(cpu, fn, arg)) && cpus[cpu].online)
+            smp_wait(cpu);
+
+        if (called) {
+            smp_wait(cpu);
+            done++;
+        }
+    }
+
+    return done;
+}
+
+void pmu_init(void)
+{
+    uint32_t a, b, c, d;
+
+    for (int e = 0; e < PMU_EVENT_COUNT; e++)
+        slot[e] = NO_SLOT;
+
+    if (cpu_features.max_leaf < 0xA)
+        return;
+
+    cpuid(0xA, 0, &a, &b, &c, &d);
+
+    // a hypervisor without a vpmu reports version 0 or no counters
+    if ((a & 0xFF) == 0 || ((a >> 8) & 0xFF) == 0)
+        return;
+
+    info.version = a & 0xFF;
+    info.gp_counters = (a >> 8) & 0xFF;
+    info.gp_width = (a >> 16) & 0xFF;
+    missing = b;
+
+    if (info.gp_counters > MAX_GP)
+        info.gp_counters = MAX_GP;
+
+    if (info.version >= 2) {
+        info.fixed_counters = d & 0x1F;
+        info.fixed_width = (d >> 5) & 0xFF;
+        if (info.fixed_counters > MAX_FIXED)
+            info.fixed_counters = MAX_FIXED;
+    }
+
+    gp_mask = info.gp_width >= 64 ? UINT64_MAX : (1ull << info.gp_width) - 1;
+    fixed_mask = info.fixed_width >= 64 ? UINT64_MAX : (1ull << info.fixed_width) - 1;
+
+    // overflow sampling wants the global status msr, version 2 and up
+    usable_gp = info.gp_counters;
+    if (info.version >= 2 && usable_gp > 1)
+        usable_gp--;
+}
+
+const struct pmu_info *pmu_info(void)
+{
+    return &info;
+}
+
+const char *pmu_event_name(enum pmu_event e)
+{
+    return e < PMU_EVENT_COUNT ? events[e].name : "?";
+}
+
+bool pmu_event_supported(enum pmu_event e)
+{
+    if (!info.version || e >= PMU_EVENT_COUNT)
+        return false;
+
+    // the walk event is model specific; version 4 came with skylake
+    if (events[e].arch_bit < 0)
+        return info.version >= 4;
+
+    return !(missing & (1u << events[e].arch_bit));
+}
+
+bool pmu_counting(enum pmu_event e)
+{
+    return e < PMU_EVENT_COUNT && slot[e] != NO_SLOT;
+}
+
+// program this cpu from the current configuration, counts start at 0
+static void apply_local(void *arg)
+{
+    if (!info.version)
+        return;
+
+    uint64_t flags = irq_save();
+    struct pmu_cpu *p = &pcpu[cpu_id()];
+    uint64_t sampling = 0;
+
+    // the overflow counter is not ours to touch here
+    if (info.version >= 2) {
+        if (usable_gp < info.gp_counters)
+            sampling = rdmsr(MSR_GLOBAL_CTRL) & (1ull << usable_gp);
+        wrmsr(MSR_GLOBAL_CTRL, 0);
+    }
+
+    for (uint32_t i = 0; i < usable_gp; i++) {
+        wrmsr(MSR_PERFEVTSEL0 + i, 0);
+        wrmsr(MSR_PMC0 + i, 0);
+        wrmsr(MSR_PERFEVTSEL0 + i, evtsel[i]);
+    }
+
+    if (info.fixed_counters) {
+        wrmsr(MSR_FIXED_CTR_CTRL, 0);
+        for (uint32_t i = 0; i < info.fixed_counters; i++)
+            wrmsr(MSR_FIXED_CTR0 + i, 0);
+        wrmsr(MSR_FIXED_CTR_CTRL, fixed_ctrl);
+    }
+
+    for (int e = 0; e < PMU_EVENT_COUNT; e++)
+        p->last[e] = 0;
+    p->total = (struct pmu_counts){ .generation = generation };
+
+    if (info.version >= 2)
+        wrmsr(MSR_GLOBAL_CTRL, global_ctrl | sampling);
+
+    irq_restore(flags);
+}
+
+void pmu_init_ap(void)
+{
+    apply_local(NULL);
+}
+
+unsigned pmu_configure(const enum pmu_event *list, unsigned n)
+{
+    unsigned counted = 0;
+    uint32_t next_gp = 0;
+
+    if (!info.version)
+        return 0;
+
+    int8_t new_slot[PMU_EVENT_COUNT];
+    for (int e = 0; e < PMU_EVENT_COUNT; e++)
+        new_slot[e] = NO_SLOT;
+
+    uint64_t new_evtsel[MAX_GP] = { 0 };
+    uint64_t new_fixed = 0, new_global = 0;
+
+    for (unsigned i = 0; i < n; i++) {
+        enum pmu_event e = list[i];
+
+        if (!pmu_event_supported(e) || new_slot[e] != NO_SLOT)
+            continue;
+
+        int8_t f = events[e].fixed;
+
+        if (f >= 0 && f < info.fixed_counters) {
+            new_slot[e] = (int8_t)(FIXED_SLOT + f);
+            new_fixed |= (uint64_t)(FIXED_OS | FIXED_USR) << (4 * f);
+            new_global |= 1ull << (32 + f);
+        } else if (next_gp < usable_gp) {
+            new_slot[e] = (int8_t)next_gp;
+            new_evtsel[next_gp] = events[e].event | ((uint64_t)events[e].umask << 8)
+                                | EVTSEL_OS | EVTSEL_USR | EVTSEL_EN;
+            new_global |= 1ull << next_gp;
+            next_gp++;
+        } else {
+            continue;
+        }
+
+        counted++;
+    }
+
+    uint64_t flags = irq_save();
+
+    for (int e = 0; e < PMU_EVENT_COUNT; e++)
+        slot[e] = new_slot[e];
+    for (uint32_t i = 0; i < MAX_GP; i++)
+        evtsel[i] = new_evtsel[i];
+    fixed_ctrl = new_fixed;
+    global_ctrl = new_global;
+    generation++;
+    active = counted > 0;
+
+    irq_restore(flags);
+
+    call_all(apply_local, NULL);
+
+    return counted;
+}
+
+// irqs off: move what the counters did since the last flush into the
+// cpu total and, if given, a thread's counts
+static void flush(struct pmu_counts *into)
+{
+    struct pmu_cpu *p = &pcpu[cpu_id()];
+
+    if (into && into->generation != generation)
+        *into = (struct pmu_counts){ .generation = generation };
+
+    for (int e = 0; e < PMU_EVENT_COUNT; e++) {
+        if (slot[e] == NO_SLOT)
+            continue;
+
+        uint64_t now = read_slot(slot[e]);
+        uint64_t delta = (now - p->last[e]) & slot_mask(slot[e]);
+
+        p->last[e] = now;
+        p->total.count[e] += delta;
+        if (into)
+            into->count[e] += delta;
+    }
+}
+
+void pmu_switch(struct pmu_counts *prev)
+{
+    if (active)
+        flush(prev);
+}
+
+void pmu_read_cpu(struct pmu_counts *out)
+{
+    uint64_t flags = irq_save();
+
+    if (active)
+        flush(&this_thread()->pmu);
+    *out = pcpu[cpu_id()].total;
+
+    irq_restore(flags);
+}
+
+void pmu_read_thread(struct thread *t, struct pmu_counts *out)
+{
+    uint64_t flags = irq_save();
+
+    if (active && t == this_thread())
+        flush(&t->pmu);
+
+    if (t->pmu.generation == generation)
+        *out = t->pmu;
+    else
+        *out = (struct pmu_counts){ .generation = generation };
+
+    irq_restore(flags);
+}
+
+/**
+ * overflow sampling. the counter starts at -period and raises the pmi
+ * when it wraps; the nmi handler takes the sample, reloads the counter
+ * and unmasks the lvt entry that delivery masked. a write to the pmc
+ * msr only takes 32 bits and sign extends them, hence the period limit.
+ */
+static uint32_t overflow_counter(void)
+{
+    return info.gp_counters - 1;
+}
+
+static void overflow_reload(void)
+{
+    wrmsr(MSR_PMC0 + overflow_counter(), (uint64_t)-(int64_t)overflow_period & gp_mask);
+}
+
+static void pmu_nmi(struct isr_frame *frame)
+{
+    struct pmu_cpu *p = &pcpu[cpu_id()];
+    uint64_t bit = 1ull << overflow_counter();
+    uint64_t status = rdmsr(MSR_GLOBAL_STATUS);
+
+    // a watchdog, the chipset, or a second pmi after this one was acked
+    if (!(status & bit)) {
+        p->spurious++;
+        return;
+    }
+
+    p->samples++;
+
+    if (overflow_fn)
+        overflow_fn(frame);
+
+    overflow_reload();
+    wrmsr(MSR_GLOBAL_OVF_CTRL, bit);
+    lapic_perfmon_nmi(true);
+}
+
+static void overflow_local(void *arg)
+{
+    bool on = arg != NULL;
+    uint32_t i = overflow_counter();
+    uint64_t flags = irq_save();
+
+    wrmsr(MSR_PERFEVTSEL0 + i, 0);
+    lapic_perfmon_nmi(false);
+
+    if (on) {
+        overflow_reload();
+        wrmsr(MSR_PERFEVTSEL0 + i, overflow_evtsel);
+        wrmsr(MSR_GLOBAL_CTRL, rdmsr(MSR_GLOBAL_CTRL) | (1ull << i));
+        lapic_perfmon_nmi(true);
+    } else {
+        wrmsr(MSR_GLOBAL_CTRL, rdmsr(MSR_GLOBAL_CTRL) & ~(1ull << i));
+        wrmsr(MSR_GLOBAL_OVF_CTRL, 1ull << i);
+    }
+
+    irq_restore(flags);
+}
+
+
+bool pmu_overflow_start(enum pmu_event e, uint64_t period, pmu_overflow_fn fn)
+{
+    if (info.version < 2 || usable_gp == info.gp_counters || !pmu_event_supported(e)
+     || period == 0 || period >= (1ull << 31))
+        return false;
+
+    overflow_fn = fn;
+    overflow_period = period;
+    overflow_evtsel = events[e].event | ((uint64_t)events[e].umask << 8)
+                    | EVTSEL_OS | EVTSEL_USR | EVTSEL_INT | EVTSEL_EN;
+
+    isr_register(VECTOR_NMI, pmu_nmi);
+
+    overflow_cpus = call_all(overflow_local, (void *)1);
+    if (overflow_cpus < cpu_count)
+        klog(LOG_WARN, "pmu: sampling on %u of %u cpus", overflow_cpus, cpu_count);
+
+    return true;
+}
+
+void pmu_overflow_stop(void)
+{
+    if (!overflow_fn)
+        return;
+
+    call_all(overflow_local, NULL);
+    isr_register(VECTOR_NMI, NULL);
+    overflow_fn = NULL;
+    overflow_cpus = 0;
+}
+
+void pmu_overflow_get_stats(struct pmu_overflow_stats *out)
+{
+    *out = (struct pmu_overflow_stats){ .cpus = overflow_cpus };
+
+    for (uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+        out->samples += __atomic_load_n(&pcpu[cpu].samples, __ATOMIC_RELAXED);
+        out->spurious += __atomic_load_n(&pcpu[cpu].spurious, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,272 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limine.h>
+
+#include <system.h>
+#include <cpuid.h>
+#include <gdt.h>
+#include <tss.h>
+#include <idt.h>
+#include <pat.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <sched.h>
+#include <timer.h>
+#include <lapic.h>
+#include <pmu.h>
+#include <syscall.h>
+#include <ktime.h>
+#include <klog.h>
+#include <percpu.h>
+
+#define IST_ORDER       2
+#define SMP_TIMEOUT_MS  1000    // for every ap together
+#define SLOTS_CLOSED    0x80000000u
+
+_Static_assert((PAGE_SIZE << IST_ORDER) == IST_STACK_SIZE, "ist stack order");
+
+struct cpu cpus[MAX_CPUS];
+uint32_t cpu_count = 1;
+
+static volatile uint32_t aps_online;
+static volatile bool stopping;
+static volatile uint32_t stopped;
+static volatile uint32_t next_slot = 1;     // SLOTS_CLOSED and up once smp_init gave up
+static uint32_t slots;                      // struct cpus set up for aps to claim
+
+// the bsp loads its tss long before the pmm is up
+static uint8_t bsp_ist[IST_COUNT][IST_STACK_SIZE] ALIGNED(16);
+
+static void set_gs(struct cpu *c)
+{
+    wrmsr(MSR_GS_BASE, (uint64_t)c);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+void percpu_init_bsp(void)
+{
+    struct cpu *c = &cpus[0];
+
+    c->self = c;
+    c->id = 0;
+    c->online = true;
+
+    for (unsigned i = 0; i < IST_COUNT; i++)
+        c->ist[i] = (uint64_t)(bsp_ist[i] + IST_STACK_SIZE);
+
+    set_gs(c);
+}
+
+// an idle ap runs queued threads and mailbox calls, and halts otherwise.
+// smp_call() sends an ipi, so a halted ap sees the mailbox right away.
+static NORETURN void ap_idle(struct cpu *c)
+{
+    for (;;) {
+        void (*fn)(void *) = __atomic_load_n(&c->call_fn, __ATOMIC_ACQUIRE);
+
+        if (!fn) {
+            sched_idle();
+            continue;
+        }
+
+        fn(c->call_arg);
+        __atomic_store_n(&c->call_fn, NULL, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * limine drops each ap here on its own stack, with interrupts off and
+ * the bootloader's gdt, idt and page tables. the idle loop only opens
+ * interrupts while halted; threads run with them on.
+ */
+static NORETURN void ap_entry(struct limine_mp_info *info)
+{
+    // ids go in order of arrival, so the ones that make it are dense
+    uint32_t id = __atomic_fetch_add(&next_slot, 1, __ATOMIC_ACQ_REL);
+
+    // too late, or one too many: stay out of the way for good
+    if (id >= slots) {
+        for (;;)
+            asm volatile ("cli; hlt");
+    }
+
+    struct cpu *c = &cpus[id];
+
+    c->lapic_id = info->lapic_id;
+    set_gs(c);
+
+    cpuid_init_ap();
+    gdt_init();
+    tss_init();
+    idt_reload();
+    syscall_init_ap();
+    pat_init();
+    vmm_init_ap();
+    pmu_init_ap();
+    timer_init_ap();
+    sched_init_ap();
+
+    __atomic_store_n(&c->online, true, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&aps_online, 1, __ATOMIC_RELEASE);
+
+    ap_idle(c);
+}
+
+static bool setup_cpu(struct cpu *c, uint32_t id)
+{
+    c->self = c;
+    c->id = id;
+
+    for (unsigned i = 0; i < IST_COUNT; i++) {
+        uint64_t phys = pmm_alloc_pages(IST_ORDER);
+        if (!phys)
+            return false;
+        c->ist[i] = (uint64_t)phys_to_virt(phys) + IST_STACK_SIZE;
+    }
+
+    return true;
+}
+
+static void free_cpu(struct cpu *c)
+{
+    for (unsigned i = 0; i < IST_COUNT; i++) {
+        if (c->ist[i])
+            pmm_free_pages(virt_to_phys((void *)(c->ist[i] - IST_STACK_SIZE)), IST_ORDER);
+        c->ist[i] = 0;
+    }
+}
+
+/**
+ * every ap starts at once and claims the next struct cpu when it gets
+ * to ap_entry(). one that has not arrived by the deadline is left
+ * behind: closing the slots makes it halt should it turn up later, and
+ * an ap that claimed one in time is running our code and will finish.
+ */
+void smp_init(struct limine_mp_response *mp)
+{
+    if (!mp) {
+        klog(LOG_WARN, "smp: no mp response, running on the bsp only");
+        return;
+    }
+
+    cpus[0].lapic_id = mp->bsp_lapic_id;
+
+    uint32_t n = 1;
+    uint64_t ignored = 0;
+
+    for (uint64_t i = 0; i < mp->cpu_count; i++) {
+        if (mp->cpus[i]->lapic_id == mp->bsp_lapic_id)
+            continue;
+
+        if (n == MAX_CPUS || !setup_cpu(&cpus[n], n)) {
+            if (n < MAX_CPUS)
+                free_cpu(&cpus[n]);
+            ignored++;
+            continue;
+        }
+
+        n++;
+    }
+
+    slots = n;
+
+    uint64_t start = rdtsc();
+    uint64_t deadline = start + ktime_ns_to_cycles(SMP_TIMEOUT_MS * 1000000ull);
+    uint32_t started = 0;
+
+    for (uint64_t i = 0; i < mp->cpu_count && started < n - 1; i++) {
+        struct limine_mp_info *info = mp->cpus[i];
+
+        if (info->lapic_id != mp->bsp_lapic_id) {
+            __atomic_store_n(&info->goto_address, ap_entry, __ATOMIC_RELEASE);
+            started++;
+        }
+    }
+
+    while (__atomic_load_n(&aps_online, __ATOMIC_ACQUIRE) < n - 1 && rdtsc() < deadline)
+        cpu_pause();
+
+    uint32_t claimed = __atomic_exchange_n(&next_slot, SLOTS_CLOSED, __ATOMIC_ACQ_REL);
+
+    if (claimed < n) {
+        klog(LOG_WARN, "smp: %u cpus did not start within %u ms", n - claimed, SMP_TIMEOUT_MS);
+
+        for (uint32_t i = claimed; i < n; i++)
+            free_cpu(&cpus[i]);
+        n = claimed;
+    }
+
+    while (__atomic_load_n(&aps_online, __ATOMIC_ACQUIRE) < n - 1)
+        cpu_pause();
+
+    cpu_count = n;
+
+    uint64_t ns = ktime_cycles_to_ns(rdtsc() - start);
+
+    kprintf("smp: %u cpus online in %lu us\n", n, ns / 1000);
+    if (ignored)
+        klog(LOG_WARN, "smp: %lu cpus left offline", ignored);
+}
+
+bool smp_call(uint32_t cpu, void (*fn)(void *arg), void *arg)
+{
+    if (cpu == 0 || cpu >= cpu_count)
+        return false;
+
+    struct cpu *c = &cpus[cpu];
+
+    if (!__atomic_load_n(&c->online, __ATOMIC_ACQUIRE)
+     || __atomic_load_n(&c->call_fn, __ATOMIC_ACQUIRE))
+        return false;
+
+    c->call_arg = arg;
+    __atomic_store_n(&c->call_fn, fn, __ATOMIC_RELEASE);
+    lapic_send_ipi(c->lapic_id, LAPIC_VECTOR_RESCHED);
+
+    return true;
+}
+
+void smp_wait(uint32_t cpu)
+{
+    if (cpu >= cpu_count)
+        return;
+
+    while (__atomic_load_n(&cpus[cpu].call_fn, __ATOMIC_ACQUIRE))
+        cpu_pause();
+}
+
+void smp_stop_others(void)
+{
+    uint32_t self = cpu_id();
+    uint32_t n = 0;
+
+    __atomic_store_n(&stopping, true, __ATOMIC_SEQ_CST);
+
+    for (uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+        if (cpu != self && __atomic_load_n(&cpus[cpu].online, __ATOMIC_ACQUIRE)) {
+            lapic_send_nmi(cpus[cpu].lapic_id);
+            n++;
+        }
+    }
+
+    // ktime may not be up yet; a cpu too wedged for an nmi is not waited on forever
+    for (uint64_t spins = 0; spins < 100000000; spins++) {
+        if (__atomic_load_n(&stopped, __ATOMIC_ACQUIRE) >= n)
+            break;
+        cpu_pause();
+    }
+}
+
+bool smp_stopping(void)
+{
+    return __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+}
+
+NORETURN void smp_stop_self(void)
+{
+    __atomic_store_n(&this_cpu()->online, false, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&stopped, 1, __ATOMIC_RELEASE);
+
+    halt();
+}
@@ -0,0 +1,99 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <gdt.h>
+#include <tss.h>
+#include <percpu.h>
+#include <sched.h>
+#include <syscall.h>
+
+#define MSR_EFER    0xC0000080
+#define MSR_STAR    0xC0000081
+#define MSR_LSTAR   0xC0000082
+#define MSR_FMASK   0xC0000084
+
+#define EFER_SCE    (1ull << 0)
+
+#define RFLAGS_TF   (1ull << 8)
+#define RFLAGS_DF   (1ull << 10)
+#define RFLAGS_NT   (1ull << 14)
+#define RFLAGS_AC   (1ull << 18)
+
+extern void syscall_entry(void);
+extern uint64_t user_enter(uint64_t rip, uint64_t rsp, uint64_t *rsp0, uint64_t arg);
+extern NORETURN void user_leave(uint64_t rsp0, uint64_t value);
+
+static syscall_fn syscall_table[SYSCALL_MAX];
+
+uint64_t syscall_dispatch(struct syscall_frame *f)
+{
+    syscall_fn fn = f->nr < SYSCALL_MAX ? syscall_table[f->nr] : NULL;
+
+    if (!fn)
+        return SYSCALL_ENOSYS;
+
+    return fn(f->rdi, f->rsi, f->rdx, f->r10, f->r8, f->r9);
+}
+
+static uint64_t sys_null(uint64_t a0, uint64_t a1, uint64_t a2,
+                         uint64_t a3, uint64_t a4, uint64_t a5)
+{
+    return 0;
+}
+
+static uint64_t sys_exit(uint64_t value, uint64_t a1, uint64_t a2,
+                         uint64_t a3, uint64_t a4, uint64_t a5)
+{
+    // rsp0 is still where user_enter left its frame
+    user_leave(this_thread()->rsp0, value);
+}
+
+bool syscall_register(uint32_t nr, syscall_fn fn)
+{
+    if (nr >= SYSCALL_MAX || syscall_table[nr])
+        return false;
+
+    syscall_table[nr] = fn;
+    return true;
+}
+
+void syscall_init(void)
+{
+    syscall_register(SYS_NULL, sys_null);
+    syscall_register(SYS_EXIT, sys_exit);
+
+    syscall_init_ap();
+}
+
+void syscall_init_ap(void)
+{
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+
+    // syscall: cs = STAR[47:32], ss = + 8. sysret: ss = STAR[63:48] + 8, cs = + 16
+    wrmsr(MSR_STAR, (uint64_t)((GDT_USER_DATA - 8) | 3) << 48
+                  | (uint64_t)GDT_KERNEL_CODE << 32);
+    wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+
+    // no interrupts until we are on the kernel stack
+    wrmsr(MSR_FMASK, RFLAGS_IF | RFLAGS_TF | RFLAGS_DF | RFLAGS_NT | RFLAGS_AC);
+}
+
+uint64_t user_run(uint64_t rip, uint64_t rsp, uint64_t arg)
+{
+    struct thread *t = this_thread();
+
+    if (!t->stack)
+        panic("syscall: user_run needs a thread with its own stack");
+
+    uint64_t value = user_enter(rip, rsp, &t->rsp0, arg);
+
+    // back to the top of the stack, the frame below it is gone
+    uint64_t flags = irq_save();
+    t->rsp0 = t->stack + THREAD_STACK_SIZE;
+    tss_set_rsp0(t->rsp0);
+    irq_restore(flags);
+
+    return value;
+}
@@ -1,88 +1,88 @@
 #include "system.h"
 #include "console.h"
+#include "kprintf.h"
+#include "klog.h"
+#include "serial.h"
+#include "spinlock.h"
+#include "percpu.h"
 #include <stdarg.h>
 
-void kputc(char c)
+#define KPRINTF_BUF 256
+#define PANIC_LOG_RECORDS 16
+
+static ksink_fn sinks[KSINK_MAX] = { console_write };
+static size_t sink_count = 1;
+static spinlock_t sink_lock = SPINLOCK_INIT;   // keeps lines from interleaving
+
+void ksink_register(ksink_fn sink)
 {
-    console_putc(c);
+    if (sink_count < KSINK_MAX)
+        sinks[sink_count++] = sink;
 }
 
-void kprint(const char *s) 
+void ksink_write(const char *s, size_t len)
 {
-    while (*s) console_putc(*s++);
+    uint64_t flags = spin_lock_irqsave(&sink_lock);
+
+    for (size_t i = 0; i < sink_count; i++)
+        sinks[i](s, len);
+
+    spin_unlock_irqrestore(&sink_lock, flags);
 }
 
-static void kprint_hex64(uint64_t n)
+// under the sink lock, the console has none of its own
+void ksink_tick(void)
 {
-    static const char *hex = "0123456789ABCDEF";
-    for (int i = 60; i >= 0; i -=4)
-        console_putc(hex[(n >> i) & 0xF]);
+    uint64_t flags = spin_lock_irqsave(&sink_lock);
+    console_tick();
+    spin_unlock_irqrestore(&sink_lock, flags);
 }
 
-void kprintf(const char *fmt, ...)
+void kputc(char c)
 {
-    va_list args;
-    va_start(args, fmt);
-
-    while (*fmt) {
-        if (*fmt == '%') {
-            fmt++;
-
-            switch (*fmt) {
-            case 'c':
-                console_putc((char)va_arg(args, int));
-                break;
-            case 's':
-                kprint(va_arg(args, const char*));
-                break;
-            case 'x':
-            case 'p':
-                kprint_hex64(va_arg(args, uint64_t));
-                break;
-            case '%':
-                console_putc('%');
-                break;
-            default:
-                console_putc('?');
-            }
-        } else {
-            console_putc(*fmt);
-        }
-
-        fmt++;
-    }
+    ksink_write(&c, 1);
+}
 
-    va_end(args);
+void kprint(const char *s) 
+{
+    ksink_write(s, strlen(s));
 }
 
-static const char *log_labels[] = 
+static void flush_to_sinks(struct fmt_out *o)
 {
-    "[DEBUG] ",
-    "[INFO]  ",
-    "[WARN]  ",
-    "[ERROR] ",
-    "[FATAL] "
-};
-
-void klog(log_level_t level, const char *fmt, ...) 
+    ksink_write(o->buf, o->len);
+    o->len = 0;
+}
+
+void kvprintf(const char *fmt, va_list ap)
 {
-    kprint(log_labels[level]);
+    char buf[KPRINTF_BUF];
+    struct fmt_out o = {
+        .buf = buf,
+        .cap = sizeof(buf),
+        .len = 0,
+        .total = 0,
+        .flush = flush_to_sinks,
+    };
+
+    kformat(&o, fmt, ap);
+
+    if (o.len)
+        flush_to_sinks(&o);
+}
 
+void kprintf(const char *fmt, ...)
+{
     va_list args;
     va_start(args, fmt);
-    kprintf(fmt, args); // same format rules
+    kvprintf(fmt, args);
     va_end(args);
-
-    kputc('\n');
-
-    if (level == LOG_FATAL)
-        panic("fatal error reached");
 }
 
 NORETURN void halt(void) 
 {
     for (;;) {
-        asm volatile ("hlt");
+        asm volatile ("cli; hlt");
     }
 }
 
@@ -100,19 +100,45 @@ static void dump_regs(void) {
 
     kprint("\nRegisters:\n");
     kprintf("RIP=%p\n", rip);
-    kprintf("RSP=%p  RBP=%p\n", rsp, rbp);
-    kprintf("CR0=%p  CR2=%p\n", cr0, cr2);
-    kprintf("CR3=%p  CR4=%p\n", cr3, cr4);
+    kprintf("RSP=%016lX  RBP=%016lX\n", rsp, rbp);
+    kprintf("CR0=%016lX  CR2=%016lX\n", cr0, cr2);
+    kprintf("CR3=%016lX  CR4=%016lX\n", cr3, cr4);
+    kprintf("PML4=%016lX  PCID=%lu\n", cr3 & ~0xFFFul & ~(1ul << 63), cr3 & 0xFFF);
 }
 
 NORETURN void panic(const char *msg) 
 {
+    static volatile uint32_t panicking;     // cpu id + 1
+    uint32_t self = cpu_id() + 1;
+    uint32_t first = 0;
+
+    irq_disable();
+
+    // one cpu reports, a second to panic waits for its nmi; one panicking
+    // again from its own report carries on
+    if (!__atomic_compare_exchange_n(&panicking, &first, self, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+     && first != self)
+        halt();
+
+    // before anything is forced: nobody else may take a lock or write from now on
+    smp_stop_others();
+
+    // nothing after this point may sit in a deferred console queue
+    console_set_mode(CONSOLE_SYNC);
+    serial_panic();
+    klog_set_sync(true);
+    __atomic_store_n(&sink_lock.locked, 0, __ATOMIC_RELEASE);  // we may have died holding it
+
     kprint("!!! STOP ERROR !!!\n");
     kprint(msg);
     kprint("\n");
 
     dump_regs();
 
+    kprint("\n");
+    klog_dump(PANIC_LOG_RECORDS);
+
     kprint("\nSystem execution halted\n");
     halt();
 }
\ No newline at end of file
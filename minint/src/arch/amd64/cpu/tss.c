@@ -3,28 +3,29 @@
 
 #include <system.h>
 #include <tss.h>
-
-struct tss64 g_tss;
+#include <percpu.h>
 
 void tss_init(void) 
 {
-    for (size_t i = 0; i < sizeof(g_tss); i++)
+    struct cpu *cpu = this_cpu();
+    struct tss64 *tss = &cpu->tss;
+
+    for (size_t i = 0; i < sizeof(*tss); i++)
     {
-        ((uint8_t *)&g_tss)[i] = 0;
+        ((uint8_t *)tss)[i] = 0;
     }
 
-    g_tss.iomap_base = sizeof(struct tss64);
+    tss->iomap_base = sizeof(struct tss64);
+    tss->ist1 = cpu->ist[IST_DOUBLE_FAULT - 1];
+    tss->ist2 = cpu->ist[IST_NMI - 1];
+    tss->ist3 = cpu->ist[IST_MACHINE_CHECK - 1];
 }
 
 void tss_set_rsp0(uint64_t rsp) 
 {
-    g_tss.rsp0 = rsp;
-}
+    struct cpu *cpu = this_cpu();
 
-static uint8_t bootstrap_stack[4096] ALIGNED(16);
-
-uint64_t bootstrap_stack_top(void)
-{
-    return (uint64_t)(bootstrap_stack + sizeof(bootstrap_stack));
+    // interrupts from ring 3 find it in the tss, syscall has to look itself
+    cpu->tss.rsp0 = rsp;
+    cpu->kernel_rsp = rsp;
 }
-
@@ -0,0 +1,55 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cpuid.h>
+#include <klib.h>
+
+size_t klib_nt_threshold = KLIB_NT_THRESHOLD_DEFAULT;
+
+static const char *klib_variant = "rep";
+
+void klib_init(void)
+{
+    if (cpu_features.llc_size) {
+        // stream once a copy would push out half the last level cache
+        klib_nt_threshold = cpu_features.llc_size / 2;
+        if (klib_nt_threshold < 256 * 1024)
+            klib_nt_threshold = 256 * 1024;
+    }
+
+    if (cpu_features.avx2) {
+        memcpy_impl  = memcpy_avx2;
+        memcpy_large = memcpy_avx2_nt;
+        memset_impl  = memset_avx2;
+        memset_large = memset_avx2_nt;
+        memmove_fwd  = memmove_avx2_fwd;
+        memmove_bwd  = memmove_avx2_bwd;
+        klib_variant = "avx2";
+    } else {
+        memcpy_impl  = memcpy_sse2;
+        memcpy_large = memcpy_sse2_nt;
+        memset_impl  = memset_sse2;
+        memset_large = memset_sse2_nt;
+        memmove_fwd  = memmove_sse2_fwd;
+        memmove_bwd  = memmove_sse2_bwd;
+        klib_variant = "sse2";
+    }
+
+    memcmp_impl = cpu_features.avx2 ? memcmp_avx2 : memcmp_sse2;
+    memchr_impl = cpu_features.avx2 ? memchr_avx2 : memchr_sse2;
+    strlen_impl = cpu_features.avx2 ? strlen_avx2 : strlen_sse2;
+    if (cpu_features.sse42)
+        strcmp_impl = strcmp_sse42;
+
+    // fast strings beat the unrolled loops below the streaming threshold
+    if (cpu_features.erms || cpu_features.fsrm) {
+        memcpy_impl  = memcpy_rep;
+        memset_impl  = memset_rep;
+        klib_variant = cpu_features.avx2 ? "erms+avx2" : "erms+sse2";
+    }
+}
+
+const char *klib_describe(void)
+{
+    return klib_variant;
+}
@@ -1,16 +1,106 @@
 #include <stddef.h>
 #include <stdint.h>
+#include <immintrin.h>
 
-int memcmp(const void *s1, const void *s2, size_t n) 
-{
-    const uint8_t *p1 = (const uint8_t *)s1;
-    const uint8_t *p2 = (const uint8_t *)s2;
+#include <klib.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
 
+memcmp_fn memcmp_impl = memcmp_word;
+
+static inline int cmp_bytes(const uint8_t *p1, const uint8_t *p2, size_t n)
+{
     for (size_t i = 0; i < n; i++) {
-        if (p1[i] != p2[i]) {
+        if (p1[i] != p2[i])
             return p1[i] < p2[i] ? -1 : 1;
-        }
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * eight bytes per step. on a mismatch the words are byte swapped so an
+ * integer compare orders them like the bytes in memory would.
+ */
+int memcmp_word(const void *s1, const void *s2, size_t n)
+{
+    const uint8_t *p1 = s1;
+    const uint8_t *p2 = s2;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t a = *(const klib_u64 *)(p1 + i);
+        uint64_t b = *(const klib_u64 *)(p2 + i);
+
+        if (a != b) {
+            a = __builtin_bswap64(a);
+            b = __builtin_bswap64(b);
+            return a < b ? -1 : 1;
+        }
+    }
+
+    return cmp_bytes(p1 + i, p2 + i, n - i);
+}
+
+SSE2 int memcmp_sse2(const void *s1, const void *s2, size_t n)
+{
+    const uint8_t *p1 = s1;
+    const uint8_t *p2 = s2;
+
+    if (n < 16)
+        return memcmp_word(s1, s2, n);
+
+    size_t i = 0;
+    for (;;) {
+        // the last block overlaps the previous one instead of going scalar
+        if (i + 16 > n)
+            i = n - 16;
+
+        __m128i a = _mm_loadu_si128((const __m128i *)(p1 + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p2 + i));
+        uint32_t ne = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF;
+
+        if (ne) {
+            size_t k = i + (size_t)__builtin_ctz(ne);
+            return (int)p1[k] - (int)p2[k];
+        }
+
+        i += 16;
+        if (i >= n)
+            return 0;
+    }
+}
+
+AVX2 int memcmp_avx2(const void *s1, const void *s2, size_t n)
+{
+    const uint8_t *p1 = s1;
+    const uint8_t *p2 = s2;
+
+    if (n < 32)
+        return memcmp_sse2(s1, s2, n);
+
+    size_t i = 0;
+    for (;;) {
+        if (i + 32 > n)
+            i = n - 32;
+
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p1 + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p2 + i));
+        uint32_t ne = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+
+        if (ne) {
+            size_t k = i + (size_t)__builtin_ctz(ne);
+            return (int)p1[k] - (int)p2[k];
+        }
+
+        i += 32;
+        if (i >= n)
+            return 0;
+    }
+}
+
+int memcmp(const void *s1, const void *s2, size_t n)
+{
+    return memcmp_impl(s1, s2, n);
+}
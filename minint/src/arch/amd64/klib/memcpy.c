@@ -1,14 +1,189 @@
 #include <stddef.h>
 #include <stdint.h>
+#include <immintrin.h>
 
-void *memcpy(void *restrict dest, const void *restrict src, size_t n) 
+#include <klib.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+memcpy_fn memcpy_impl  = memcpy_rep;
+memcpy_fn memcpy_large = memcpy_rep;
+
+void *memcpy_rep(void *restrict dest, const void *restrict src, size_t n)
+{
+    void *d = dest;
+
+    asm volatile ("rep movsb"
+                  : "+D"(d), "+S"(src), "+c"(n)
+                  :
+                  : "memory");
+
+    return dest;
+}
+
+/**
+ * head and tail are loaded up front and stored last, the loop in between
+ * runs on an aligned destination. memmove.c has the same loops without
+ * restrict for the overlapping forward case.
+ */
+SSE2 void *memcpy_sse2(void *restrict dest, const void *restrict src, size_t n)
+{
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (n <= 16) {
+        klib_copy_small(d, s, n);
+        return dest;
+    }
+
+    __m128i head = _mm_loadu_si128((const __m128i *)s);
+    __m128i tail = _mm_loadu_si128((const __m128i *)(s + n - 16));
+
+    size_t i = (16 - ((uintptr_t)d & 15)) & 15;
+
+    for (; i + 64 <= n; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + i + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + i + 48));
+        _mm_store_si128((__m128i *)(d + i), a);
+        _mm_store_si128((__m128i *)(d + i + 16), b);
+        _mm_store_si128((__m128i *)(d + i + 32), c);
+        _mm_store_si128((__m128i *)(d + i + 48), e);
+    }
+
+    for (; i + 16 <= n; i += 16)
+        _mm_store_si128((__m128i *)(d + i),
+                        _mm_loadu_si128((const __m128i *)(s + i)));
+
+    _mm_storeu_si128((__m128i *)d, head);
+    _mm_storeu_si128((__m128i *)(d + n - 16), tail);
+
+    return dest;
+}
+
+AVX2 void *memcpy_avx2(void *restrict dest, const void *restrict src, size_t n)
+{
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (n <= 32)
+        return memcpy_sse2(dest, src, n);
+
+    __m256i head = _mm256_loadu_si256((const __m256i *)s);
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+
+    size_t i = (32 - ((uintptr_t)d & 31)) & 31;
+
+    for (; i + 128 <= n; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(s + i + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i *)(s + i + 96));
+        _mm256_store_si256((__m256i *)(d + i), a);
+        _mm256_store_si256((__m256i *)(d + i + 32), b);
+        _mm256_store_si256((__m256i *)(d + i + 64), c);
+        _mm256_store_si256((__m256i *)(d + i + 96), e);
+    }
+
+    for (; i + 32 <= n; i += 32)
+        _mm256_store_si256((__m256i *)(d + i),
+                           _mm256_loadu_si256((const __m256i *)(s + i)));
+
+    _mm256_storeu_si256((__m256i *)d, head);
+    _mm256_storeu_si256((__m256i *)(d + n - 32), tail);
+
+    return dest;
+}
+
+/**
+ * streaming variants, only reached for copies above klib_nt_threshold.
+ * the sfence orders the weakly-ordered stores before we return.
+ */
+SSE2 void *memcpy_sse2_nt(void *restrict dest, const void *restrict src, size_t n)
 {
-    uint8_t *restrict pdest = (uint8_t *restrict)dest;
-    const uint8_t *restrict psrc = (const uint8_t *restrict)src;
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (n < 128)
+        return memcpy_sse2(dest, src, n);
+
+    __m128i head = _mm_loadu_si128((const __m128i *)s);
+    __m128i tail = _mm_loadu_si128((const __m128i *)(s + n - 16));
+
+    size_t i = (16 - ((uintptr_t)d & 15)) & 15;
 
-    for (size_t i = 0; i < n; i++) {
-        pdest[i] = psrc[i];
+    for (; i + 64 <= n; i += 64) {
+        _mm_prefetch((const char *)(s + i + 512), _MM_HINT_NTA);
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + i + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + i + 48));
+        _mm_stream_si128((__m128i *)(d + i), a);
+        _mm_stream_si128((__m128i *)(d + i + 16), b);
+        _mm_stream_si128((__m128i *)(d + i + 32), c);
+        _mm_stream_si128((__m128i *)(d + i + 48), e);
     }
 
+    for (; i + 16 <= n; i += 16)
+        _mm_stream_si128((__m128i *)(d + i),
+                         _mm_loadu_si128((const __m128i *)(s + i)));
+
+    _mm_sfence();
+
+    _mm_storeu_si128((__m128i *)d, head);
+    _mm_storeu_si128((__m128i *)(d + n - 16), tail);
+
     return dest;
-}
\ No newline at end of file
+}
+
+AVX2 void *memcpy_avx2_nt(void *restrict dest, const void *restrict src, size_t n)
+{
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (n < 256)
+        return memcpy_avx2(dest, src, n);
+
+    __m256i head = _mm256_loadu_si256((const __m256i *)s);
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+
+    size_t i = (32 - ((uintptr_t)d & 31)) & 31;
+
+    for (; i + 128 <= n; i += 128) {
+        _mm_prefetch((const char *)(s + i + 1024), _MM_HINT_NTA);
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(s + i + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i *)(s + i + 96));
+        _mm256_stream_si256((__m256i *)(d + i), a);
+        _mm256_stream_si256((__m256i *)(d + i + 32), b);
+        _mm256_stream_si256((__m256i *)(d + i + 64), c);
+        _mm256_stream_si256((__m256i *)(d + i + 96), e);
+    }
+
+    for (; i + 32 <= n; i += 32)
+        _mm256_stream_si256((__m256i *)(d + i),
+                            _mm256_loadu_si256((const __m256i *)(s + i)));
+
+    _mm_sfence();
+
+    _mm256_storeu_si256((__m256i *)d, head);
+    _mm256_storeu_si256((__m256i *)(d + n - 32), tail);
+
+    return dest;
+}
+
+void *memcpy(void *restrict dest, const void *restrict src, size_t n)
+{
+    if (n <= 16) {
+        klib_copy_small(dest, src, n);
+        return dest;
+    }
+
+    if (n >= klib_nt_threshold)
+        return memcpy_large(dest, src, n);
+
+    return memcpy_impl(dest, src, n);
+}
@@ -1,20 +1,211 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <immintrin.h>
 
-void *memmove(void *dest, const void *src, size_t n) 
+#include <klib.h>
+#include <memstring.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+memmove_fn memmove_fwd = memmove_rep_fwd;
+memmove_fn memmove_bwd = memmove_rep_bwd;
+
+void *memmove_rep_fwd(void *dest, const void *src, size_t n)
+{
+    void *d = dest;
+
+    asm volatile ("rep movsb"
+                  : "+D"(d), "+S"(src), "+c"(n)
+                  :
+                  : "memory");
+
+    return dest;
+}
+
+void *memmove_rep_bwd(void *dest, const void *src, size_t n)
+{
+    void *d = (uint8_t *)dest + n - 1;
+    const void *s = (const uint8_t *)src + n - 1;
+
+    asm volatile ("std\n\t"
+                  "rep movsb\n\t"
+                  "cld"
+                  : "+D"(d), "+S"(s), "+c"(n)
+                  :
+                  : "memory");
+
+    return dest;
+}
+
+/**
+ * memcpy_sse2 and memcpy_avx2 without restrict, which would let the
+ * compiler move the head and tail loads past the loop's stores. with
+ * dest below src each block is loaded before the stores reach it.
+ */
+SSE2 void *memmove_sse2_fwd(void *dest, const void *src, size_t n)
+{
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (n <= 16) {
+        klib_copy_small(d, s, n);
+        return dest;
+    }
+
+    __m128i head = _mm_loadu_si128((const __m128i *)s);
+    __m128i tail = _mm_loadu_si128((const __m128i *)(s + n - 16));
+
+    size_t i = (16 - ((uintptr_t)d & 15)) & 15;
+
+    for (; i + 64 <= n; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + i + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + i + 48));
+        _mm_store_si128((__m128i *)(d + i), a);
+        _mm_store_si128((__m128i *)(d + i + 16), b);
+        _mm_store_si128((__m128i *)(d + i + 32), c);
+        _mm_store_si128((__m128i *)(d + i + 48), e);
+    }
+
+    for (; i + 16 <= n; i += 16)
+        _mm_store_si128((__m128i *)(d + i),
+                        _mm_loadu_si128((const __m128i *)(s + i)));
+
+    _mm_storeu_si128((__m128i *)d, head);
+    _mm_storeu_si128((__m128i *)(d + n - 16), tail);
+
+    return dest;
+}
+
+AVX2 void *memmove_avx2_fwd(void *dest, const void *src, size_t n)
 {
-    uint8_t *pdest = (uint8_t *)dest;
-    const uint8_t *psrc = (const uint8_t *)src;
-
-    if (src > dest) {
-        for (size_t i = 0; i < n; i++) {
-            pdest[i] = psrc[i];
-        }
-    } else if (src < dest) {
-        for (size_t i = n; i > 0; i--) {
-            pdest[i-1] = psrc[i-1];
-        }
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (n <= 32)
+        return memmove_sse2_fwd(dest, src, n);
+
+    __m256i head = _mm256_loadu_si256((const __m256i *)s);
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+
+    size_t i = (32 - ((uintptr_t)d & 31)) & 31;
+
+    for (; i + 128 <= n; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(s + i + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i *)(s + i + 96));
+        _mm256_store_si256((__m256i *)(d + i), a);
+        _mm256_store_si256((__m256i *)(d + i + 32), b);
+        _mm256_store_si256((__m256i *)(d + i + 64), c);
+        _mm256_store_si256((__m256i *)(d + i + 96), e);
     }
 
+    for (; i + 32 <= n; i += 32)
+        _mm256_store_si256((__m256i *)(d + i),
+                           _mm256_loadu_si256((const __m256i *)(s + i)));
+
+    _mm256_storeu_si256((__m256i *)d, head);
+    _mm256_storeu_si256((__m256i *)(d + n - 32), tail);
+
+    return dest;
+}
+
+/**
+ * mirror image of memcpy_sse2: the loop walks down from an aligned end,
+ * so each block is loaded before anything below it gets overwritten.
+ */
+SSE2 void *memmove_sse2_bwd(void *dest, const void *src, size_t n)
+{
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (n <= 16) {
+        klib_copy_small(d, s, n);
+        return dest;
+    }
+
+    __m128i head = _mm_loadu_si128((const __m128i *)s);
+    __m128i tail = _mm_loadu_si128((const __m128i *)(s + n - 16));
+
+    size_t i = n - ((uintptr_t)(d + n) & 15);
+
+    for (; i >= 64; i -= 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i - 16));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i - 32));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + i - 48));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + i - 64));
+        _mm_store_si128((__m128i *)(d + i - 16), a);
+        _mm_store_si128((__m128i *)(d + i - 32), b);
+        _mm_store_si128((__m128i *)(d + i - 48), c);
+        _mm_store_si128((__m128i *)(d + i - 64), e);
+    }
+
+    for (; i >= 16; i -= 16)
+        _mm_store_si128((__m128i *)(d + i - 16),
+                        _mm_loadu_si128((const __m128i *)(s + i - 16)));
+
+    _mm_storeu_si128((__m128i *)(d + n - 16), tail);
+    _mm_storeu_si128((__m128i *)d, head);
+
+    return dest;
+}
+
+AVX2 void *memmove_avx2_bwd(void *dest, const void *src, size_t n)
+{
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (n <= 32)
+        return memmove_sse2_bwd(dest, src, n);
+
+    __m256i head = _mm256_loadu_si256((const __m256i *)s);
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+
+    size_t i = n - ((uintptr_t)(d + n) & 31);
+
+    for (; i >= 128; i -= 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i - 32));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i - 64));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(s + i - 96));
+        __m256i e = _mm256_loadu_si256((const __m256i *)(s + i - 128));
+        _mm256_store_si256((__m256i *)(d + i - 32), a);
+        _mm256_store_si256((__m256i *)(d + i - 64), b);
+        _mm256_store_si256((__m256i *)(d + i - 96), c);
+        _mm256_store_si256((__m256i *)(d + i - 128), e);
+    }
+
+    for (; i >= 32; i -= 32)
+        _mm256_store_si256((__m256i *)(d + i - 32),
+                           _mm256_loadu_si256((const __m256i *)(s + i - 32)));
+
+    _mm256_storeu_si256((__m256i *)(d + n - 32), tail);
+    _mm256_storeu_si256((__m256i *)d, head);
+
+    return dest;
+}
+
+void *memmove(void *dest, const void *src, size_t n)
+{
+    uintptr_t d = (uintptr_t)dest;
+    uintptr_t s = (uintptr_t)src;
+
+    if (n <= 16) {
+        klib_copy_small(dest, src, n);
+        return dest;
+    }
+
+    // disjoint ranges can take every memcpy path, streaming included
+    if (d - s >= n && s - d >= n)
+        return memcpy(dest, src, n);
+
+    if (d < s)
+        return memmove_fwd(dest, src, n);
+
+    if (d > s)
+        return memmove_bwd(dest, src, n);
+
     return dest;
-}
\ No newline at end of file
+}
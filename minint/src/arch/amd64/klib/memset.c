@@ -1,13 +1,150 @@
 #include <stddef.h>
 #include <stdint.h>
+#include <immintrin.h>
 
-void *memset(void *s, int c, size_t n) 
+#include <klib.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+memset_fn memset_impl  = memset_rep;
+memset_fn memset_large = memset_rep;
+
+void *memset_rep(void *s, int c, size_t n)
+{
+    void *d = s;
+
+    asm volatile ("rep stosb"
+                  : "+D"(d), "+c"(n)
+                  : "a"(c)
+                  : "memory");
+
+    return s;
+}
+
+SSE2 void *memset_sse2(void *s, int c, size_t n)
+{
+    uint8_t *p = s;
+
+    if (n <= 16) {
+        klib_set_small(p, (uint8_t)c, n);
+        return s;
+    }
+
+    __m128i v = _mm_set1_epi8((char)c);
+
+    _mm_storeu_si128((__m128i *)p, v);
+    _mm_storeu_si128((__m128i *)(p + n - 16), v);
+
+    size_t i = (16 - ((uintptr_t)p & 15)) & 15;
+
+    for (; i + 64 <= n; i += 64) {
+        _mm_store_si128((__m128i *)(p + i), v);
+        _mm_store_si128((__m128i *)(p + i + 16), v);
+        _mm_store_si128((__m128i *)(p + i + 32), v);
+        _mm_store_si128((__m128i *)(p + i + 48), v);
+    }
+
+    for (; i + 16 <= n; i += 16)
+        _mm_store_si128((__m128i *)(p + i), v);
+
+    return s;
+}
+
+AVX2 void *memset_avx2(void *s, int c, size_t n)
+{
+    uint8_t *p = s;
+
+    if (n <= 32)
+        return memset_sse2(s, c, n);
+
+    __m256i v = _mm256_set1_epi8((char)c);
+
+    _mm256_storeu_si256((__m256i *)p, v);
+    _mm256_storeu_si256((__m256i *)(p + n - 32), v);
+
+    size_t i = (32 - ((uintptr_t)p & 31)) & 31;
+
+    for (; i + 128 <= n; i += 128) {
+        _mm256_store_si256((__m256i *)(p + i), v);
+        _mm256_store_si256((__m256i *)(p + i + 32), v);
+        _mm256_store_si256((__m256i *)(p + i + 64), v);
+        _mm256_store_si256((__m256i *)(p + i + 96), v);
+    }
+
+    for (; i + 32 <= n; i += 32)
+        _mm256_store_si256((__m256i *)(p + i), v);
+
+    return s;
+}
+
+SSE2 void *memset_sse2_nt(void *s, int c, size_t n)
 {
-    uint8_t *p = (uint8_t *)s;
+    uint8_t *p = s;
+
+    if (n < 128)
+        return memset_sse2(s, c, n);
+
+    __m128i v = _mm_set1_epi8((char)c);
+
+    _mm_storeu_si128((__m128i *)p, v);
+    _mm_storeu_si128((__m128i *)(p + n - 16), v);
 
-    for (size_t i = 0; i < n; i++) {
-        p[i] = (uint8_t)c;
+    size_t i = (16 - ((uintptr_t)p & 15)) & 15;
+
+    for (; i + 64 <= n; i += 64) {
+        _mm_stream_si128((__m128i *)(p + i), v);
+        _mm_stream_si128((__m128i *)(p + i + 16), v);
+        _mm_stream_si128((__m128i *)(p + i + 32), v);
+        _mm_stream_si128((__m128i *)(p + i + 48), v);
     }
 
+    for (; i + 16 <= n; i += 16)
+        _mm_stream_si128((__m128i *)(p + i), v);
+
+    _mm_sfence();
+
     return s;
-}
\ No newline at end of file
+}
+
+AVX2 void *memset_avx2_nt(void *s, int c, size_t n)
+{
+    uint8_t *p = s;
+
+    if (n < 256)
+        return memset_avx2(s, c, n);
+
+    __m256i v = _mm256_set1_epi8((char)c);
+
+    _mm256_storeu_si256((__m256i *)p, v);
+    _mm256_storeu_si256((__m256i *)(p + n - 32), v);
+
+    size_t i = (32 - ((uintptr_t)p & 31)) & 31;
+
+    for (; i + 128 <= n; i += 128) {
+        _mm256_stream_si256((__m256i *)(p + i), v);
+        _mm256_stream_si256((__m256i *)(p + i + 32), v);
+        _mm256_stream_si256((__m256i *)(p + i + 64), v);
+        _mm256_stream_si256((__m256i *)(p + i + 96), v);
+    }
+
+    for (; i + 32 <= n; i += 32)
+        _mm256_stream_si256((__m256i *)(p + i), v);
+
+    _mm_sfence();
+
+    return s;
+}
+
+void *memset(void *s, int c, size_t n)
+{
+    if (n <= 16) {
+        klib_set_small(s, (uint8_t)c, n);
+        return s;
+    }
+
+    if (n >= klib_nt_threshold)
+        return memset_large(s, c, n);
+
+    return memset_impl(s, c, n);
+}
@@ -0,0 +1,534 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#include <system.h>
+#include <kprintf.h>
+
+/**
+ * printf core shared by kvsnprintf and the kprintf family.
+ *
+ * supported: %c %s %d %i %u %x %X %o %p %%, flags - 0 + space #,
+ * field width and precision (both may be *), and the hh h l ll z t
+ * length modifiers. %p prints the pointer as 16 hex digits.
+ */
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// exact n / 100 for every 64 bit n, as a multiply-high by the reciprocal
+static inline uint64_t div100(uint64_t n)
+{
+    return (uint64_t)(((unsigned __int128)(n >> 2) * 0x28F5C28F5C28F5C3ull) >> 64) >> 2;
+}
+
+/**
+ * write v backwards ending at end, return the first digit. decimal goes
+ * two digits per step through the pair table, with no divide at all.
+ */
+static char *format_u64(char *end, uint64_t v, unsigned base, bool upper)
+{
+    const char *hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char *p = end;
+
+    if (base == 10) {
+        while (v >= 100) {
+            uint64_t q = div100(v);
+            uint32_t r = (uint32_t)(v - q * 100);
+            p -= 2;
+            p[0] = digit_pairs[r * 2];
+            p[1] = digit_pairs[r * 2 + 1];
+            v = q;
+        }
+        if (v >= 10) {
+            p -= 2;
+            p[0] = digit_pairs[v * 2];
+            p[1] = digit_pairs[v * 2 + 1];
+        } else {
+            *--p = (char)('0' + v);
+        }
+        return p;
+    }
+
+    unsigned shift = base == 16 ? 4 : 3;
+    do {
+        *--p = hex[v & (base - 1)];
+        v >>= shift;
+    } while (v);
+
+    return p;
+}
+
+static inline void out_char(struct fmt_out *o, char c)
+{
+    o->total++;
+
+    if (o->len < o->cap)
+        o->buf[o->len++] = c;
+
+    if (o->flush && (o->len == o->cap || c == '\n'))
+        o->flush(o);
+}
+
+static void out_mem(struct fmt_out *o, const char *s, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out_char(o, s[i]);
+}
+
+static void out_pad(struct fmt_out *o, char c, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out_char(o, c);
+}
+
+enum
+{
+    FL_LEFT  = 1 << 0,
+    FL_ZERO  = 1 << 1,
+    FL_PLUS  = 1 << 2,
+    FL_SPACE = 1 << 3,
+    FL_ALT   = 1 << 4,
+};
+
+static void out_number(struct fmt_out *o, uint64_t v, bool negative,
+                       unsigned base, bool upper, unsigned flags,
+                       int width, int precision)
+{
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *digits;
+    size_t ndigits;
+    char prefix[2];
+    size_t nprefix = 0;
+
+    if (precision == 0 && v == 0) {
+        digits = end;
+    } else {
+        digits = format_u64(end, v, base, upper);
+    }
+    ndigits = (size_t)(end - digits);
+
+    if (negative)
+        prefix[nprefix++] = '-';
+    else if (flags & FL_PLUS)
+        prefix[nprefix++] = '+';
+    else if (flags & FL_SPACE)
+        prefix[nprefix++] = ' ';
+
+    if ((flags & FL_ALT) && v != 0) {
+        if (base == 16) {
+            prefix[0] = '0';
+            prefix[1] = upper ? 'X' : 'x';
+            nprefix = 2;
+        } else if (base == 8 && (precision < 0 || (size_t)precision <= ndigits)) {
+            precision = (int)ndigits + 1;
+        }
+    }
+
+    size_t zeros = precision > 0 && (size_t)precision > ndigits
+                 ? (size_t)precision - ndigits : 0;
+    size_t body = nprefix + zeros + ndigits;
+    size_t pad = width > 0 && (size_t)width > body ? (size_t)width - body : 0;
+
+    // the 0 flag is ignored with an explicit precision, as in c
+    if ((flags & FL_ZERO) && !(flags & FL_LEFT) && precision < 0) {
+        zeros += pad;
+        pad = 0;
+    }
+
+    if (!(flags & FL_LEFT))
+        out_pad(o, ' ', pad);
+    out_mem(o, prefix, nprefix);
+    out_pad(o, '0', zeros);
+    out_mem(o, digits, ndigits);
+    if (flags & FL_LEFT)
+        out_pad(o, ' ', pad);
+}
+
+static void out_string(struct fmt_out *o, const char *s, unsigned flags,
+                       int width, int precision)
+{
+    size_t len = 0;
+
+    if (!s)
+        s = "(null)";
+
+    while ((precision < 0 || len < (size_t)precision) && s[len])
+        len++;
+
+    size_t pad = width > 0 && (size_t)width > len ? (size_t)width - len : 0;
+
+    if (!(flags & FL_LEFT))
+        out_pad(o, ' ', pad);
+    out_mem(o, s, len);
+    if (flags & FL_LEFT)
+        out_pad(o, ' ', pad);
+}
+
+enum length { LEN_INT, LEN_CHAR, LEN_SHORT, LEN_LONG, LEN_SIZE };
+
+struct spec
+{
+    unsigned flags;
+    int width;
+    int precision;
+    bool width_arg;     // width given as *
+    bool precision_arg; // precision given as *
+    enum length len;
+    char conv;
+};
+
+/**
+ * parse one conversion after the '%'. returns false at a truncated
+ * spec. arguments for * are not fetched here, the caller does that in
+ * order: width, precision, value.
+ */
+static bool parse_spec(const char **fmtp, struct spec *sp)
+{
+    const char *fmt = *fmtp;
+
+    sp->flags = 0;
+    for (;; fmt++) {
+        if (*fmt == '-')
+            sp->flags |= FL_LEFT;
+        else if (*fmt == '0')
+            sp->flags |= FL_ZERO;
+        else if (*fmt == '+')
+            sp->flags |= FL_PLUS;
+        else if (*fmt == ' ')
+            sp->flags |= FL_SPACE;
+        else if (*fmt == '#')
+            sp->flags |= FL_ALT;
+        else
+            break;
+    }
+
+    sp->width = 0;
+    sp->width_arg = false;
+    if (*fmt == '*') {
+        sp->width_arg = true;
+        fmt++;
+    } else {
+        while (*fmt >= '0' && *fmt <= '9')
+            sp->width = sp->width * 10 + (*fmt++ - '0');
+    }
+
+    sp->precision = -1;
+    sp->precision_arg = false;
+    if (*fmt == '.') {
+        fmt++;
+        sp->precision = 0;
+        if (*fmt == '*') {
+            sp->precision_arg = true;
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9')
+                sp->precision = sp->precision * 10 + (*fmt++ - '0');
+        }
+    }
+
+    sp->len = LEN_INT;
+    switch (*fmt) {
+    case 'h':
+        fmt++;
+        sp->len = LEN_SHORT;
+        if (*fmt == 'h') {
+            fmt++;
+            sp->len = LEN_CHAR;
+        }
+        break;
+    case 'l':
+        fmt++;
+        sp->len = LEN_LONG;
+        if (*fmt == 'l')
+            fmt++;
+        break;
+    case 'z':
+    case 't':
+        fmt++;
+        sp->len = LEN_SIZE;
+        break;
+    }
+
+    sp->conv = *fmt;
+    if (sp->conv == '\0')
+        return false;
+
+    *fmtp = fmt + 1;
+    return true;
+}
+
+static inline bool is_wide(enum length len)
+{
+    return len == LEN_LONG || len == LEN_SIZE;
+}
+
+/**
+ * where conversion arguments come from: a va_list, or an array of
+ * 64 bit slots filled by kformat_capture. in array mode %s slots hold
+ * an offset into strbase, and missing slots read as zero.
+ */
+struct fmt_args
+{
+    va_list *ap;
+    const uint64_t *vals;
+    size_t count;
+    size_t next;
+    const char *strbase;
+};
+
+static inline uint64_t next_slot(struct fmt_args *a)
+{
+    return a->next < a->count ? a->vals[a->next++] : 0;
+}
+
+static int arg_int(struct fmt_args *a)
+{
+    return a->vals ? (int)next_slot(a) : va_arg(*a->ap, int);
+}
+
+static int64_t arg_signed(struct fmt_args *a, enum length len)
+{
+    if (a->vals)
+        return (int64_t)next_slot(a);
+
+    return is_wide(len) ? va_arg(*a->ap, int64_t) : va_arg(*a->ap, int);
+}
+
+static uint64_t arg_unsigned(struct fmt_args *a, enum length len)
+{
+    if (a->vals)
+        return next_slot(a);
+
+    return is_wide(len) ? va_arg(*a->ap, uint64_t) : va_arg(*a->ap, unsigned int);
+}
+
+static const char *arg_string(struct fmt_args *a)
+{
+    if (a->vals)
+        return a->strbase + next_slot(a);
+
+    return va_arg(*a->ap, const char *);
+}
+
+static uint64_t arg_pointer(struct fmt_args *a)
+{
+    if (a->vals)
+        return next_slot(a);
+
+    return (uint64_t)(uintptr_t)va_arg(*a->ap, void *);
+}
+
+static void format(struct fmt_out *o, const char *fmt, struct fmt_args *a)
+{
+    while (*fmt) {
+        if (*fmt != '%') {
+            // copy the literal run up to the next conversion in one go
+            const char *start = fmt;
+            while (*fmt && *fmt != '%')
+                fmt++;
+            out_mem(o, start, (size_t)(fmt - start));
+            continue;
+        }
+
+        fmt++;
+
+        struct spec sp;
+        if (!parse_spec(&fmt, &sp))
+            break;
+
+        if (sp.width_arg) {
+            sp.width = arg_int(a);
+            if (sp.width < 0) {
+                sp.flags |= FL_LEFT;
+                sp.width = -sp.width;
+            }
+        }
+        if (sp.precision_arg)
+            sp.precision = arg_int(a);
+
+        switch (sp.conv) {
+        case 'c': {
+            char c = (char)arg_int(a);
+            size_t pad = sp.width > 1 ? (size_t)sp.width - 1 : 0;
+            if (!(sp.flags & FL_LEFT))
+                out_pad(o, ' ', pad);
+            out_char(o, c);
+            if (sp.flags & FL_LEFT)
+                out_pad(o, ' ', pad);
+            break;
+        }
+        case 's':
+            out_string(o, arg_string(a), sp.flags, sp.width, sp.precision);
+            break;
+        case 'd':
+        case 'i': {
+            int64_t v = arg_signed(a, sp.len);
+            if (sp.len == LEN_CHAR)
+                v = (signed char)v;
+            else if (sp.len == LEN_SHORT)
+                v = (short)v;
+
+            uint64_t mag = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+            out_number(o, mag, v < 0, 10, false, sp.flags, sp.width,
+                       sp.precision);
+            break;
+        }
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o': {
+            uint64_t v = arg_unsigned(a, sp.len);
+            if (sp.len == LEN_CHAR)
+                v = (unsigned char)v;
+            else if (sp.len == LEN_SHORT)
+                v = (unsigned short)v;
+
+            unsigned base = sp.conv == 'u' ? 10 : sp.conv == 'o' ? 8 : 16;
+            out_number(o, v, false, base, sp.conv == 'X',
+                       sp.flags & ~(FL_PLUS | FL_SPACE), sp.width, sp.precision);
+            break;
+        }
+        case 'p':
+            out_number(o, arg_pointer(a), false, 16, true, FL_ZERO, 16, -1);
+            break;
+        case '%':
+            out_char(o, '%');
+            break;
+        default:
+            out_char(o, '%');
+            out_char(o, sp.conv);
+            break;
+        }
+    }
+}
+
+void kformat(struct fmt_out *o, const char *fmt, va_list ap)
+{
+    va_list cp;
+    va_copy(cp, ap);
+
+    struct fmt_args a = { .ap = &cp };
+    format(o, fmt, &a);
+
+    va_end(cp);
+}
+
+void kformat_args(struct fmt_out *o, const char *fmt, const uint64_t *args,
+                  size_t count, const char *strbase)
+{
+    struct fmt_args a = {
+        .vals = args,
+        .count = count,
+        .strbase = strbase,
+    };
+
+    format(o, fmt, &a);
+}
+
+size_t kformat_capture(const char *fmt, va_list ap, uint64_t *args,
+                       size_t max_args, char *strs, size_t str_cap)
+{
+    va_list cp;
+    va_copy(cp, ap);
+
+    struct fmt_args a = { .ap = &cp };
+    size_t n = 0;
+    size_t str_used = 0;
+
+    while (*fmt && n < max_args) {
+        if (*fmt++ != '%')
+            continue;
+
+        struct spec sp;
+        if (!parse_spec(&fmt, &sp))
+            break;
+
+        if (sp.width_arg && n < max_args)
+            args[n++] = (uint64_t)(int64_t)arg_int(&a);
+        if (sp.precision_arg && n < max_args)
+            args[n++] = (uint64_t)(int64_t)arg_int(&a);
+        if (n == max_args)
+            break;
+
+        switch (sp.conv) {
+        case 'c':
+            args[n++] = (uint64_t)(int64_t)arg_int(&a);
+            break;
+        case 'd':
+        case 'i':
+            args[n++] = (uint64_t)arg_signed(&a, sp.len);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            args[n++] = arg_unsigned(&a, sp.len);
+            break;
+        case 'p':
+            args[n++] = arg_pointer(&a);
+            break;
+        case 's': {
+            // strings are copied, the caller's buffer may be gone by then
+            const char *s = arg_string(&a);
+            if (!s)
+                s = "(null)";
+
+            size_t start = str_used < str_cap ? str_used : str_cap - 1;
+            size_t i = start;
+            while (*s && i + 1 < str_cap)
+                strs[i++] = *s++;
+            strs[i] = '\0';
+
+            args[n++] = start;
+            str_used = i + 1;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    va_end(cp);
+
+    return n;
+}
+
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list ap)
+{
+    struct fmt_out o = {
+        .buf = buf,
+        .cap = size ? size - 1 : 0,
+        .len = 0,
+        .total = 0,
+        .flush = NULL,
+    };
+
+    kformat(&o, fmt, ap);
+
+    if (size)
+        buf[o.len] = '\0';
+
+    return (int)o.total;
+}
+
+int ksnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = kvsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+
+    return n;
+}
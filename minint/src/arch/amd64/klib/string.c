@@ -0,0 +1,263 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+#include <klib.h>
+#include <memstring.h>
+
+#define SSE2  __attribute__((target("sse2")))
+#define SSE42 __attribute__((target("sse4.2")))
+#define AVX2  __attribute__((target("avx2")))
+
+#define ONES  0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+
+#define PAGE_SIZE 4096
+
+memchr_fn memchr_impl = memchr_word;
+strlen_fn strlen_impl = strlen_word;
+strcmp_fn strcmp_impl = strcmp_byte;
+
+// lowest set high bit marks the first zero byte, later ones may be bogus
+static inline uint64_t has_zero(uint64_t v)
+{
+    return (v - ONES) & ~v & HIGHS;
+}
+
+void *memchr_word(const void *s, int c, size_t n)
+{
+    const uint8_t *p = s;
+    uint64_t pattern = ONES * (uint8_t)c;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t z = has_zero(*(const klib_u64 *)(p + i) ^ pattern);
+        if (z)
+            return (void *)(p + i + (__builtin_ctzll(z) >> 3));
+    }
+
+    for (; i < n; i++) {
+        if (p[i] == (uint8_t)c)
+            return (void *)(p + i);
+    }
+
+    return NULL;
+}
+
+SSE2 void *memchr_sse2(const void *s, int c, size_t n)
+{
+    const uint8_t *p = s;
+
+    if (n < 16)
+        return memchr_word(s, c, n);
+
+    __m128i needle = _mm_set1_epi8((char)c);
+
+    size_t i = 0;
+    for (;;) {
+        // an overlapping last block can't hit early, that part was seen
+        if (i + 16 > n)
+            i = n - 16;
+
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+
+        if (m)
+            return (void *)(p + i + __builtin_ctz(m));
+
+        i += 16;
+        if (i >= n)
+            return NULL;
+    }
+}
+
+AVX2 void *memchr_avx2(const void *s, int c, size_t n)
+{
+    const uint8_t *p = s;
+
+    if (n < 32)
+        return memchr_sse2(s, c, n);
+
+    __m256i needle = _mm256_set1_epi8((char)c);
+
+    size_t i = 0;
+    for (;;) {
+        if (i + 32 > n)
+            i = n - 32;
+
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+
+        if (m)
+            return (void *)(p + i + __builtin_ctz(m));
+
+        i += 32;
+        if (i >= n)
+            return NULL;
+    }
+}
+
+/**
+ * strlen can't know where the string ends, so every wide load is
+ * aligned: an aligned block never straddles a page, and bytes in front
+ * of the string are masked off the first compare.
+ */
+size_t strlen_word(const char *s)
+{
+    const char *p = s;
+
+    for (; (uintptr_t)p & 7; p++) {
+        if (!*p)
+            return (size_t)(p - s);
+    }
+
+    for (;; p += 8) {
+        uint64_t z = has_zero(*(const klib_u64 *)p);
+        if (z)
+            return (size_t)(p - s) + (__builtin_ctzll(z) >> 3);
+    }
+}
+
+SSE2 size_t strlen_sse2(const char *s)
+{
+    uintptr_t off = (uintptr_t)s & 15;
+    const char *p = s - off;
+    __m128i zero = _mm_setzero_si128();
+
+    uint32_t m = (uint32_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)p), zero));
+    m >>= off;
+    if (m)
+        return __builtin_ctz(m);
+
+    for (;;) {
+        p += 16;
+        m = (uint32_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)p), zero));
+        if (m)
+            return (size_t)(p - s) + __builtin_ctz(m);
+    }
+}
+
+AVX2 size_t strlen_avx2(const char *s)
+{
+    uintptr_t off = (uintptr_t)s & 31;
+    const char *p = s - off;
+    __m256i zero = _mm256_setzero_si256();
+
+    uint32_t m = (uint32_t)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)p), zero));
+    m >>= off;
+    if (m)
+        return __builtin_ctz(m);
+
+    for (;;) {
+        p += 32;
+        m = (uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)p), zero));
+        if (m)
+            return (size_t)(p - s) + __builtin_ctz(m);
+    }
+}
+
+int strcmp_byte(const char *s1, const char *s2)
+{
+    const uint8_t *a = (const uint8_t *)s1;
+    const uint8_t *b = (const uint8_t *)s2;
+
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+
+    return (int)*a - (int)*b;
+}
+
+/**
+ * pcmpistri in "equal each, negated" mode finds the first byte that
+ * differs or where only one string has ended. both strings are read
+ * unaligned, so near a page end we fall back to one byte at a time.
+ */
+#define STRCMP_MODE (_SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_EACH | \
+                     _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT)
+
+static inline int near_page_end(const void *p)
+{
+    return ((uintptr_t)p & (PAGE_SIZE - 1)) > PAGE_SIZE - 16;
+}
+
+SSE42 int strcmp_sse42(const char *s1, const char *s2)
+{
+    const uint8_t *a = (const uint8_t *)s1;
+    const uint8_t *b = (const uint8_t *)s2;
+
+    for (;;) {
+        if (near_page_end(a) || near_page_end(b)) {
+            if (*a != *b || !*a)
+                return (int)*a - (int)*b;
+            a++;
+            b++;
+            continue;
+        }
+
+        __m128i va = _mm_loadu_si128((const __m128i *)a);
+        __m128i vb = _mm_loadu_si128((const __m128i *)b);
+
+        if (_mm_cmpistrc(va, vb, STRCMP_MODE)) {
+            int k = _mm_cmpistri(va, vb, STRCMP_MODE);
+            return (int)a[k] - (int)b[k];
+        }
+
+        if (_mm_cmpistrz(va, vb, STRCMP_MODE))
+            return 0;
+
+        a += 16;
+        b += 16;
+    }
+}
+
+void *memchr(const void *s, int c, size_t n)
+{
+    return memchr_impl(s, c, n);
+}
+
+size_t strlen(const char *s)
+{
+    return strlen_impl(s);
+}
+
+int strcmp(const char *s1, const char *s2)
+{
+    return strcmp_impl(s1, s2);
+}
+
+// maxlen is often just the destination size, so never read past the nul
+size_t strnlen(const char *s, size_t maxlen)
+{
+    size_t i = 0;
+
+    while (i < maxlen && s[i])
+        i++;
+
+    return i;
+}
+
+char *strchr(const char *s, int c)
+{
+    for (;; s++) {
+        if (*s == (char)c)
+            return (char *)s;
+        if (!*s)
+            return NULL;
+    }
+}
+
+char *strncpy(char *restrict dest, const char *restrict src, size_t n)
+{
+    size_t len = strnlen(src, n);
+
+    memcpy(dest, src, len);
+    memset(dest + len, 0, n - len);
+
+    return dest;
+}
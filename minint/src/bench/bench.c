@@ -0,0 +1,233 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <percpu.h>
+#include <sched.h>
+#include <bench.h>
+
+void bench_print_u64(uint64_t n)
+{
+    kprintf("%lu", n);
+}
+
+void bench_print_fixed(uint64_t num, uint64_t den)
+{
+    if (den == 0) {
+        kprint("-");
+        return;
+    }
+
+    kprintf("%lu.%02lu", num / den, (num % den) * 100 / den);
+}
+
+void bench_print_size(uint64_t bytes)
+{
+    if (bytes >= 1024 * 1024 && bytes % (1024 * 1024) == 0)
+        kprintf("%luMiB", bytes / (1024 * 1024));
+    else if (bytes >= 1024 && bytes % 1024 == 0)
+        kprintf("%luKiB", bytes / 1024);
+    else
+        kprintf("%luB", bytes);
+}
+
+void bench_print_pad(const char *s, size_t width)
+{
+    kprintf("%-*s", (int)width, s);
+}
+
+// a * b / c without overflowing in between, saturating if the result does
+static uint64_t mul_div(uint64_t a, uint64_t b, uint64_t c)
+{
+    unsigned __int128 p = (unsigned __int128)a * b;
+    uint64_t hi = (uint64_t)(p >> 64);
+    uint64_t q, r;
+
+    if (c == 0 || hi >= c)
+        return UINT64_MAX;
+
+    asm ("divq %4" : "=a"(q), "=d"(r) : "a"((uint64_t)p), "d"(hi), "rm"(c));
+    return q;
+}
+
+void bench_print_rate(uint64_t count, uint64_t cycles, const char *unit)
+{
+    static const char prefixes[] = " kMG";
+    uint64_t per_sec = mul_div(count, tsc_hz * 100, cycles);  // hundredths
+    uint64_t scale = 1;
+    unsigned i = 0;
+
+    if (cycles == 0) {
+        kprintf("- %s", unit);
+        return;
+    }
+
+    while (i < sizeof(prefixes) - 2 && per_sec >= scale * 1000 * 100) {
+        scale *= 1000;
+        i++;
+    }
+
+    bench_print_fixed(per_sec, scale * 100);
+    if (i)
+        kprintf(" %c%s", prefixes[i], unit);
+    else
+        kprintf(" %s", unit);
+}
+
+void bench_print_ns(uint64_t cycles, uint64_t count)
+{
+    bench_print_fixed(mul_div(cycles, 1000000000000ull, tsc_hz), count * 1000);
+}
+
+void bench_report_bw(const char *op, const char *variant, size_t size,
+                     uint64_t bytes, uint64_t cycles)
+{
+    kprintf("%-8s%-10s", op, variant);
+    bench_print_size(size);
+    kprint("  ");
+    bench_print_rate(bytes, cycles, "B/s");
+    kprint("\n");
+}
+
+static void pmu_snapshot(bool whole_cpu, struct pmu_counts *out)
+{
+    if (whole_cpu)
+        pmu_read_cpu(out);
+    else
+        pmu_read_thread(this_thread(), out);
+}
+
+void bench_pmu_begin(struct bench_pmu *b, bool whole_cpu)
+{
+    b->whole_cpu = whole_cpu;
+    pmu_snapshot(whole_cpu, &b->start);
+}
+
+void bench_pmu_report(const char *prefix, const struct bench_pmu *b,
+                      uint64_t items, const char *item)
+{
+    const struct pmu_counts *snap = &b->start;
+    struct pmu_counts now;
+    bool any = false;
+
+    pmu_snapshot(b->whole_cpu, &now);
+
+    for (int e = 0; e < PMU_EVENT_COUNT; e++)
+        any |= pmu_counting(e);
+
+    if (!any || now.generation != snap->generation)
+        return;
+
+    kprint(prefix);
+
+    for (int e = 0; e < PMU_EVENT_COUNT; e++) {
+        if (!pmu_counting(e) || e == PMU_CYCLES || e == PMU_INSTRUCTIONS)
+            continue;
+
+        kprintf("  %s ", pmu_event_name(e));
+        bench_print_fixed(now.count[e] - snap->count[e], items);
+        kprintf("/%s", item);
+    }
+
+    if (pmu_counting(PMU_CYCLES) && pmu_counting(PMU_INSTRUCTIONS)) {
+        kprint("  ipc ");
+        bench_print_fixed(now.count[PMU_INSTRUCTIONS] - snap->count[PMU_INSTRUCTIONS],
+                          now.count[PMU_CYCLES] - snap->count[PMU_CYCLES]);
+    }
+
+    kprint("\n");
+}
+
+struct par_work
+{
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+static volatile uint32_t par_ready;
+static volatile bool par_go;
+
+static void par_worker(void *p)
+{
+    struct par_work *w = p;
+
+    __atomic_fetch_add(&par_ready, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&par_go, __ATOMIC_ACQUIRE))
+        cpu_pause();
+
+    w->fn(w->arg);
+}
+
+uint64_t bench_parallel(uint32_t ncpus, void (*fn)(void *arg), void *arg)
+{
+    struct par_work w = { fn, arg };
+    uint32_t started = 0;
+
+    if (ncpus > cpu_count)
+        ncpus = cpu_count;
+
+    par_ready = 0;
+    par_go = false;
+
+    for (uint32_t i = 1; i < ncpus; i++)
+        started += smp_call(i, par_worker, &w);
+
+    while (__atomic_load_n(&par_ready, __ATOMIC_ACQUIRE) < started)
+        cpu_pause();
+
+    // everyone is parked on the flag, so the clock starts with the work
+    uint64_t start = bench_begin();
+    __atomic_store_n(&par_go, true, __ATOMIC_RELEASE);
+
+    fn(arg);
+
+    for (uint32_t i = 1; i < ncpus; i++)
+        smp_wait(i);
+
+    return bench_end() - start;
+}
+
+uint32_t bench_next_cpus(uint32_t n)
+{
+    if (n >= cpu_count)
+        return 0;
+
+    return n * 2 < cpu_count ? n * 2 : cpu_count;
+}
+
+void bench_run_all(void)
+{
+    static const enum pmu_event events[] = {
+        PMU_CYCLES, PMU_INSTRUCTIONS, PMU_LLC_MISSES, PMU_BRANCH_MISSES, PMU_DTLB_WALKS,
+    };
+
+    kprint("\n--- benchmarks ---\n");
+
+    // the benches that care print these under their own results
+    pmu_configure(events, ARRAY_LEN(events));
+
+    bench_mem();
+    bench_string();
+    bench_console();
+    bench_blit();
+    bench_klog();
+    bench_serial();
+    bench_pmm();
+    bench_slab();
+    bench_vmm();
+    bench_fb();
+    bench_sched();
+    bench_lock();
+    bench_rcu();
+    bench_object();
+    bench_timer();
+    bench_irq();
+    bench_syscall();
+
+    kprint("--- benchmarks done ---\n");
+}
+
+#endif
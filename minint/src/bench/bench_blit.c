@@ -0,0 +1,67 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <system.h>
+#include <console.h>
+#include <blit.h>
+#include <bench.h>
+
+/**
+ * full-screen clear and one-text-row scroll through the blitter, on the
+ * live framebuffer and on ram surfaces at 1080p and 4k. ram is not the
+ * same memory type as video memory, so the two sets are not comparable
+ * with each other, only across builds.
+ */
+
+#define BLIT_4K_W   3840
+#define BLIT_4K_H   2160
+#define BLIT_ROUNDS 16
+#define SCROLL_H    16
+
+static uint32_t ram_surface[BLIT_4K_W * BLIT_4K_H] ALIGNED(64);
+
+static void run(const char *name, const struct blit_surface *s)
+{
+    uint64_t frame = (uint64_t)s->width * s->height * sizeof(uint32_t);
+
+    blit_clear(s, 0);
+
+    uint64_t t0 = bench_begin();
+    for (int i = 0; i < BLIT_ROUNDS; i++)
+        blit_clear(s, (uint32_t)i * 0x010101);
+    uint64_t t1 = bench_end();
+
+    bench_print_pad("clear", 8);
+    bench_print_pad(name, 10);
+    bench_print_rate(frame * BLIT_ROUNDS, t1 - t0, "B/s");
+    kprint("\n");
+
+    t0 = bench_begin();
+    for (int i = 0; i < BLIT_ROUNDS; i++) {
+        blit_copy_rect(s, 0, 0, 0, SCROLL_H, s->width, s->height - SCROLL_H);
+        blit_fill_rect(s, 0, s->height - SCROLL_H, s->width, SCROLL_H, 0);
+    }
+    t1 = bench_end();
+
+    bench_print_pad("scroll", 8);
+    bench_print_pad(name, 10);
+    bench_print_rate(frame * BLIT_ROUNDS, t1 - t0, "B/s");
+    kprint("\n");
+}
+
+void bench_blit(void)
+{
+    struct blit_surface fb = *console_surface();
+    struct blit_surface hd = { ram_surface, 1920, 1080, 1920 };
+    struct blit_surface uhd = { ram_surface, BLIT_4K_W, BLIT_4K_H, BLIT_4K_W };
+
+    run("fb", &fb);
+    console_clear();
+
+    run("ram-1080p", &hd);
+    run("ram-4k", &uhd);
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <console.h>
+#include <bench.h>
+
+/**
+ * glyph rendering: fill every cell above the last row through
+ * console_putc, so no scroll happens inside the timed region, once with
+ * the bitwise renderer and once with the expanded-row one.
+ *
+ * logging: print lines at the bottom of a full screen, so every line
+ * scrolls, with the shadow grid and with the old framebuffer readback,
+ * then once more in deferred mode with a single flush at the end.
+ */
+
+#define LOG_LINES 256
+
+static uint64_t fill_screen(size_t cols, size_t rows)
+{
+    console_clear();
+
+    uint64_t t0 = bench_begin();
+    for (size_t r = 0; r + 1 < rows; r++)
+        for (size_t c = 0; c < cols; c++)
+            console_putc((char)('!' + (r * cols + c) % 94));
+    uint64_t t1 = bench_end();
+
+    return t1 - t0;
+}
+
+static void report_glyphs(const char *variant, uint64_t chars, uint64_t cycles)
+{
+    bench_print_pad("glyphs", 8);
+    bench_print_pad(variant, 10);
+    bench_print_fixed(cycles, chars);
+    kprint(" cycles/char  ");
+    bench_print_u64(chars * 1000000 / (cycles ? cycles : 1));
+    kprint(" chars/Mcycle\n");
+}
+
+static uint64_t log_lines(size_t rows)
+{
+    static const char line[] =
+        "[INFO]  the quick brown fox jumps over the lazy dog 0123456789\n";
+
+    console_clear();
+    for (size_t r = 0; r < rows; r++)
+        console_putc('\n');
+
+    uint64_t t0 = bench_begin();
+    for (size_t i = 0; i < LOG_LINES; i++)
+        console_print(line);
+    console_flush();
+    uint64_t t1 = bench_end();
+
+    return t1 - t0;
+}
+
+static void report_lines(const char *variant, uint64_t lines, uint64_t cycles)
+{
+    bench_print_pad("lines", 8);
+    bench_print_pad(variant, 10);
+    bench_print_u64(cycles / lines);
+    kprint(" cycles/line  ");
+    bench_print_fixed(lines * 1000000, cycles);
+    kprint(" lines/Mcycle\n");
+}
+
+void bench_console(void)
+{
+    size_t cols, rows;
+    console_get_size(&cols, &rows);
+
+    uint64_t chars = (uint64_t)cols * (rows - 1);
+
+    console_set_bitwise_render(true);
+    uint64_t slow = fill_screen(cols, rows);
+    console_set_bitwise_render(false);
+    uint64_t fast = fill_screen(cols, rows);
+
+    console_set_readback_scroll(true);
+    uint64_t readback = log_lines(rows);
+    console_set_readback_scroll(false);
+    uint64_t shadow = log_lines(rows);
+    console_set_mode(CONSOLE_DEFERRED);
+    uint64_t deferred = log_lines(rows);
+    console_set_mode(CONSOLE_SYNC);
+
+    console_clear();
+
+    report_glyphs("bitwise", chars, slow);
+    report_glyphs("expanded", chars, fast);
+    report_lines("readback", LOG_LINES, readback);
+    report_lines("shadow", LOG_LINES, shadow);
+    report_lines("deferred", LOG_LINES, deferred);
+}
+
+#endif
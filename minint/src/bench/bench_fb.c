@@ -0,0 +1,77 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <console.h>
+#include <pat.h>
+#include <bench.h>
+
+/**
+ * framebuffer memory type: full-screen console_clear() and a screenful
+ * of scrolling lines with the framebuffer mapped uc, wb and wc. the
+ * effective type is printed too, since an mtrr can overrule the pat.
+ */
+
+#define FB_CLEARS   16
+#define FB_LINES    256
+
+static const enum memtype types[] = { MEMTYPE_UC, MEMTYPE_WB, MEMTYPE_WC };
+
+static uint64_t clears(void)
+{
+    uint64_t start = bench_begin();
+    for (int i = 0; i < FB_CLEARS; i++)
+        console_clear();
+    return bench_end() - start;
+}
+
+static uint64_t scroll_lines(void)
+{
+    static const char line[] =
+        "[INFO]  the quick brown fox jumps over the lazy dog 0123456789\n";
+    size_t cols, rows;
+
+    console_get_size(&cols, &rows);
+    console_clear();
+    for (size_t r = 0; r < rows; r++)
+        console_putc('\n');
+
+    uint64_t start = bench_begin();
+    for (int i = 0; i < FB_LINES; i++)
+        console_print(line);
+    return bench_end() - start;
+}
+
+void bench_fb(void)
+{
+    const struct blit_surface *s = console_surface();
+    uint64_t bytes = (uint64_t)s->stride * s->height * sizeof(uint32_t);
+    uint64_t clear_cycles[ARRAY_LEN(types)];
+    uint64_t line_cycles[ARRAY_LEN(types)];
+    enum memtype effective[ARRAY_LEN(types)];
+
+    // the console is being thrashed, so collect first and print after
+    for (size_t i = 0; i < ARRAY_LEN(types); i++) {
+        console_set_memtype(types[i]);
+        effective[i] = console_memtype();
+        clear_cycles[i] = clears();
+        line_cycles[i] = scroll_lines();
+    }
+
+    console_set_memtype(MEMTYPE_WC);
+    console_clear();
+
+    for (size_t i = 0; i < ARRAY_LEN(types); i++) {
+        kprintf("fb      pat %-3s (%-3s) clear ", memtype_name(types[i]),
+                memtype_name(effective[i]));
+        bench_print_rate(bytes * FB_CLEARS, clear_cycles[i], "B/s");
+        kprint("  scroll ");
+        bench_print_ns(line_cycles[i], FB_LINES);
+        kprint(" ns/line\n");
+    }
+}
+
+#endif
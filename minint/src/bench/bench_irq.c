@@ -0,0 +1,76 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <idt.h>
+#include <lapic.h>
+#include <bench.h>
+
+/**
+ * interrupt round trip: a self-ipi from sending it to being back past
+ * the iretq, split at the tsc the handler reads into delivery plus entry
+ * and handler exit plus return. min is the path itself, avg includes
+ * whatever else got in the way.
+ */
+
+#define IRQ_ROUNDS  10000
+
+static volatile uint64_t entered;
+
+static void bench_handler(struct isr_frame *frame)
+{
+    entered = rdtsc();
+    lapic_eoi();
+}
+
+static void report(const char *what, uint64_t min, uint64_t sum)
+{
+    kprintf("irq     %-9s min %5lu cycles (", what, min);
+    bench_print_ns(min, 1);
+    kprintf(" ns)  avg %5lu cycles\n", sum / IRQ_ROUNDS);
+}
+
+void bench_irq(void)
+{
+    uint64_t min_trip = UINT64_MAX, min_in = UINT64_MAX, min_out = UINT64_MAX;
+    uint64_t sum_trip = 0, sum_in = 0, sum_out = 0;
+    uint32_t self = lapic_id();
+
+    isr_register(LAPIC_VECTOR_BENCH, bench_handler);
+
+    for (int i = 0; i < IRQ_ROUNDS; i++) {
+        entered = 0;
+
+        uint64_t t0 = bench_begin();
+        lapic_send_ipi(self, LAPIC_VECTOR_BENCH);
+
+        while (!entered)
+            cpu_pause();
+
+        uint64_t t1 = bench_end();
+        uint64_t in = entered - t0;
+        uint64_t out = t1 - entered;
+
+        sum_trip += t1 - t0;
+        sum_in += in;
+        sum_out += out;
+
+        if (t1 - t0 < min_trip)
+            min_trip = t1 - t0;
+        if (in < min_in)
+            min_in = in;
+        if (out < min_out)
+            min_out = out;
+    }
+
+    isr_register(LAPIC_VECTOR_BENCH, NULL);
+
+    report("self-ipi", min_trip, sum_trip);
+    report("  entry", min_in, sum_in);
+    report("  return", min_out, sum_out);
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <klog.h>
+#include <bench.h>
+
+/**
+ * klog(LOG_INFO, ...) cost seen by the caller: formatted and rendered
+ * in place (the old behaviour, still there as sync mode) against a
+ * record in the per-cpu ring, plus what the drainer pays later on to
+ * format and print the same records.
+ */
+
+#define KLOG_CALLS KLOG_RING_SIZE   // one ring's worth, nothing is dropped
+
+static void report(const char *what, uint64_t calls, uint64_t cycles)
+{
+    kprintf("klog    %-10s %5lu calls  ", what, calls);
+    bench_print_ns(cycles, calls);
+    kprint(" ns/call  ");
+    bench_print_rate(calls, cycles, "records/s");
+    kprint("\n");
+}
+
+static uint64_t log_burst(void)
+{
+    uint64_t start = bench_begin();
+
+    for (uint32_t i = 0; i < KLOG_CALLS; i++)
+        klog(LOG_INFO, "bench record %u of %u (%s)", i, KLOG_CALLS, "klog");
+
+    return bench_end() - start;
+}
+
+void bench_klog(void)
+{
+    klog_drain();
+
+    klog_set_sync(true);
+    uint64_t sync_cycles = log_burst();
+    klog_set_sync(false);
+
+    uint64_t ring_cycles = log_burst();
+
+    uint64_t start = bench_begin();
+    size_t drained = klog_drain();
+    uint64_t drain_cycles = bench_end() - start;
+
+    report("sync", KLOG_CALLS, sync_cycles);
+    report("ring", KLOG_CALLS, ring_cycles);
+    report("drain", drained, drain_cycles);
+    kprintf("klog    lost %lu\n", klog_lost());
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <percpu.h>
+#include <spinlock.h>
+#include <bench.h>
+
+/**
+ * lock handoff under contention: every cpu in the set takes the same
+ * lock over and over, bumps a shared counter inside and does a little
+ * private work outside, over 1, 2, 4 ... cpus (up to MAX_CPUS). the total
+ * is split between the cpus so each run does the same amount of work,
+ * and the counter is checked afterwards. the rwlock runs once with only
+ * writers and once with one write in RW_WRITE_EVERY.
+ */
+
+#define LOCK_OPS        200000      // acquisitions per run, over all cpus
+#define LOCK_THINK      64          // loop iterations outside the lock
+#define RW_WRITE_EVERY  16
+
+struct lock_kind
+{
+    const char *name;
+    void (*op)(uint32_t i);
+    bool exclusive;                 // the counter must come out exact
+};
+
+static spinlock_t spin ALIGNED(64) = SPINLOCK_INIT;
+static ticket_lock_t ticket ALIGNED(64) = TICKET_LOCK_INIT;
+static mcs_lock_t mcs ALIGNED(64) = MCS_LOCK_INIT;
+static rwlock_t rw ALIGNED(64) = RWLOCK_INIT;
+
+static volatile uint64_t counter ALIGNED(64);
+static volatile uint64_t writes;
+static uint32_t ops_per_cpu;
+
+static void op_spin(uint32_t i)
+{
+    spin_lock(&spin);
+    counter++;
+    spin_unlock(&spin);
+}
+
+static void op_ticket(uint32_t i)
+{
+    ticket_lock(&ticket);
+    counter++;
+    ticket_unlock(&ticket);
+}
+
+static void op_mcs(uint32_t i)
+{
+    struct mcs_node node;
+
+    mcs_lock(&mcs, &node);
+    counter++;
+    mcs_unlock(&mcs, &node);
+}
+
+static void op_rw_write(uint32_t i)
+{
+    write_lock(&rw);
+    counter++;
+    write_unlock(&rw);
+}
+
+static void op_rw_mixed(uint32_t i)
+{
+    if (i % RW_WRITE_EVERY == 0) {
+        write_lock(&rw);
+        counter++;
+        writes++;
+        write_unlock(&rw);
+    } else {
+        read_lock(&rw);
+        (void)counter;
+        read_unlock(&rw);
+    }
+}
+
+static const struct lock_kind kinds[] = {
+    { "tas",      op_spin,     true  },
+    { "ticket",   op_ticket,   true  },
+    { "mcs",      op_mcs,      true  },
+    { "rw write", op_rw_write, true  },
+    { "rw 1/16",  op_rw_mixed, false },
+};
+
+static void worker(void *arg)
+{
+    const struct lock_kind *k = arg;
+
+    // the bsp runs this with interrupts on, a tick while holding stalls everyone
+    uint64_t flags = irq_save();
+
+    for (uint32_t i = 0; i < ops_per_cpu; i++) {
+        k->op(i);
+
+        for (uint32_t n = 0; n < LOCK_THINK; n++)
+            bench_clobber();
+    }
+
+    irq_restore(flags);
+}
+
+void bench_lock(void)
+{
+    for (size_t k = 0; k < ARRAY_LEN(kinds); k++) {
+        for (uint32_t n = 1; n; n = bench_next_cpus(n)) {
+            counter = 0;
+            writes = 0;
+            ops_per_cpu = LOCK_OPS / n;
+
+            uint64_t cycles = bench_parallel(n, worker, (void *)&kinds[k]);
+            uint64_t ops = (uint64_t)ops_per_cpu * n;
+
+            // the mixed run only counts under the write lock
+            uint64_t expect = kinds[k].exclusive ? ops : writes;
+
+            kprint("lock    ");
+            bench_print_pad(kinds[k].name, 9);
+            kprintf("%2u cpus  ", n);
+            bench_print_rate(ops, cycles, "acq/s");
+            kprint("  ");
+            bench_print_ns(cycles, ops);
+            kprintf(" ns/acq%s\n", counter == expect ? "" : "  (lost updates!)");
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <cpuid.h>
+#include <klib.h>
+#include <bench.h>
+
+/**
+ * memcpy/memset/memmove size sweep, 16 B to 16 MiB in powers of four.
+ * every variant is run directly, plus the dispatched entry point, and
+ * the result is reported as bandwidth in bytes per second.
+ */
+
+#define BENCH_MEM_MAX     (16 * 1024 * 1024)
+#define BENCH_MEM_VOLUME  (64 * 1024 * 1024)   // bytes moved per data point
+#define BENCH_MEM_SLACK   4096
+
+static uint8_t bench_src[BENCH_MEM_MAX + BENCH_MEM_SLACK] ALIGNED(64);
+static uint8_t bench_dst[BENCH_MEM_MAX + BENCH_MEM_SLACK] ALIGNED(64);
+
+struct copy_variant
+{
+    const char *name;
+    memcpy_fn fn;
+    bool *needs;
+};
+
+struct set_variant
+{
+    const char *name;
+    memset_fn fn;
+    bool *needs;
+};
+
+static void *dispatched_memcpy(void *restrict d, const void *restrict s, size_t n)
+{
+    return memcpy(d, s, n);
+}
+
+static void *dispatched_memset(void *s, int c, size_t n)
+{
+    return memset(s, c, n);
+}
+
+static void *dispatched_memmove(void *d, const void *s, size_t n)
+{
+    return memmove(d, s, n);
+}
+
+static const struct copy_variant copy_variants[] =
+{
+    { "rep",      memcpy_rep,        NULL },
+    { "sse2",     memcpy_sse2,       NULL },
+    { "sse2-nt",  memcpy_sse2_nt,    NULL },
+    { "avx2",     memcpy_avx2,       &cpu_features.avx2 },
+    { "avx2-nt",  memcpy_avx2_nt,    &cpu_features.avx2 },
+    { "dispatch", dispatched_memcpy, NULL },
+};
+
+static const struct set_variant set_variants[] =
+{
+    { "rep",      memset_rep,        NULL },
+    { "sse2",     memset_sse2,       NULL },
+    { "sse2-nt",  memset_sse2_nt,    NULL },
+    { "avx2",     memset_avx2,       &cpu_features.avx2 },
+    { "avx2-nt",  memset_avx2_nt,    &cpu_features.avx2 },
+    { "dispatch", dispatched_memset, NULL },
+};
+
+static const struct copy_variant move_variants[] =
+{
+    { "rep-bwd",  memmove_rep_bwd,    NULL },
+    { "sse2-bwd", memmove_sse2_bwd,   NULL },
+    { "avx2-bwd", memmove_avx2_bwd,   &cpu_features.avx2 },
+    { "dispatch", dispatched_memmove, NULL },
+};
+
+static size_t bench_iters(size_t size)
+{
+    size_t iters = BENCH_MEM_VOLUME / size;
+    return iters ? iters : 1;
+}
+
+static void sweep_copy(const char *op, const struct copy_variant *v,
+                       size_t count, size_t dst_off)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (v[i].needs && !*v[i].needs)
+            continue;
+
+        for (size_t size = 16; size <= BENCH_MEM_MAX; size *= 4) {
+            size_t iters = bench_iters(size);
+
+            // the memmove sweep overlaps src and dst by all but dst_off
+            uint8_t *src = dst_off ? bench_dst : bench_src;
+            uint8_t *dst = bench_dst + dst_off;
+
+            v[i].fn(dst, src, size);    // warm up tlb and caches
+
+            uint64_t t0 = bench_begin();
+            for (size_t it = 0; it < iters; it++) {
+                v[i].fn(dst, src, size);
+                bench_clobber();
+            }
+            uint64_t t1 = bench_end();
+
+            bench_report_bw(op, v[i].name, size,
+                            (uint64_t)size * iters, t1 - t0);
+        }
+    }
+}
+
+static void sweep_set(void)
+{
+    for (size_t i = 0; i < ARRAY_LEN(set_variants); i++) {
+        const struct set_variant *v = &set_variants[i];
+
+        if (v->needs && !*v->needs)
+            continue;
+
+        for (size_t size = 16; size <= BENCH_MEM_MAX; size *= 4) {
+            size_t iters = bench_iters(size);
+
+            v->fn(bench_dst, 0, size);
+
+            uint64_t t0 = bench_begin();
+            for (size_t it = 0; it < iters; it++) {
+                v->fn(bench_dst, (int)it, size);
+                bench_clobber();
+            }
+            uint64_t t1 = bench_end();
+
+            bench_report_bw("memset", v->name, size,
+                            (uint64_t)size * iters, t1 - t0);
+        }
+    }
+}
+
+void bench_mem(void)
+{
+    kprint("klib: ");
+    kprint(klib_describe());
+    kprint(", streaming from ");
+    bench_print_size(klib_nt_threshold);
+    kprint("\n");
+
+    for (size_t i = 0; i < sizeof(bench_src); i++)
+        bench_src[i] = (uint8_t)(i * 131);
+
+    sweep_copy("memcpy", copy_variants, ARRAY_LEN(copy_variants), 0);
+    sweep_set();
+    sweep_copy("memmove", move_variants, ARRAY_LEN(move_variants), 64);
+}
+
+#endif
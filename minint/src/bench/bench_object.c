@@ -0,0 +1,180 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <percpu.h>
+#include <slab.h>
+#include <rcu.h>
+#include <object.h>
+#include <bench.h>
+
+/**
+ * one handle table shared by every cpu, as the threads of one process
+ * would, over 1, 2, 4 ... cpus. open/close: each cpu opens a batch of
+ * handles to its own object and closes them again. lookup: every cpu
+ * translates random handles out of a common set, once taking and
+ * dropping a reference (objects are distinct, so only a collision
+ * bounces a count) and once under rcu_read_lock() without one.
+ */
+
+#define OPEN_BATCH      128
+#define OPEN_ROUNDS     200
+#define LOOKUP_SET      4096
+#define LOOKUPS_PER_CPU 200000
+
+struct bench_obj
+{
+    struct object hdr;
+    uint64_t payload;
+};
+
+static void obj_destroy(struct object *o)
+{
+    kfree(o);
+}
+
+static const struct object_type bench_type = { "bench", obj_destroy };
+
+static struct handle_table *table;
+static struct bench_obj *objs[MAX_CPUS];
+static handle_t opened[MAX_CPUS][OPEN_BATCH];
+static handle_t set[LOOKUP_SET];
+static volatile uint64_t failed;
+
+static struct bench_obj *obj_create(void)
+{
+    struct bench_obj *o = kmalloc(sizeof(*o));
+
+    if (o) {
+        object_init(&o->hdr, &bench_type);
+        o->payload = 0;
+    }
+
+    return o;
+}
+
+static void open_close(void *arg)
+{
+    uint32_t cpu = cpu_id();
+    handle_t *h = opened[cpu];
+    uint64_t errors = 0;
+
+    for (int r = 0; r < OPEN_ROUNDS; r++) {
+        for (int i = 0; i < OPEN_BATCH; i++)
+            h[i] = handle_open(table, &objs[cpu]->hdr);
+
+        for (int i = 0; i < OPEN_BATCH; i++)
+            errors += !handle_close(table, h[i]);
+    }
+
+    if (errors)
+        __atomic_fetch_add(&failed, errors, __ATOMIC_RELAXED);
+}
+
+static void lookup(void *arg)
+{
+    bool use_rcu = *(bool *)arg;
+    uint64_t x = 0x2545F4914F6CDD1Dull * (cpu_id() + 1);
+    uint64_t errors = 0;
+
+    for (uint32_t i = 0; i < LOOKUPS_PER_CPU; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+
+        handle_t h = set[x % LOOKUP_SET];
+
+        if (use_rcu) {
+            rcu_read_lock();
+            if (!handle_lookup_rcu(table, h, &bench_type))
+                errors++;
+            rcu_read_unlock();
+        } else {
+            struct object *o = handle_lookup(table, h, &bench_type);
+            if (o)
+                object_unref(o);
+            else
+                errors++;
+        }
+    }
+
+    if (errors)
+        __atomic_fetch_add(&failed, errors, __ATOMIC_RELAXED);
+}
+
+static void report(const char *what, uint32_t n, uint64_t ops, uint64_t cycles)
+{
+    kprintf("object  %-11s %2u cpus  ", what, n);
+    bench_print_rate(ops, cycles, "ops/s");
+    kprint("  ");
+    bench_print_ns(cycles * n, ops);
+    kprintf(" ns/op/cpu%s\n", failed ? "  (handles failed!)" : "");
+}
+
+static void bench_open_close(void)
+{
+    for (uint32_t n = 1; n; n = bench_next_cpus(n)) {
+        failed = 0;
+
+        uint64_t cycles = bench_parallel(n, open_close, NULL);
+
+        report("open+close", n, (uint64_t)OPEN_ROUNDS * OPEN_BATCH * 2 * n, cycles);
+    }
+}
+
+static void bench_lookup(void)
+{
+    static const bool modes[] = { false, true };
+    static const char *const names[] = { "lookup+ref", "lookup rcu" };
+
+    for (uint32_t i = 0; i < LOOKUP_SET; i++) {
+        struct bench_obj *o = obj_create();
+
+        set[i] = o ? handle_open(table, &o->hdr) : HANDLE_INVALID;
+        if (o)
+            object_unref(&o->hdr);      // the handle keeps it alive
+    }
+
+    for (uint32_t n = 1; n; n = bench_next_cpus(n)) {
+        for (int m = 0; m < 2; m++) {
+            failed = 0;
+
+            uint64_t cycles = bench_parallel(n, lookup, (void *)&modes[m]);
+
+            report(names[m], n, (uint64_t)LOOKUPS_PER_CPU * n, cycles);
+        }
+    }
+
+    for (uint32_t i = 0; i < LOOKUP_SET; i++)
+        handle_close(table, set[i]);
+}
+
+void bench_object(void)
+{
+    table = handle_table_create();
+    if (!table) {
+        kprint("object  cannot create a handle table\n");
+        return;
+    }
+
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        objs[i] = obj_create();
+        if (!objs[i]) {
+            kprint("object  cannot allocate objects\n");
+            return;
+        }
+    }
+
+    bench_open_close();
+    bench_lookup();
+
+    for (uint32_t i = 0; i < cpu_count; i++)
+        object_unref(&objs[i]->hdr);
+
+    handle_table_destroy(table);
+}
+
+#endif
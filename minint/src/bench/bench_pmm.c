@@ -0,0 +1,148 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <pmm.h>
+#include <slab.h>
+#include <percpu.h>
+#include <bench.h>
+
+/**
+ * single page alloc/free pairs through the per-cpu cache against the
+ * locked buddy path, back to back and in bursts deep enough to make the
+ * cache refill and trim.
+ */
+
+#define PMM_PAIRS   100000
+#define PMM_BURST   512
+#define PMM_SCALE_PAIRS 20000   // per cpu
+
+static uint64_t burst[PMM_BURST];
+
+static void report(const char *path, const char *pattern, uint64_t pairs,
+                   uint64_t cycles)
+{
+    kprintf("pmm     %-8s%-8s", path, pattern);
+    bench_print_ns(cycles, pairs);
+    kprint(" ns/pair  ");
+    bench_print_rate(pairs, cycles, "pairs/s");
+    kprint("\n");
+}
+
+static void run(const char *path, uint64_t (*alloc)(void),
+                void (*release)(uint64_t))
+{
+    uint64_t start = bench_begin();
+    for (int i = 0; i < PMM_PAIRS; i++)
+        release(alloc());
+    uint64_t pingpong = bench_end() - start;
+
+    start = bench_begin();
+    for (int r = 0; r < PMM_PAIRS / PMM_BURST; r++) {
+        for (int i = 0; i < PMM_BURST; i++)
+            burst[i] = alloc();
+        for (int i = 0; i < PMM_BURST; i++)
+            release(burst[i]);
+    }
+    uint64_t bursts = bench_end() - start;
+
+    report(path, "pingpong", PMM_PAIRS, pingpong);
+    report(path, "burst", (PMM_PAIRS / PMM_BURST) * PMM_BURST, bursts);
+}
+
+static uint64_t buddy_alloc_page(void)
+{
+    return pmm_alloc_pages(0);
+}
+
+static void buddy_free_page(uint64_t phys)
+{
+    pmm_free_pages(phys, 0);
+}
+
+/**
+ * the same patterns on 1, 2, 4 ... cpus at once. the per-cpu caches
+ * should scale until refills and trims start queueing on the buddy lock,
+ * the buddy path shows that lock from the start.
+ */
+struct scale_arg
+{
+    uint64_t (*alloc)(void);
+    void (*release)(uint64_t);
+    bool burst;
+};
+
+static uint64_t *scale_buf[MAX_CPUS];
+
+static void scale_worker(void *p)
+{
+    struct scale_arg *a = p;
+    uint64_t *buf = scale_buf[cpu_id()];
+
+    if (!a->burst) {
+        for (int i = 0; i < PMM_SCALE_PAIRS; i++)
+            a->release(a->alloc());
+        return;
+    }
+
+    for (int r = 0; r < PMM_SCALE_PAIRS / PMM_BURST; r++) {
+        for (int i = 0; i < PMM_BURST; i++)
+            buf[i] = a->alloc();
+        for (int i = 0; i < PMM_BURST; i++)
+            a->release(buf[i]);
+    }
+}
+
+static void scale(const char *path, uint64_t (*alloc)(void),
+                  void (*release)(uint64_t), bool burst)
+{
+    struct scale_arg a = { alloc, release, burst };
+    uint64_t per_cpu = burst ? (PMM_SCALE_PAIRS / PMM_BURST) * PMM_BURST
+                             : PMM_SCALE_PAIRS;
+
+    for (uint32_t n = 1; n; n = bench_next_cpus(n)) {
+        uint64_t cycles = bench_parallel(n, scale_worker, &a);
+
+        kprintf("pmm     %-8s%-8s%2u cpus  ", path, burst ? "burst" : "pingpong", n);
+        bench_print_rate(n * per_cpu, cycles, "pairs/s");
+        kprint("\n");
+    }
+}
+
+void bench_pmm(void)
+{
+    struct pmm_stats before, after;
+
+    pmm_get_stats(&before);
+
+    kprintf("pmm     1 cpu\n");
+    run("pcp", pmm_alloc_page, pmm_free_page);
+    run("buddy", buddy_alloc_page, buddy_free_page);
+
+    bool have_bufs = true;
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        scale_buf[i] = kmalloc(PMM_BURST * sizeof(uint64_t));
+        have_bufs = have_bufs && scale_buf[i];
+    }
+
+    if (cpu_count > 1 && have_bufs) {
+        scale("pcp", pmm_alloc_page, pmm_free_page, false);
+        scale("pcp", pmm_alloc_page, pmm_free_page, true);
+        scale("buddy", buddy_alloc_page, buddy_free_page, false);
+    }
+
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        kfree(scale_buf[i]);
+        scale_buf[i] = NULL;
+    }
+
+    pmm_get_stats(&after);
+    kprintf("pmm     %lu refills, %lu trims\n",
+            after.pcp_refills - before.pcp_refills,
+            after.pcp_trims - before.pcp_trims);
+}
+
+#endif
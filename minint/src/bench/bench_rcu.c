@@ -0,0 +1,246 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <percpu.h>
+#include <spinlock.h>
+#include <slab.h>
+#include <sched.h>
+#include <rcu.h>
+#include <bench.h>
+
+/**
+ * a chained hash table looked up from every cpu at once, the readers
+ * protected once by rcu and once by a rwlock, over 1, 2, 4 ... cpus.
+ * each cpu does the same number of lookups, so a lock that scales keeps
+ * the per-cpu rate flat. a second pass makes one op in UPDATE_EVERY an
+ * update: rcu copies the entry and frees the old one through call_rcu(),
+ * the rwlock writer changes it in place. then what a grace period costs.
+ */
+
+#define TABLE_BUCKETS   1024
+#define TABLE_ENTRIES   4096
+#define LOOKUPS_PER_CPU 100000
+#define UPDATE_EVERY    1024
+#define SYNC_ROUNDS     100
+
+struct entry
+{
+    struct entry *next;
+    uint64_t key;
+    uint64_t value;
+    struct rcu_head rcu;
+};
+
+struct run
+{
+    bool use_rcu;
+    bool updates;
+};
+
+static struct entry *table[TABLE_BUCKETS];
+static rwlock_t table_rw ALIGNED(64) = RWLOCK_INIT;
+static spinlock_t table_update ALIGNED(64) = SPINLOCK_INIT;   // rcu writers
+static volatile uint64_t missed;
+
+static uint32_t bucket(uint64_t key)
+{
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 54);
+}
+
+static uint64_t lookup_rcu(uint64_t key)
+{
+    uint64_t value = 0;
+
+    rcu_read_lock();
+    for (struct entry *e = rcu_dereference(table[bucket(key)]); e; e = rcu_dereference(e->next)) {
+        if (e->key == key) {
+            value = e->value;
+            break;
+        }
+    }
+    rcu_read_unlock();
+
+    return value;
+}
+
+static uint64_t lookup_rw(uint64_t key)
+{
+    uint64_t value = 0;
+
+    read_lock(&table_rw);
+    for (struct entry *e = table[bucket(key)]; e; e = e->next) {
+        if (e->key == key) {
+            value = e->value;
+            break;
+        }
+    }
+    read_unlock(&table_rw);
+
+    return value;
+}
+
+static void free_entry(struct rcu_head *head)
+{
+    kfree((struct entry *)((uint8_t *)head - offsetof(struct entry, rcu)));
+}
+
+static void update_rcu(uint64_t key)
+{
+    struct entry *copy = kmalloc(sizeof(*copy));
+    if (!copy)
+        return;
+
+    spin_lock(&table_update);
+
+    struct entry **link = &table[bucket(key)];
+
+    while (*link && (*link)->key != key)
+        link = &(*link)->next;
+
+    struct entry *old = *link;
+
+    if (!old) {
+        spin_unlock(&table_update);
+        kfree(copy);
+        return;
+    }
+
+    *copy = *old;
+    copy->value++;
+    rcu_assign_pointer(*link, copy);
+
+    spin_unlock(&table_update);
+
+    call_rcu(&old->rcu, free_entry);
+}
+
+static void update_rw(uint64_t key)
+{
+    write_lock(&table_rw);
+
+    for (struct entry *e = table[bucket(key)]; e; e = e->next) {
+        if (e->key == key) {
+            e->value++;
+            break;
+        }
+    }
+
+    write_unlock(&table_rw);
+}
+
+static void worker(void *arg)
+{
+    const struct run *r = arg;
+    uint64_t x = 0x2545F4914F6CDD1Dull * (cpu_id() + 1);
+    uint64_t misses = 0;
+
+    for (uint32_t i = 0; i < LOOKUPS_PER_CPU; i++) {
+        // xorshift, the keys are 1..TABLE_ENTRIES
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+
+        uint64_t key = x % TABLE_ENTRIES + 1;
+
+        if (r->updates && i % UPDATE_EVERY == 0) {
+            if (r->use_rcu)
+                update_rcu(key);
+            else
+                update_rw(key);
+        } else if (!(r->use_rcu ? lookup_rcu(key) : lookup_rw(key)))
+            misses++;
+    }
+
+    if (misses)
+        __atomic_fetch_add(&missed, misses, __ATOMIC_RELAXED);
+}
+
+static bool build_table(void)
+{
+    for (uint64_t key = 1; key <= TABLE_ENTRIES; key++) {
+        struct entry *e = kmalloc(sizeof(*e));
+        if (!e)
+            return false;
+
+        e->key = key;
+        e->value = key;
+        e->next = table[bucket(key)];
+        table[bucket(key)] = e;
+    }
+
+    return true;
+}
+
+static void free_table(void)
+{
+    for (uint32_t b = 0; b < TABLE_BUCKETS; b++) {
+        while (table[b]) {
+            struct entry *e = table[b];
+            table[b] = e->next;
+            kfree(e);
+        }
+    }
+}
+
+static void bench_lookups(bool updates)
+{
+    static const char *const names[] = { "rwlock", "rcu" };
+
+    for (uint32_t n = 1; n; n = bench_next_cpus(n)) {
+        for (int use_rcu = 0; use_rcu < 2; use_rcu++) {
+            struct run r = { use_rcu, updates };
+
+            missed = 0;
+
+            uint64_t cycles = bench_parallel(n, worker, &r);
+            uint64_t ops = (uint64_t)LOOKUPS_PER_CPU * n;
+
+            kprintf("rcu     %-6s %s %2u cpus  ", names[use_rcu],
+                    updates ? "1/1024 upd" : "read only ", n);
+            bench_print_rate(ops, cycles, "ops/s");
+            kprint("  ");
+            bench_print_ns(cycles * n, ops);
+            kprintf(" ns/op/cpu%s\n", missed ? "  (lookups missed!)" : "");
+        }
+    }
+}
+
+static void bench_sync(void)
+{
+    struct rcu_stats before, after;
+
+    rcu_get_stats(&before);
+    uint64_t start = bench_begin();
+
+    for (int i = 0; i < SYNC_ROUNDS; i++)
+        synchronize_rcu();
+
+    uint64_t cycles = bench_end() - start;
+    rcu_get_stats(&after);
+
+    kprint("rcu     synchronize_rcu  ");
+    bench_print_ns(cycles, SYNC_ROUNDS);
+    kprintf(" ns/call  (%lu ipis)\n", after.ipis - before.ipis);
+}
+
+void bench_rcu(void)
+{
+    if (!build_table()) {
+        kprint("rcu     cannot allocate the table\n");
+        free_table();
+        return;
+    }
+
+    bench_lookups(false);
+    bench_lookups(true);
+    bench_sync();
+
+    // replaced entries are the rcu thread's to free, these are the live ones
+    free_table();
+}
+
+#endif
@@ -0,0 +1,166 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <percpu.h>
+#include <sched.h>
+#include <bench.h>
+
+/**
+ * scheduler costs: a yield ping-pong between two threads on one cpu
+ * (the pure switch path), thread create/run/exit/reap round trips, and
+ * a pile of cpu-bound threads started on the bsp and spread out by
+ * stealing over 1, 2, 4 ... cpus.
+ */
+
+#define PINGPONG_YIELDS 100000
+#define CREATE_THREADS  20000
+#define SPREAD_THREADS  64
+#define SPREAD_WORK     1000000     // loop iterations per thread
+
+static volatile uint32_t remaining;
+static struct thread *waiter;
+
+static void finished(void)
+{
+    if (__atomic_sub_fetch(&remaining, 1, __ATOMIC_ACQ_REL) == 0)
+        sched_wake(waiter);
+}
+
+static void wait_all(void)
+{
+    while (__atomic_load_n(&remaining, __ATOMIC_ACQUIRE))
+        sched_block();
+}
+
+static void pingpong(void *arg)
+{
+    for (int i = 0; i < PINGPONG_YIELDS; i++)
+        sched_yield();
+
+    finished();
+}
+
+static void noop(void *arg)
+{
+    __atomic_sub_fetch(&remaining, 1, __ATOMIC_RELAXED);
+}
+
+static void spin(void *arg)
+{
+    for (uint64_t i = 0; i < SPREAD_WORK; i++)
+        bench_clobber();
+
+    finished();
+}
+
+static void bench_pingpong(void)
+{
+    struct sched_stats before, after;
+
+    waiter = this_thread();
+    remaining = 2;
+
+    struct bench_pmu pmu;
+
+    sched_get_stats(cpu_id(), &before);
+    bench_pmu_begin(&pmu, true);
+    uint64_t start = bench_begin();
+
+    if (!thread_create("ping", pingpong, NULL, SCHED_PRIO_NORMAL, THREAD_PINNED)
+     || !thread_create("pong", pingpong, NULL, SCHED_PRIO_NORMAL, THREAD_PINNED)) {
+        kprint("sched   cannot create threads\n");
+        return;
+    }
+
+    wait_all();
+
+    uint64_t cycles = bench_end() - start;
+    sched_get_stats(cpu_id(), &after);
+
+    uint64_t switches = after.switches - before.switches;
+
+    kprint("sched   pingpong  ");
+    bench_print_ns(cycles, switches);
+    kprintf(" ns/switch  (%lu switches)\n", switches);
+
+    // kmain slept through it, the pinned pair is what the cpu counted
+    bench_pmu_report("sched  ", &pmu, switches, "switch");
+}
+
+static void bench_create(void)
+{
+    remaining = CREATE_THREADS;
+
+    uint64_t start = bench_begin();
+
+    // each one runs and is reaped before we get the cpu back
+    for (int i = 0; i < CREATE_THREADS; i++) {
+        if (!thread_create("noop", noop, NULL, SCHED_PRIO_NORMAL, THREAD_PINNED)) {
+            kprint("sched   cannot create threads\n");
+            return;
+        }
+        sched_yield();
+    }
+
+    uint64_t cycles = bench_end() - start;
+
+    kprint("sched   create    ");
+    bench_print_ns(cycles, CREATE_THREADS);
+    kprint(" ns/thread  ");
+    bench_print_rate(CREATE_THREADS, cycles, "threads/s");
+    kprintf("%s\n", remaining ? "  (some never ran!)" : "");
+}
+
+static uint64_t total_steals(void)
+{
+    uint64_t steals = 0;
+
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        struct sched_stats s;
+        sched_get_stats(i, &s);
+        steals += s.steals;
+    }
+
+    return steals;
+}
+
+static void bench_spread(void)
+{
+    waiter = this_thread();
+
+    for (uint32_t n = 1; n; n = bench_next_cpus(n)) {
+        sched_set_steal_cpus(n);
+        remaining = SPREAD_THREADS;
+
+        uint64_t steals = total_steals();
+        uint64_t start = bench_begin();
+
+        for (int i = 0; i < SPREAD_THREADS; i++) {
+            if (!thread_create("spin", spin, NULL, SCHED_PRIO_NORMAL, 0))
+                panic("bench: cannot create threads");
+        }
+
+        wait_all();
+
+        uint64_t cycles = bench_end() - start;
+
+        kprintf("sched   spread    %2u cpus  ", n);
+        bench_print_rate((uint64_t)SPREAD_THREADS * SPREAD_WORK, cycles, "iterations/s");
+        kprintf("  (%lu steals)\n", total_steals() - steals);
+    }
+
+    sched_set_steal_cpus(MAX_CPUS);
+}
+
+void bench_sched(void)
+{
+    bench_pingpong();
+    bench_create();
+    bench_spread();
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <serial.h>
+#include <bench.h>
+
+/**
+ * serial tx: what a writer pays to hand over a burst when it spins on
+ * lsr itself against copying into the irq-fed ring, and how long the
+ * ring takes to reach the wire. the burst is larger than the ring so
+ * the stall path is exercised too.
+ */
+
+#define SERIAL_LINE     64
+#define SERIAL_VOLUME   (32 * 1024)
+
+static char line[SERIAL_LINE];
+
+static uint64_t write_burst(void)
+{
+    uint64_t start = bench_begin();
+
+    for (size_t done = 0; done < SERIAL_VOLUME; done += SERIAL_LINE)
+        serial_write_len(line, SERIAL_LINE);
+
+    return bench_end() - start;
+}
+
+static void report(const char *what, uint64_t cycles, uint64_t stalls)
+{
+    kprintf("serial  %-10s", what);
+    bench_print_size(SERIAL_VOLUME);
+    kprint("  ");
+    bench_print_rate(SERIAL_VOLUME, cycles, "B/s");
+    kprintf("  %lu stalls\n", stalls);
+}
+
+void bench_serial(void)
+{
+    struct serial_stats before, after;
+
+    memset(line, '.', SERIAL_LINE - 1);
+    line[SERIAL_LINE - 1] = '\n';
+
+    serial_set_polled(true);
+    uint64_t polled = write_burst();
+    serial_set_polled(false);
+
+    serial_get_stats(&before);
+    uint64_t start = bench_begin();
+    uint64_t queued = write_burst();
+    serial_flush();
+    uint64_t drained = bench_end() - start;
+    serial_get_stats(&after);
+
+    report("polled", polled, 0);
+    report("ring", queued, after.stalls - before.stalls);
+    report("ring+wire", drained, after.stalls - before.stalls);
+    kprintf("serial  %lu irqs, %lu bytes sent total\n",
+            after.irqs - before.irqs, after.tx_bytes);
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <slab.h>
+#include <percpu.h>
+#include <bench.h>
+
+/**
+ * object alloc/free latency with the per-cpu magazines against the same
+ * cache going straight to the locked slab layer. the burst pattern holds
+ * more objects than two magazines, so it also covers depot traffic.
+ */
+
+#define SLAB_PAIRS  100000
+#define SLAB_BURST  256
+
+#define SLAB_SCALE_PAIRS 20000  // per cpu
+
+static void *held[SLAB_BURST];
+
+static const size_t sizes[] = { 32, 256, 2048 };
+
+static void report(const char *variant, size_t size, const char *pattern,
+                   uint64_t pairs, uint64_t cycles)
+{
+    kprintf("slab    %-8s%5zu  %-9s", variant, size, pattern);
+    bench_print_ns(cycles, pairs);
+    kprint(" ns/pair\n");
+}
+
+static void run(const char *variant, struct kmem_cache *c, size_t size)
+{
+    uint64_t start = bench_begin();
+    for (int i = 0; i < SLAB_PAIRS; i++)
+        kmem_cache_free(c, kmem_cache_alloc(c));
+    uint64_t pingpong = bench_end() - start;
+
+    start = bench_begin();
+    for (int r = 0; r < SLAB_PAIRS / SLAB_BURST; r++) {
+        for (int i = 0; i < SLAB_BURST; i++)
+            held[i] = kmem_cache_alloc(c);
+        for (int i = 0; i < SLAB_BURST; i++)
+            kmem_cache_free(c, held[i]);
+    }
+    uint64_t bursts = bench_end() - start;
+
+    report(variant, size, "pingpong", SLAB_PAIRS, pingpong);
+    report(variant, size, "burst", (SLAB_PAIRS / SLAB_BURST) * SLAB_BURST, bursts);
+}
+
+/**
+ * one shared cache hammered from 1, 2, 4 ... cpus at once. the magazine
+ * layer keeps each cpu off the cache lock, the raw cache takes it on
+ * every call.
+ */
+static void scale_worker(void *p)
+{
+    struct kmem_cache *c = p;
+
+    for (int i = 0; i < SLAB_SCALE_PAIRS; i++)
+        kmem_cache_free(c, kmem_cache_alloc(c));
+}
+
+static void scale(const char *variant, struct kmem_cache *c, size_t size)
+{
+    for (uint32_t n = 1; n; n = bench_next_cpus(n)) {
+        uint64_t cycles = bench_parallel(n, scale_worker, c);
+
+        kprintf("slab    %-8s%5zu  %2u cpus   ", variant, size, n);
+        bench_print_rate((uint64_t)n * SLAB_SCALE_PAIRS, cycles, "pairs/s");
+        kprint("\n");
+    }
+}
+
+void bench_slab(void)
+{
+    kprintf("slab    1 cpu\n");
+
+    for (size_t i = 0; i < ARRAY_LEN(sizes); i++) {
+        struct kmem_cache *mag = kmem_cache_create("bench-mag", sizes[i], 64, NULL, 0);
+        struct kmem_cache *raw = kmem_cache_create("bench-raw", sizes[i], 64, NULL,
+                                                   KMEM_NO_MAGAZINE);
+        if (!mag || !raw) {
+            kprint("slab    cannot create bench caches\n");
+            return;
+        }
+
+        run("magazine", mag, sizes[i]);
+        run("slab", raw, sizes[i]);
+
+        if (cpu_count > 1) {
+            scale("magazine", mag, sizes[i]);
+            scale("slab", raw, sizes[i]);
+        }
+    }
+
+    uint64_t start = bench_begin();
+    for (int i = 0; i < SLAB_PAIRS; i++)
+        kfree(kmalloc(100));
+    uint64_t cycles = bench_end() - start;
+    report("kmalloc", 100, "pingpong", SLAB_PAIRS, cycles);
+
+    kmem_dump_stats();
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <cpuid.h>
+#include <klib.h>
+#include <bench.h>
+
+/**
+ * string routines: first a differential pass that runs every variant
+ * against a byte-at-a-time reference over random lengths, alignments
+ * and mismatch positions, then throughput against the old byte loop.
+ */
+
+#define STR_BUF      (64 * 1024)
+#define STR_ROUNDS   20000
+#define STR_VOLUME   (32 * 1024 * 1024)
+
+static uint8_t buf_a[STR_BUF + 64] ALIGNED(64);
+static uint8_t buf_b[STR_BUF + 64] ALIGNED(64);
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int sign(int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+// the klib memcmp before it was vectorized, kept as the reference
+static int memcmp_bytes(const void *s1, const void *s2, size_t n)
+{
+    const uint8_t *p1 = s1;
+    const uint8_t *p2 = s2;
+
+    for (size_t i = 0; i < n; i++) {
+        if (p1[i] != p2[i])
+            return p1[i] < p2[i] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static const void *memchr_bytes(const void *s, int c, size_t n)
+{
+    const uint8_t *p = s;
+
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] == (uint8_t)c)
+            return p + i;
+    }
+
+    return NULL;
+}
+
+static size_t strlen_bytes(const char *s)
+{
+    size_t n = 0;
+
+    while (s[n])
+        n++;
+
+    return n;
+}
+
+struct cmp_variant
+{
+    const char *name;
+    memcmp_fn fn;
+    bool *needs;
+};
+
+static const struct cmp_variant cmp_variants[] =
+{
+    { "bytes", memcmp_bytes, NULL },
+    { "word",  memcmp_word,  NULL },
+    { "sse2",  memcmp_sse2,  NULL },
+    { "avx2",  memcmp_avx2,  &cpu_features.avx2 },
+};
+
+static bool usable(bool *needs)
+{
+    return !needs || *needs;
+}
+
+static void fill_random(uint8_t *p, size_t n)
+{
+    // a small alphabet so strings and buffers agree for a while
+    for (size_t i = 0; i < n; i++)
+        p[i] = (uint8_t)('a' + rng() % 4);
+}
+
+static size_t check_variants(void)
+{
+    size_t failures = 0;
+
+    for (size_t round = 0; round < STR_ROUNDS; round++) {
+        size_t n = rng() % (round & 7 ? 300 : 4000);
+        uint8_t *a = buf_a + rng() % 64;
+        uint8_t *b = buf_b + rng() % 64;
+
+        fill_random(a, n + 1);
+        for (size_t i = 0; i <= n; i++)
+            b[i] = a[i];
+        if (n && (rng() & 1))
+            b[rng() % n] = (uint8_t)('a' + rng() % 6);
+
+        int want = sign(memcmp_bytes(a, b, n));
+        failures += sign(memcmp_word(a, b, n)) != want;
+        failures += sign(memcmp_sse2(a, b, n)) != want;
+        if (cpu_features.avx2)
+            failures += sign(memcmp_avx2(a, b, n)) != want;
+
+        int c = 'a' + (int)(rng() % 6);
+        const void *hit = memchr_bytes(a, c, n);
+        failures += memchr_word(a, c, n) != hit;
+        failures += memchr_sse2(a, c, n) != hit;
+        if (cpu_features.avx2)
+            failures += memchr_avx2(a, c, n) != hit;
+
+        a[n] = 0;
+        b[n] = 0;
+        if (n > 1 && rng() % 3 == 0)
+            b[rng() % n] = 0;
+
+        size_t len = strlen_bytes((const char *)a);
+        failures += strlen_word((const char *)a) != len;
+        failures += strlen_sse2((const char *)a) != len;
+        if (cpu_features.avx2)
+            failures += strlen_avx2((const char *)a) != len;
+
+        want = sign(strcmp_byte((const char *)a, (const char *)b));
+        if (cpu_features.sse42)
+            failures += sign(strcmp_sse42((const char *)a,
+                                          (const char *)b)) != want;
+    }
+
+    return failures;
+}
+
+static void bench_memcmp(void)
+{
+    // equal buffers, so every variant has to look at every byte
+    for (size_t i = 0; i < STR_BUF; i++)
+        buf_a[i] = buf_b[i] = (uint8_t)i;
+
+    for (size_t v = 0; v < ARRAY_LEN(cmp_variants); v++) {
+        if (!usable(cmp_variants[v].needs))
+            continue;
+
+        for (size_t size = 16; size <= STR_BUF; size *= 4) {
+            size_t iters = STR_VOLUME / size;
+            int sink = 0;
+
+            uint64_t t0 = bench_begin();
+            for (size_t it = 0; it < iters; it++) {
+                sink |= cmp_variants[v].fn(buf_a, buf_b, size);
+                bench_clobber();
+            }
+            uint64_t t1 = bench_end();
+
+            if (sink)
+                kprint("memcmp: bogus mismatch\n");
+
+            bench_report_bw("memcmp", cmp_variants[v].name, size,
+                            (uint64_t)size * iters, t1 - t0);
+        }
+    }
+}
+
+static void bench_scan(void)
+{
+    for (size_t i = 0; i < STR_BUF; i++)
+        buf_a[i] = 'x';
+    buf_a[STR_BUF - 1] = 0;
+
+    for (size_t i = 0; i < STR_BUF; i++)
+        buf_b[i] = buf_a[i];
+
+    for (size_t size = 16; size <= STR_BUF; size *= 4) {
+        size_t iters = STR_VOLUME / size;
+        const char *s = (const char *)buf_a + STR_BUF - size;
+
+        uint64_t t0 = bench_begin();
+        for (size_t it = 0; it < iters; it++) {
+            (void)strlen(s);
+            bench_clobber();
+        }
+        uint64_t t1 = bench_end();
+        bench_report_bw("strlen", "dispatch", size,
+                        (uint64_t)size * iters, t1 - t0);
+
+        t0 = bench_begin();
+        for (size_t it = 0; it < iters; it++) {
+            (void)memchr(buf_a, 'y', size);
+            bench_clobber();
+        }
+        t1 = bench_end();
+        bench_report_bw("memchr", "dispatch", size,
+                        (uint64_t)size * iters, t1 - t0);
+
+        t0 = bench_begin();
+        for (size_t it = 0; it < iters; it++) {
+            (void)strcmp(s, (const char *)buf_b + STR_BUF - size);
+            bench_clobber();
+        }
+        t1 = bench_end();
+        bench_report_bw("strcmp", "dispatch", size,
+                        (uint64_t)size * iters, t1 - t0);
+    }
+}
+
+void bench_string(void)
+{
+    size_t failures = check_variants();
+
+    kprint("string: differential check ");
+    if (failures) {
+        bench_print_u64(failures);
+        kprint(" mismatches\n");
+    } else {
+        kprint("ok\n");
+    }
+
+    bench_memcmp();
+    bench_scan();
+}
+
+#endif
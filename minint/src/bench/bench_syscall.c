@@ -0,0 +1,97 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <klib.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <sched.h>
+#include <syscall.h>
+#include <bench.h>
+
+/**
+ * the null system call round trip: a ring 3 loop that makes SYS_NULL
+ * SYSCALL_ROUNDS times and then SYS_EXIT, in an address space of its
+ * own with one code and one stack page. the time covers the whole
+ * excursion, user_run() in and out included, spread over the calls.
+ * the space itself stays behind, nothing tears one down yet.
+ */
+
+#define SYSCALL_ROUNDS  1000000
+#define USER_CODE       0x400000ull
+#define USER_STACK      0x800000ull
+
+static const uint8_t user_loop[] = {
+    0x48, 0x89, 0xFB,               // mov rbx, rdi
+    0x31, 0xC0,                     // 1: xor eax, eax (SYS_NULL)
+    0x0F, 0x05,                     // syscall
+    0x48, 0xFF, 0xCB,               // dec rbx
+    0x75, 0xF7,                     // jnz 1b
+    0xB8, SYS_EXIT, 0x00, 0x00, 0x00,   // mov eax, SYS_EXIT
+    0x31, 0xFF,                     // xor edi, edi
+    0x0F, 0x05,                     // syscall
+    0x0F, 0x0B,                     // ud2
+};
+
+static volatile bool done;
+static struct thread *waiter;
+static uint64_t result;
+
+static void run(void *arg)
+{
+    struct vmm_space *space = arg;
+
+    vmm_switch(space);
+
+    uint64_t start = bench_begin();
+    user_run(USER_CODE, USER_STACK + PAGE_SIZE, SYSCALL_ROUNDS);
+    result = bench_end() - start;
+
+    vmm_switch(&kernel_space);
+
+    done = true;
+    sched_wake(waiter);
+}
+
+void bench_syscall(void)
+{
+    struct vmm_space *space = vmm_create_space();
+    uint64_t code = pmm_alloc_page();
+    uint64_t stack = pmm_alloc_page();
+
+    if (!space || !code || !stack
+     || !vmm_map(space, USER_CODE, code, PAGE_SIZE, PTE_PRESENT | PTE_USER)
+     || !vmm_map(space, USER_STACK, stack, PAGE_SIZE,
+                 PTE_PRESENT | PTE_WRITE | PTE_USER | PTE_NX)) {
+        kprint("syscall cannot set up user memory\n");
+        return;
+    }
+
+    memcpy(phys_to_virt(code), user_loop, sizeof(user_loop));
+
+    waiter = this_thread();
+    done = false;
+
+    // user_run() wants a stack of its own, kmain runs on the boot one
+    if (!thread_create("user", run, space, SCHED_PRIO_NORMAL, THREAD_PINNED)) {
+        kprint("syscall cannot create a thread\n");
+        return;
+    }
+
+    while (!done)
+        sched_block();
+
+    kprintf("syscall null      %lu cycles/round trip, ", result / SYSCALL_ROUNDS);
+    bench_print_ns(result, SYSCALL_ROUNDS);
+    kprint(" ns\n");
+
+    vmm_unmap(space, USER_CODE, PAGE_SIZE);
+    vmm_unmap(space, USER_STACK, PAGE_SIZE);
+    pmm_free_page(code);
+    pmm_free_page(stack);
+}
+
+#endif
@@ -0,0 +1,133 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <percpu.h>
+#include <sched.h>
+#include <timer.h>
+#include <bench.h>
+
+/**
+ * what reading the clock costs, the interrupt load of an idle system
+ * (kmain asleep, nothing else queued) and how late one-shot timers fire
+ * relative to their deadline.
+ */
+
+#define CLOCK_READS     1000000
+#define IDLE_MS         1000
+#define JITTER_SHOTS    2000
+#define JITTER_BUCKETS  12      // 100 ns << n, the last one open ended
+
+static uint64_t hist[JITTER_BUCKETS];
+static uint64_t worst;
+static volatile bool fired;
+static struct thread *waiter;
+
+static uint64_t interrupts(void)
+{
+    uint64_t n = 0;
+
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        struct timer_stats t;
+        struct sched_stats s;
+
+        timer_get_stats(i, &t);
+        sched_get_stats(i, &s);
+        n += t.irqs + s.ipis;
+    }
+
+    return n;
+}
+
+static void bench_clock(void)
+{
+    uint64_t start = bench_begin();
+
+    // rdtsc is volatile asm, the unused reads stay in
+    for (int i = 0; i < CLOCK_READS; i++)
+        ktime_get_ns();
+
+    uint64_t cycles = bench_end() - start;
+
+    kprint("timer   ktime_get_ns  ");
+    bench_print_ns(cycles, CLOCK_READS);
+    kprintf(" ns/call  (%lu cycles/call)\n", cycles / CLOCK_READS);
+}
+
+static void bench_idle(void)
+{
+    uint64_t before = interrupts();
+    uint64_t start = rdtsc();
+
+    sched_sleep_until(start + timer_ms(IDLE_MS));
+
+    uint64_t cycles = rdtsc() - start;
+    uint64_t n = interrupts() - before;
+
+    kprintf("timer   idle      %lu irqs over %u cpus in %lu ms, ", n, cpu_count,
+            ktime_cycles_to_ns(cycles) / 1000000);
+    bench_print_rate(n, cycles, "irqs/s");
+    kprint("\n");
+}
+
+static void shot(void *arg)
+{
+    uint64_t late = ktime_cycles_to_ns(rdtsc() - *(uint64_t *)arg);
+    unsigned b = 0;
+
+    while (b < JITTER_BUCKETS - 1 && late >= (100ul << b))
+        b++;
+
+    hist[b]++;
+    if (late > worst)
+        worst = late;
+
+    fired = true;
+    sched_wake(waiter);
+}
+
+static void bench_jitter(void)
+{
+    struct timer t;
+    uint64_t deadline;
+
+    waiter = this_thread();
+    worst = 0;
+    memset(hist, 0, sizeof(hist));
+
+    for (int i = 0; i < JITTER_SHOTS; i++) {
+        // 50-800 us out, spread so the deadline never lines up with anything
+        deadline = rdtsc() + timer_us(50 + (uint64_t)(i * 37) % 750);
+        fired = false;
+
+        timer_add(&t, deadline, shot, &deadline);
+        while (!fired)
+            sched_block();
+    }
+
+    kprintf("timer   jitter    %d shots, worst %lu ns\n", JITTER_SHOTS, worst);
+
+    for (unsigned b = 0; b < JITTER_BUCKETS; b++) {
+        if (!hist[b])
+            continue;
+
+        if (b < JITTER_BUCKETS - 1)
+            kprintf("timer     < %7lu ns  %lu\n", 100ul << b, hist[b]);
+        else
+            kprintf("timer     >=%7lu ns  %lu\n", 100ul << (b - 1), hist[b]);
+    }
+}
+
+void bench_timer(void)
+{
+    kprintf("timer   %s\n", timer_mode());
+
+    bench_clock();
+    bench_idle();
+    bench_jitter();
+}
+
+#endif
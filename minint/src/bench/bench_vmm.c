@@ -0,0 +1,100 @@
+#ifdef CONFIG_BENCH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <bench.h>
+
+/**
+ * dtlb reach: random loads across a 4 GiB window, once mapped with 4 KiB
+ * pages and once with 2 MiB pages. the window aliases a small pool of
+ * physical blocks over and over, so both runs touch the same memory and
+ * the difference is down to tlb misses and page walks.
+ */
+
+#define TLB_SPAN        (4ull << 30)
+#define TLB_POOL_BLOCKS 8                               // order 10, 4 MiB each
+#define TLB_BLOCK       (PAGE_SIZE << PMM_MAX_ORDER)
+#define TLB_LOADS       (1u << 20)
+
+static uint64_t pool[TLB_POOL_BLOCKS];
+
+static bool map_window(uint64_t flags)
+{
+    for (uint64_t off = 0; off < TLB_SPAN; off += TLB_BLOCK) {
+        uint64_t phys = pool[(off / TLB_BLOCK) % TLB_POOL_BLOCKS];
+        if (!vmm_map(&kernel_space, VMM_KVA_BASE + off, phys, TLB_BLOCK, flags))
+            return false;
+    }
+
+    return true;
+}
+
+static uint64_t random_loads(void)
+{
+    uint64_t x = 0x9E3779B97F4A7C15ull;
+    uint64_t sum = 0;
+    uint64_t start = bench_begin();
+
+    for (uint32_t i = 0; i < TLB_LOADS; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        sum += *(volatile uint64_t *)(VMM_KVA_BASE + (x & (TLB_SPAN - 64)));
+    }
+
+    uint64_t cycles = bench_end() - start;
+    (void)sum;
+
+    return cycles;
+}
+
+static void run(const char *variant, uint64_t flags)
+{
+    if (!map_window(VMM_KERNEL_RW | flags)) {
+        kprintf("vmm     %s: cannot map the window\n", variant);
+        vmm_unmap(&kernel_space, VMM_KVA_BASE, TLB_SPAN);
+        return;
+    }
+
+    struct bench_pmu pmu;
+
+    // first pass faults the pool into the caches, second is the one we keep
+    random_loads();
+    bench_pmu_begin(&pmu, false);
+    uint64_t cycles = random_loads();
+
+    kprintf("vmm     %-6s random 8B loads over 4GiB  ", variant);
+    bench_print_ns(cycles, TLB_LOADS);
+    kprint(" ns/load\n");
+    bench_pmu_report("vmm    ", &pmu, TLB_LOADS, "load");
+
+    vmm_unmap(&kernel_space, VMM_KVA_BASE, TLB_SPAN);
+}
+
+void bench_vmm(void)
+{
+    size_t n;
+
+    for (n = 0; n < TLB_POOL_BLOCKS; n++) {
+        pool[n] = pmm_alloc_pages(PMM_MAX_ORDER);
+        if (!pool[n])
+            break;
+    }
+
+    if (n == TLB_POOL_BLOCKS) {
+        run("4KiB", VMM_SMALL);
+        run("2MiB", 0);
+    } else {
+        kprint("vmm     not enough memory for the tlb pool\n");
+    }
+
+    while (n--)
+        pmm_free_pages(pool[n], PMM_MAX_ORDER);
+}
+
+#endif
@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <vmm.h>
+#include <acpi.h>
+
+struct rsdp
+{
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    // revision 2 and up
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} PACKED;
+
+static const struct acpi_header *root;     // xsdt, or rsdt on acpi 1.0
+static bool root_is_xsdt;
+
+static bool checksum_ok(const void *p, size_t len)
+{
+    const uint8_t *b = p;
+    uint8_t sum = 0;
+
+    for (size_t i = 0; i < len; i++)
+        sum += b[i];
+
+    return sum == 0;
+}
+
+// the header first, to learn how much of the table to map
+static const struct acpi_header *map_table(uint64_t phys)
+{
+    const struct acpi_header *h = vmm_map_mmio(phys, sizeof(*h), MEMTYPE_WB);
+
+    if (!h)
+        return NULL;
+
+    h = vmm_map_mmio(phys, h->length, MEMTYPE_WB);
+    if (!h || !checksum_ok(h, h->length))
+        return NULL;
+
+    return h;
+}
+
+void acpi_init(uint64_t rsdp_phys)
+{
+    const struct rsdp *rsdp = vmm_map_mmio(rsdp_phys, sizeof(*rsdp), MEMTYPE_WB);
+
+    if (!rsdp || memcmp(rsdp->signature, "RSD PTR ", 8) || !checksum_ok(rsdp, 20)) {
+        klog(LOG_WARN, "acpi: no valid rsdp");
+        return;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address) {
+        root = map_table(rsdp->xsdt_address);
+        root_is_xsdt = true;
+    } else {
+        root = map_table(rsdp->rsdt_address);
+    }
+
+    if (!root)
+        klog(LOG_WARN, "acpi: bad root table");
+}
+
+const struct acpi_header *acpi_find_table(const char *signature)
+{
+    if (!root)
+        return NULL;
+
+    size_t width = root_is_xsdt ? 8 : 4;
+    size_t count = (root->length - sizeof(*root)) / width;
+    const uint8_t *entries = (const uint8_t *)(root + 1);
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t phys = 0;
+        memcpy(&phys, entries + i * width, width);
+
+        // only the header until the signature matches
+        const struct acpi_header *h = vmm_map_mmio(phys, sizeof(*h), MEMTYPE_WB);
+        if (h && !memcmp(h->signature, signature, 4))
+            return map_table(phys);
+    }
+
+    return NULL;
+}
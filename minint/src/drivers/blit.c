@@ -0,0 +1,210 @@
+#include <immintrin.h>
+
+#include "blit.h"
+#include "system.h"
+#include "cpuid.h"
+#include "memstring.h"
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+typedef void (*fill_span_fn)(uint32_t *d, uint32_t color, size_t n);
+typedef void (*copy_span_fn)(uint32_t *d, const uint32_t *s, size_t n);
+
+/**
+ * span helpers: single pixels with movnti until the destination is
+ * vector aligned, then full-width streaming stores, then the tail.
+ * none of them fence, the public entry points do that once at the end.
+ */
+SSE2 static void fill_span_sse2(uint32_t *d, uint32_t color, size_t n)
+{
+    for (; n && ((uintptr_t)d & 15); n--)
+        _mm_stream_si32((int *)d++, (int)color);
+
+    __m128i v = _mm_set1_epi32((int)color);
+
+    for (; n >= 16; n -= 16, d += 16) {
+        _mm_stream_si128((__m128i *)d, v);
+        _mm_stream_si128((__m128i *)(d + 4), v);
+        _mm_stream_si128((__m128i *)(d + 8), v);
+        _mm_stream_si128((__m128i *)(d + 12), v);
+    }
+
+    for (; n >= 4; n -= 4, d += 4)
+        _mm_stream_si128((__m128i *)d, v);
+
+    for (; n; n--)
+        _mm_stream_si32((int *)d++, (int)color);
+}
+
+AVX2 static void fill_span_avx2(uint32_t *d, uint32_t color, size_t n)
+{
+    for (; n && ((uintptr_t)d & 31); n--)
+        _mm_stream_si32((int *)d++, (int)color);
+
+    __m256i v = _mm256_set1_epi32((int)color);
+
+    for (; n >= 32; n -= 32, d += 32) {
+        _mm256_stream_si256((__m256i *)d, v);
+        _mm256_stream_si256((__m256i *)(d + 8), v);
+        _mm256_stream_si256((__m256i *)(d + 16), v);
+        _mm256_stream_si256((__m256i *)(d + 24), v);
+    }
+
+    for (; n >= 8; n -= 8, d += 8)
+        _mm256_stream_si256((__m256i *)d, v);
+
+    for (; n; n--)
+        _mm_stream_si32((int *)d++, (int)color);
+}
+
+SSE2 static void copy_span_sse2(uint32_t *d, const uint32_t *s, size_t n)
+{
+    for (; n && ((uintptr_t)d & 15); n--)
+        _mm_stream_si32((int *)d++, (int)*s++);
+
+    for (; n >= 16; n -= 16, d += 16, s += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 4));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 8));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 12));
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 4), b);
+        _mm_stream_si128((__m128i *)(d + 8), c);
+        _mm_stream_si128((__m128i *)(d + 12), e);
+    }
+
+    for (; n >= 4; n -= 4, d += 4, s += 4)
+        _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+
+    for (; n; n--)
+        _mm_stream_si32((int *)d++, (int)*s++);
+}
+
+AVX2 static void copy_span_avx2(uint32_t *d, const uint32_t *s, size_t n)
+{
+    for (; n && ((uintptr_t)d & 31); n--)
+        _mm_stream_si32((int *)d++, (int)*s++);
+
+    for (; n >= 32; n -= 32, d += 32, s += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)s);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + 8));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(s + 16));
+        __m256i e = _mm256_loadu_si256((const __m256i *)(s + 24));
+        _mm256_stream_si256((__m256i *)d, a);
+        _mm256_stream_si256((__m256i *)(d + 8), b);
+        _mm256_stream_si256((__m256i *)(d + 16), c);
+        _mm256_stream_si256((__m256i *)(d + 24), e);
+    }
+
+    for (; n >= 8; n -= 8, d += 8, s += 8)
+        _mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+
+    for (; n; n--)
+        _mm_stream_si32((int *)d++, (int)*s++);
+}
+
+static inline fill_span_fn pick_fill(void)
+{
+    return cpu_features.avx2 ? fill_span_avx2 : fill_span_sse2;
+}
+
+static inline copy_span_fn pick_copy(void)
+{
+    return cpu_features.avx2 ? copy_span_avx2 : copy_span_sse2;
+}
+
+static inline void store_fence(void)
+{
+    asm volatile ("sfence" ::: "memory");
+}
+
+// clip a w x h rect at (x, y) to the surface, false if nothing is left
+static bool clip(const struct blit_surface *s, uint32_t x, uint32_t y,
+                 uint32_t *w, uint32_t *h)
+{
+    if (x >= s->width || y >= s->height)
+        return false;
+
+    if (*w > s->width - x)
+        *w = s->width - x;
+    if (*h > s->height - y)
+        *h = s->height - y;
+
+    return *w && *h;
+}
+
+void blit_fill_rect(const struct blit_surface *s, uint32_t x, uint32_t y,
+                    uint32_t w, uint32_t h, uint32_t color)
+{
+    if (!clip(s, x, y, &w, &h))
+        return;
+
+    fill_span_fn fill = pick_fill();
+    uint32_t *row = s->base + (size_t)y * s->stride + x;
+
+    // a full-width rect over a packed surface is one long span
+    if (x == 0 && w == s->stride) {
+        fill(row, color, (size_t)w * h);
+    } else {
+        for (uint32_t i = 0; i < h; i++, row += s->stride)
+            fill(row, color, w);
+    }
+
+    store_fence();
+}
+
+void blit_copy_rect(const struct blit_surface *s, uint32_t dx, uint32_t dy,
+                    uint32_t sx, uint32_t sy, uint32_t w, uint32_t h)
+{
+    if (!clip(s, dx, dy, &w, &h) || !clip(s, sx, sy, &w, &h))
+        return;
+
+    uint32_t *dst = s->base + (size_t)dy * s->stride + dx;
+    const uint32_t *src = s->base + (size_t)sy * s->stride + sx;
+
+    // rows overlap sideways only when they are the same rows
+    if (dy == sy) {
+        for (uint32_t i = 0; i < h; i++, dst += s->stride, src += s->stride)
+            memmove(dst, src, (size_t)w * sizeof(uint32_t));
+        return;
+    }
+
+    copy_span_fn copy = pick_copy();
+
+    if (dy < sy) {
+        for (uint32_t i = 0; i < h; i++, dst += s->stride, src += s->stride)
+            copy(dst, src, w);
+    } else {
+        dst += (size_t)(h - 1) * s->stride;
+        src += (size_t)(h - 1) * s->stride;
+        for (uint32_t i = 0; i < h; i++, dst -= s->stride, src -= s->stride)
+            copy(dst, src, w);
+    }
+
+    store_fence();
+}
+
+void blit_put(const struct blit_surface *s, uint32_t x, uint32_t y,
+              const uint32_t *src, size_t src_stride, uint32_t w, uint32_t h)
+{
+    if (!clip(s, x, y, &w, &h))
+        return;
+
+    copy_span_fn copy = pick_copy();
+    uint32_t *dst = s->base + (size_t)y * s->stride + x;
+
+    for (uint32_t i = 0; i < h; i++, dst += s->stride, src += src_stride)
+        copy(dst, src, w);
+
+    store_fence();
+}
+
+void blit_clear(const struct blit_surface *s, uint32_t color)
+{
+    // clear the pitch padding too, it is one contiguous span that way
+    fill_span_fn fill = pick_fill();
+
+    fill(s->base, color, s->stride * s->height);
+    store_fence();
+}
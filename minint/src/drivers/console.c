@@ -1,8 +1,18 @@
+#include <immintrin.h>
+
 #include "console.h"
 #include "font8x16.h"
+#include "system.h"
+#include "cpuid.h"
+#include "memstring.h"
+#include "blit.h"
+#include "vmm.h"
+#include "pat.h"
+#include "boottrace.h"
 
 static struct limine_framebuffer *fb;
 static uint32_t *fb_ptr;
+static struct blit_surface screen;
 
 static uint32_t fb_width;
 static uint32_t fb_height;
@@ -14,12 +24,143 @@ static size_t cursor_y = 0;
 #define FONT_W 8
 #define FONT_H 16
 
+#define CONSOLE_FG 0xffffff
+#define CONSOLE_BG 0x000000
+
+/**
+ * the screen contents live in a text-cell grid in ordinary ram. the grid
+ * is a ring of rows: scrolling advances ring_top and re-renders, so the
+ * framebuffer (uncached or write-combining) is never read back.
+ */
+#define CONSOLE_MAX_COLS 512
+#define CONSOLE_MAX_ROWS 256
+
+static uint8_t cells[CONSOLE_MAX_ROWS][CONSOLE_MAX_COLS];
+static size_t text_cols;
+static size_t text_rows;
+static size_t ring_top;
+
+// one composed text row, handed to the blitter in a single go
+#define ROWBUF_STRIDE (CONSOLE_MAX_COLS * FONT_W)
+static uint32_t rowbuf[FONT_H][ROWBUF_STRIDE] ALIGNED(64);
+
+/**
+ * in deferred mode writes only touch the cell grid and set a bit per
+ * dirty screen row; console_flush() renders the dirty rows in one pass.
+ * a scroll dirties every row, so any number of scrolls between two
+ * flushes costs a single redraw. the pending count forces a flush once
+ * about a screenful of output has piled up, and klogd's wakeups flush
+ * whatever is left every 10 to 100 ms.
+ */
+static enum console_mode mode = CONSOLE_SYNC;
+static uint64_t dirty[CONSOLE_MAX_ROWS / 64];
+static size_t pending;
+
+/**
+ * every possible 8 pixel glyph row, already expanded to the current
+ * fg/bg pair. drawing a glyph row is then one table lookup and a single
+ * 32 byte store instead of eight bit tests and pixel writes.
+ */
+static uint32_t glyph_rows[256][FONT_W] ALIGNED(32);
+static uint32_t glyph_fg;
+static uint32_t glyph_bg;
+static bool glyph_rows_valid;
+
+#ifdef CONFIG_BENCH
+static bool render_bitwise;
+static bool scroll_readback;
+#endif
+
+static void expand_glyph_rows(uint32_t fg, uint32_t bg)
+{
+    for (size_t bits = 0; bits < 256; bits++)
+        for (size_t col = 0; col < FONT_W; col++)
+            glyph_rows[bits][col] = (bits & (0x80 >> col)) ? fg : bg;
+
+    glyph_fg = fg;
+    glyph_bg = bg;
+    glyph_rows_valid = true;
+}
+
+static inline uint8_t *cell_row(size_t row)
+{
+    size_t idx = ring_top + row;
+
+    if (idx >= text_rows)
+        idx -= text_rows;
+
+    return cells[idx];
+}
+
+__attribute__((target("sse2")))
+static void draw_rows_sse2(uint32_t *dst, size_t stride, const uint8_t *glyph)
+{
+    for (size_t row = 0; row < FONT_H; row++, dst += stride) {
+        const __m128i *src = (const __m128i *)glyph_rows[glyph[row]];
+        _mm_storeu_si128((__m128i *)dst, _mm_load_si128(src));
+        _mm_storeu_si128((__m128i *)(dst + 4), _mm_load_si128(src + 1));
+    }
+}
+
+__attribute__((target("avx2")))
+static void draw_rows_avx2(uint32_t *dst, size_t stride, const uint8_t *glyph)
+{
+    for (size_t row = 0; row < FONT_H; row++, dst += stride) {
+        const __m256i *src = (const __m256i *)glyph_rows[glyph[row]];
+        _mm256_storeu_si256((__m256i *)dst, _mm256_load_si256(src));
+    }
+}
+
+__attribute__((target("sse2")))
+static void compose_scanline_sse2(const uint8_t *text, size_t scan)
+{
+    for (size_t col = 0; col < text_cols; col++) {
+        const __m128i *src = (const __m128i *)glyph_rows[font8x16[text[col]][scan]];
+        __m128i *dst = (__m128i *)&rowbuf[scan][col * FONT_W];
+        _mm_store_si128(dst, _mm_load_si128(src));
+        _mm_store_si128(dst + 1, _mm_load_si128(src + 1));
+    }
+}
+
+__attribute__((target("avx2")))
+static void compose_scanline_avx2(const uint8_t *text, size_t scan)
+{
+    for (size_t col = 0; col < text_cols; col++) {
+        const __m256i *src = (const __m256i *)glyph_rows[font8x16[text[col]][scan]];
+        _mm256_store_si256((__m256i *)&rowbuf[scan][col * FONT_W],
+                           _mm256_load_si256(src));
+    }
+}
+
+/**
+ * render one text row from the cell grid into rowbuf, then upload it,
+ * so the framebuffer only ever sees sequential full-width writes.
+ */
+static void render_row(size_t row)
+{
+    const uint8_t *text = cell_row(row);
+
+    if (!glyph_rows_valid)
+        expand_glyph_rows(CONSOLE_FG, CONSOLE_BG);
+
+    for (size_t scan = 0; scan < FONT_H; scan++) {
+        if (cpu_features.avx2)
+            compose_scanline_avx2(text, scan);
+        else
+            compose_scanline_sse2(text, scan);
+    }
+
+    blit_put(&screen, 0, (uint32_t)(row * FONT_H), &rowbuf[0][0],
+             ROWBUF_STRIDE, (uint32_t)(text_cols * FONT_W), FONT_H);
+}
+
+#ifdef CONFIG_BENCH
 static inline void putpixel(uint32_t x, uint32_t y, uint32_t color)
 {
     fb_ptr[y * (fb_pitch / 4) + x] = color;
 }
 
-static void draw_char(char c, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg)
+static void draw_char_bitwise(char c, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg)
 {
     const uint8_t *glyph = font8x16[(uint8_t)c];
 
@@ -31,21 +172,72 @@ static void draw_char(char c, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg)
         }
     }
 }
+#endif
 
-static void scroll(void)
+static void draw_char(char c, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg)
 {
+#ifdef CONFIG_BENCH
+    if (render_bitwise) {
+        draw_char_bitwise(c, x, y, fg, bg);
+        return;
+    }
+#endif
+
+    if (!glyph_rows_valid || fg != glyph_fg || bg != glyph_bg)
+        expand_glyph_rows(fg, bg);
+
     const size_t stride = fb_pitch / 4;
-    const size_t row_pixels = stride * FONT_H;
+    uint32_t *dst = fb_ptr + (size_t)y * stride + x;
+    const uint8_t *glyph = font8x16[(uint8_t)c];
+
+    if (cpu_features.avx2)
+        draw_rows_avx2(dst, stride, glyph);
+    else
+        draw_rows_sse2(dst, stride, glyph);
+}
 
-    for (size_t y = 0; y < fb_height - FONT_H; y++) {
-        fb_ptr[y * stride] = fb_ptr[(y + FONT_H) * stride];
-        for (size_t x = 0; x < fb_width; x++)
-            fb_ptr[y * stride + x] = fb_ptr[(y + FONT_H) * stride + x];
+#ifdef CONFIG_BENCH
+// the pre-shadow scroll, reading every pixel back from video memory
+static void scroll_framebuffer(void)
+{
+    blit_copy_rect(&screen, 0, 0, 0, FONT_H, fb_width, fb_height - FONT_H);
+    blit_fill_rect(&screen, 0, fb_height - FONT_H, fb_width, FONT_H, CONSOLE_BG);
+}
+#endif
+
+static inline void mark_dirty(size_t row)
+{
+    dirty[row / 64] |= 1ull << (row % 64);
+}
+
+static void mark_all_dirty(void)
+{
+    for (size_t i = 0; i < text_rows / 64; i++)
+        dirty[i] = ~0ull;
+    if (text_rows % 64)
+        dirty[text_rows / 64] |= (1ull << (text_rows % 64)) - 1;
+}
+
+static void scroll(void)
+{
+    // the old top row becomes the new, blank bottom row
+    memset(cell_row(0), ' ', text_cols);
+    ring_top = ring_top + 1 == text_rows ? 0 : ring_top + 1;
+
+    if (mode == CONSOLE_DEFERRED) {
+        mark_all_dirty();
+        return;
     }
 
-    for (size_t y = fb_height - FONT_H; y < fb_height; y++)
-        for (size_t x = 0; x < fb_width; x++)
-            putpixel(x, y, 0x000000);
+#ifdef CONFIG_BENCH
+    if (scroll_readback) {
+        scroll_framebuffer();
+        return;
+    }
+#endif
+
+    for (size_t row = 0; row < text_rows; row++)
+        render_row(row);
 }
 
 void console_init(struct limine_framebuffer *framebuffer)
@@ -57,56 +249,204 @@ void console_init(struct limine_framebuffer *framebuffer)
     fb_height = fb->height;
     fb_pitch = fb->pitch;
 
+    screen.base = fb_ptr;
+    screen.width = fb_width;
+    screen.height = fb_height;
+    screen.stride = fb_pitch / 4;
+
+    text_cols = fb_width / FONT_W;
+    text_rows = fb_height / FONT_H;
+    if (text_cols > CONSOLE_MAX_COLS)
+        text_cols = CONSOLE_MAX_COLS;
+    if (text_rows > CONSOLE_MAX_ROWS)
+        text_rows = CONSOLE_MAX_ROWS;
+
     cursor_x = cursor_y = 0;
+
+    // a full-screen fill, on large framebuffers the bulk of boot time
+    boottrace_mark("console clear");
     console_clear();
 }
 
 void console_clear(void) 
 {
-    for (size_t y = 0; y < fb_height; y++)
-        for (size_t x = 0; x < fb_width; x++)
-            putpixel(x, y, 0x000000);
+    blit_clear(&screen, CONSOLE_BG);
 
+    memset(cells, ' ', sizeof(cells));
+    memset(dirty, 0, sizeof(dirty));
+    ring_top = 0;
+    pending = 0;
     cursor_x = cursor_y = 0;
 }
 
-void console_putc(char c)
+void console_flush(void)
 {
-    if (c == '\n') {
-        cursor_x = 0;
-        cursor_y++;
-        goto check_scroll;
+    for (size_t i = 0; i < ARRAY_LEN(dirty); i++) {
+        while (dirty[i]) {
+            size_t bit = (size_t)__builtin_ctzll(dirty[i]);
+            dirty[i] &= dirty[i] - 1;
+            render_row(i * 64 + bit);
+        }
     }
 
-    draw_char(c, cursor_x * FONT_W, cursor_y * FONT_H, 0xffffff, 0x000000);
+    pending = 0;
+}
+
+void console_tick(void)
+{
+    if (pending)
+        console_flush();
+}
 
-    cursor_x++;
-    if (cursor_x * FONT_W >= fb_width) {
-        cursor_x = 0;
-        cursor_y++;
-    }
+void console_set_mode(enum console_mode new_mode)
+{
+    // anything still queued has to hit the screen before we go sync
+    if (new_mode == CONSOLE_SYNC)
+        console_flush();
+
+    mode = new_mode;
+}
+
+static void account(size_t n)
+{
+    if (mode != CONSOLE_DEFERRED)
+        return;
+
+    pending += n;
+    if (pending >= text_cols * text_rows)
+        console_flush();
+}
+
+static void newline(void)
+{
+    cursor_x = 0;
+    cursor_y++;
 
-check_scroll:
-    if ((cursor_y + 1) * FONT_H >= fb_height) {
+    if (cursor_y >= text_rows) {
         scroll();
         cursor_y--;
     }
 }
 
-void console_print(const char *s)
+/**
+ * write a run of text. everything up to the next newline or the end of
+ * the row goes into the cell grid with one copy, and the cursor, wrap
+ * and scroll checks happen once per run instead of once per character.
+ */
+void console_write(const char *s, size_t len)
 {
-    while (*s) {
-        console_putc(*s++);
+    while (len) {
+        if (*s == '\n') {
+            newline();
+            account(1);
+            s++;
+            len--;
+            continue;
+        }
+
+        size_t run = text_cols - cursor_x;
+        if (run > len)
+            run = len;
+
+        const char *nl = memchr(s, '\n', run);
+        if (nl)
+            run = (size_t)(nl - s);
+
+        memcpy(cell_row(cursor_y) + cursor_x, s, run);
+
+        if (mode == CONSOLE_DEFERRED) {
+            mark_dirty(cursor_y);
+        } else {
+            for (size_t i = 0; i < run; i++)
+                draw_char(s[i], (uint32_t)((cursor_x + i) * FONT_W),
+                          (uint32_t)(cursor_y * FONT_H), CONSOLE_FG, CONSOLE_BG);
+        }
+
+        cursor_x += run;
+        s += run;
+        len -= run;
+
+        if (cursor_x >= text_cols)
+            newline();
+
+        account(run);
     }
 }
 
-void console_fill(uint32_t color)
+void console_putc(char c)
+{
+    console_write(&c, 1);
+}
+
+void console_print(const char *s)
+{
+    console_write(s, strlen(s));
+}
+
+void console_get_size(size_t *cols, size_t *rows)
+{
+    *cols = text_cols;
+    *rows = text_rows;
+}
+
+const struct blit_surface *console_surface(void)
+{
+    return &screen;
+}
+
+static void fb_range(uint64_t *start, uint64_t *size)
+{
+    *start = ALIGN_DOWN((uint64_t)fb_ptr, PAGE_SIZE);
+    *size = ALIGN_UP((uint64_t)fb_ptr + (uint64_t)fb_pitch * fb_height, PAGE_SIZE) - *start;
+}
+
+enum memtype console_memtype(void)
+{
+    uint64_t start, size, phys;
+
+    fb_range(&start, &size);
+
+    if (!vmm_translate(&kernel_space, start, &phys))
+        return MEMTYPE_UC;
+
+    return memtype_effective(mtrr_memtype(phys),
+                             pat_memtype(vmm_flags(&kernel_space, start)));
+}
+
+bool console_set_memtype(enum memtype type)
+{
+    uint64_t start, size;
+
+    fb_range(&start, &size);
+
+    if (!vmm_protect(&kernel_space, start, size, VMM_KERNEL_RW | pat_pte_bits(type)))
+        return false;
+
+    // a cacheable alias may have left lines behind that would now go stale
+    asm volatile ("wbinvd" ::: "memory");
+
+    return true;
+}
+
+#ifdef CONFIG_BENCH
+void console_set_bitwise_render(bool enable)
+{
+    render_bitwise = enable;
+}
+
+void console_set_readback_scroll(bool enable)
 {
-    uint32_t *p = fb->address;
-    size_t pixels = (fb->pitch / 4) * fb->height;
+    scroll_readback = enable;
+}
+#endif
 
-    for (size_t i = 0; i < pixels; i++)
-        p[i] = color;
+void console_fill(uint32_t color)
+{
+    blit_clear(&screen, color);
 
+    memset(cells, ' ', sizeof(cells));
+    memset(dirty, 0, sizeof(dirty));
+    ring_top = 0;
+    pending = 0;
     cursor_x = cursor_y = 0;
 }
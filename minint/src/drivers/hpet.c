@@ -0,0 +1,75 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <vmm.h>
+#include <acpi.h>
+#include <hpet.h>
+
+#define HPET_CAPS       0x000
+#define HPET_CONFIG     0x010
+#define HPET_COUNTER    0x0F0
+
+#define CAPS_64BIT      (1ull << 13)
+#define CONFIG_ENABLE   (1ull << 0)
+
+#define MAX_PERIOD_FS   100000000ull    // the spec's upper bound, 100 ns
+
+struct hpet_table
+{
+    struct acpi_header header;
+    uint32_t event_timer_block_id;
+    struct acpi_gas address;
+    uint8_t hpet_number;
+    uint16_t min_tick;
+    uint8_t page_protection;
+} PACKED;
+
+static volatile uint64_t *regs;
+static uint64_t period_fs;
+static uint64_t mask;
+
+static inline uint64_t hpet_reg(uint32_t off)
+{
+    return regs[off / 8];
+}
+
+bool hpet_init(void)
+{
+    const struct hpet_table *t = (const struct hpet_table *)acpi_find_table("HPET");
+
+    if (!t || t->address.space_id != ACPI_GAS_MEMORY || !t->address.address)
+        return false;
+
+    regs = vmm_map_mmio(t->address.address, PAGE_SIZE, MEMTYPE_UC);
+    if (!regs)
+        return false;
+
+    uint64_t caps = hpet_reg(HPET_CAPS);
+    period_fs = caps >> 32;
+
+    if (period_fs == 0 || period_fs > MAX_PERIOD_FS) {
+        regs = NULL;
+        return false;
+    }
+
+    mask = (caps & CAPS_64BIT) ? UINT64_MAX : UINT32_MAX;
+    regs[HPET_CONFIG / 8] = hpet_reg(HPET_CONFIG) | CONFIG_ENABLE;
+
+    return true;
+}
+
+uint64_t hpet_read(void)
+{
+    return hpet_reg(HPET_COUNTER) & mask;
+}
+
+uint64_t hpet_period_fs(void)
+{
+    return period_fs;
+}
+
+uint64_t hpet_mask(void)
+{
+    return mask;
+}
@@ -0,0 +1,326 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <io.h>
+#include <idt.h>
+#include <pic.h>
+#include <spinlock.h>
+#include <serial.h>
+
+#define COM1        0x3F8
+#define COM1_IRQ    4
+
+#define UART_THR    0   // tx holding, dlab=0
+#define UART_RBR    0   // rx buffer, dlab=0
+#define UART_DLL    0   // divisor low, dlab=1
+#define UART_IER    1
+#define UART_DLM    1   // divisor high, dlab=1
+#define UART_IIR    2   // read
+#define UART_FCR    2   // write
+#define UART_LCR    3
+#define UART_MCR    4
+#define UART_LSR    5
+#define UART_MSR    6
+
+#define IER_THRI    0x02
+
+#define IIR_NO_INT  0x01
+#define IIR_ID      0x0E
+#define IIR_MSI     0x00
+#define IIR_THRI    0x02
+#define IIR_RDI     0x04
+#define IIR_RLSI    0x06
+#define IIR_TIMEOUT 0x0C
+
+#define LSR_DR      0x01
+#define LSR_THRE    0x20
+#define LSR_TEMT    0x40
+
+#define LCR_DLAB    0x80
+#define LCR_8N1     0x03
+
+#define FCR_ENABLE  0x01
+#define FCR_CLR_RX  0x02
+#define FCR_CLR_TX  0x04
+#define FCR_TRIG_14 0xC0
+
+#define MCR_DTR     0x01
+#define MCR_RTS     0x02
+#define MCR_OUT2    0x08    // gates the uart interrupt onto the isa line
+#define MCR_LOOP    0x10
+
+#define UART_FIFO   16
+#define BAUD_DIV    1       // 115200, the fastest the divisor can go
+
+#define TX_RING     8192    // power of two
+#define TX_MASK     (TX_RING - 1)
+
+// the ring, the uart and the stats: writers on any cpu and the irq on the bsp
+static spinlock_t tx_lock = SPINLOCK_INIT;
+
+static char tx_ring[TX_RING];
+static uint32_t tx_head;            // written by writers
+static uint32_t tx_tail;            // written by whoever feeds the fifo
+static bool tx_active;              // thr interrupt armed
+static bool present;
+static bool polled;
+
+static struct serial_stats stats;
+
+static inline uint8_t uart_in(uint16_t reg)
+{
+    return inb(COM1 + reg);
+}
+
+static inline void uart_out(uint16_t reg, uint8_t value)
+{
+    outb(COM1 + reg, value);
+}
+
+static inline uint32_t tx_used(void)
+{
+    return tx_head - tx_tail;
+}
+
+// move up to a fifo load from the ring into an empty thr. tx_lock held.
+static void tx_fill(void)
+{
+    if (!(uart_in(UART_LSR) & LSR_THRE))
+        return;
+
+    uint32_t tail = tx_tail;
+    uint32_t n = tx_head - tail;
+
+    if (n > UART_FIFO)
+        n = UART_FIFO;
+
+    for (uint32_t i = 0; i < n; i++)
+        uart_out(UART_THR, (uint8_t)tx_ring[(tail + i) & TX_MASK]);
+
+    tx_tail = tail + n;
+    stats.tx_bytes += n;
+}
+
+// start the interrupt chain if nothing is feeding the fifo. tx_lock held.
+static void tx_kick(void)
+{
+    if (tx_active)
+        return;
+
+    tx_fill();
+
+    if (tx_used()) {
+        tx_active = true;
+        uart_out(UART_IER, IER_THRI);
+    }
+}
+
+static void tx_stop(void)
+{
+    uart_out(UART_IER, 0);
+    tx_active = false;
+}
+
+// push one fifo load out, waiting for the thr. tx_lock held.
+static void tx_pump_polled(void)
+{
+    while (!(uart_in(UART_LSR) & LSR_THRE))
+        cpu_pause();
+
+    tx_fill();
+}
+
+static void write_polled(const char *s, size_t len)
+{
+    while (len) {
+        while (!(uart_in(UART_LSR) & LSR_THRE))
+            cpu_pause();
+
+        size_t n = len < UART_FIFO ? len : UART_FIFO;
+
+        for (size_t i = 0; i < n; i++)
+            uart_out(UART_THR, (uint8_t)s[i]);
+
+        stats.tx_bytes += n;
+        s += n;
+        len -= n;
+    }
+}
+
+static void serial_irq(struct isr_frame *frame)
+{
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+
+    stats.irqs++;
+
+    for (;;) {
+        uint8_t iir = uart_in(UART_IIR);
+
+        if (iir & IIR_NO_INT)
+            break;
+
+        switch (iir & IIR_ID) {
+        case IIR_THRI:
+            tx_fill();
+            if (!tx_used())
+                tx_stop();
+            break;
+        case IIR_RDI:
+        case IIR_TIMEOUT:
+            while (uart_in(UART_LSR) & LSR_DR)
+                (void)uart_in(UART_RBR);
+            break;
+        case IIR_RLSI:
+            (void)uart_in(UART_LSR);
+            break;
+        case IIR_MSI:
+            (void)uart_in(UART_MSR);
+            break;
+        }
+    }
+
+    spin_unlock_irqrestore(&tx_lock, flags);
+
+    pic_eoi(COM1_IRQ);
+}
+
+void serial_init(void)
+{
+    uart_out(UART_IER, 0);
+
+    uart_out(UART_LCR, LCR_DLAB);
+    uart_out(UART_DLL, BAUD_DIV & 0xFF);
+    uart_out(UART_DLM, BAUD_DIV >> 8);
+    uart_out(UART_LCR, LCR_8N1);
+
+    uart_out(UART_FCR, FCR_ENABLE | FCR_CLR_RX | FCR_CLR_TX | FCR_TRIG_14);
+
+    // loopback self test, a missing uart reads back 0xFF
+    uart_out(UART_MCR, MCR_RTS | MCR_OUT2 | MCR_LOOP);
+    uart_out(UART_THR, 0xAE);
+    for (int i = 0; i < 1000 && !(uart_in(UART_LSR) & LSR_DR); i++)
+        io_wait();
+    if (uart_in(UART_RBR) != 0xAE)
+        return;
+
+    uart_out(UART_MCR, MCR_DTR | MCR_RTS | MCR_OUT2);
+
+    isr_register(PIC_VECTOR_BASE + COM1_IRQ, serial_irq);
+    pic_unmask(COM1_IRQ);
+
+    present = true;
+}
+
+void serial_write_len(const char *s, size_t len)
+{
+    if (!present)
+        return;
+
+    while (len) {
+        uint64_t flags = spin_lock_irqsave(&tx_lock);
+
+        if (polled) {
+            write_polled(s, len);
+            spin_unlock_irqrestore(&tx_lock, flags);
+            return;
+        }
+
+        uint32_t space = TX_RING - tx_used();
+
+        if (space == 0) {
+            /*
+             * most writers come through the sink with interrupts off, so
+             * waiting for the irq would only work for a few. feed the
+             * fifo from here, a load at a time so the irq gets a look in.
+             */
+            stats.stalls++;
+            tx_pump_polled();
+            spin_unlock_irqrestore(&tx_lock, flags);
+            continue;
+        }
+
+        uint32_t head = tx_head;
+        uint32_t off = head & TX_MASK;
+        uint32_t n = len < space ? (uint32_t)len : space;
+        uint32_t first = n < TX_RING - off ? n : TX_RING - off;
+
+        memcpy(tx_ring + off, s, first);
+        memcpy(tx_ring, s + first, n - first);
+        tx_head = head + n;
+
+        tx_kick();
+        spin_unlock_irqrestore(&tx_lock, flags);
+
+        s += n;
+        len -= n;
+    }
+}
+
+void serial_putc(char c)
+{
+    serial_write_len(&c, 1);
+}
+
+void serial_write(const char *s)
+{
+    serial_write_len(s, strlen(s));
+}
+
+void serial_flush(void)
+{
+    if (!present)
+        return;
+
+    for (;;) {
+        uint64_t flags = spin_lock_irqsave(&tx_lock);
+        bool empty = !tx_used();
+
+        if (!empty)
+            tx_pump_polled();
+
+        spin_unlock_irqrestore(&tx_lock, flags);
+
+        if (empty)
+            break;
+    }
+
+    while (!(uart_in(UART_LSR) & LSR_TEMT))
+        cpu_pause();
+}
+
+void serial_panic(void)
+{
+    if (!present)
+        return;
+
+    irq_disable();
+
+    // the other cpus are stopped, one that died holding the lock never lets go
+    for (int i = 0; i < 1000000 && !spin_trylock(&tx_lock); i++)
+        cpu_pause();
+
+    tx_stop();
+
+    while (tx_used())
+        tx_pump_polled();
+
+    polled = true;
+    __atomic_store_n(&tx_lock.locked, 0, __ATOMIC_RELEASE);
+}
+
+void serial_get_stats(struct serial_stats *out)
+{
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    *out = stats;
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+#ifdef CONFIG_BENCH
+void serial_set_polled(bool enable)
+{
+    serial_flush();
+    polled = enable;
+}
+#endif
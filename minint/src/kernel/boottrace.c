@@ -0,0 +1,119 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <limine.h>
+
+#include <system.h>
+#include <kprintf.h>
+#include <serial.h>
+#include <ktime.h>
+#include <boottrace.h>
+
+#define SLOWEST 5
+
+struct phase
+{
+    const char *name;
+    uint64_t start;     // ns since reset
+    uint64_t len;       // ns
+};
+
+static struct
+{
+    const char *name;
+    uint64_t tsc;
+} marks[BOOTTRACE_MAX_PHASES];
+
+static uint32_t nmarks;
+
+void boottrace_mark(const char *phase)
+{
+    if (nmarks < BOOTTRACE_MAX_PHASES) {
+        marks[nmarks].name = phase;
+        marks[nmarks].tsc = rdtsc();
+        nmarks++;
+    }
+}
+
+static void out(const char *fmt, ...) PRINTF_LIKE(1, 2);
+
+static void out(const char *fmt, ...)
+{
+    char buf[128];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = kvsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (n > (int)sizeof(buf) - 1)
+        n = sizeof(buf) - 1;
+
+    serial_write_len(buf, (size_t)n);
+}
+
+static void print_phase(const struct phase *p)
+{
+    out("boot: %10lu %7lu.%03lu  %s\n", p->start / 1000, p->len / 1000,
+        p->len % 1000, p->name);
+}
+
+void boottrace_report(const struct limine_bootloader_performance_response *perf)
+{
+    struct phase phases[BOOTTRACE_MAX_PHASES + 2];
+    uint32_t n = 0;
+    uint64_t end = rdtsc();
+
+    if (!nmarks)
+        return;
+
+    /**
+     * the tsc starts at zero on reset, which gives the kernel entry time
+     * without limine's help; with it the firmware and loader phases line
+     * up exactly and the kernel starts where the loader handed over.
+     */
+    uint64_t entry = ktime_cycles_to_ns(marks[0].tsc);
+
+    if (perf && perf->exec_usec >= perf->init_usec && perf->init_usec >= perf->reset_usec) {
+        phases[n++] = (struct phase){ "firmware", 0,
+                                      (perf->init_usec - perf->reset_usec) * 1000 };
+        phases[n++] = (struct phase){ "bootloader", (perf->init_usec - perf->reset_usec) * 1000,
+                                      (perf->exec_usec - perf->init_usec) * 1000 };
+        entry = (perf->exec_usec - perf->reset_usec) * 1000;
+    }
+
+    for (uint32_t i = 0; i < nmarks; i++) {
+        uint64_t next = i + 1 < nmarks ? marks[i + 1].tsc : end;
+
+        phases[n++] = (struct phase){
+            marks[i].name,
+            entry + ktime_cycles_to_ns(marks[i].tsc - marks[0].tsc),
+            ktime_cycles_to_ns(next - marks[i].tsc),
+        };
+    }
+
+    out("boot: %10s %11s  %s\n", "start us", "us", "phase");
+    for (uint32_t i = 0; i < n; i++)
+        print_phase(&phases[i]);
+
+    out("boot: kernel init %lu us, %lu us since reset\n",
+        ktime_cycles_to_ns(end - marks[0].tsc) / 1000,
+        (entry + ktime_cycles_to_ns(end - marks[0].tsc)) / 1000);
+
+    // selection of the slowest few, n is small
+    bool taken[BOOTTRACE_MAX_PHASES + 2] = { false };
+
+    out("boot: slowest\n");
+    for (uint32_t k = 0; k < SLOWEST && k < n; k++) {
+        uint32_t best = n;
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (!taken[i] && (best == n || phases[i].len > phases[best].len))
+                best = i;
+        }
+
+        taken[best] = true;
+        print_phase(&phases[best]);
+    }
+}
@@ -0,0 +1,269 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#include <system.h>
+#include <kprintf.h>
+#include <klog.h>
+#include <sched.h>
+#include <timer.h>
+#include <ktime.h>
+
+#define RING_MASK (KLOG_RING_SIZE - 1)
+
+struct klog_ring
+{
+    uint64_t head ALIGNED(64);  // next position to reserve, producers
+    uint64_t tail ALIGNED(64);  // next position to drain, drainer only
+    uint64_t lost;
+    struct klog_record recs[KLOG_RING_SIZE];
+};
+
+static struct klog_ring rings[KLOG_MAX_CPUS];
+static bool sync_mode;
+static uint64_t lost_total;
+static int draining;
+
+static const char *log_labels[] =
+{
+    "[DEBUG] ",
+    "[INFO]  ",
+    "[WARN]  ",
+    "[ERROR] ",
+    "[FATAL] "
+};
+
+static void emit_line(log_level_t level, const char *fmt, va_list ap)
+{
+    char buf[256];
+    size_t len = strlen(log_labels[level]);
+
+    // label, message and newline leave as one line
+    memcpy(buf, log_labels[level], len);
+
+    // keep one byte back for the newline, kvsnprintf wants one for nul
+    size_t room = sizeof(buf) - len - 1;
+    size_t n = (size_t)kvsnprintf(buf + len, room, fmt, ap);
+
+    len += n < room ? n : room - 1;
+    buf[len++] = '\n';
+
+    ksink_write(buf, len);
+}
+
+static void emit_record(const struct klog_record *rec, bool with_tsc)
+{
+    char buf[256];
+    struct fmt_out o = {
+        .buf = buf,
+        .cap = sizeof(buf) - 1,
+    };
+
+    if (with_tsc && !tsc_hz) {
+        o.len = (size_t)ksnprintf(buf, sizeof(buf), "[%lu cpu%u] ",
+                                  rec->tsc, rec->cpu);
+    } else if (with_tsc) {
+        uint64_t us = ktime_cycles_to_ns(rec->tsc) / 1000;
+
+        o.len = (size_t)ksnprintf(buf, sizeof(buf), "[%lu.%06lu cpu%u] ",
+                                  us / 1000000, us % 1000000, rec->cpu);
+    }
+
+    size_t label = strlen(log_labels[rec->level]);
+    memcpy(buf + o.len, log_labels[rec->level], label);
+    o.len += label;
+
+    kformat_args(&o, rec->fmt, rec->args, rec->nargs, rec->strs);
+    buf[o.len++] = '\n';
+
+    ksink_write(buf, o.len);
+}
+
+void klog(log_level_t level, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+
+    if (sync_mode) {
+        emit_line(level, fmt, args);
+    } else {
+        uint32_t cpu = cpu_id();
+        struct klog_ring *ring = &rings[cpu];
+        uint64_t pos = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+        struct klog_record *rec = &ring->recs[pos & RING_MASK];
+
+        // unpublish first, so a drainer never mixes old and new halves
+        __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        rec->tsc = rdtsc();
+        rec->fmt = fmt;
+        rec->level = (uint8_t)level;
+        rec->cpu = (uint16_t)cpu;
+        rec->nargs = (uint8_t)kformat_capture(fmt, args, rec->args,
+                                              KLOG_MAX_ARGS, rec->strs,
+                                              KLOG_STR_BYTES);
+
+        __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+    }
+
+    va_end(args);
+
+    if (level == LOG_FATAL)
+        panic("fatal error reached");
+}
+
+void klog_set_sync(bool sync)
+{
+    sync_mode = sync;
+}
+
+/**
+ * copy out the next committed record of a ring without consuming it.
+ * a slot that was overwritten before we got to it, or while we were
+ * copying it, is skipped and counted as lost.
+ */
+static bool ring_peek(struct klog_ring *ring, struct klog_record *out)
+{
+    for (;;) {
+        uint64_t pos = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        if (pos == head)
+            return false;
+
+        if (head - pos > KLOG_RING_SIZE) {
+            ring->lost += head - pos - KLOG_RING_SIZE;
+            ring->tail = head - KLOG_RING_SIZE;
+            continue;
+        }
+
+        struct klog_record *rec = &ring->recs[pos & RING_MASK];
+        uint64_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+
+        // still being written, come back on the next drain
+        if (seq < pos + 1)
+            return false;
+
+        if (seq == pos + 1) {
+            memcpy(out, rec, sizeof(*out));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == seq)
+                return true;
+        }
+
+        ring->lost++;
+        ring->tail++;
+    }
+}
+
+size_t klog_drain(void)
+{
+    static struct klog_record next[KLOG_MAX_CPUS];
+    bool have[KLOG_MAX_CPUS];
+    size_t count = 0;
+
+    // one drainer at a time; whoever loses just leaves it to the winner
+    if (__atomic_exchange_n(&draining, 1, __ATOMIC_ACQUIRE))
+        return 0;
+
+    for (size_t cpu = 0; cpu < KLOG_MAX_CPUS; cpu++)
+        have[cpu] = ring_peek(&rings[cpu], &next[cpu]);
+
+    for (;;) {
+        size_t best = KLOG_MAX_CPUS;
+
+        for (size_t cpu = 0; cpu < KLOG_MAX_CPUS; cpu++) {
+            if (have[cpu] && (best == KLOG_MAX_CPUS || next[cpu].tsc < next[best].tsc))
+                best = cpu;
+        }
+
+        if (best == KLOG_MAX_CPUS)
+            break;
+
+        emit_record(&next[best], false);
+        rings[best].tail++;
+        count++;
+
+        have[best] = ring_peek(&rings[best], &next[best]);
+    }
+
+    for (size_t cpu = 0; cpu < KLOG_MAX_CPUS; cpu++) {
+        lost_total += rings[cpu].lost;
+        rings[cpu].lost = 0;
+    }
+
+    __atomic_store_n(&draining, 0, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+/**
+ * panic path: print the newest records still in the rings, drained or
+ * not, oldest first. this ignores the drainer state entirely, since it
+ * may be the drainer that died.
+ */
+void klog_dump(size_t count)
+{
+    static struct klog_record picked[KLOG_RING_SIZE];
+    size_t n = 0;
+
+    if (count > KLOG_RING_SIZE)
+        count = KLOG_RING_SIZE;
+
+    for (size_t cpu = 0; cpu < KLOG_MAX_CPUS; cpu++) {
+        struct klog_ring *ring = &rings[cpu];
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t first = head > KLOG_RING_SIZE ? head - KLOG_RING_SIZE : 0;
+
+        for (uint64_t pos = first; pos < head; pos++) {
+            const struct klog_record *rec = &ring->recs[pos & RING_MASK];
+
+            if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != pos + 1)
+                continue;
+
+            // keep the newest count records, insertion sorted by tsc
+            size_t i = n < count ? n++ : count;
+            if (i == count) {
+                if (rec->tsc <= picked[0].tsc)
+                    continue;
+                memmove(&picked[0], &picked[1], (count - 1) * sizeof(picked[0]));
+                i = count - 1;
+            }
+            while (i > 0 && picked[i - 1].tsc > rec->tsc) {
+                picked[i] = picked[i - 1];
+                i--;
+            }
+            picked[i] = *rec;
+        }
+    }
+
+    kprintf("--- last %zu log records ---\n", n);
+    for (size_t i = 0; i < n; i++)
+        emit_record(&picked[i], true);
+}
+
+uint64_t klog_lost(void)
+{
+    return lost_total;
+}
+
+#define KLOGD_BUSY_MS   10
+#define KLOGD_IDLE_MS   100
+
+// polls faster while there is traffic, and is the deferred console's tick
+static NORETURN void klogd(void *arg)
+{
+    for (;;) {
+        size_t n = klog_drain();
+        ksink_tick();
+        sched_sleep_until(rdtsc() + timer_ms(n ? KLOGD_BUSY_MS : KLOGD_IDLE_MS));
+    }
+}
+
+void klog_start_thread(void)
+{
+    if (!thread_create("klogd", klogd, NULL, SCHED_PRIO_LOW, THREAD_PINNED))
+        klog(LOG_WARN, "klog: no drainer thread, records stay in the rings");
+}
@@ -0,0 +1,205 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limine.h>
+
+#include <system.h>
+#include <slab.h>
+#include <ksym.h>
+
+#define SHT_SYMTAB  2
+#define PT_LOAD     1
+#define STT_NOTYPE  0
+#define STT_FUNC    2
+#define SHN_UNDEF   0
+
+struct elf64_ehdr
+{
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+};
+
+struct elf64_phdr
+{
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+};
+
+struct elf64_shdr
+{
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+};
+
+struct elf64_sym
+{
+    uint32_t name;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+};
+
+struct ksym
+{
+    uint64_t addr;
+    uint64_t end;       // exclusive, up to the next symbol if elf says 0
+    const char *name;
+};
+
+// linker script, where the code ends up at run time
+extern char __text_start[], __text_end[];
+
+static struct ksym *syms;
+static uint32_t nsyms;
+
+// shell sort, the table is sorted once at boot
+static void sort_syms(void)
+{
+    static const uint32_t gaps[] = { 701, 301, 132, 57, 23, 10, 4, 1 };
+
+    for (size_t g = 0; g < ARRAY_LEN(gaps); g++) {
+        uint32_t gap = gaps[g];
+
+        for (uint32_t i = gap; i < nsyms; i++) {
+            struct ksym s = syms[i];
+            uint32_t j = i;
+
+            while (j >= gap && syms[j - gap].addr > s.addr) {
+                syms[j] = syms[j - gap];
+                j -= gap;
+            }
+            syms[j] = s;
+        }
+    }
+}
+
+static bool is_code(const struct elf64_sym *s, uint64_t slide)
+{
+    uint8_t type = s->info & 0xF;
+    uint64_t addr = s->value + slide;
+
+    // asm labels come out as notype
+    return (type == STT_FUNC || type == STT_NOTYPE) && s->shndx != SHN_UNDEF
+        && addr >= (uint64_t)__text_start && addr < (uint64_t)__text_end;
+}
+
+bool ksym_init(const struct limine_file *kernel, uint64_t virtual_base)
+{
+    const uint8_t *image = kernel->address;
+    const struct elf64_ehdr *eh = kernel->address;
+
+    if (kernel->size < sizeof(*eh) || memcmp(eh->ident, "\x7f" "ELF", 4)
+     || eh->shentsize != sizeof(struct elf64_shdr)
+     || eh->shoff + (uint64_t)eh->shnum * sizeof(struct elf64_shdr) > kernel->size
+     || eh->phoff + (uint64_t)eh->phnum * sizeof(struct elf64_phdr) > kernel->size)
+        return false;
+
+    // limine may have moved us from where the linker put us
+    uint64_t link_base = UINT64_MAX;
+    const struct elf64_phdr *ph = (const struct elf64_phdr *)(image + eh->phoff);
+
+    for (uint16_t i = 0; i < eh->phnum; i++) {
+        if (ph[i].type == PT_LOAD && ph[i].vaddr < link_base)
+            link_base = ph[i].vaddr;
+    }
+
+    uint64_t slide = link_base == UINT64_MAX ? 0 : virtual_base - link_base;
+
+    const struct elf64_shdr *sh = (const struct elf64_shdr *)(image + eh->shoff);
+    const struct elf64_shdr *symtab = NULL;
+
+    for (uint16_t i = 0; i < eh->shnum; i++) {
+        if (sh[i].type == SHT_SYMTAB) {
+            symtab = &sh[i];
+            break;
+        }
+    }
+
+    if (!symtab || symtab->link >= eh->shnum
+     || symtab->offset + symtab->size > kernel->size)
+        return false;
+
+    const struct elf64_sym *elf_syms = (const struct elf64_sym *)(image + symtab->offset);
+    const char *strtab = (const char *)(image + sh[symtab->link].offset);
+    uint64_t count = symtab->size / sizeof(struct elf64_sym);
+
+    uint32_t n = 0;
+    for (uint64_t i = 0; i < count; i++)
+        n += is_code(&elf_syms[i], slide);
+
+    syms = kmalloc((size_t)n * sizeof(*syms));
+    if (!syms)
+        return false;
+
+    for (uint64_t i = 0; i < count; i++) {
+        const struct elf64_sym *s = &elf_syms[i];
+
+        if (!is_code(s, slide))
+            continue;
+
+        syms[nsyms].addr = s->value + slide;
+        syms[nsyms].end = s->size ? s->value + slide + s->size : 0;
+        syms[nsyms].name = strtab + s->name;
+        nsyms++;
+    }
+
+    sort_syms();
+
+    for (uint32_t i = 0; i < nsyms; i++) {
+        if (!syms[i].end)
+            syms[i].end = i + 1 < nsyms ? syms[i + 1].addr : (uint64_t)__text_end;
+    }
+
+    return true;
+}
+
+const char *ksym_lookup(uint64_t addr, uint64_t *offset)
+{
+    uint32_t lo = 0, hi = nsyms;
+
+    // last symbol starting at or below addr
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (syms[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0 || addr >= syms[lo - 1].end)
+        return NULL;
+
+    if (offset)
+        *offset = addr - syms[lo - 1].addr;
+
+    return syms[lo - 1].name;
+}
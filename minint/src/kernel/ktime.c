@@ -0,0 +1,218 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <cpuid.h>
+#include <percpu.h>
+#include <hpet.h>
+#include <pit.h>
+#include <ktime.h>
+
+#define CALIBRATE_MS    10
+#define CALIBRATE_RUNS  3
+#define SKEW_ROUNDS     64
+
+#define NS_PER_SEC      1000000000ull
+#define FS_PER_MS       1000000000000ull
+
+uint64_t tsc_hz;
+uint64_t ktime_ns_mult;
+uint64_t ktime_cyc_mult;
+
+static const char *source = "none";
+
+/**
+ * the hpet read sits between two tsc reads and is taken to have happened
+ * halfway. uncached mmio is slow, a few hundred cycles either side, but
+ * that is noise against a 10 ms window.
+ */
+static uint64_t hpet_sample(uint64_t *tsc)
+{
+    uint64_t before = tsc_read_start();
+    uint64_t count = hpet_read();
+    uint64_t after = tsc_read_end();
+
+    *tsc = before + (after - before) / 2;
+    return count;
+}
+
+static uint64_t calibrate_hpet_once(void)
+{
+    uint64_t mask = hpet_mask();
+    uint64_t ticks = CALIBRATE_MS * FS_PER_MS / hpet_period_fs();
+    uint64_t tsc_start, tsc_end;
+
+    uint64_t flags = irq_save();
+
+    uint64_t start = hpet_sample(&tsc_start);
+    uint64_t end;
+
+    do {
+        end = hpet_sample(&tsc_end);
+    } while (((end - start) & mask) < ticks);
+
+    irq_restore(flags);
+
+    // femtoseconds would overflow the multiply below, nanoseconds do not
+    uint64_t ns = ((end - start) & mask) * hpet_period_fs() / 1000000;
+
+    return (tsc_end - tsc_start) * NS_PER_SEC / ns;
+}
+
+static uint64_t calibrate_hpet(void)
+{
+    uint64_t hz[CALIBRATE_RUNS];
+
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t v = calibrate_hpet_once();
+        int j = i;
+
+        while (j > 0 && hz[j - 1] > v) {
+            hz[j] = hz[j - 1];
+            j--;
+        }
+        hz[j] = v;
+    }
+
+    return hz[CALIBRATE_RUNS / 2];
+}
+
+// the pit gives no count to read back, so the shortest run wins instead
+static uint64_t calibrate_pit(void)
+{
+    uint64_t best = UINT64_MAX;
+
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t flags = irq_save();
+
+        pit_oneshot_start(PIT_HZ * CALIBRATE_MS / 1000);
+        uint64_t start = rdtsc();
+
+        while (!pit_oneshot_done())
+            cpu_pause();
+
+        uint64_t cycles = rdtsc() - start;
+
+        irq_restore(flags);
+
+        if (cycles < best)
+            best = cycles;
+    }
+
+    return best * 1000 / CALIBRATE_MS;
+}
+
+void ktime_init(void)
+{
+    if (hpet_init()) {
+        tsc_hz = calibrate_hpet();
+        source = "hpet";
+    } else {
+        tsc_hz = calibrate_pit();
+        source = "pit";
+    }
+
+    // 1e9 << 32 still fits, tsc_hz << 32 does not past 4 GHz, so khz it is
+    ktime_ns_mult = (NS_PER_SEC << KTIME_SHIFT) / tsc_hz;
+    ktime_cyc_mult = ((tsc_hz / 1000) << KTIME_SHIFT) / 1000000;
+
+    if (!cpu_features.invariant_tsc)
+        klog(LOG_WARN, "ktime: tsc is not invariant, times drift with power states");
+}
+
+const char *ktime_source(void)
+{
+    return source;
+}
+
+/**
+ * cross-cpu skew, one ap at a time. the bsp stamps t0 and bumps seq, the
+ * ap stamps t1 and bumps it back, the bsp stamps t2. if the clocks agree
+ * t1 lands halfway between t0 and t2; how far it is off is the skew,
+ * give or take half the round trip, so only the fastest round counts.
+ */
+struct skew_line
+{
+    volatile uint64_t seq;
+    volatile uint64_t t1;
+} ALIGNED(64);
+
+static struct skew_line skew;
+
+static void skew_ap(void *arg)
+{
+    for (uint64_t r = 0; r < SKEW_ROUNDS; r++) {
+        while (__atomic_load_n(&skew.seq, __ATOMIC_ACQUIRE) != 2 * r + 1)
+            cpu_pause();
+
+        skew.t1 = tsc_read_start();
+        __atomic_store_n(&skew.seq, 2 * r + 2, __ATOMIC_RELEASE);
+    }
+}
+
+static int64_t measure_skew(uint32_t cpu, uint64_t *rtt)
+{
+    int64_t offset = 0;
+
+    skew.seq = 0;
+    *rtt = UINT64_MAX;
+
+    if (!smp_call(cpu, skew_ap, NULL))
+        return 0;
+
+    uint64_t flags = irq_save();
+
+    for (uint64_t r = 0; r < SKEW_ROUNDS; r++) {
+        uint64_t t0 = tsc_read_start();
+        __atomic_store_n(&skew.seq, 2 * r + 1, __ATOMIC_RELEASE);
+
+        while (__atomic_load_n(&skew.seq, __ATOMIC_ACQUIRE) != 2 * r + 2)
+            cpu_pause();
+
+        uint64_t t2 = tsc_read_end();
+
+        if (t2 - t0 < *rtt) {
+            *rtt = t2 - t0;
+            offset = (int64_t)(skew.t1 - (t0 + (t2 - t0) / 2));
+        }
+    }
+
+    irq_restore(flags);
+    smp_wait(cpu);
+
+    return offset;
+}
+
+void ktime_check_skew(void)
+{
+    int64_t worst = 0;
+    uint32_t worst_cpu = 0;
+    uint64_t worst_rtt = 0;
+
+    if (cpu_count < 2)
+        return;
+
+    for (uint32_t cpu = 1; cpu < cpu_count; cpu++) {
+        uint64_t rtt;
+        int64_t offset = measure_skew(cpu, &rtt);
+        uint64_t dist = offset < 0 ? (uint64_t)-offset : (uint64_t)offset;
+
+        if (rtt == UINT64_MAX)
+            continue;
+
+        if (dist >= (uint64_t)(worst < 0 ? -worst : worst)) {
+            worst = offset;
+            worst_cpu = cpu;
+            worst_rtt = rtt;
+        }
+    }
+
+    uint64_t dist = worst < 0 ? (uint64_t)-worst : (uint64_t)worst;
+
+    kprintf("ktime: max tsc skew %ld cycles (%lu ns) on cpu%u, +-%lu cycles\n",
+            worst, ktime_cycles_to_ns(dist), worst_cpu, worst_rtt / 2);
+
+    if (dist > worst_rtt / 2)
+        klog(LOG_WARN, "ktime: tsc skew on cpu%u exceeds the measurement error", worst_cpu);
+}
@@ -0,0 +1,116 @@
+#ifdef CONFIG_LOCKSTAT
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <ktime.h>
+#include <ksym.h>
+#include <spinlock.h>
+
+static struct lockstat *locks;
+static volatile uint32_t locks_busy;    // a bare flag, a spinlock_t would count itself
+
+static void list_lock(void)
+{
+    while (__atomic_exchange_n(&locks_busy, 1, __ATOMIC_ACQUIRE))
+        cpu_pause();
+}
+
+static void list_unlock(void)
+{
+    __atomic_store_n(&locks_busy, 0, __ATOMIC_RELEASE);
+}
+
+void lockstat_register(struct lockstat *s, uint64_t site)
+{
+    uint32_t expected = 0;
+
+    // readers can get here together
+    if (!__atomic_compare_exchange_n(&s->registered, &expected, 1, false,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+
+    uint64_t flags = irq_save();
+    list_lock();
+
+    s->site = site;
+    s->next = locks;
+    locks = s;
+
+    list_unlock();
+    irq_restore(flags);
+}
+
+void lockstat_unregister(struct lockstat *s)
+{
+    if (!__atomic_load_n(&s->registered, __ATOMIC_RELAXED))
+        return;
+
+    uint64_t flags = irq_save();
+    list_lock();
+
+    for (struct lockstat **link = &locks; *link; link = &(*link)->next) {
+        if (*link == s) {
+            *link = s->next;
+            break;
+        }
+    }
+
+    s->registered = 0;
+
+    list_unlock();
+    irq_restore(flags);
+}
+
+static void print_side(const char *side, uint64_t acq, uint64_t cont, uint64_t wait)
+{
+    kprintf("lockstat   %-5s %10lu acq  %9lu contended (%2lu.%01lu%%)", side, acq, cont,
+            acq ? cont * 100 / acq : 0, acq ? cont * 1000 / acq % 10 : 0);
+
+    if (cont)
+        kprintf("  avg wait %lu ns", ktime_cycles_to_ns(wait / cont));
+
+    kprint("\n");
+}
+
+static void print_held(const struct lockstat *s)
+{
+    kprint("lockstat   held ");
+
+    for (unsigned b = 0; b < LOCKSTAT_BUCKETS; b++) {
+        if (!s->held[b])
+            continue;
+
+        if (b < LOCKSTAT_BUCKETS - 1)
+            kprintf(" <%lu:%lu", ktime_cycles_to_ns(64ul << b), s->held[b]);
+        else
+            kprintf(" >=%lu:%lu", ktime_cycles_to_ns(64ul << (b - 1)), s->held[b]);
+    }
+
+    kprint(" (ns:count)\n");
+}
+
+void lockstat_dump(void)
+{
+    kprint("\n--- lockstat ---\n");
+
+    for (struct lockstat *s = __atomic_load_n(&locks, __ATOMIC_ACQUIRE); s; s = s->next) {
+        uint64_t off;
+        const char *sym = ksym_lookup(s->site, &off);
+
+        kprintf("lockstat %p  first taken in %s+0x%lx\n", (void *)s,
+                sym ? sym : "?", sym ? off : s->site);
+
+        if (s->acquisitions) {
+            print_side("excl", s->acquisitions, s->contentions, s->wait_cycles);
+            print_held(s);
+        }
+
+        if (s->read_acquisitions)
+            print_side("read", s->read_acquisitions, s->read_contentions, s->read_wait_cycles);
+    }
+}
+
+#endif
@@ -8,6 +8,28 @@
 #include <gdt.h>
 #include <tss.h>
 #include <idt.h>
+#include <pic.h>
+#include <serial.h>
+#include <pmm.h>
+#include <slab.h>
+#include <vmm.h>
+#include <pat.h>
+#include <percpu.h>
+#include <cpuid.h>
+#include <klib.h>
+#include <klog.h>
+#include <sched.h>
+#include <timer.h>
+#include <acpi.h>
+#include <ktime.h>
+#include <boottrace.h>
+#include <ksym.h>
+#include <profile.h>
+#include <pmu.h>
+#include <spinlock.h>
+#include <rcu.h>
+#include <syscall.h>
+#include <bench.h>
 
 __attribute__((used, section(".limine_requests")))
 static volatile uint64_t limine_base_revision[] = LIMINE_BASE_REVISION(4);
@@ -18,6 +40,49 @@ static volatile struct limine_framebuffer_request framebuffer_request = {
     .revision = 0
 };
 
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_memmap_request memmap_request = {
+    .id = LIMINE_MEMMAP_REQUEST_ID,
+    .revision = 0
+};
+
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_hhdm_request hhdm_request = {
+    .id = LIMINE_HHDM_REQUEST_ID,
+    .revision = 0
+};
+
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_executable_address_request executable_address_request = {
+    .id = LIMINE_EXECUTABLE_ADDRESS_REQUEST_ID,
+    .revision = 0
+};
+
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_executable_file_request executable_file_request = {
+    .id = LIMINE_EXECUTABLE_FILE_REQUEST_ID,
+    .revision = 0
+};
+
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_mp_request mp_request = {
+    .id = LIMINE_MP_REQUEST_ID,
+    .revision = 0,
+    .flags = 0
+};
+
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_rsdp_request rsdp_request = {
+    .id = LIMINE_RSDP_REQUEST_ID,
+    .revision = 0
+};
+
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_bootloader_performance_request perf_request = {
+    .id = LIMINE_BOOTLOADER_PERFORMANCE_REQUEST_ID,
+    .revision = 0
+};
+
 __attribute__((used, section(".limine_requests_start")))
 static volatile uint64_t limine_requests_start_marker[] =
 LIMINE_REQUESTS_START_MARKER;
@@ -28,6 +93,8 @@ LIMINE_REQUESTS_END_MARKER;
 
 void kmain(void)
 {
+    boottrace_mark("entry");
+
     if (LIMINE_BASE_REVISION_SUPPORTED(limine_base_revision) == false) {
         halt();
     }
@@ -37,18 +104,136 @@ void kmain(void)
         halt();
     }
 
+    if (memmap_request.response == NULL || hhdm_request.response == NULL
+     || executable_address_request.response == NULL) {
+        halt();
+    }
+
     struct limine_framebuffer *framebuffer = framebuffer_request.response->framebuffers[0];
 
+    // everything below may ask which cpu it is on
+    boottrace_mark("percpu");
+    percpu_init_bsp();
+
+    boottrace_mark("cpuid");
+    cpuid_init();
+    boottrace_mark("klib");
+    klib_init();
+
+    boottrace_mark("console");
     console_init(framebuffer);
 
     console_print("Welcome to the Wired\n");
 
+    boottrace_mark("gdt");
     gdt_init();
+    boottrace_mark("tss");
     tss_init();
+    boottrace_mark("idt");
     idt_init();
+    boottrace_mark("pic");
+    pic_init();
+
+    boottrace_mark("serial");
+    serial_init();
+    ksink_register(serial_write_len);
+
+    irq_enable();
 
     console_print("GDT initialized\n");
 
+    boottrace_mark("pmm");
+    pmm_init(memmap_request.response, hhdm_request.response->offset);
+    boottrace_mark("kmem");
+    kmem_init();
+
+    boottrace_mark("ksym");
+    if (!executable_file_request.response
+     || !ksym_init(executable_file_request.response->executable_file,
+                   executable_address_request.response->virtual_base))
+        klog(LOG_WARN, "ksym: no kernel symbols");
+
+    boottrace_mark("pat");
+    pat_init();
+    boottrace_mark("vmm");
+    vmm_init(memmap_request.response, executable_address_request.response);
+
+    boottrace_mark("framebuffer wc");
+    enum memtype fb_was = console_memtype();
+    if (!console_set_memtype(MEMTYPE_WC))
+        klog(LOG_WARN, "framebuffer: cannot remap write-combining");
+    kprintf("framebuffer: %s (was %s)\n", memtype_name(console_memtype()),
+            memtype_name(fb_was));
+
+    boottrace_mark("acpi");
+    // base revision 4 hands the rsdp over as a physical address
+    if (rsdp_request.response)
+        acpi_init((uint64_t)rsdp_request.response->address);
+    else
+        klog(LOG_WARN, "acpi: no rsdp response");
+
+    boottrace_mark("ktime");
+    ktime_init();
+    kprintf("ktime: tsc %lu.%03lu MHz against the %s, %sinvariant\n",
+            tsc_hz / 1000000, tsc_hz / 1000 % 1000, ktime_source(),
+            cpu_features.invariant_tsc ? "" : "not ");
+
+    boottrace_mark("sched");
+    sched_init();
+    boottrace_mark("timer");
+    timer_init();
+    kprintf("timer: %s\n", timer_mode());
+
+    boottrace_mark("pmu");
+    pmu_init();
+    if (pmu_info()->version)
+        kprintf("pmu: version %u, %u general x%u bits, %u fixed x%u bits\n",
+                pmu_info()->version, pmu_info()->gp_counters, pmu_info()->gp_width,
+                pmu_info()->fixed_counters, pmu_info()->fixed_width);
+    else
+        kprint("pmu: not available\n");
+
+    boottrace_mark("rcu");
+    rcu_init();
+    boottrace_mark("syscall");
+    syscall_init();
+
+    boottrace_mark("smp");
+    smp_init(mp_request.response);
+    boottrace_mark("tsc skew");
+    ktime_check_skew();
+    boottrace_mark("klogd");
+    klog_start_thread();
+
+    struct pmm_stats mem;
+    pmm_get_stats(&mem);
+    kprintf("pmm: %lu MiB free\n", mem.free_pages * PAGE_SIZE / (1024 * 1024));
+
+    kprintf("klib using %s\n", klib_describe());
+
+    klog(LOG_INFO, "descriptor tables loaded");
+
+    boottrace_report(perf_request.response);
+
+#ifdef CONFIG_PROFILE
+    // the pmu sees irqs-off code too, the timer is the fallback
+    if (!profile_start_pmu(tsc_hz / PROFILE_HZ) && !profile_start(PROFILE_HZ))
+        klog(LOG_WARN, "profile: cannot allocate sample buffers");
+#endif
+
+#ifdef CONFIG_BENCH
+    bench_run_all();
+#endif
+
+#ifdef CONFIG_PROFILE
+    profile_stop();
+    profile_dump();
+#endif
+
+#ifdef CONFIG_LOCKSTAT
+    lockstat_dump();
+#endif
+
     panic("test panic");
 
     halt();
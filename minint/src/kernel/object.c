@@ -0,0 +1,249 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <klib.h>
+#include <percpu.h>
+#include <spinlock.h>
+#include <pmm.h>
+#include <slab.h>
+#include <rcu.h>
+#include <object.h>
+
+_Static_assert(HANDLE_MAX < (1ull << 32), "slot indexes fit the low half");
+
+static void destroy(struct rcu_head *head)
+{
+    struct object *o = (struct object *)((uint8_t *)head - offsetof(struct object, rcu));
+
+    o->type->destroy(o);
+}
+
+void object_release(struct object *o)
+{
+    // a lookup may have found it just before the last handle went
+    call_rcu(&o->rcu, destroy);
+}
+
+static ALWAYS_INLINE uint32_t handle_index(handle_t h)
+{
+    return (uint32_t)h;
+}
+
+static ALWAYS_INLINE uint32_t handle_generation(handle_t h)
+{
+    return (uint32_t)(h >> 32);
+}
+
+// NULL for slots the table has not grown to
+static ALWAYS_INLINE struct handle_entry *slot(struct handle_table *t, uint32_t index)
+{
+    if (index == 0 || index >= HANDLE_MAX)
+        return NULL;
+
+    struct handle_entry *page = rcu_dereference(t->dir[index / HANDLE_PER_PAGE]);
+
+    return page ? &page[index % HANDLE_PER_PAGE] : NULL;
+}
+
+struct handle_table *handle_table_create(void)
+{
+    struct handle_table *t = kmalloc(sizeof(*t));
+    if (!t)
+        return NULL;
+
+    uint64_t dir = pmm_alloc_page();
+    if (!dir) {
+        kfree(t);
+        return NULL;
+    }
+
+    memset(t, 0, sizeof(*t));
+    t->dir = phys_to_virt(dir);
+    memset((void *)t->dir, 0, PAGE_SIZE);
+    t->lock = (spinlock_t)SPINLOCK_INIT;
+    t->next_index = 1;
+
+    return t;
+}
+
+static void table_free(struct rcu_head *head)
+{
+    struct handle_table *t = (struct handle_table *)((uint8_t *)head
+                           - offsetof(struct handle_table, rcu));
+
+    for (uint32_t i = 0; i < HANDLE_DIR_SIZE && t->dir[i]; i++)
+        pmm_free_page(virt_to_phys(t->dir[i]));
+
+    pmm_free_page(virt_to_phys((void *)t->dir));
+    lock_destroy(&t->lock);
+    kfree(t);
+}
+
+void handle_table_destroy(struct handle_table *t)
+{
+    for (uint32_t i = 1; i < t->next_index; i++) {
+        struct handle_entry *e = slot(t, i);
+
+        if (e->generation & 1)
+            object_unref(e->object);
+    }
+
+    // a lookup may still be walking the directory or a slot page
+    call_rcu(&t->rcu, table_free);
+}
+
+// lock held: up to a batch of slots onto the cpu's list, from the shared list or new pages
+static void refill(struct handle_table *t, uint32_t cpu)
+{
+    for (uint32_t n = 0; n < HANDLE_FREE_BATCH; n++) {
+        uint32_t index = t->free_head;
+        struct handle_entry *e;
+
+        if (index) {
+            e = slot(t, index);
+            t->free_head = e->next_free;
+            t->free_count--;
+        } else {
+            index = t->next_index;
+            if (index >= HANDLE_MAX)
+                break;
+
+            struct handle_entry *volatile *page = &t->dir[index / HANDLE_PER_PAGE];
+
+            if (!*page) {
+                uint64_t phys = pmm_alloc_page();
+                if (!phys)
+                    break;
+
+                // generation 0: free
+                memset(phys_to_virt(phys), 0, PAGE_SIZE);
+                rcu_assign_pointer(*page, phys_to_virt(phys));
+            }
+
+            t->next_index++;
+            e = slot(t, index);
+        }
+
+        e->next_free = t->free[cpu].head;
+        t->free[cpu].head = index;
+        t->free[cpu].count++;
+    }
+}
+
+// lock held: a batch off the cpu's list, which has more than that
+static void spill(struct handle_table *t, uint32_t cpu)
+{
+    for (uint32_t n = 0; n < HANDLE_FREE_BATCH; n++) {
+        uint32_t index = t->free[cpu].head;
+        struct handle_entry *e = slot(t, index);
+
+        t->free[cpu].head = e->next_free;
+        t->free[cpu].count--;
+
+        e->next_free = t->free_head;
+        t->free_head = index;
+        t->free_count++;
+    }
+}
+
+handle_t handle_open(struct handle_table *t, struct object *o)
+{
+    uint64_t flags = irq_save();
+    uint32_t cpu = cpu_id();
+
+    if (!t->free[cpu].head) {
+        spin_lock(&t->lock);
+        refill(t, cpu);
+        spin_unlock(&t->lock);
+
+        if (!t->free[cpu].head) {
+            irq_restore(flags);
+            return HANDLE_INVALID;
+        }
+    }
+
+    uint32_t index = t->free[cpu].head;
+    struct handle_entry *e = slot(t, index);
+
+    t->free[cpu].head = e->next_free;
+    t->free[cpu].count--;
+
+    irq_restore(flags);
+
+    // the slot is ours alone until the generation says it is open
+    object_ref(o);
+    e->object = o;
+
+    uint32_t gen = e->generation + 1;
+    __atomic_store_n(&e->generation, gen, __ATOMIC_RELEASE);
+
+    return (handle_t)gen << 32 | index;
+}
+
+bool handle_close(struct handle_table *t, handle_t h)
+{
+    struct handle_entry *e = slot(t, handle_index(h));
+    uint32_t gen = handle_generation(h);
+
+    if (!e || !(gen & 1))
+        return false;
+
+    // closes the handle for every lookup that reads the generation after this
+    if (!__atomic_compare_exchange_n(&e->generation, &gen, gen + 1, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return false;
+
+    struct object *o = __atomic_exchange_n(&e->object, NULL, __ATOMIC_ACQ_REL);
+
+    uint64_t flags = irq_save();
+    uint32_t cpu = cpu_id();
+
+    e->next_free = t->free[cpu].head;
+    t->free[cpu].head = handle_index(h);
+
+    if (++t->free[cpu].count >= 2 * HANDLE_FREE_BATCH) {
+        spin_lock(&t->lock);
+        spill(t, cpu);
+        spin_unlock(&t->lock);
+    }
+
+    irq_restore(flags);
+
+    object_unref(o);
+    return true;
+}
+
+struct object *handle_lookup_rcu(struct handle_table *t, handle_t h,
+                                 const struct object_type *type)
+{
+    struct handle_entry *e = slot(t, handle_index(h));
+    uint32_t gen = handle_generation(h);
+
+    if (!e || !(gen & 1) || __atomic_load_n(&e->generation, __ATOMIC_ACQUIRE) != gen)
+        return NULL;
+
+    struct object *o = __atomic_load_n(&e->object, __ATOMIC_ACQUIRE);
+
+    // unchanged across the object load: not closed, nor closed and reopened
+    if (!o || __atomic_load_n(&e->generation, __ATOMIC_ACQUIRE) != gen)
+        return NULL;
+
+    return !type || o->type == type ? o : NULL;
+}
+
+struct object *handle_lookup(struct handle_table *t, handle_t h,
+                             const struct object_type *type)
+{
+    rcu_read_lock();
+
+    struct object *o = handle_lookup_rcu(t, h, type);
+
+    if (o && !object_tryref(o))
+        o = NULL;
+
+    rcu_read_unlock();
+
+    return o;
+}
@@ -0,0 +1,314 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <kprintf.h>
+#include <percpu.h>
+#include <pmm.h>
+#include <slab.h>
+#include <serial.h>
+#include <sched.h>
+#include <timer.h>
+#include <ksym.h>
+#include <pmu.h>
+#include <profile.h>
+
+struct sample
+{
+    uint32_t depth;
+    uint32_t resolved;          // bit i: pc[i] holds a symbol name
+    uint64_t pc[PROFILE_DEPTH]; // innermost first
+};
+
+struct profile_cpu
+{
+    struct sample *buf;
+    uint32_t count;
+    uint64_t dropped;
+    struct timer timer;
+} ALIGNED(64);
+
+// linker script
+extern char __text_start[], __text_end[];
+
+static struct profile_cpu pcpu[MAX_CPUS];
+static uint64_t period;
+static volatile bool running;
+static bool pmu_mode;
+
+static uint32_t buf_order(void)
+{
+    uint64_t bytes = (uint64_t)PROFILE_SAMPLES * sizeof(struct sample);
+    uint32_t order = 0;
+
+    while ((PAGE_SIZE << order) < bytes)
+        order++;
+
+    return order;
+}
+
+static uint32_t walk(const struct isr_frame *f, uint64_t *pc)
+{
+    uint32_t n = 0;
+
+    pc[n++] = f->rip;
+
+    // user mode has nothing of ours to walk
+    if (f->cs & 3)
+        return n;
+
+    // a frame is { saved rbp, return address } and sits above the
+    // interrupted rsp, below the top of the thread's stack
+    struct thread *t = this_thread();
+    uint64_t lo = f->rsp;
+    uint64_t hi = t && t->stack ? t->stack + THREAD_STACK_SIZE : lo + THREAD_STACK_SIZE;
+    uint64_t fp = f->rbp;
+
+    while (n < PROFILE_DEPTH && fp >= lo && fp + 16 <= hi && !(fp & 7)) {
+        const uint64_t *frame = (const uint64_t *)fp;
+        uint64_t ret = frame[1];
+
+        if (ret < (uint64_t)__text_start || ret >= (uint64_t)__text_end)
+            break;
+
+        pc[n++] = ret;
+        lo = fp + 16;
+        fp = frame[0];
+    }
+
+    return n;
+}
+
+void profile_sample(const struct isr_frame *frame)
+{
+    struct profile_cpu *p = &pcpu[cpu_id()];
+
+    if (!p->buf)
+        return;
+
+    if (p->count == PROFILE_SAMPLES) {
+        p->dropped++;
+        return;
+    }
+
+    struct sample *s = &p->buf[p->count];
+
+    s->depth = walk(frame, s->pc);
+    s->resolved = 0;
+    p->count++;
+}
+
+static void tick(void *arg)
+{
+    struct profile_cpu *p = arg;
+    const struct isr_frame *frame = this_cpu()->irq_frame;
+
+    if (frame)
+        profile_sample(frame);
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        return;
+
+    // keep the rate, unless we fell more than a period behind
+    uint64_t next = p->timer.deadline + period;
+    uint64_t now = rdtsc();
+
+    timer_add(&p->timer, next > now ? next : now + period, tick, p);
+}
+
+static void start_local(void *arg)
+{
+    struct profile_cpu *p = &pcpu[cpu_id()];
+
+    timer_add(&p->timer, rdtsc() + period, tick, p);
+}
+
+static bool alloc_buffers(void)
+{
+    uint32_t order = buf_order();
+
+    for (uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+        struct profile_cpu *p = &pcpu[cpu];
+
+        if (!p->buf) {
+            uint64_t phys = pmm_alloc_pages(order);
+            if (!phys)
+                return false;
+            p->buf = phys_to_virt(phys);
+        }
+
+        p->count = 0;
+        p->dropped = 0;
+    }
+
+    return true;
+}
+
+bool profile_start(uint32_t hz)
+{
+    if (!alloc_buffers())
+        return false;
+
+    pmu_mode = false;
+    period = tsc_hz / hz;
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+
+    start_local(NULL);
+    for (uint32_t cpu = 1; cpu < cpu_count; cpu++) {
+        if (smp_call(cpu, start_local, NULL))
+            smp_wait(cpu);
+    }
+
+    return true;
+}
+
+bool profile_start_pmu(uint64_t cycles)
+{
+    if (!pmu_event_supported(PMU_CYCLES) || !alloc_buffers())
+        return false;
+
+    pmu_mode = pmu_overflow_start(PMU_CYCLES, cycles, profile_sample);
+    return pmu_mode;
+}
+
+void profile_stop(void)
+{
+    if (pmu_mode) {
+        pmu_overflow_stop();
+        pmu_mode = false;
+        return;
+    }
+
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+
+    // a tick already past the running check re-arms one last time
+    sched_sleep_until(rdtsc() + 2 * period);
+
+    for (uint32_t cpu = 0; cpu < cpu_count; cpu++)
+        timer_cancel(&pcpu[cpu].timer);
+}
+
+/**
+ * folding: every pc becomes its function's name (or stays a raw address
+ * if it has none), then equal stacks are sorted next to each other and
+ * counted. ret addresses are looked up one byte back so a call at the
+ * very end of a function is charged to that function.
+ */
+static void symbolize(struct sample *s)
+{
+    for (uint32_t i = 0; i < s->depth; i++) {
+        const char *name = ksym_lookup(i ? s->pc[i] - 1 : s->pc[i], NULL);
+
+        if (name) {
+            s->pc[i] = (uint64_t)name;
+            s->resolved |= 1u << i;
+        }
+    }
+}
+
+static int compare(const struct sample *a, const struct sample *b)
+{
+    if (a->depth != b->depth)
+        return a->depth < b->depth ? -1 : 1;
+
+    for (uint32_t i = 0; i < a->depth; i++) {
+        if (a->pc[i] != b->pc[i])
+            return a->pc[i] < b->pc[i] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static void sort(struct sample **v, uint32_t n)
+{
+    static const uint32_t gaps[] = { 4193, 1750, 701, 301, 132, 57, 23, 10, 4, 1 };
+
+    for (size_t g = 0; g < ARRAY_LEN(gaps); g++) {
+        uint32_t gap = gaps[g];
+
+        for (uint32_t i = gap; i < n; i++) {
+            struct sample *s = v[i];
+            uint32_t j = i;
+
+            while (j >= gap && compare(v[j - gap], s) > 0) {
+                v[j] = v[j - gap];
+                j -= gap;
+            }
+            v[j] = s;
+        }
+    }
+}
+
+static void emit(const struct sample *s, uint32_t count)
+{
+    char line[1024];
+    size_t len = 0;
+
+    // folded stacks go outermost first; a line too long loses its leaves
+    for (uint32_t i = s->depth; i-- > 0;) {
+        const char *sep = i + 1 < s->depth ? ";" : "";
+        size_t room = sizeof(line) - 16 - len;
+        int n;
+
+        if (s->resolved & (1u << i))
+            n = ksnprintf(line + len, room, "%s%s", sep, (const char *)s->pc[i]);
+        else
+            n = ksnprintf(line + len, room, "%s%#lx", sep, s->pc[i]);
+
+        if ((size_t)n >= room)
+            break;
+        len += (size_t)n;
+    }
+
+    len += (size_t)ksnprintf(line + len, sizeof(line) - len, " %u\n", count);
+    serial_write_len(line, len);
+}
+
+void profile_dump(void)
+{
+    uint32_t total = 0;
+    uint64_t dropped = 0;
+
+    for (uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+        total += pcpu[cpu].count;
+        dropped += pcpu[cpu].dropped;
+    }
+
+    struct sample **v = kmalloc((size_t)total * sizeof(*v) + 1);
+    if (!v) {
+        klog(LOG_WARN, "profile: no memory to fold %u samples", total);
+        return;
+    }
+
+    uint32_t n = 0;
+    for (uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+        struct profile_cpu *p = &pcpu[cpu];
+
+        for (uint32_t i = 0; i < p->count; i++) {
+            if (!p->buf[i].resolved)
+                symbolize(&p->buf[i]);
+            v[n++] = &p->buf[i];
+        }
+    }
+
+    sort(v, n);
+
+    char head[96];
+    int len = ksnprintf(head, sizeof(head), "profile: begin %u samples, %lu dropped\n",
+                        total, dropped);
+    serial_write_len(head, (size_t)len);
+
+    for (uint32_t i = 0; i < n;) {
+        uint32_t j = i + 1;
+
+        while (j < n && compare(v[i], v[j]) == 0)
+            j++;
+
+        emit(v[i], j - i);
+        i = j;
+    }
+
+    serial_write("profile: end\n");
+    kfree(v);
+}
@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <percpu.h>
+#include <idt.h>
+#include <lapic.h>
+#include <sched.h>
+#include <timer.h>
+#include <rcu.h>
+
+#define RCU_SPIN_US     20      // before the laggards get an ipi
+#define RCU_POLL_US     100     // sleep between looks, and ipis, after that
+
+// written once per grace period, read at every quiescent point
+volatile uint64_t rcu_gp ALIGNED(64);
+
+// call_rcu() pushes onto its own cpu's list, the rcu thread takes them all
+static struct
+{
+    struct rcu_head *volatile head;
+} ALIGNED(64) pending[MAX_CPUS];
+
+static volatile bool wanted;
+static struct thread *rcu_thread;
+static struct rcu_stats stats;
+
+void rcu_read_unlock_slow(void)
+{
+    struct thread *t = this_thread();
+    uint64_t flags = irq_save();
+
+    // the ipi found us reading; the section is over, so is the cpu's part
+    if (t->rcu_qs_needed) {
+        t->rcu_qs_needed = false;
+        rcu_quiescent();
+    }
+
+    // from an irq handler or under irq_save() the next interrupt does it
+    if (t->preempt_deferred && (flags & RFLAGS_IF))
+        sched_preempt();
+
+    irq_restore(flags);
+}
+
+static void rcu_ipi(struct isr_frame *frame)
+{
+    struct thread *t = this_thread();
+
+    lapic_eoi();
+
+    // without a read section open, whatever we interrupted holds nothing
+    if (!t->rcu_nesting)
+        rcu_quiescent();
+    else
+        t->rcu_qs_needed = true;
+}
+
+static bool caught_up(uint32_t cpu, uint64_t gp)
+{
+    return !__atomic_load_n(&cpus[cpu].online, __ATOMIC_ACQUIRE)
+        || __atomic_load_n(&cpus[cpu].rcu_seen, __ATOMIC_ACQUIRE) >= gp;
+}
+
+void synchronize_rcu(void)
+{
+    // orders the caller's unlinking before any cpu can see the new period
+    uint64_t gp = __atomic_add_fetch(&rcu_gp, 1, __ATOMIC_SEQ_CST);
+    uint64_t start = rdtsc();
+    uint32_t next = 0;
+
+    uint64_t flags = irq_save();
+    rcu_quiescent();
+    irq_restore(flags);
+
+    for (;;) {
+        while (next < cpu_count && caught_up(next, gp))
+            next++;
+
+        if (next == cpu_count)
+            break;
+
+        if (rdtsc() - start < timer_us(RCU_SPIN_US)) {
+            cpu_pause();
+            continue;
+        }
+
+        // every look: one that hit a read section has the unlock report,
+        // but a thread may have come and gone on that cpu since
+        for (uint32_t i = next; i < cpu_count; i++) {
+            if (i != cpu_id() && !caught_up(i, gp)) {
+                lapic_send_ipi(cpus[i].lapic_id, LAPIC_VECTOR_RCU);
+                __atomic_fetch_add(&stats.ipis, 1, __ATOMIC_RELAXED);
+            }
+        }
+
+        // we may have moved, and a switch is a quiescent point anyway
+        sched_sleep_until(rdtsc() + timer_us(RCU_POLL_US));
+    }
+
+    __atomic_fetch_add(&stats.grace_periods, 1, __ATOMIC_RELAXED);
+}
+
+void call_rcu(struct rcu_head *head, void (*fn)(struct rcu_head *head))
+{
+    uint64_t flags = irq_save();
+    struct rcu_head *volatile *list = &pending[cpu_id()].head;
+
+    head->fn = fn;
+    head->next = __atomic_load_n(list, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(list, &head->next, head, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    // the thread clears the flag before collecting, so this push is seen
+    if (!__atomic_load_n(&wanted, __ATOMIC_RELAXED)
+     && !__atomic_exchange_n(&wanted, true, __ATOMIC_ACQ_REL) && rcu_thread)
+        sched_wake(rcu_thread);
+
+    irq_restore(flags);
+}
+
+static NORETURN void rcu_worker(void *arg)
+{
+    for (;;) {
+        while (!__atomic_exchange_n(&wanted, false, __ATOMIC_ACQ_REL))
+            sched_block();
+
+        struct rcu_head *batch = NULL;
+
+        for (uint32_t i = 0; i < cpu_count; i++) {
+            struct rcu_head *h = __atomic_exchange_n(&pending[i].head, NULL, __ATOMIC_ACQUIRE);
+
+            while (h) {
+                struct rcu_head *next = h->next;
+                h->next = batch;
+                batch = h;
+                h = next;
+            }
+        }
+
+        if (!batch)
+            continue;
+
+        // everything queued so far was unlinked before this period started
+        synchronize_rcu();
+
+        uint64_t n = 0;
+
+        while (batch) {
+            struct rcu_head *next = batch->next;
+            batch->fn(batch);
+            batch = next;
+            n++;
+        }
+
+        __atomic_fetch_add(&stats.callbacks, n, __ATOMIC_RELAXED);
+    }
+}
+
+void rcu_init(void)
+{
+    isr_register(LAPIC_VECTOR_RCU, rcu_ipi);
+
+    rcu_thread = thread_create("rcu", rcu_worker, NULL, SCHED_PRIO_HIGH, 0);
+    if (!rcu_thread)
+        panic("rcu: cannot create the rcu thread");
+
+    // callbacks queued before we were up
+    if (__atomic_load_n(&wanted, __ATOMIC_ACQUIRE))
+        sched_wake(rcu_thread);
+}
+
+void rcu_get_stats(struct rcu_stats *out)
+{
+    out->grace_periods = __atomic_load_n(&stats.grace_periods, __ATOMIC_RELAXED);
+    out->ipis = __atomic_load_n(&stats.ipis, __ATOMIC_RELAXED);
+    out->callbacks = __atomic_load_n(&stats.callbacks, __ATOMIC_RELAXED);
+}
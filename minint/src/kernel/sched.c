@@ -0,0 +1,656 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <cpuid.h>
+#include <spinlock.h>
+#include <percpu.h>
+#include <tss.h>
+#include <idt.h>
+#include <lapic.h>
+#include <pmm.h>
+#include <slab.h>
+#include <sched.h>
+#include <timer.h>
+#include <ktime.h>
+#include <rcu.h>
+
+#define FCW_DEFAULT     0x037F
+#define MXCSR_DEFAULT   0x1F80
+
+#define FRAME_WORDS     9   // six callee saved, the return address, padding
+
+_Static_assert(MAX_CPUS <= 64, "idle_mask is one word");
+
+extern struct thread *switch_context(struct thread *prev, struct thread *next);
+extern void thread_start(void);
+
+struct runqueue
+{
+    spinlock_t lock;
+    struct thread *head[SCHED_PRIO_COUNT];
+    struct thread *tail[SCHED_PRIO_COUNT];
+    uint32_t bitmap;                // bit n set: head[n] is not empty
+    volatile uint32_t nr;           // queued threads
+    volatile uint32_t nr_stealable; // ... that are not pinned, read unlocked
+    struct thread *idle;
+    struct timer slice;             // armed only while someone waits for the cpu
+    struct sched_stats stats;
+} ALIGNED(64);
+
+static struct runqueue rqs[MAX_CPUS];
+static struct kmem_cache *thread_cache;
+static uint32_t next_id;
+static uint32_t steal_cpus = MAX_CPUS;
+static bool use_xsave;
+static uint64_t slice_cycles;
+static uint64_t idle_mask;          // cpus halted in sched_idle()
+
+static inline void fpu_save(struct thread *t)
+{
+    if (use_xsave)
+        asm volatile ("xsave64 (%0)" : : "r"(t->fpu), "a"(~0u), "d"(~0u) : "memory");
+    else
+        asm volatile ("fxsave64 (%0)" : : "r"(t->fpu) : "memory");
+}
+
+static inline void fpu_restore(struct thread *t)
+{
+    if (use_xsave)
+        asm volatile ("xrstor64 (%0)" : : "r"(t->fpu), "a"(~0u), "d"(~0u) : "memory");
+    else
+        asm volatile ("fxrstor64 (%0)" : : "r"(t->fpu) : "memory");
+}
+
+// an empty xsave header restores every component to its init state,
+// fxrstor takes the control words as given
+static void fpu_init(struct thread *t)
+{
+    memset(t->fpu, 0, 512 + 64);
+    *(uint16_t *)&t->fpu[0] = FCW_DEFAULT;
+    *(uint32_t *)&t->fpu[24] = MXCSR_DEFAULT;
+}
+
+static inline void set_nr(volatile uint32_t *n, uint32_t v)
+{
+    __atomic_store_n(n, v, __ATOMIC_RELAXED);
+}
+
+/**
+ * run queue ops, rq lock held
+ */
+static void enqueue(struct runqueue *rq, struct thread *t)
+{
+    unsigned p = t->prio;
+
+    t->next = NULL;
+    if (rq->tail[p])
+        rq->tail[p]->next = t;
+    else
+        rq->head[p] = t;
+    rq->tail[p] = t;
+
+    rq->bitmap |= 1u << p;
+    set_nr(&rq->nr, rq->nr + 1);
+    if (!(t->flags & THREAD_PINNED))
+        set_nr(&rq->nr_stealable, rq->nr_stealable + 1);
+}
+
+static void unlink(struct runqueue *rq, struct thread *t, struct thread *prev)
+{
+    unsigned p = t->prio;
+
+    if (prev)
+        prev->next = t->next;
+    else
+        rq->head[p] = t->next;
+
+    if (rq->tail[p] == t)
+        rq->tail[p] = prev;
+
+    if (!rq->head[p])
+        rq->bitmap &= ~(1u << p);
+
+    set_nr(&rq->nr, rq->nr - 1);
+    if (!(t->flags & THREAD_PINNED))
+        set_nr(&rq->nr_stealable, rq->nr_stealable - 1);
+
+    t->next = NULL;
+}
+
+static struct thread *dequeue(struct runqueue *rq)
+{
+    if (!rq->bitmap)
+        return NULL;
+
+    struct thread *t = rq->head[__builtin_ctz(rq->bitmap)];
+    unlink(rq, t, NULL);
+
+    return t;
+}
+
+// first unpinned thread of the best priority that has one
+static struct thread *take_stealable(struct runqueue *rq)
+{
+    for (unsigned p = 0; p < SCHED_PRIO_COUNT; p++) {
+        struct thread *prev = NULL;
+
+        for (struct thread *t = rq->head[p]; t; prev = t, t = t->next) {
+            if (!(t->flags & THREAD_PINNED)) {
+                unlink(rq, t, prev);
+                return t;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * pull one thread off the busiest queue. we hold our own lock, so only
+ * ever trylock the victim: two cpus stealing from each other must not
+ * wait on one another.
+ */
+static inline uint32_t steal_limit(void)
+{
+    return cpu_count < steal_cpus ? cpu_count : steal_cpus;
+}
+
+// the other queue with the most stealable threads, unlocked peek
+static uint32_t busiest(uint32_t self, uint32_t *victim)
+{
+    uint32_t limit = steal_limit();
+    uint32_t most = 0;
+
+    if (self >= limit)
+        return 0;
+
+    for (uint32_t i = 0; i < limit; i++) {
+        uint32_t n = __atomic_load_n(&rqs[i].nr_stealable, __ATOMIC_RELAXED);
+
+        if (i != self && n > most) {
+            most = n;
+            *victim = i;
+        }
+    }
+
+    return most;
+}
+
+static struct thread *steal(uint32_t self)
+{
+    uint32_t victim;
+
+    if (!busiest(self, &victim) || !spin_trylock(&rqs[victim].lock))
+        return NULL;
+
+    struct thread *t = take_stealable(&rqs[victim]);
+    spin_unlock(&rqs[victim].lock);
+
+    if (t) {
+        t->cpu = self;
+        rqs[self].stats.steals++;
+    }
+
+    return t;
+}
+
+static void slice_expired(void *arg)
+{
+    // nothing to do here, timer_irq() calls sched_preempt() on its way out
+}
+
+/**
+ * keep the slice timer armed exactly while a thread of the same or a
+ * better priority is queued behind the running one. rq lock held.
+ */
+static void update_slice(struct runqueue *rq, struct thread *curr)
+{
+    bool want = curr != rq->idle && (rq->bitmap & ((2u << curr->prio) - 1));
+    uint64_t deadline = curr->slice_start + slice_cycles;
+
+    if (rq->slice.pending && (!want || rq->slice.deadline != deadline))
+        timer_cancel(&rq->slice);
+
+    if (want && !rq->slice.pending)
+        timer_add(&rq->slice, deadline, slice_expired, NULL);
+}
+
+// an ipi brings a halted cpu back, or makes a busy one look at its queue
+static void kick(uint32_t cpu)
+{
+    if (cpu != cpu_id())
+        lapic_send_ipi(cpus[cpu].lapic_id, LAPIC_VECTOR_RESCHED);
+}
+
+/**
+ * after queueing a stealable thread, wake one halted cpu to take it. the
+ * idle side sets its bit before looking at the queues and we look at
+ * the bits after queueing, so one of us always sees the other.
+ */
+static void kick_idle(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint32_t limit = steal_limit();
+    uint64_t mask = __atomic_load_n(&idle_mask, __ATOMIC_RELAXED) & ~(1ull << cpu_id());
+
+    if (limit < 64)
+        mask &= (1ull << limit) - 1;
+
+    if (mask)
+        kick((uint32_t)__builtin_ctzll(mask));
+}
+
+static void reap(struct thread *t)
+{
+    if (t->stack)
+        pmm_free_pages(virt_to_phys((void *)t->stack), THREAD_STACK_ORDER);
+
+    kmem_cache_free(thread_cache, t);
+}
+
+/**
+ * the run queue lock is held across the switch and dropped by whoever
+ * comes out on the other side, so nobody can steal or wake the outgoing
+ * thread before its registers are saved. we may come back on another
+ * cpu, so look everything up again.
+ */
+static void finish_switch(struct thread *prev)
+{
+    struct cpu *cpu = this_cpu();
+    struct thread *self = cpu->thread;
+
+    fpu_restore(self);
+    self->slice_start = rdtsc();
+
+    update_slice(&rqs[cpu->id], self);
+    spin_unlock(&rqs[cpu->id].lock);
+
+    if (prev->state == THREAD_DEAD)
+        reap(prev);
+}
+
+// irqs off, this cpu's rq lock held; returns with it dropped
+static void schedule_locked(void)
+{
+    struct cpu *cpu = this_cpu();
+    struct runqueue *rq = &rqs[cpu->id];
+    struct thread *prev = cpu->thread;
+
+    if (prev->rcu_nesting)
+        panic("sched: thread switched out inside an rcu read section");
+
+    // whatever we pick next, this cpu is done with what it was reading
+    rcu_quiescent();
+
+    if (prev->state == THREAD_RUNNING && prev != rq->idle) {
+        prev->state = THREAD_RUNNABLE;
+        enqueue(rq, prev);
+    }
+
+    struct thread *next = dequeue(rq);
+
+    if (!next)
+        next = steal(cpu->id);
+    if (!next)
+        next = rq->idle;
+
+    next->state = THREAD_RUNNING;
+
+    if (next == prev) {
+        spin_unlock(&rq->lock);
+        return;
+    }
+
+    rq->stats.switches++;
+    cpu->thread = next;
+
+    if (next->stack)
+        tss_set_rsp0(next->rsp0);
+
+    if (prev->state != THREAD_DEAD)
+        fpu_save(prev);
+    pmu_switch(&prev->pmu);
+
+    prev = switch_context(prev, next);
+    finish_switch(prev);
+}
+
+static void schedule(void)
+{
+    spin_lock(&rqs[cpu_id()].lock);
+    schedule_locked();
+}
+
+// first thing a new thread runs, from thread_start in cpu.s
+NORETURN void thread_entry(struct thread *prev)
+{
+    finish_switch(prev);
+    irq_enable();
+
+    struct thread *self = this_thread();
+    self->fn(self->arg);
+
+    thread_exit();
+}
+
+static struct thread *thread_alloc(const char *name, thread_fn fn, void *arg,
+                                   unsigned prio, uint32_t flags)
+{
+    struct thread *t = kmem_cache_alloc(thread_cache);
+    if (!t)
+        return NULL;
+
+    uint64_t stack = pmm_alloc_pages(THREAD_STACK_ORDER);
+    if (!stack) {
+        kmem_cache_free(thread_cache, t);
+        return NULL;
+    }
+
+    t->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    t->cpu = cpu_id();
+    t->prio = (uint8_t)(prio < SCHED_PRIO_COUNT ? prio : SCHED_PRIO_LOW);
+    t->flags = (uint8_t)flags;
+    t->state = THREAD_RUNNABLE;
+    t->wake_pending = false;
+    t->preempt_deferred = false;
+    t->rcu_qs_needed = false;
+    t->rcu_nesting = 0;
+    t->fn = fn;
+    t->arg = arg;
+    t->name = name;
+    t->stack = (uint64_t)phys_to_virt(stack);
+    t->rsp0 = t->stack + THREAD_STACK_SIZE;
+    t->next = NULL;
+    memset(&t->pmu, 0, sizeof(t->pmu));
+
+    fpu_init(t);
+
+    // switch_context pops six zeroed registers and returns to thread_start
+    uint64_t *frame = (uint64_t *)(t->stack + THREAD_STACK_SIZE) - FRAME_WORDS;
+    memset(frame, 0, FRAME_WORDS * sizeof(uint64_t));
+    frame[6] = (uint64_t)thread_start;
+    t->rsp = (uint64_t)frame;
+
+    return t;
+}
+
+struct thread *thread_create(const char *name, thread_fn fn, void *arg,
+                             unsigned prio, uint32_t flags)
+{
+    uint64_t irq = irq_save();
+    struct thread *t = thread_alloc(name, fn, arg, prio, flags);
+
+    if (t) {
+        struct runqueue *rq = &rqs[t->cpu];
+
+        spin_lock(&rq->lock);
+        enqueue(rq, t);
+        rq->stats.created++;
+        update_slice(rq, this_thread());
+        spin_unlock(&rq->lock);
+
+        if (!(flags & THREAD_PINNED))
+            kick_idle();
+    }
+
+    irq_restore(irq);
+
+    return t;
+}
+
+NORETURN void thread_exit(void)
+{
+    irq_disable();
+
+    struct runqueue *rq = &rqs[cpu_id()];
+
+    spin_lock(&rq->lock);
+    this_thread()->state = THREAD_DEAD;
+    rq->stats.exited++;
+    schedule_locked();
+
+    panic("sched: dead thread came back");
+}
+
+void sched_yield(void)
+{
+    // nothing else queued here, yielding would pick us again
+    if (!__atomic_load_n(&rqs[cpu_id()].nr, __ATOMIC_RELAXED))
+        return;
+
+    uint64_t flags = irq_save();
+    schedule();
+    irq_restore(flags);
+}
+
+void sched_block(void)
+{
+    uint64_t flags = irq_save();
+    struct runqueue *rq = &rqs[cpu_id()];
+    struct thread *self = this_thread();
+
+    spin_lock(&rq->lock);
+
+    if (self->wake_pending) {
+        self->wake_pending = false;
+        spin_unlock(&rq->lock);
+    } else {
+        self->state = THREAD_BLOCKED;
+        schedule_locked();
+    }
+
+    irq_restore(flags);
+}
+
+void sched_wake(struct thread *t)
+{
+    uint64_t flags = irq_save();
+    struct runqueue *rq;
+
+    // a queued thread can be stolen under us, make sure we lock its cpu
+    for (;;) {
+        rq = &rqs[__atomic_load_n(&t->cpu, __ATOMIC_RELAXED)];
+        spin_lock(&rq->lock);
+        if (rq == &rqs[t->cpu])
+            break;
+        spin_unlock(&rq->lock);
+    }
+
+    uint32_t cpu = (uint32_t)(rq - rqs);
+    bool queued = false;
+
+    if (t->state == THREAD_BLOCKED) {
+        t->state = THREAD_RUNNABLE;
+        enqueue(rq, t);
+        queued = true;
+
+        if (cpu == cpu_id())
+            update_slice(rq, this_thread());
+    } else if (t->state != THREAD_DEAD) {
+        t->wake_pending = true;
+    }
+
+    spin_unlock(&rq->lock);
+
+    // its own cpu may be halted, or owe the newcomer a slice timer
+    if (queued)
+        kick(cpu);
+
+    irq_restore(flags);
+}
+
+void sched_preempt(void)
+{
+    struct cpu *cpu = this_cpu();
+    struct runqueue *rq = &rqs[cpu->id];
+    struct thread *self = cpu->thread;
+
+    // a halted idle thread resumes and picks up the work by itself
+    if (!self || self == rq->idle)
+        return;
+
+    // a reader runs on until rcu_read_unlock(), which comes back here
+    if (self->rcu_nesting) {
+        self->preempt_deferred = true;
+        return;
+    }
+
+    self->preempt_deferred = false;
+    spin_lock(&rq->lock);
+
+    uint32_t better = rq->bitmap & ((1u << self->prio) - 1);
+    uint32_t equal = rq->bitmap & (1u << self->prio);
+
+    if (better || (equal && rdtsc() - self->slice_start >= slice_cycles)) {
+        rq->stats.preemptions++;
+        schedule_locked();
+        return;
+    }
+
+    update_slice(rq, self);
+    spin_unlock(&rq->lock);
+}
+
+static void sched_ipi(struct isr_frame *frame)
+{
+    lapic_eoi();
+    rqs[cpu_id()].stats.ipis++;
+    sched_preempt();
+}
+
+void sched_idle(void)
+{
+    uint64_t flags = irq_save();
+    uint32_t self = cpu_id();
+    uint32_t victim;
+
+    schedule();
+
+    __atomic_fetch_or(&idle_mask, 1ull << self, __ATOMIC_SEQ_CST);
+
+    // sti takes effect after hlt, so a wakeup cannot slip in between
+    if (!__atomic_load_n(&rqs[self].nr, __ATOMIC_RELAXED) && !busiest(self, &victim))
+        asm volatile ("sti; hlt; cli" ::: "memory");
+
+    __atomic_fetch_and(&idle_mask, ~(1ull << self), __ATOMIC_RELAXED);
+
+    irq_restore(flags);
+}
+
+#define SLEEP_WAITING   0
+#define SLEEP_WAKING    1
+#define SLEEP_DONE      2
+
+struct sleeper
+{
+    struct timer timer;
+    struct thread *thread;
+    volatile uint8_t state;
+};
+
+/**
+ * only the callback ends a sleep. the timer's own pending flag drops
+ * before this runs, so a sleeper going by it could return, and even
+ * exit, while the wake below still has its hands on the thread. the
+ * waking state covers the few instructions of sched_wake(): the sleeper
+ * spins through them instead of blocking again and missing the wake.
+ */
+static void sleep_timer(void *arg)
+{
+    struct sleeper *s = arg;
+
+    __atomic_store_n(&s->state, SLEEP_WAKING, __ATOMIC_SEQ_CST);
+    sched_wake(s->thread);
+    __atomic_store_n(&s->state, SLEEP_DONE, __ATOMIC_RELEASE);
+}
+
+void sched_sleep_until(uint64_t deadline)
+{
+    struct sleeper s = { .thread = this_thread(), .state = SLEEP_WAITING };
+
+    timer_add(&s.timer, deadline, sleep_timer, &s);
+
+    for (;;) {
+        uint8_t state = __atomic_load_n(&s.state, __ATOMIC_ACQUIRE);
+
+        if (state == SLEEP_DONE)
+            break;
+        if (state == SLEEP_WAITING)
+            sched_block();
+        else
+            cpu_pause();
+    }
+}
+
+static NORETURN void idle_loop(void *arg)
+{
+    for (;;)
+        sched_idle();
+}
+
+static struct thread *boot_thread(const char *name, unsigned prio)
+{
+    struct thread *t = kmem_cache_alloc(thread_cache);
+    if (!t)
+        panic("sched: no memory for a boot thread");
+
+    memset(t, 0, offsetof(struct thread, fpu));
+    t->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    t->cpu = cpu_id();
+    t->prio = (uint8_t)prio;
+    t->flags = THREAD_BOOT | THREAD_PINNED;
+    t->state = THREAD_RUNNING;
+    t->name = name;
+    t->slice_start = rdtsc();
+
+    return t;
+}
+
+void sched_init(void)
+{
+    use_xsave = cpu_features.xsave;
+    slice_cycles = ktime_ns_to_cycles(SCHED_SLICE_NS);
+
+    if (use_xsave) {
+        uint32_t a, b, c, d;
+        cpuid(0xD, 0, &a, &b, &c, &d);
+        if (b > THREAD_FPU_SIZE)
+            panic("sched: xsave area does not fit in a thread");
+    }
+
+    thread_cache = kmem_cache_create("thread", sizeof(struct thread), 64, NULL, 0);
+    if (!thread_cache)
+        panic("sched: cannot create the thread cache");
+
+    isr_register(LAPIC_VECTOR_RESCHED, sched_ipi);
+
+    this_cpu()->thread = boot_thread("kmain", SCHED_PRIO_NORMAL);
+
+    // the bsp's idle thread needs a stack of its own, kmain keeps the boot one
+    rqs[0].idle = thread_alloc("idle", idle_loop, NULL, SCHED_PRIO_LOW, THREAD_PINNED);
+    if (!rqs[0].idle)
+        panic("sched: cannot create the idle thread");
+}
+
+void sched_init_ap(void)
+{
+    struct thread *t = boot_thread("idle", SCHED_PRIO_LOW);
+
+    rqs[cpu_id()].idle = t;
+    this_cpu()->thread = t;
+}
+
+void sched_get_stats(uint32_t cpu, struct sched_stats *out)
+{
+    *out = rqs[cpu].stats;
+}
+
+#ifdef CONFIG_BENCH
+void sched_set_steal_cpus(uint32_t n)
+{
+    steal_cpus = n;
+}
+#endif
@@ -0,0 +1,220 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <spinlock.h>
+#include <percpu.h>
+#include <idt.h>
+#include <ktime.h>
+#include <lapic.h>
+#include <sched.h>
+#include <timer.h>
+
+#define CALIBRATE_MS    10
+#define CALIBRATE_RUNS  3
+
+struct timer_base
+{
+    spinlock_t lock;
+    struct timer *head;
+    uint64_t programmed;    // deadline the lapic is set for, 0 if off
+    struct timer_stats stats;
+} ALIGNED(64);
+
+static struct timer_base bases[MAX_CPUS];
+static uint64_t lapic_hz;
+static uint64_t lapic_mult;     // lapic ticks per tsc cycle, 32.32 fixed point
+
+/**
+ * lapic ticks over a tsc-timed window; the tsc is already calibrated by
+ * ktime_init(). the shortest of a few runs is the one least disturbed.
+ */
+static void calibrate(void)
+{
+    uint64_t window = ktime_ns_to_cycles(CALIBRATE_MS * 1000000ull);
+    uint64_t best_tsc = UINT64_MAX;
+    uint32_t best_ticks = 0;
+
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t flags = irq_save();
+
+        lapic_timer_free_run();
+        uint64_t start = rdtsc();
+
+        while (rdtsc() - start < window)
+            cpu_pause();
+
+        uint32_t ticks = lapic_timer_stop();
+        uint64_t cycles = rdtsc() - start;
+
+        irq_restore(flags);
+
+        if (cycles < best_tsc) {
+            best_tsc = cycles;
+            best_ticks = ticks;
+        }
+    }
+
+    lapic_mult = ((uint64_t)best_ticks << 32) / best_tsc;
+    lapic_hz = (uint64_t)(((unsigned __int128)tsc_hz * lapic_mult) >> 32);
+}
+
+// point the lapic at the earliest deadline, base lock held, own cpu only
+static void program(struct timer_base *b)
+{
+    uint64_t deadline = b->head ? b->head->deadline : 0;
+
+    if (deadline == b->programmed)
+        return;
+
+    b->programmed = deadline;
+    b->stats.programmed++;
+
+    if (lapic_deadline_mode()) {
+        lapic_timer_deadline(deadline);
+        return;
+    }
+
+    if (!deadline) {
+        lapic_timer_oneshot(0);
+        return;
+    }
+
+    // a count too long for 32 bits just fires early and gets reprogrammed
+    uint64_t now = rdtsc();
+    uint64_t delta = deadline > now ? deadline - now : 0;
+    uint64_t ticks = (uint64_t)(((unsigned __int128)delta * lapic_mult) >> 32);
+
+    if (ticks == 0)
+        ticks = 1;
+    if (ticks > UINT32_MAX)
+        ticks = UINT32_MAX;
+
+    lapic_timer_oneshot((uint32_t)ticks);
+}
+
+static void unlink(struct timer_base *b, struct timer *t)
+{
+    struct timer **pp = &b->head;
+
+    while (*pp != t)
+        pp = &(*pp)->next;
+
+    *pp = t->next;
+    t->next = NULL;
+}
+
+void timer_add(struct timer *t, uint64_t deadline, void (*fn)(void *arg), void *arg)
+{
+    uint64_t flags = irq_save();
+    uint32_t cpu = cpu_id();
+    struct timer_base *b = &bases[cpu];
+
+    spin_lock(&b->lock);
+
+    t->deadline = deadline;
+    t->fn = fn;
+    t->arg = arg;
+    t->cpu = cpu;
+    t->pending = true;
+
+    struct timer **pp = &b->head;
+    while (*pp && (*pp)->deadline <= deadline)
+        pp = &(*pp)->next;
+
+    t->next = *pp;
+    *pp = t;
+
+    if (b->head == t)
+        program(b);
+
+    spin_unlock(&b->lock);
+    irq_restore(flags);
+}
+
+bool timer_cancel(struct timer *t)
+{
+    if (!__atomic_load_n(&t->pending, __ATOMIC_ACQUIRE))
+        return false;
+
+    uint64_t flags = irq_save();
+    struct timer_base *b = &bases[t->cpu];
+    bool was_pending;
+
+    spin_lock(&b->lock);
+
+    was_pending = t->pending;
+    if (was_pending) {
+        unlink(b, t);
+        t->pending = false;
+
+        // a remote lapic just fires early and finds nothing to do
+        if (t->cpu == cpu_id())
+            program(b);
+    }
+
+    spin_unlock(&b->lock);
+    irq_restore(flags);
+
+    return was_pending;
+}
+
+static void timer_irq(struct isr_frame *frame)
+{
+    struct timer_base *b = &bases[cpu_id()];
+
+    lapic_eoi();
+    b->stats.irqs++;
+
+    // the one-shot is spent, whatever is left needs programming again
+    spin_lock(&b->lock);
+    b->programmed = 0;
+
+    for (;;) {
+        struct timer *t = b->head;
+
+        if (!t || t->deadline > rdtsc())
+            break;
+
+        void (*fn)(void *) = t->fn;
+        void *arg = t->arg;
+
+        b->head = t->next;
+        t->next = NULL;
+        __atomic_store_n(&t->pending, false, __ATOMIC_RELEASE);
+        b->stats.expired++;
+
+        spin_unlock(&b->lock);
+        fn(arg);
+        spin_lock(&b->lock);
+    }
+
+    program(b);
+    spin_unlock(&b->lock);
+
+    sched_preempt();
+}
+
+void timer_init(void)
+{
+    lapic_init();
+    calibrate();
+
+    isr_register(LAPIC_VECTOR_TIMER, timer_irq);
+}
+
+void timer_init_ap(void)
+{
+    lapic_init_ap();
+}
+
+void timer_get_stats(uint32_t cpu, struct timer_stats *out)
+{
+    *out = bases[cpu].stats;
+}
+
+const char *timer_mode(void)
+{
+    return lapic_deadline_mode() ? "tsc-deadline" : "lapic one-shot";
+}
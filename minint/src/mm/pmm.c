@@ -0,0 +1,406 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <spinlock.h>
+#include <pmm.h>
+
+#define PG_FREE     0x01    // head of a free buddy block
+#define PG_CACHED   0x02    // in a cpu cache
+#define PG_USABLE   0x04    // backed by a usable memmap entry
+
+struct page
+{
+    struct page *next;
+    struct page *prev;
+    void *owner;            // set by whoever allocated the block
+    uint8_t order;
+    uint8_t flags;
+};
+
+struct page_list
+{
+    struct page *head;
+    struct page *tail;
+    uint64_t count;
+};
+
+struct pcp_cache
+{
+    struct page_list pages;     // hot at the head, cold at the tail
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t refills;
+    uint64_t trims;
+} ALIGNED(64);
+
+uint64_t hhdm_offset;
+
+static struct page *pages;
+static uint64_t max_pfn;
+
+static spinlock_t buddy_lock = SPINLOCK_INIT;
+static struct page_list free_area[PMM_MAX_ORDER + 1];
+static uint64_t buddy_free;     // in pages
+static uint64_t total_pages;
+static uint64_t direct_allocs;  // pmm_alloc_pages, the caches count their own
+static uint64_t direct_frees;
+static uint64_t failed;
+
+static struct pcp_cache pcp[MAX_CPUS];
+
+static inline uint64_t page_pfn(const struct page *p)
+{
+    return (uint64_t)(p - pages);
+}
+
+static inline uint64_t page_phys(const struct page *p)
+{
+    return page_pfn(p) << PAGE_SHIFT;
+}
+
+static inline struct page *phys_page(uint64_t phys)
+{
+    return &pages[phys >> PAGE_SHIFT];
+}
+
+static void list_push_head(struct page_list *l, struct page *p)
+{
+    p->prev = NULL;
+    p->next = l->head;
+
+    if (l->head)
+        l->head->prev = p;
+    else
+        l->tail = p;
+
+    l->head = p;
+    l->count++;
+}
+
+static void list_push_tail(struct page_list *l, struct page *p)
+{
+    p->next = NULL;
+    p->prev = l->tail;
+
+    if (l->tail)
+        l->tail->next = p;
+    else
+        l->head = p;
+
+    l->tail = p;
+    l->count++;
+}
+
+static void list_remove(struct page_list *l, struct page *p)
+{
+    if (p->prev)
+        p->prev->next = p->next;
+    else
+        l->head = p->next;
+
+    if (p->next)
+        p->next->prev = p->prev;
+    else
+        l->tail = p->prev;
+
+    l->count--;
+}
+
+/**
+ * buddy core, buddy_lock held
+ */
+static struct page *buddy_alloc(unsigned order)
+{
+    unsigned o = order;
+
+    while (o <= PMM_MAX_ORDER && !free_area[o].head)
+        o++;
+
+    if (o > PMM_MAX_ORDER) {
+        failed++;
+        return NULL;
+    }
+
+    struct page *p = free_area[o].head;
+    list_remove(&free_area[o], p);
+    p->flags &= ~PG_FREE;
+
+    // split down, handing the upper halves back
+    while (o > order) {
+        o--;
+        struct page *half = p + (1ull << o);
+        half->order = (uint8_t)o;
+        half->flags |= PG_FREE;
+        list_push_head(&free_area[o], half);
+    }
+
+    p->order = (uint8_t)order;
+    buddy_free -= 1ull << order;
+
+    return p;
+}
+
+static void buddy_free_block(struct page *p, unsigned order)
+{
+    uint64_t pfn = page_pfn(p);
+
+    buddy_free += 1ull << order;
+
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy_pfn = pfn ^ (1ull << order);
+
+        if (buddy_pfn >= max_pfn)
+            break;
+
+        struct page *b = &pages[buddy_pfn];
+
+        if (!(b->flags & PG_FREE) || b->order != order)
+            break;
+
+        list_remove(&free_area[order], b);
+        b->flags &= ~PG_FREE;
+
+        pfn &= ~(1ull << order);
+        order++;
+    }
+
+    p = &pages[pfn];
+    p->order = (uint8_t)order;
+    p->flags |= PG_FREE;
+    list_push_head(&free_area[order], p);
+}
+
+uint64_t pmm_alloc_pages(unsigned order)
+{
+    if (order > PMM_MAX_ORDER)
+        return 0;
+
+    uint64_t flags = spin_lock_irqsave(&buddy_lock);
+    struct page *p = buddy_alloc(order);
+    if (p)
+        direct_allocs++;
+    spin_unlock_irqrestore(&buddy_lock, flags);
+
+    return p ? page_phys(p) : 0;
+}
+
+void pmm_free_pages(uint64_t phys, unsigned order)
+{
+    if (!phys)
+        return;
+
+    uint64_t flags = spin_lock_irqsave(&buddy_lock);
+    buddy_free_block(phys_page(phys), order);
+    direct_frees++;
+    spin_unlock_irqrestore(&buddy_lock, flags);
+}
+
+/**
+ * per-cpu cache. only its own cpu touches it, so disabling interrupts
+ * is all the exclusion it needs.
+ */
+static bool pcp_refill(struct pcp_cache *c)
+{
+    uint64_t flags = spin_lock_irqsave(&buddy_lock);
+
+    for (int i = 0; i < PMM_PCP_BATCH; i++) {
+        struct page *p = buddy_alloc(0);
+        if (!p)
+            break;
+        p->flags |= PG_CACHED;
+        list_push_tail(&c->pages, p);
+    }
+
+    spin_unlock_irqrestore(&buddy_lock, flags);
+
+    c->refills++;
+
+    return c->pages.count != 0;
+}
+
+static void pcp_trim(struct pcp_cache *c)
+{
+    uint64_t flags = spin_lock_irqsave(&buddy_lock);
+
+    for (int i = 0; i < PMM_PCP_BATCH && c->pages.tail; i++) {
+        struct page *p = c->pages.tail;
+        list_remove(&c->pages, p);
+        p->flags &= ~PG_CACHED;
+        buddy_free_block(p, 0);
+    }
+
+    spin_unlock_irqrestore(&buddy_lock, flags);
+
+    c->trims++;
+}
+
+uint64_t pmm_alloc_page(void)
+{
+    uint64_t flags = irq_save();
+    struct pcp_cache *c = &pcp[cpu_id()];
+    struct page *p = c->pages.head;
+
+    if (!p && pcp_refill(c))
+        p = c->pages.head;
+
+    if (p) {
+        list_remove(&c->pages, p);
+        p->flags &= ~PG_CACHED;
+        c->allocs++;
+    }
+
+    irq_restore(flags);
+
+    return p ? page_phys(p) : 0;
+}
+
+static void pcp_free(uint64_t phys, bool hot)
+{
+    if (!phys)
+        return;
+
+    uint64_t flags = irq_save();
+    struct pcp_cache *c = &pcp[cpu_id()];
+    struct page *p = phys_page(phys);
+
+    p->order = 0;
+    p->flags |= PG_CACHED;
+
+    if (hot)
+        list_push_head(&c->pages, p);
+    else
+        list_push_tail(&c->pages, p);
+
+    c->frees++;
+
+    if (c->pages.count > PMM_PCP_HIGH)
+        pcp_trim(c);
+
+    irq_restore(flags);
+}
+
+void pmm_free_page(uint64_t phys)
+{
+    pcp_free(phys, true);
+}
+
+void pmm_free_page_cold(uint64_t phys)
+{
+    pcp_free(phys, false);
+}
+
+void pmm_set_owner(uint64_t phys, unsigned order, void *owner)
+{
+    struct page *p = phys_page(phys);
+
+    for (uint64_t i = 0; i < (1ull << order); i++)
+        p[i].owner = owner;
+}
+
+void *pmm_owner(uint64_t phys)
+{
+    return phys_page(phys)->owner;
+}
+
+unsigned pmm_order(uint64_t phys)
+{
+    return phys_page(phys)->order;
+}
+
+void pmm_get_stats(struct pmm_stats *out)
+{
+    uint64_t flags = spin_lock_irqsave(&buddy_lock);
+
+    *out = (struct pmm_stats){
+        .total_pages = total_pages,
+        .free_pages = buddy_free,
+        .allocs = direct_allocs,
+        .frees = direct_frees,
+        .failed = failed,
+    };
+
+    for (size_t i = 0; i < MAX_CPUS; i++) {
+        out->cached_pages += pcp[i].pages.count;
+        out->allocs += pcp[i].allocs;
+        out->frees += pcp[i].frees;
+        out->pcp_refills += pcp[i].refills;
+        out->pcp_trims += pcp[i].trims;
+    }
+
+    spin_unlock_irqrestore(&buddy_lock, flags);
+
+    out->free_pages += out->cached_pages;
+}
+
+/**
+ * add [base, base + len) to the buddy as the largest naturally aligned
+ * blocks that fit
+ */
+static void add_range(uint64_t base, uint64_t len)
+{
+    uint64_t pfn = ALIGN_UP(base, PAGE_SIZE) >> PAGE_SHIFT;
+    uint64_t end = ALIGN_DOWN(base + len, PAGE_SIZE) >> PAGE_SHIFT;
+
+    for (uint64_t i = pfn; i < end; i++)
+        pages[i].flags |= PG_USABLE;
+
+    while (pfn < end) {
+        unsigned order = PMM_MAX_ORDER;
+
+        while (order && ((pfn & ((1ull << order) - 1)) || pfn + (1ull << order) > end))
+            order--;
+
+        buddy_free_block(&pages[pfn], order);
+        total_pages += 1ull << order;
+        pfn += 1ull << order;
+    }
+}
+
+void pmm_init(struct limine_memmap_response *memmap, uint64_t hhdm)
+{
+    hhdm_offset = hhdm;
+
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry *e = memmap->entries[i];
+
+        if (e->type == LIMINE_MEMMAP_USABLE && e->base + e->length > max_pfn << PAGE_SHIFT)
+            max_pfn = (e->base + e->length) >> PAGE_SHIFT;
+    }
+
+    // the page array comes off the front of the first entry it fits in
+    uint64_t array_size = ALIGN_UP(max_pfn * sizeof(struct page), PAGE_SIZE);
+    uint64_t array_phys = 0;
+
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry *e = memmap->entries[i];
+
+        if (e->type == LIMINE_MEMMAP_USABLE && e->length >= array_size) {
+            array_phys = e->base;
+            break;
+        }
+    }
+
+    if (!array_phys)
+        panic("pmm: no room for the page array");
+
+    pages = phys_to_virt(array_phys);
+    memset(pages, 0, array_size);
+
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry *e = memmap->entries[i];
+        uint64_t base = e->base;
+        uint64_t len = e->length;
+
+        if (e->type != LIMINE_MEMMAP_USABLE)
+            continue;
+
+        if (base == array_phys) {
+            base += array_size;
+            len -= array_size;
+        }
+
+        add_range(base, len);
+    }
+}
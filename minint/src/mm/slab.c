@@ -0,0 +1,479 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <spinlock.h>
+#include <serial.h>
+#include <pmm.h>
+#include <slab.h>
+
+#define MAG_ROUNDS      14      // keeps a magazine at two cache lines
+#define SLAB_MAX_ORDER  3
+#define SLAB_MIN_OBJS   8
+#define KMEM_NAME_LEN   24
+#define KMALLOC_CLASSES 10      // 8 bytes to KMALLOC_MAX
+
+struct magazine
+{
+    struct magazine *next;
+    uint64_t rounds;
+    void *objs[MAG_ROUNDS];
+};
+
+/**
+ * lives at the start of every slab. padded to a full line so the slab
+ * bookkeeping never shares a cache line with the first object.
+ */
+struct slab
+{
+    struct slab *next;
+    struct slab *prev;
+    struct kmem_cache *cache;
+    void *free;
+    uint32_t inuse;
+    uint32_t total;
+} ALIGNED(64);
+
+struct slab_list
+{
+    struct slab *head;
+    uint64_t count;
+};
+
+// written only by its own cpu, one line each
+struct kmem_cpu
+{
+    struct magazine *loaded;
+    struct magazine *prev;
+    uint64_t hits;
+    uint64_t misses;
+} ALIGNED(64);
+
+struct kmem_cache
+{
+    // read-mostly after creation
+    char name[KMEM_NAME_LEN];
+    size_t size;
+    size_t stride;
+    size_t free_off;        // where a free object keeps its next pointer
+    size_t first_off;       // first object, from the slab start
+    uint32_t objs_per_slab;
+    uint32_t order;
+    uint32_t flags;
+    kmem_ctor_fn ctor;
+    struct kmem_cache *next_cache;
+
+    // slab layer and depot, under lock
+    spinlock_t lock ALIGNED(64);
+    struct slab_list partial;
+    struct slab_list full;
+    struct slab *empty;     // one spare slab is kept around
+    struct magazine *depot_full;
+    struct magazine *depot_empty;
+    uint64_t depot_full_count;
+    uint64_t slabs;
+    uint64_t inuse;         // objects out of slabs, magazines included
+
+    struct kmem_cpu cpu[MAX_CPUS];
+};
+
+static struct kmem_cache cache_cache;   // struct kmem_cache objects
+static struct kmem_cache mag_cache;     // struct magazine objects
+static struct kmem_cache *kmalloc_caches[KMALLOC_CLASSES];
+
+static spinlock_t caches_lock = SPINLOCK_INIT;
+static struct kmem_cache *caches;
+
+static void slab_list_add(struct slab_list *l, struct slab *s)
+{
+    s->prev = NULL;
+    s->next = l->head;
+    if (l->head)
+        l->head->prev = s;
+    l->head = s;
+    l->count++;
+}
+
+static void slab_list_del(struct slab_list *l, struct slab *s)
+{
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        l->head = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+    l->count--;
+}
+
+static inline void **free_link(struct kmem_cache *c, void *obj)
+{
+    return (void **)((uint8_t *)obj + c->free_off);
+}
+
+/**
+ * slab layer, cache lock held
+ */
+static struct slab *slab_create(struct kmem_cache *c)
+{
+    uint64_t phys = c->order ? pmm_alloc_pages(c->order) : pmm_alloc_page();
+
+    if (!phys)
+        return NULL;
+
+    struct slab *s = phys_to_virt(phys);
+    uint8_t *obj = (uint8_t *)s + c->first_off;
+
+    s->cache = c;
+    s->inuse = 0;
+    s->total = c->objs_per_slab;
+    s->free = NULL;
+
+    // thread the free list back to front so objects go out in address order
+    for (uint32_t i = c->objs_per_slab; i-- > 0;) {
+        void *o = obj + (size_t)i * c->stride;
+        if (c->ctor)
+            c->ctor(o);
+        *free_link(c, o) = s->free;
+        s->free = o;
+    }
+
+    pmm_set_owner(phys, c->order, s);
+    c->slabs++;
+
+    return s;
+}
+
+static void slab_destroy(struct kmem_cache *c, struct slab *s)
+{
+    uint64_t phys = virt_to_phys(s);
+
+    pmm_set_owner(phys, c->order, NULL);
+    c->slabs--;
+
+    if (c->order)
+        pmm_free_pages(phys, c->order);
+    else
+        pmm_free_page(phys);
+}
+
+static void *slab_alloc(struct kmem_cache *c)
+{
+    struct slab *s = c->partial.head;
+
+    if (!s) {
+        s = c->empty;
+        c->empty = NULL;
+        if (!s)
+            s = slab_create(c);
+        if (!s)
+            return NULL;
+        slab_list_add(&c->partial, s);
+    }
+
+    void *obj = s->free;
+    s->free = *free_link(c, obj);
+    s->inuse++;
+    c->inuse++;
+
+    if (s->inuse == s->total) {
+        slab_list_del(&c->partial, s);
+        slab_list_add(&c->full, s);
+    }
+
+    return obj;
+}
+
+static void slab_free(struct kmem_cache *c, void *obj)
+{
+    struct slab *s = pmm_owner(virt_to_phys(obj));
+
+    if (s->inuse == s->total) {
+        slab_list_del(&c->full, s);
+        slab_list_add(&c->partial, s);
+    }
+
+    *free_link(c, obj) = s->free;
+    s->free = obj;
+    s->inuse--;
+    c->inuse--;
+
+    if (s->inuse == 0) {
+        slab_list_del(&c->partial, s);
+        if (c->empty)
+            slab_destroy(c, c->empty);
+        c->empty = s;
+    }
+}
+
+static void *slab_alloc_locked(struct kmem_cache *c)
+{
+    spin_lock(&c->lock);
+    void *obj = slab_alloc(c);
+    spin_unlock(&c->lock);
+    return obj;
+}
+
+static void slab_free_locked(struct kmem_cache *c, void *obj)
+{
+    spin_lock(&c->lock);
+    slab_free(c, obj);
+    spin_unlock(&c->lock);
+}
+
+/**
+ * magazine layer, interrupts off
+ */
+static inline void mag_swap(struct kmem_cpu *cc)
+{
+    struct magazine *m = cc->loaded;
+    cc->loaded = cc->prev;
+    cc->prev = m;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *c)
+{
+    uint64_t flags = irq_save();
+    struct kmem_cpu *cc = &c->cpu[cpu_id()];
+    void *obj;
+
+    while (!(c->flags & KMEM_NO_MAGAZINE)) {
+        if (cc->loaded && cc->loaded->rounds) {
+            obj = cc->loaded->objs[--cc->loaded->rounds];
+            cc->hits++;
+            irq_restore(flags);
+            return obj;
+        }
+
+        if (cc->prev && cc->prev->rounds) {
+            mag_swap(cc);
+            continue;
+        }
+
+        // both empty, trade the older one for a full one from the depot
+        spin_lock(&c->lock);
+        struct magazine *m = c->depot_full;
+        if (m) {
+            c->depot_full = m->next;
+            c->depot_full_count--;
+            if (cc->prev) {
+                cc->prev->next = c->depot_empty;
+                c->depot_empty = cc->prev;
+            }
+            cc->prev = cc->loaded;
+            cc->loaded = m;
+        }
+        spin_unlock(&c->lock);
+
+        if (!m)
+            break;
+    }
+
+    cc->misses++;
+    obj = slab_alloc_locked(c);
+    irq_restore(flags);
+
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+    uint64_t flags = irq_save();
+    struct kmem_cpu *cc = &c->cpu[cpu_id()];
+
+    while (!(c->flags & KMEM_NO_MAGAZINE)) {
+        if (cc->loaded && cc->loaded->rounds < MAG_ROUNDS) {
+            cc->loaded->objs[cc->loaded->rounds++] = obj;
+            cc->hits++;
+            irq_restore(flags);
+            return;
+        }
+
+        if (cc->prev && cc->prev->rounds == 0) {
+            mag_swap(cc);
+            continue;
+        }
+
+        // both full, park the older one in the depot behind an empty one
+        spin_lock(&c->lock);
+        struct magazine *m = c->depot_empty;
+        if (m)
+            c->depot_empty = m->next;
+        spin_unlock(&c->lock);
+
+        if (!m) {
+            m = kmem_cache_alloc(&mag_cache);
+            if (!m)
+                break;
+            m->rounds = 0;
+        }
+
+        if (cc->prev) {
+            spin_lock(&c->lock);
+            cc->prev->next = c->depot_full;
+            c->depot_full = cc->prev;
+            c->depot_full_count++;
+            spin_unlock(&c->lock);
+        }
+
+        cc->prev = cc->loaded;
+        cc->loaded = m;
+    }
+
+    cc->misses++;
+    slab_free_locked(c, obj);
+    irq_restore(flags);
+}
+
+static void cache_setup(struct kmem_cache *c, const char *name, size_t size,
+                        size_t align, kmem_ctor_fn ctor, uint32_t flags)
+{
+    memset(c, 0, sizeof(*c));
+    strncpy(c->name, name, sizeof(c->name) - 1);
+
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+
+    c->size = size;
+    c->ctor = ctor;
+    c->flags = flags;
+
+    // a constructed object keeps its contents, so its link goes past the end
+    size_t stride = size < sizeof(void *) ? sizeof(void *) : size;
+    if (ctor)
+        stride += sizeof(void *);
+    c->stride = ALIGN_UP(stride, align);
+    c->free_off = ctor ? c->stride - sizeof(void *) : 0;
+    c->first_off = ALIGN_UP(sizeof(struct slab), align);
+
+    for (c->order = 0; c->order < SLAB_MAX_ORDER; c->order++) {
+        if (((PAGE_SIZE << c->order) - c->first_off) / c->stride >= SLAB_MIN_OBJS)
+            break;
+    }
+    c->objs_per_slab = (uint32_t)(((PAGE_SIZE << c->order) - c->first_off) / c->stride);
+
+    uint64_t lf = spin_lock_irqsave(&caches_lock);
+    c->next_cache = caches;
+    caches = c;
+    spin_unlock_irqrestore(&caches_lock, lf);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+                                     size_t align, kmem_ctor_fn ctor,
+                                     uint32_t flags)
+{
+    struct kmem_cache *c = kmem_cache_alloc(&cache_cache);
+
+    if (c)
+        cache_setup(c, name, size, align, ctor, flags);
+
+    return c;
+}
+
+void kmem_cache_stats(struct kmem_cache *c, struct kmem_cache_stats *out)
+{
+    uint64_t cached = 0;
+
+    *out = (struct kmem_cache_stats){ 0 };
+
+    for (size_t i = 0; i < MAX_CPUS; i++) {
+        struct kmem_cpu *cc = &c->cpu[i];
+        out->mag_hits += cc->hits;
+        out->mag_misses += cc->misses;
+        if (cc->loaded)
+            cached += cc->loaded->rounds;
+        if (cc->prev)
+            cached += cc->prev->rounds;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&c->lock);
+    out->slabs = c->slabs;
+    out->active = c->inuse - cached - c->depot_full_count * MAG_ROUNDS;
+    spin_unlock_irqrestore(&c->lock, flags);
+}
+
+void kmem_init(void)
+{
+    static const char *names[KMALLOC_CLASSES] = {
+        "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64",
+        "kmalloc-128", "kmalloc-256", "kmalloc-512", "kmalloc-1024",
+        "kmalloc-2048", "kmalloc-4096",
+    };
+
+    cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 64,
+                NULL, KMEM_NO_MAGAZINE);
+    cache_setup(&mag_cache, "magazine", sizeof(struct magazine), 64,
+                NULL, KMEM_NO_MAGAZINE);
+
+    for (size_t i = 0; i < ARRAY_LEN(names); i++) {
+        size_t size = 8ul << i;
+        kmalloc_caches[i] = kmem_cache_create(names[i], size,
+                                              size < 64 ? size : 64, NULL, 0);
+        if (!kmalloc_caches[i])
+            panic("kmem: cannot create kmalloc caches");
+    }
+}
+
+static inline unsigned size_class(size_t size)
+{
+    if (size <= 8)
+        return 0;
+
+    return (unsigned)(64 - __builtin_clzl(size - 1)) - 3;
+}
+
+void *kmalloc(size_t size)
+{
+    if (size <= KMALLOC_MAX)
+        return kmem_cache_alloc(kmalloc_caches[size_class(size)]);
+
+    unsigned order = 0;
+    while ((PAGE_SIZE << order) < size)
+        order++;
+
+    uint64_t phys = pmm_alloc_pages(order);
+
+    return phys ? phys_to_virt(phys) : NULL;
+}
+
+void kfree(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    uint64_t phys = virt_to_phys(ptr);
+    struct slab *s = pmm_owner(phys);
+
+    // no owner means kmalloc took the pages straight from the buddy
+    if (s)
+        kmem_cache_free(s->cache, ptr);
+    else
+        pmm_free_pages(phys, pmm_order(phys));
+}
+
+void kmem_dump_stats(void)
+{
+    char line[96];
+    int n;
+
+    n = ksnprintf(line, sizeof(line), "%-16s %6s %10s %6s %7s\n",
+                  "cache", "size", "active", "slabs", "mag hit");
+    serial_write_len(line, (size_t)n);
+
+    uint64_t flags = spin_lock_irqsave(&caches_lock);
+
+    for (struct kmem_cache *c = caches; c; c = c->next_cache) {
+        struct kmem_cache_stats st;
+        kmem_cache_stats(c, &st);
+
+        uint64_t total = st.mag_hits + st.mag_misses;
+        uint64_t permille = total ? st.mag_hits * 1000 / total : 0;
+
+        n = ksnprintf(line, sizeof(line), "%-16s %6zu %10lu %6lu %5lu.%lu%%\n",
+                      c->name, c->size, st.active, st.slabs,
+                      permille / 10, permille % 10);
+        serial_write_len(line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+    }
+
+    spin_unlock_irqrestore(&caches_lock, flags);
+}
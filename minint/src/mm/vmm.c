@@ -0,0 +1,712 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <system.h>
+#include <cpuid.h>
+#include <percpu.h>
+#include <idt.h>
+#include <lapic.h>
+#include <spinlock.h>
+#include <pmm.h>
+#include <slab.h>
+#include <vmm.h>
+
+#define PTE_ADDR_MASK   0x000FFFFFFFFFF000ull
+#define PTE_PAT_HUGE    (1ull << 12)    // pat bit of a 2 MiB / 1 GiB entry
+
+#define PT_ENTRIES      512
+
+#define SIZE_4K         0x1000ull
+#define SIZE_2M         0x200000ull
+#define SIZE_1G         0x40000000ull
+
+#define EFER            0xC0000080
+#define EFER_NXE        (1ull << 11)
+
+#define CR4_PGE         (1ull << 7)
+#define CR4_PCIDE       (1ull << 17)
+
+#define CR3_NOFLUSH     (1ull << 63)
+#define PCID_MAX        4096
+#define PCID_SHARED     (PCID_MAX - 1)  // once the rest are taken, flushed on every switch
+
+#define SHOOTDOWN_PAGES 32      // past this many pages a remote cpu drops everything
+
+extern char __text_start[], __text_end[];
+extern char __rodata_start[], __rodata_end[];
+extern char __data_start[], __data_end[];
+
+struct vmm_space kernel_space;
+
+static spinlock_t vmm_lock = SPINLOCK_INIT;
+static bool pcid_enabled;
+static uint64_t pcid_used[PCID_MAX / 64] = { 1 };   // 0 is kernel_space's
+static uint64_t nx_mask;        // PTE_NX, or 0 if the cpu cannot do it
+static uint64_t mmio_next = VMM_MMIO_BASE;
+
+// vmm_lock: kernel half changes other cpus have yet to hear about, and
+// tables to free once they have
+static uint64_t stale_start = UINT64_MAX, stale_end;
+static uint64_t *free_later;
+
+// one shootdown at a time, under shoot_lock
+static spinlock_t shoot_lock = SPINLOCK_INIT;
+static volatile uint64_t shoot_start, shoot_end;
+static volatile uint32_t shoot_left;
+static volatile bool shoot_pending[MAX_CPUS];
+
+static inline uint64_t level_size(unsigned level)
+{
+    return SIZE_4K << (9 * (level - 1));
+}
+
+static inline unsigned pt_index(uint64_t virt, unsigned level)
+{
+    return (virt >> (12 + 9 * (level - 1))) & (PT_ENTRIES - 1);
+}
+
+static inline uint64_t *table_of(uint64_t entry)
+{
+    return phys_to_virt(entry & PTE_ADDR_MASK);
+}
+
+static inline uint64_t read_cr3(void)
+{
+    uint64_t cr3;
+    asm volatile ("mov %%cr3, %0" : "=r"(cr3));
+    return cr3;
+}
+
+static inline void write_cr3(uint64_t cr3)
+{
+    asm volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+static inline void invlpg(uint64_t virt)
+{
+    asm volatile ("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+static inline bool is_current(const struct vmm_space *s)
+{
+    return (read_cr3() & PTE_ADDR_MASK) == s->pml4;
+}
+
+/**
+ * kernel half entries are global and shared by every space, but every
+ * cpu caches them: this one drops them here, the others when the
+ * operation ends, see sync(). a user half change in a space that is not
+ * loaded waits for the next switch into it; a user space is only ever
+ * loaded on one cpu at a time.
+ */
+static void flush(struct vmm_space *s, uint64_t virt)
+{
+    if (virt >= 0xffff800000000000ull) {
+        invlpg(virt);
+        if (virt < stale_start)
+            stale_start = virt;
+        if (virt + PAGE_SIZE > stale_end)
+            stale_end = virt + PAGE_SIZE;
+    } else if (is_current(s)) {
+        invlpg(virt);
+    } else {
+        s->stale = true;
+    }
+}
+
+static void flush_range(uint64_t start, uint64_t end)
+{
+    if ((end - start) / PAGE_SIZE <= SHOOTDOWN_PAGES) {
+        for (uint64_t v = start; v < end; v += PAGE_SIZE)
+            invlpg(v);
+        return;
+    }
+
+    // toggling pge drops every entry, global ones and all pcids included
+    uint64_t cr4;
+
+    asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+    asm volatile ("mov %0, %%cr4" : : "r"(cr4 & ~CR4_PGE) : "memory");
+    asm volatile ("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+// from the ipi, or from a cpu that waits with interrupts off
+static void shoot_poll(void)
+{
+    uint32_t cpu = cpu_id();
+
+    if (!__atomic_load_n(&shoot_pending[cpu], __ATOMIC_ACQUIRE))
+        return;
+
+    flush_range(shoot_start, shoot_end);
+
+    shoot_pending[cpu] = false;
+    __atomic_fetch_sub(&shoot_left, 1, __ATOMIC_RELEASE);
+}
+
+static void shoot_ipi(struct isr_frame *frame)
+{
+    shoot_poll();
+    lapic_eoi();
+}
+
+/**
+ * have every other online cpu drop [start, end) and wait until they all
+ * have. two cpus shooting at once would wait for each other with
+ * interrupts off, so the loser answers the winner's request by polling.
+ * the caller must not hold a lock another cpu may spin on with
+ * interrupts off.
+ */
+static void shootdown(uint64_t start, uint64_t end)
+{
+    uint64_t flags = irq_save();
+    uint32_t self = cpu_id();
+
+    while (!spin_trylock(&shoot_lock)) {
+        shoot_poll();
+        cpu_pause();
+    }
+
+    shoot_start = start;
+    shoot_end = end;
+
+    uint32_t n = 0;
+    for (uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+        if (cpu != self && cpus[cpu].online) {
+            shoot_pending[cpu] = true;
+            n++;
+        }
+    }
+
+    __atomic_store_n(&shoot_left, n, __ATOMIC_RELEASE);
+
+    for (uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+        if (shoot_pending[cpu])
+            lapic_send_ipi(cpus[cpu].lapic_id, LAPIC_VECTOR_TLB);
+    }
+
+    while (__atomic_load_n(&shoot_left, __ATOMIC_ACQUIRE))
+        cpu_pause();
+
+    spin_unlock(&shoot_lock);
+    irq_restore(flags);
+}
+
+/**
+ * a table page that is out of the tree but may still be cached
+ * elsewhere, freed by sync(). the link is page aligned, so to a walk
+ * still in flight the entry it overwrites reads as not present.
+ */
+static void table_free(uint64_t *t)
+{
+    t[0] = (uint64_t)free_later;
+    free_later = t;
+}
+
+/**
+ * ends every operation that changes entries: drops vmm_lock, brings the
+ * other cpus up to date on the kernel half, then frees the tables taken
+ * out of it.
+ */
+static void sync(uint64_t irq)
+{
+    uint64_t start = stale_start, end = stale_end;
+    uint64_t *tables = free_later;
+
+    stale_start = UINT64_MAX;
+    stale_end = 0;
+    free_later = NULL;
+
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    if (end > start)
+        shootdown(start, end);
+
+    while (tables) {
+        uint64_t *next = (uint64_t *)tables[0];
+
+        pmm_free_page(virt_to_phys(tables));
+        tables = next;
+    }
+}
+
+static uint64_t alloc_table(void)
+{
+    uint64_t phys = pmm_alloc_page();
+
+    if (phys)
+        memset(phys_to_virt(phys), 0, PAGE_SIZE);
+
+    return phys;
+}
+
+static uint64_t table_flags(uint64_t virt)
+{
+    uint64_t flags = PTE_PRESENT | PTE_WRITE;
+
+    if (virt < 0x0000800000000000ull)
+        flags |= PTE_USER;
+
+    return flags;
+}
+
+// flags of a leaf entry with the page size and pat bits normalized to 4k
+static inline uint64_t leaf_flags(uint64_t e, unsigned level)
+{
+    uint64_t flags = e & ~PTE_ADDR_MASK;
+
+    if (level > 1) {
+        flags &= ~PTE_HUGE;
+        if (e & PTE_PAT_HUGE)
+            flags |= PTE_PAT;
+    }
+
+    return flags;
+}
+
+static inline uint64_t leaf_addr(uint64_t e, unsigned level)
+{
+    return e & PTE_ADDR_MASK & ~(level_size(level) - 1);
+}
+
+static inline uint64_t make_leaf(uint64_t phys, uint64_t flags, unsigned level)
+{
+    if (level == 1)
+        return phys | flags;
+
+    uint64_t e = phys | (flags & ~PTE_PAT) | PTE_HUGE;
+    if (flags & PTE_PAT)
+        e |= PTE_PAT_HUGE;
+
+    return e;
+}
+
+// replace a huge leaf with a table of the next size down, same mapping
+static bool split(uint64_t *e, unsigned level)
+{
+    uint64_t phys = alloc_table();
+
+    if (!phys)
+        return false;
+
+    uint64_t *t = phys_to_virt(phys);
+    uint64_t base = leaf_addr(*e, level);
+    uint64_t flags = leaf_flags(*e, level);
+    uint64_t step = level_size(level - 1);
+
+    for (unsigned i = 0; i < PT_ENTRIES; i++)
+        t[i] = make_leaf(base + i * step, flags, level - 1);
+
+    *e = phys | PTE_PRESENT | PTE_WRITE | (flags & PTE_USER);
+
+    return true;
+}
+
+static void free_tree(uint64_t *t, unsigned level)
+{
+    if (level > 2) {
+        for (unsigned i = 0; i < PT_ENTRIES; i++) {
+            if ((t[i] & PTE_PRESENT) && !(t[i] & PTE_HUGE))
+                free_tree(table_of(t[i]), level - 1);
+        }
+    }
+
+    table_free(t);
+}
+
+/**
+ * entry for virt at the given level, creating tables on the way down and
+ * splitting any huge page in the way
+ */
+static uint64_t *walk_create(struct vmm_space *s, uint64_t virt, unsigned level)
+{
+    uint64_t *t = phys_to_virt(s->pml4);
+
+    for (unsigned l = 4; l > level; l--) {
+        uint64_t *e = &t[pt_index(virt, l)];
+
+        if (!(*e & PTE_PRESENT)) {
+            uint64_t phys = alloc_table();
+            if (!phys)
+                return NULL;
+            *e = phys | table_flags(virt);
+        } else if (*e & PTE_HUGE) {
+            if (!split(e, l))
+                return NULL;
+            flush(s, virt);
+        }
+
+        t = table_of(*e);
+    }
+
+    return &t[pt_index(virt, level)];
+}
+
+// the leaf mapping virt and its level, or NULL and the level of the hole
+static uint64_t *walk_leaf(struct vmm_space *s, uint64_t virt, unsigned *level)
+{
+    uint64_t *t = phys_to_virt(s->pml4);
+
+    for (unsigned l = 4; ; l--) {
+        uint64_t *e = &t[pt_index(virt, l)];
+
+        *level = l;
+
+        if (!(*e & PTE_PRESENT))
+            return NULL;
+        if (l == 1 || (*e & PTE_HUGE))
+            return e;
+
+        t = table_of(*e);
+    }
+}
+
+static unsigned pick_level(uint64_t virt, uint64_t phys, uint64_t left,
+                           bool small)
+{
+    if (small)
+        return 1;
+
+    if (cpu_features.pdpe1gb && !((virt | phys) & (SIZE_1G - 1)) && left >= SIZE_1G)
+        return 3;
+
+    if (!((virt | phys) & (SIZE_2M - 1)) && left >= SIZE_2M)
+        return 2;
+
+    return 1;
+}
+
+static inline uint64_t leaf_bits(uint64_t flags)
+{
+    return (flags & ~VMM_SMALL & (~PTE_NX | nx_mask)) | PTE_PRESENT;
+}
+
+bool vmm_map(struct vmm_space *s, uint64_t virt, uint64_t phys, size_t size,
+             uint64_t flags)
+{
+    if ((virt | phys | size) & (PAGE_SIZE - 1))
+        return false;
+
+    bool small = flags & VMM_SMALL;
+    uint64_t end = virt + size;
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+
+    flags = leaf_bits(flags);
+
+    while (virt < end) {
+        unsigned level = pick_level(virt, phys, end - virt, small);
+        uint64_t *e = walk_create(s, virt, level);
+
+        if (!e)
+            break;
+
+        uint64_t old = *e;
+
+        *e = make_leaf(phys, flags, level);
+
+        // a bigger page replaces whatever smaller mappings were under it
+        if (level > 1 && (old & PTE_PRESENT) && !(old & PTE_HUGE))
+            free_tree(table_of(old), level);
+
+        if (old & PTE_PRESENT)
+            flush(s, virt);
+
+        virt += level_size(level);
+        phys += level_size(level);
+    }
+
+    sync(irq);
+
+    return virt >= end;
+}
+
+// free the page table (level 1) or directory (level 2) at virt if it is empty
+static void prune_table(struct vmm_space *s, uint64_t virt, unsigned level)
+{
+    uint64_t *t = phys_to_virt(s->pml4);
+    uint64_t *e = NULL;
+
+    for (unsigned l = 4; l > level; l--) {
+        e = &t[pt_index(virt, l)];
+        if (!(*e & PTE_PRESENT) || (*e & PTE_HUGE))
+            return;
+        t = table_of(*e);
+    }
+
+    for (unsigned i = 0; i < PT_ENTRIES; i++) {
+        if (t[i])
+            return;
+    }
+
+    *e = 0;
+    flush(s, virt);
+    table_free(t);
+}
+
+/**
+ * walk [virt, virt + size) leaf by leaf. a leaf the range only partly
+ * covers is split first. returns false if a split ran out of memory.
+ */
+static bool for_each_leaf(struct vmm_space *s, uint64_t virt, size_t size,
+                          void (*fn)(uint64_t *e, unsigned level, uint64_t arg),
+                          uint64_t arg)
+{
+    uint64_t end = virt + size;
+
+    while (virt < end) {
+        unsigned level;
+        uint64_t *e = walk_leaf(s, virt, &level);
+        uint64_t span = level_size(level);
+
+        if (!e) {
+            virt = ALIGN_DOWN(virt, span) + span;
+            continue;
+        }
+
+        if ((virt & (span - 1)) || end - virt < span) {
+            if (!split(e, level))
+                return false;
+            flush(s, virt);
+            continue;
+        }
+
+        fn(e, level, arg);
+        flush(s, virt);
+        virt += span;
+    }
+
+    return true;
+}
+
+static void clear_leaf(uint64_t *e, unsigned level, uint64_t arg)
+{
+    *e = 0;
+}
+
+static void protect_leaf(uint64_t *e, unsigned level, uint64_t flags)
+{
+    *e = make_leaf(leaf_addr(*e, level), flags, level);
+}
+
+void vmm_unmap(struct vmm_space *s, uint64_t virt, size_t size)
+{
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+
+    for_each_leaf(s, virt, size, clear_leaf, 0);
+
+    // tables hanging off the pml4 stay, the kernel half ones are shared
+    for (uint64_t v = ALIGN_DOWN(virt, SIZE_2M); v < virt + size; v += SIZE_2M)
+        prune_table(s, v, 1);
+    for (uint64_t v = ALIGN_DOWN(virt, SIZE_1G); v < virt + size; v += SIZE_1G)
+        prune_table(s, v, 2);
+
+    sync(irq);
+}
+
+bool vmm_protect(struct vmm_space *s, uint64_t virt, size_t size,
+                 uint64_t flags)
+{
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    bool ok = for_each_leaf(s, virt, size, protect_leaf, leaf_bits(flags));
+    sync(irq);
+
+    return ok;
+}
+
+bool vmm_translate(struct vmm_space *s, uint64_t virt, uint64_t *phys)
+{
+    unsigned level;
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    uint64_t *e = walk_leaf(s, virt, &level);
+
+    if (e)
+        *phys = leaf_addr(*e, level) + (virt & (level_size(level) - 1));
+
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    return e != NULL;
+}
+
+uint64_t vmm_flags(struct vmm_space *s, uint64_t virt)
+{
+    unsigned level;
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    uint64_t *e = walk_leaf(s, virt, &level);
+    uint64_t flags = e ? leaf_flags(*e, level) : 0;
+
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    return flags;
+}
+
+void *vmm_map_mmio(uint64_t phys, size_t size, enum memtype type)
+{
+    uint64_t base = ALIGN_DOWN(phys, PAGE_SIZE);
+    uint64_t len = ALIGN_UP(phys + size, PAGE_SIZE) - base;
+    uint64_t virt = __atomic_fetch_add(&mmio_next, len, __ATOMIC_RELAXED);
+
+    if (!vmm_map(&kernel_space, virt, base, len,
+                 VMM_KERNEL_RW | VMM_SMALL | pat_pte_bits(type)))
+        return NULL;
+
+    return (void *)(virt + (phys - base));
+}
+
+struct vmm_space *vmm_create_space(void)
+{
+    struct vmm_space *s = kmalloc(sizeof(*s));
+
+    if (!s)
+        return NULL;
+
+    s->pml4 = alloc_table();
+    if (!s->pml4) {
+        kfree(s);
+        return NULL;
+    }
+
+    uint64_t *dst = phys_to_virt(s->pml4);
+    uint64_t *src = phys_to_virt(kernel_space.pml4);
+
+    for (unsigned i = PT_ENTRIES / 2; i < PT_ENTRIES; i++)
+        dst[i] = src[i];
+
+    // nothing gives a pcid back yet; past the last one, spaces share one
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    s->pcid = PCID_SHARED;
+    for (unsigned i = 0; i < PCID_MAX / 64; i++) {
+        uint64_t free = ~pcid_used[i];
+
+        if (i == PCID_SHARED / 64)
+            free &= ~(1ull << (PCID_SHARED % 64));
+
+        if (free) {
+            unsigned bit = __builtin_ctzll(free);
+
+            pcid_used[i] |= 1ull << bit;
+            s->pcid = i * 64 + bit;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    s->stale = true;
+
+    return s;
+}
+
+void vmm_switch(struct vmm_space *s)
+{
+    uint64_t cr3 = s->pml4;
+
+    if (pcid_enabled) {
+        cr3 |= s->pcid;
+        if (!s->stale && s->pcid != PCID_SHARED)
+            cr3 |= CR3_NOFLUSH;
+    }
+
+    s->stale = false;
+    write_cr3(cr3);
+}
+
+static void map_section(struct limine_executable_address_response *exe,
+                        const char *start, const char *end, uint64_t flags)
+{
+    uint64_t virt = ALIGN_DOWN((uint64_t)start, PAGE_SIZE);
+    uint64_t size = ALIGN_UP((uint64_t)end, PAGE_SIZE) - virt;
+    uint64_t phys = virt - exe->virtual_base + exe->physical_base;
+
+    if (size && !vmm_map(&kernel_space, virt, phys, size, flags))
+        panic("vmm: cannot map the kernel image");
+}
+
+static void map_direct(uint64_t start, uint64_t end)
+{
+    if (end > start && !vmm_map(&kernel_space, hhdm_offset + start, start,
+                                end - start, VMM_KERNEL_RW))
+        panic("vmm: cannot build the direct map");
+}
+
+// switch the calling cpu over to kernel_space with the paging features on
+static void load_kernel_space(void)
+{
+    uint64_t cr4;
+
+    if (cpu_features.nx)
+        wrmsr(EFER, rdmsr(EFER) | EFER_NXE);
+
+    asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+    if (cpu_features.pge)
+        cr4 |= CR4_PGE;
+    asm volatile ("mov %0, %%cr4" : : "r"(cr4));
+
+    // pcide can only be set while cr3 names pcid 0, which ours does
+    write_cr3(kernel_space.pml4);
+
+    // pcids tag the kernel half too unless it is global
+    if (cpu_features.pcid && cpu_features.pge) {
+        cr4 |= CR4_PCIDE;
+        asm volatile ("mov %0, %%cr4" : : "r"(cr4));
+        pcid_enabled = true;
+    }
+}
+
+void vmm_init(struct limine_memmap_response *memmap,
+              struct limine_executable_address_response *exe)
+{
+    if (cpu_features.nx)
+        nx_mask = PTE_NX;
+
+    kernel_space.pml4 = alloc_table();
+    if (!kernel_space.pml4)
+        panic("vmm: no memory for the kernel pml4");
+
+    // every kernel half pdpt exists up front so all spaces can share them
+    uint64_t *pml4 = phys_to_virt(kernel_space.pml4);
+    for (unsigned i = PT_ENTRIES / 2; i < PT_ENTRIES; i++) {
+        uint64_t phys = alloc_table();
+        if (!phys)
+            panic("vmm: no memory for the kernel half");
+        pml4[i] = phys | PTE_PRESENT | PTE_WRITE;
+    }
+
+    // direct map like limine's: everything but reserved and bad memory,
+    // with touching entries merged so the big pages line up
+    uint64_t run_start = 0, run_end = 0;
+
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry *e = memmap->entries[i];
+
+        if (e->type == LIMINE_MEMMAP_RESERVED || e->type == LIMINE_MEMMAP_BAD_MEMORY)
+            continue;
+
+        uint64_t start = ALIGN_DOWN(e->base, PAGE_SIZE);
+        uint64_t end = ALIGN_UP(e->base + e->length, PAGE_SIZE);
+
+        if (run_end && start <= run_end) {
+            if (end > run_end)
+                run_end = end;
+            continue;
+        }
+
+        map_direct(run_start, run_end);
+        run_start = start;
+        run_end = end;
+    }
+
+    map_direct(run_start, run_end);
+
+    map_section(exe, __text_start, __text_end, VMM_KERNEL_RX);
+    map_section(exe, __rodata_start, __rodata_end, VMM_KERNEL_RO);
+    map_section(exe, __data_start, __data_end, VMM_KERNEL_RW);
+
+    load_kernel_space();
+
+    isr_register(LAPIC_VECTOR_TLB, shoot_ipi);
+}
+
+void vmm_init_ap(void)
+{
+    load_kernel_space();
+}